@@ -24,6 +24,12 @@ public:
         _cos(std::cos(radValue)),
         _sin(std::sin(radValue)) {}
 
+  /** \brief Construct an angle from its radian value and its already known cosine and sine values. */
+  Angle(float radValue, float cosValue, float sinValue)
+      : _radian(radValue),
+        _cos(cosValue),
+        _sin(sinValue) {}
+
   Angle(const Angle &other)
       : _radian(other._radian),
         _cos(other._cos),
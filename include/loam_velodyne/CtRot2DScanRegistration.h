@@ -69,7 +69,7 @@ public:
    * @param laserCloudIn the new input cloud to process
    * @param scanTime the scan (message) timestamp
    */
-  void process(const pcl::PointCloud<pcl::PointXYZ>& laserCloudIn,
+  void process(const pcl::PointCloud<pcl::PointXYZI>& laserCloudIn,
                const ros::Time& scanTime);
 
   /** \brief Extract features from current laser cloud.
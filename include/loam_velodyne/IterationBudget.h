@@ -0,0 +1,122 @@
+// Copyright 2013, Ji Zhang, Carnegie Mellon University
+// Further contributions copyright (c) 2016, Southwest Research Institute
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from this
+//    software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// This is an implementation of the algorithm described in the following paper:
+//   J. Zhang and S. Singh. LOAM: Lidar Odometry and Mapping in Real-time.
+//     Robotics: Science and Systems Conference (RSS). Berkeley, CA, July 2014.
+
+#ifndef LOAM_ITERATIONBUDGET_H
+#define LOAM_ITERATIONBUDGET_H
+
+
+#include <ros/time.h>
+
+#include <cstddef>
+
+
+namespace loam {
+
+/** \brief Wall clock time budget for an iterative solver.
+ *
+ * The budget is started at the beginning of a frame and consulted after each solver iteration. A further iteration
+ * is only granted if the time spent so far plus the average duration of the iterations of the current frame still
+ * fits into the budget, such that the solver stops before (and not after) it exceeds its deadline.
+ * A budget of zero never expires.
+ */
+class IterationBudget {
+public:
+  explicit IterationBudget(const double& budget = 0)
+      : _budget(budget),
+        _iterations(0),
+        _firstIterationTime(0) {}
+
+  /** \brief Set the time budget.
+   *
+   * @param budget the time budget per frame in seconds (0 = unlimited)
+   */
+  void setBudget(const double& budget) { _budget = budget; }
+
+  /** \brief Retrieve the time budget per frame in seconds (0 = unlimited). */
+  const double& budget() const { return _budget; }
+
+  /** \brief Check if the budget is limited. */
+  bool limited() const { return _budget > 0; }
+
+  /** \brief Start the budget of a new frame. */
+  void start()
+  {
+    _startTime = ros::WallTime::now();
+    _iterations = 0;
+    _firstIterationTime = 0;
+  }
+
+  /** \brief Mark the start of the iteration phase.
+   *
+   * Time spent between start() and this call (e.g. for building search structures) is charged to the budget, but
+   * not taken into account when predicting the duration of the next iteration.
+   */
+  void startIterations()
+  {
+    _firstIterationTime = elapsed();
+    _iterations = 0;
+  }
+
+  /** \brief Check if another iteration fits into the remaining budget.
+   *
+   * Has to be called once after each completed iteration.
+   *
+   * @return true if another iteration can be started, false if the deadline would be missed
+   */
+  bool nextIteration()
+  {
+    _iterations++;
+    if (!limited()) {
+      return true;
+    }
+
+    double now = elapsed();
+    double avgIterationTime = (now - _firstIterationTime) / _iterations;
+    return now + avgIterationTime <= _budget;
+  }
+
+  /** \brief Retrieve the number of iterations completed in the current frame. */
+  const size_t& iterations() const { return _iterations; }
+
+  /** \brief Retrieve the time elapsed since the start of the current frame in seconds. */
+  double elapsed() const { return (ros::WallTime::now() - _startTime).toSec(); }
+
+private:
+  double _budget;               ///< time budget per frame in seconds (0 = unlimited)
+  ros::WallTime _startTime;     ///< start time of the current frame
+  size_t _iterations;           ///< number of completed iterations in the current frame
+  double _firstIterationTime;   ///< elapsed time at the start of the first iteration
+};
+
+} // end namespace loam
+
+#endif //LOAM_ITERATIONBUDGET_H
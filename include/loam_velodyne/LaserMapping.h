@@ -36,16 +36,30 @@
 
 #include "Twist.h"
 #include "CircularBuffer.h"
+#include "VoxelGridFilter.h"
+#include "MapTileStore.h"
+#include "MapTilePager.h"
+#include "MapCloudPublisher.h"
+#include "IterationBudget.h"
+#include "PointXYZIRT.h"
+#include "nanoflann_pcl.h"
 
 #include <ros/ros.h>
 #include <nav_msgs/Odometry.h>
 #include <sensor_msgs/Imu.h>
 #include <sensor_msgs/PointCloud2.h>
+#include <std_msgs/Empty.h>
 #include <tf/transform_datatypes.h>
 #include <tf/transform_broadcaster.h>
 #include <pcl/point_cloud.h>
 #include <pcl/point_types.h>
-#include <pcl/filters/voxel_grid.h>
+#include <boost/atomic.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <map>
+#include <set>
 
 
 namespace loam {
@@ -82,6 +96,43 @@ typedef struct IMUState2 {
 
 
 
+/** \brief Down sized clouds of a single map cube at a coarse resolution level. */
+struct CoarseMapCube {
+  CoarseMapCube()
+      : cornerCloud(new pcl::PointCloud<PointXYZIRT>()),
+        surfCloud(new pcl::PointCloud<PointXYZIRT>()),
+        upToDate(false) {}
+
+  pcl::PointCloud<PointXYZIRT>::Ptr cornerCloud;     ///< down sized corner cloud of the cube
+  pcl::PointCloud<PointXYZIRT>::Ptr surfCloud;       ///< down sized surface cloud of the cube
+  bool upToDate;                                     ///< flag if the clouds match the current cube content
+};
+
+
+
+/** \brief Feature stack and map clouds of a coarse resolution level of the scan to map matching. */
+struct MapResolutionLevel {
+  MapResolutionLevel()
+      : scale(1),
+        cornerStack(new pcl::PointCloud<PointXYZIRT>()),
+        surfStack(new pcl::PointCloud<PointXYZIRT>()),
+        cornerMap(new pcl::PointCloud<PointXYZIRT>()),
+        surfMap(new pcl::PointCloud<PointXYZIRT>()) {}
+
+  float scale;                                          ///< leaf size of this level relative to the finest level
+  VoxelGridFilter<PointXYZIRT> cornerFilter;         ///< voxel filter for corner clouds of this level
+  VoxelGridFilter<PointXYZIRT> surfFilter;           ///< voxel filter for surface clouds of this level
+  pcl::PointCloud<PointXYZIRT>::Ptr cornerStack;     ///< down sized corner feature stack
+  pcl::PointCloud<PointXYZIRT>::Ptr surfStack;       ///< down sized surface feature stack
+  pcl::PointCloud<PointXYZIRT>::Ptr cornerMap;       ///< down sized valid map corner cloud
+  pcl::PointCloud<PointXYZIRT>::Ptr surfMap;         ///< down sized valid map surface cloud
+  nanoflann::KdTreeFLANN<PointXYZIRT> cornerTree;    ///< KD-tree of the map corner cloud
+  nanoflann::KdTreeFLANN<PointXYZIRT> surfTree;      ///< KD-tree of the map surface cloud
+  std::map<CubeKey, CoarseMapCube> cubes;            ///< down sized clouds of the map cubes (updated on demand)
+};
+
+
+
 /** \brief Implementation of the LOAM laser mapping component.
  *
  */
@@ -128,12 +179,36 @@ public:
    */
   void imuHandler(const sensor_msgs::Imu::ConstPtr& imuIn);
 
+  /** \brief Handler method for map delta resynchronization requests (e.g. from clients that missed a delta).
+   *
+   * @param request the (empty) request message
+   */
+  void mapDeltaResyncHandler(const std_msgs::Empty::ConstPtr& request);
+
   /** \brief Process incoming messages in a loop until shutdown (used in active mode). */
   void spin();
 
   /** \brief Try to process buffered data. */
   void process();
 
+  /** \brief Retrieve the latest mapping odometry (for in-process use). */
+  const nav_msgs::Odometry& odomAftMapped() const { return _odomAftMapped; }
+
+  /** \brief Write all non-empty map cubes as tiles to the map directory.
+   *
+   * Unless the map was loaded from the map directory during setup, tiles of earlier sessions that are not part of the
+   * saved (or paged out) map are removed, as they may refer to a different map origin.
+   *
+   * @return true if all tiles were written and all stale tiles removed successfully, false otherwise
+   */
+  bool saveMap();
+
+  /** \brief Load all map tiles from the map directory that fall into the current map cube grid.
+   *
+   * @return true if the map directory could be read, false otherwise
+   */
+  bool loadMap();
+
 
 protected:
   /** \brief Reset flags, etc. */
@@ -145,10 +220,59 @@ protected:
   /** Run an optimization. */
   void optimizeTransformTobeMapped();
 
+  /** \brief Run the optimization iterations against a single map resolution level.
+   *
+   * @param cornerStack the down sized corner feature stack of the level
+   * @param surfStack the down sized surface feature stack of the level
+   * @param cornerMap the valid map corner cloud of the level
+   * @param surfMap the valid map surface cloud of the level
+   * @param cornerTree the KD-tree of the map corner cloud
+   * @param surfTree the KD-tree of the map surface cloud
+   * @param scale the leaf size of the level relative to the finest level
+   * @param finestLevel flag if this is the finest (last) level
+   * @return false if the optimization was stopped by the time budget, true otherwise
+   */
+  bool optimizeTransformAtLevel(const pcl::PointCloud<PointXYZIRT>& cornerStack,
+                                const pcl::PointCloud<PointXYZIRT>& surfStack,
+                                const pcl::PointCloud<PointXYZIRT>& cornerMap,
+                                const pcl::PointCloud<PointXYZIRT>& surfMap,
+                                const nanoflann::KdTreeFLANN<PointXYZIRT>& cornerTree,
+                                const nanoflann::KdTreeFLANN<PointXYZIRT>& surfTree,
+                                const float& scale,
+                                const bool& finestLevel);
+
+  /** \brief Transform the given feature points into the map frame and search their five nearest map neighbors.
+   *
+   * The results are stored in the flat _pointsSel, _pointSearchInd and _pointSearchSqDis buffers.
+   *
+   * @param features the feature points
+   * @param tree the KD-tree of the map cloud to search
+   * @param order the spatial processing order of the feature points, or NULL if they are already stored in one
+   */
+  void searchMapNeighbors(const pcl::PointCloud<PointXYZIRT>& features,
+                          const nanoflann::KdTreeFLANN<PointXYZIRT>& tree,
+                          const std::vector<int>* order);
+
+  /** \brief Merge the current frame into the feature stack. */
+  void stackFrame();
+
+  /** \brief Take over the feature stack and its state for processing (stack mutex must be held). */
+  void takeStack();
+
+  /** \brief Optimize the map transform of the taken feature stack and add the stack to the map. */
+  void processStack();
+
+  /** \brief Store the down sized feature stack in the map cubes and down size the valid cubes again. */
+  void insertFeatureStack();
+
+  /** \brief Mapping thread loop (used in threaded mode). */
+  void runMapping();
+
+  /** \brief Estimate the map transform of the current frame from its odometry transform (stack mutex must be held). */
   void transformAssociateToMap();
   void transformUpdate();
-  void pointAssociateToMap(const pcl::PointXYZI& pi, pcl::PointXYZI& po);
-  void pointAssociateTobeMapped(const pcl::PointXYZI& pi, pcl::PointXYZI& po);
+  void pointAssociateToMap(const PointXYZIRT& pi, PointXYZIRT& po);
+  void pointAssociateToMap(const PointXYZIRT& pi, PointXYZIRT& po, const Twist& transform);
 
   /** \brief Publish the current result via the respective topics. */
   void publishResult();
@@ -161,16 +285,60 @@ private:
     return i + _laserCloudWidth * j + _laserCloudWidth * _laserCloudHeight * k;
   }
 
+  /** \brief Retrieve the world cube key of the given map cube grid cell. */
+  CubeKey toCubeKey(int i, int j, int k) const
+  {
+    return CubeKey(i - _laserCloudCenWidth, j - _laserCloudCenHeight, k - _laserCloudCenDepth);
+  }
+
+  /** \brief Remove the cube in the given grid cell from memory, paging it out if map paging is enabled.
+   *
+   * The cube is kept in memory if its previously paged out points could not be paged in.
+   */
+  void releaseCube(int i, int j, int k);
+
+  /** \brief Page in the cube in the given grid cell if it is currently paged out (blocking).
+   *
+   * @return true if the cube is completely held in memory, false if its paged out points could not be read
+   */
+  bool restoreCube(int i, int j, int k);
+
+  /** \brief Merge a paged in cube into its grid cell (or page it out again if it left the grid meanwhile). */
+  void installTile(const MapTile& tile);
+
+  /** \brief Collect and merge all cubes paged in (or handed back after a failed page out) since the last call. */
+  void installPagedInTiles();
+
+  /** \brief Mark the coarse resolution clouds of a changed cube as outdated.
+   *
+   * @param key the key of the changed cube
+   * @param release true to also release the coarse resolution clouds, e.g. if the cube is removed from memory
+   */
+  void invalidateCoarseCube(const CubeKey& key, const bool& release = false);
+
+  /** \brief Collect the cubes changed since the last map delta (or all cubes for full updates) into the map snapshot. */
+  void collectMapDelta();
+
+  /** \brief Page out cubes far from the given center cube and page in / prefetch cubes close to it.
+   *
+   * @param centerCubeI the grid i index of the current center cube
+   * @param centerCubeJ the grid j index of the current center cube
+   * @param centerCubeK the grid k index of the current center cube
+   */
+  void updateMapPaging(int centerCubeI, int centerCubeJ, int centerCubeK);
+
 
   float _scanPeriod;          ///< time per scan
-  const int _stackFrameNum;
+  int _stackFrameNum;         ///< number of frames merged into the feature stack before it is processed
+  int _maxStackFrameNum;      ///< maximum number of frames merged into the feature stack
   const int _mapFrameNum;
-  long _frameCount;
   long _mapFrameCount;
 
   size_t _maxIterations;  ///< maximum number of iterations
   float _deltaTAbort;     ///< optimization abort threshold for deltaT
   float _deltaRAbort;     ///< optimization abort threshold for deltaR
+  IterationBudget _solveBudget;  ///< wall clock time budget for processing a feature stack
+  long _budgetStops;             ///< number of feature stacks in which the optimization was stopped by the time budget
 
   int _laserCloudCenWidth;
   int _laserCloudCenHeight;
@@ -180,27 +348,63 @@ private:
   const size_t _laserCloudDepth;
   const size_t _laserCloudNum;
 
-  pcl::PointCloud<pcl::PointXYZI>::Ptr _laserCloudCornerLast;   ///< last corner points cloud
-  pcl::PointCloud<pcl::PointXYZI>::Ptr _laserCloudSurfLast;     ///< last surface points cloud
-  pcl::PointCloud<pcl::PointXYZI>::Ptr _laserCloudFullRes;      ///< last full resolution cloud
+  pcl::PointCloud<PointXYZIRT>::Ptr _laserCloudCornerLast;   ///< last corner points cloud
+  pcl::PointCloud<PointXYZIRT>::Ptr _laserCloudSurfLast;     ///< last surface points cloud
+  pcl::PointCloud<PointXYZIRT>::Ptr _laserCloudFullRes;      ///< last full resolution cloud
 
-  pcl::PointCloud<pcl::PointXYZI>::Ptr _laserCloudCornerStack;
-  pcl::PointCloud<pcl::PointXYZI>::Ptr _laserCloudSurfStack;
-  pcl::PointCloud<pcl::PointXYZI>::Ptr _laserCloudCornerStackDS;  ///< down sampled
-  pcl::PointCloud<pcl::PointXYZI>::Ptr _laserCloudSurfStackDS;    ///< down sampled
+  pcl::PointCloud<PointXYZIRT>::Ptr _laserCloudCornerStack;
+  pcl::PointCloud<PointXYZIRT>::Ptr _laserCloudSurfStack;
+  pcl::PointCloud<PointXYZIRT>::Ptr _laserCloudCornerStackMapping;   ///< corner stack taken for processing
+  pcl::PointCloud<PointXYZIRT>::Ptr _laserCloudSurfStackMapping;     ///< surface stack taken for processing
+  pcl::PointCloud<PointXYZIRT>::Ptr _laserCloudCornerStackDS;  ///< down sampled
+  pcl::PointCloud<PointXYZIRT>::Ptr _laserCloudSurfStackDS;    ///< down sampled
 
-  pcl::PointCloud<pcl::PointXYZI>::Ptr _laserCloudSurround;
-  pcl::PointCloud<pcl::PointXYZI>::Ptr _laserCloudSurroundDS;     ///< down sampled
-  pcl::PointCloud<pcl::PointXYZI>::Ptr _laserCloudCornerFromMap;
-  pcl::PointCloud<pcl::PointXYZI>::Ptr _laserCloudSurfFromMap;
+  pcl::PointCloud<PointXYZIRT>::Ptr _laserCloudCornerFromMap;
+  pcl::PointCloud<PointXYZIRT>::Ptr _laserCloudSurfFromMap;
 
-  std::vector<pcl::PointCloud<pcl::PointXYZI>::Ptr> _laserCloudCornerArray;
-  std::vector<pcl::PointCloud<pcl::PointXYZI>::Ptr> _laserCloudSurfArray;
-  std::vector<pcl::PointCloud<pcl::PointXYZI>::Ptr> _laserCloudCornerDSArray;  ///< down sampled
-  std::vector<pcl::PointCloud<pcl::PointXYZI>::Ptr> _laserCloudSurfDSArray;    ///< down sampled
+  std::vector<pcl::PointCloud<PointXYZIRT>::Ptr> _laserCloudCornerArray;
+  std::vector<pcl::PointCloud<PointXYZIRT>::Ptr> _laserCloudSurfArray;
+  std::vector<pcl::PointCloud<PointXYZIRT>::Ptr> _laserCloudCornerDSArray;  ///< down sampled
+  std::vector<pcl::PointCloud<PointXYZIRT>::Ptr> _laserCloudSurfDSArray;    ///< down sampled
 
   std::vector<size_t> _laserCloudValidInd;
   std::vector<size_t> _laserCloudSurroundInd;
+  std::vector<CubeKey> _validCubes;       ///< keys of the valid (within field of view) cubes
+  std::vector<CubeKey> _surroundCubes;    ///< keys of the cubes surrounding the current position
+
+  nanoflann::KdTreeFLANN<PointXYZIRT> _kdtreeCornerFromMap;  ///< KD-tree of the valid map corner cloud
+  nanoflann::KdTreeFLANN<PointXYZIRT> _kdtreeSurfFromMap;    ///< KD-tree of the valid map surface cloud
+  std::vector<CubeKey> _mapIndexCubes;      ///< keys of the cubes the map KD-trees were built from
+  bool _mapIndexDirty;                      ///< flag if cube contents changed since the map KD-trees were built
+
+  static const int MAX_MAP_RESOLUTION_LEVELS = 3;
+  int _mapResolutionLevels;                 ///< number of resolution levels used for scan to map matching
+  MapResolutionLevel _coarseMapLevels[MAX_MAP_RESOLUTION_LEVELS - 1];   ///< coarse levels with 2x, 4x leaf size
+
+  pcl::PointCloud<PointXYZIRT> _laserCloudOri;   ///< selected feature points of the current optimization iteration
+  pcl::PointCloud<PointXYZIRT> _coeffSel;        ///< residual coefficients of the selected feature points
+  bool _mortonOrder;                             ///< flag if map cubes and feature stacks are stored in Morton order
+  pcl::PointCloud<PointXYZIRT> _pointsSel;       ///< feature points transformed into the map frame
+  std::vector<int> _cornerQueryOrder;            ///< spatial processing order of the corner feature queries
+  std::vector<int> _surfQueryOrder;              ///< spatial processing order of the surface feature queries
+  nanoflann::KdTreeFLANN<PointXYZIRT>::SortKeys _queryKeys;   ///< sort key buffer for the query orders
+  std::vector<int> _pointSearchInd;              ///< nearest neighbor search indices, five per feature point
+  std::vector<float> _pointSearchSqDis;          ///< nearest neighbor search squared distances, five per feature point
+
+  bool _localizationMode;                   ///< flag if the pose is only localized against a static map
+  std::vector<CubeKey> _publishedSurroundCubes;   ///< keys of the surrounding cubes of the last frame
+  bool _surroundChanged;                    ///< flag if the surrounding cubes changed since the last map publishing
+  uint32_t _mapSubscribers;                 ///< number of map cloud subscribers at the last map publishing
+  bool _featureOnly;                        ///< flag if no full resolution cloud is received and registered
+
+  MapTileStore _mapTileStore;     ///< on disk storage of the map cubes
+  bool _loadMapOnStartup;         ///< flag if the map should be loaded from the map directory during setup
+  bool _saveMapOnShutdown;        ///< flag if the map should be saved to the map directory after spinning
+
+  MapTilePager _mapTilePager;           ///< asynchronous pager of map cubes to the map directory
+  int _mapPagingRadius;                 ///< number of cubes around the center cube kept in memory (0 = no paging)
+  Vector3 _lastPagingPos;               ///< position at the last paging update, for estimating the direction of travel
+  std::vector<MapTile> _pagedInTiles;   ///< buffer for collecting paged in cubes
 
   ros::Time _timeLaserCloudCornerLast;   ///< time of current last corner cloud
   ros::Time _timeLaserCloudSurfLast;     ///< time of current last surface cloud
@@ -213,21 +417,48 @@ private:
   bool _newLaserOdometry;         ///< flag if a new laser odometry has been received
 
   Twist _transformSum;
-  Twist _transformIncre;
   Twist _transformTobeMapped;
   Twist _transformBefMapped;
   Twist _transformAftMapped;
 
   CircularBuffer<IMUState2> _imuHistory;    ///< history of IMU states
-
-  pcl::VoxelGrid<pcl::PointXYZI> _downSizeFilterCorner;   ///< voxel filter for down sizing corner clouds
-  pcl::VoxelGrid<pcl::PointXYZI> _downSizeFilterSurf;     ///< voxel filter for down sizing surface clouds
-  pcl::VoxelGrid<pcl::PointXYZI> _downSizeFilterMap;      ///< voxel filter for down sizing accumulated map
+  boost::mutex _imuMutex;                   ///< mutex guarding the IMU history
+
+  bool _threadedMapping;                    ///< flag if feature stacks are processed in a separate mapping thread
+  boost::thread _mappingThread;             ///< the mapping thread
+  boost::mutex _stackMutex;                 ///< mutex guarding the feature stack, its state and the mapped transforms
+  boost::condition_variable _stackCond;     ///< signaled on new stacked frames and stop requests
+  bool _stopMapping;                        ///< flag if the mapping thread should stop
+  int _stackedFrames;                       ///< number of frames in the feature stack
+  ros::Time _stackTime;                     ///< time of the newest frame in the feature stack
+  ros::WallTime _stackWallStart;            ///< wall clock time the oldest frame was merged into the feature stack
+  Twist _stackTransformSum;                 ///< odometry transform of the newest frame in the feature stack
+  Twist _stackTransformTobeMapped;          ///< map transform estimate of the newest frame in the feature stack
+  pcl::PointCloud<PointXYZIRT>::Ptr _stackFullRes;   ///< full resolution cloud of the newest frame in the stack
+
+  ros::Time _mappingTime;                   ///< time of the feature stack being processed
+  Twist _mappingTransformSum;               ///< odometry transform of the feature stack being processed
+  pcl::PointCloud<PointXYZIRT>::Ptr _mappingFullRes;  ///< full resolution cloud of the stack being processed
+  double _solveTimeAvg;                     ///< moving average of the feature stack processing time (in seconds)
+
+  VoxelGridFilter<PointXYZIRT> _downSizeFilterCorner;   ///< voxel filter for down sizing corner clouds
+  VoxelGridFilter<PointXYZIRT> _downSizeFilterSurf;     ///< voxel filter for down sizing surface clouds
+  VoxelGridFilter<PointXYZIRT> _downSizeFilterMap;      ///< voxel filter for down sizing accumulated map
 
   nav_msgs::Odometry _odomAftMapped;      ///< mapping odometry message
   tf::StampedTransform _aftMappedTrans;   ///< mapping odometry transformation
 
   ros::Publisher _pubLaserCloudSurround;    ///< map cloud message publisher
+  ros::Publisher _pubMapDelta;              ///< map delta message publisher
+  MapCloudPublisher _mapCloudPublisher;     ///< asynchronous map cloud assembly and publishing
+  MapSnapshot _mapSnapshot;                 ///< buffer for collecting the map cubes to publish
+
+  std::set<CubeKey> _dirtyCubes;                      ///< cubes changed since the last map delta
+  std::vector<MapCubeSnapshot> _releasedCubes;        ///< cubes removed from memory since the last map delta
+  uint64_t _mapVersion;                               ///< version of the last published map delta
+  uint32_t _mapDeltaSubscribers;                      ///< number of map delta subscribers at the last map publishing
+  bool _mapDeltaResync;                               ///< flag if the next map delta has to be a full update
+  boost::atomic<bool> _mapDeltaResyncRequested;       ///< flag if a client requested a full update
   ros::Publisher _pubLaserCloudFullRes;     ///< current full resolution cloud message publisher
   ros::Publisher _pubOdomAftMapped;         ///< mapping odometry publisher
   tf::TransformBroadcaster _tfBroadcaster;  ///< mapping odometry transform broadcaster
@@ -237,6 +468,7 @@ private:
   ros::Subscriber _subLaserCloudFullRes;      ///< full resolution cloud message subscriber
   ros::Subscriber _subLaserOdometry;          ///< laser odometry message subscriber
   ros::Subscriber _subImu;                    ///< IMU message subscriber
+  ros::Subscriber _subMapDeltaResync;         ///< map delta resynchronization request subscriber
 
 };
 
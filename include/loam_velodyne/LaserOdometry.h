@@ -34,6 +34,9 @@
 #define LOAM_LASERODOMETRY_H
 
 
+#include "IterationBudget.h"
+#include "PointXYZIRT.h"
+#include "SweepFeatures.h"
 #include "Twist.h"
 #include "nanoflann_pcl.h"
 
@@ -65,41 +68,11 @@ public:
   virtual bool setup(ros::NodeHandle& node,
                      ros::NodeHandle& privateNode);
 
-  /** \brief Handler method for a new sharp corner cloud.
+  /** \brief Handler method for a new feature frame.
    *
-   * @param cornerPointsSharpMsg the new sharp corner cloud message
+   * @param featureFrameMsg the new feature frame message
    */
-  void laserCloudSharpHandler(const sensor_msgs::PointCloud2ConstPtr& cornerPointsSharpMsg);
-
-  /** \brief Handler method for a new less sharp corner cloud.
-   *
-   * @param cornerPointsLessSharpMsg the new less sharp corner cloud message
-   */
-  void laserCloudLessSharpHandler(const sensor_msgs::PointCloud2ConstPtr& cornerPointsLessSharpMsg);
-
-  /** \brief Handler method for a new flat surface cloud.
-   *
-   * @param surfPointsFlatMsg the new flat surface cloud message
-   */
-  void laserCloudFlatHandler(const sensor_msgs::PointCloud2ConstPtr& surfPointsFlatMsg);
-
-  /** \brief Handler method for a new less flat surface cloud.
-   *
-   * @param surfPointsLessFlatMsg the new less flat surface cloud message
-   */
-  void laserCloudLessFlatHandler(const sensor_msgs::PointCloud2ConstPtr& surfPointsLessFlatMsg);
-
-  /** \brief Handler method for a new full resolution cloud.
-   *
-   * @param laserCloudFullResMsg the new full resolution cloud message
-   */
-  void laserCloudFullResHandler(const sensor_msgs::PointCloud2ConstPtr& laserCloudFullResMsg);
-
-  /** \brief Handler method for a new IMU transformation information.
-   *
-   * @param laserCloudFullResMsg the new IMU transformation information message
-   */
-  void imuTransHandler(const sensor_msgs::PointCloud2ConstPtr& imuTransMsg);
+  void featureFrameHandler(const loam_velodyne::FeatureFrame::ConstPtr& featureFrameMsg);
 
   /** \brief Process incoming messages in a loop until shutdown (used in active mode). */
   void spin();
@@ -107,6 +80,15 @@ public:
   /** \brief Try to process buffered data. */
   void process();
 
+  /** \brief Retrieve the latest laser odometry (for in-process use). */
+  const nav_msgs::Odometry& laserOdometry() const { return _laserOdometryMsg; }
+
+  /** \brief Retrieve the latest corner cloud, transformed to the sweep end (for in-process use). */
+  const pcl::PointCloud<PointXYZIRT>& lastCornerCloud() const { return *_lastCornerCloud; }
+
+  /** \brief Retrieve the latest surface cloud, transformed to the sweep end (for in-process use). */
+  const pcl::PointCloud<PointXYZIRT>& lastSurfaceCloud() const { return *_lastSurfaceCloud; }
+
 
 protected:
   /** \brief Reset flags, etc. */
@@ -115,34 +97,33 @@ protected:
   /** \brief Check if all required information for a new processing step is available. */
   bool hasNewData();
 
-  /** \brief Transform the given point to the start of the sweep.
+  /** \brief Transform the points of the given cloud to the start of the sweep.
+   *
+   * @param cloudIn the point cloud to transform
+   * @param cloudOut the point cloud instance for storing the result
+   */
+  void transformToStart(const pcl::PointCloud<PointXYZIRT>& cloudIn,
+                        pcl::PointCloud<PointXYZIRT>& cloudOut);
+
+  /** \brief Search the closest point of each point transformed to the sweep start in the given KD-tree.
+   *
+   * The results are stored in the _pointSearchInd and _pointSearchSqDis buffers, one entry per point.
    *
-   * @param pi the point to transform
-   * @param po the point instance for storing the result
+   * @param tree the KD-tree of the last corner or surface cloud
    */
-  void transformToStart(const pcl::PointXYZI& pi,
-                        pcl::PointXYZI& po);
+  void searchClosestPoints(const nanoflann::KdTreeFLANN<PointXYZIRT>& tree);
 
   /** \brief Transform the given point cloud to the end of the sweep.
    *
    * @param cloud the point cloud to transform
    */
-  size_t transformToEnd(pcl::PointCloud<pcl::PointXYZI>::Ptr& cloud);
-
-  void pluginIMURotation(const Angle& bcx, const Angle& bcy, const Angle& bcz,
-                         const Angle& blx, const Angle& bly, const Angle& blz,
-                         const Angle& alx, const Angle& aly, const Angle& alz,
-                         Angle &acx, Angle &acy, Angle &acz);
-
-  void accumulateRotation(Angle cx, Angle cy, Angle cz,
-                          Angle lx, Angle ly, Angle lz,
-                          Angle &ox, Angle &oy, Angle &oz);
+  size_t transformToEnd(pcl::PointCloud<PointXYZIRT>& cloud);
 
   /** \brief Publish the current result via the respective topics. */
   void publishResult();
 
 private:
-  float _scanPeriod;       ///< time per scan
+  float _scanPeriod;       ///< time per scan (taken over from the feature frames)
   uint16_t _ioRatio;       ///< ratio of input to output frames
   bool _systemInited;      ///< initialization flag
   long _frameCount;        ///< number of processed frames
@@ -150,35 +131,22 @@ private:
   size_t _maxIterations;   ///< maximum number of iterations
   float _deltaTAbort;     ///< optimization abort threshold for deltaT
   float _deltaRAbort;     ///< optimization abort threshold for deltaR
+  IterationBudget _solveBudget;  ///< wall clock time budget of the optimization per frame
+  long _budgetStops;             ///< number of frames in which the optimization was stopped by the time budget
+  bool _featureOnly;             ///< flag if the full resolution cloud is neither received nor forwarded
 
-  pcl::PointCloud<pcl::PointXYZI>::Ptr _cornerPointsSharp;      ///< sharp corner points cloud
-  pcl::PointCloud<pcl::PointXYZI>::Ptr _cornerPointsLessSharp;  ///< less sharp corner points cloud
-  pcl::PointCloud<pcl::PointXYZI>::Ptr _surfPointsFlat;         ///< flat surface points cloud
-  pcl::PointCloud<pcl::PointXYZI>::Ptr _surfPointsLessFlat;     ///< less flat surface points cloud
-  pcl::PointCloud<pcl::PointXYZI>::Ptr _laserCloud;             ///< full resolution cloud
-
-  pcl::PointCloud<pcl::PointXYZI>::Ptr _lastCornerCloud;    ///< last corner points cloud
-  pcl::PointCloud<pcl::PointXYZI>::Ptr _lastSurfaceCloud;   ///< last surface points cloud
-
-  pcl::PointCloud<pcl::PointXYZI>::Ptr _laserCloudOri;      ///< point selection
-  pcl::PointCloud<pcl::PointXYZI>::Ptr _coeffSel;           ///< point selection coefficients
+  SweepFeatures _features;   ///< full resolution cloud, features and IMU information of the current sweep
+  bool _newFeatures;         ///< flag if a new feature frame has been received
 
-  nanoflann::KdTreeFLANN<pcl::PointXYZI> _lastCornerKDTree;   ///< last corner cloud KD-tree
-  nanoflann::KdTreeFLANN<pcl::PointXYZI> _lastSurfaceKDTree;  ///< last surface cloud KD-tree
+  pcl::PointCloud<PointXYZIRT>::Ptr _lastCornerCloud;    ///< last corner points cloud
+  pcl::PointCloud<PointXYZIRT>::Ptr _lastSurfaceCloud;   ///< last surface points cloud
 
-  ros::Time _timeCornerPointsSharp;      ///< time of current sharp corner cloud
-  ros::Time _timeCornerPointsLessSharp;  ///< time of current less sharp corner cloud
-  ros::Time _timeSurfPointsFlat;         ///< time of current flat surface cloud
-  ros::Time _timeSurfPointsLessFlat;     ///< time of current less flat surface cloud
-  ros::Time _timeLaserCloudFullRes;      ///< time of current full resolution cloud
-  ros::Time _timeImuTrans;               ///< time of current IMU transformation information
+  pcl::PointCloud<PointXYZIRT>::Ptr _laserCloudOri;      ///< point selection
+  pcl::PointCloud<PointXYZIRT>::Ptr _coeffSel;           ///< point selection coefficients
+  pcl::PointCloud<PointXYZIRT> _pointsToStart;           ///< feature points transformed to the sweep start
 
-  bool _newCornerPointsSharp;       ///< flag if a new sharp corner cloud has been received
-  bool _newCornerPointsLessSharp;   ///< flag if a new less sharp corner cloud has been received
-  bool _newSurfPointsFlat;          ///< flag if a new flat surface cloud has been received
-  bool _newSurfPointsLessFlat;      ///< flag if a new less flat surface cloud has been received
-  bool _newLaserCloudFullRes;       ///< flag if a new full resolution cloud has been received
-  bool _newImuTrans;                ///< flag if a new IMU transformation information cloud has been received
+  nanoflann::KdTreeFLANN<PointXYZIRT> _lastCornerKDTree;   ///< last corner cloud KD-tree
+  nanoflann::KdTreeFLANN<PointXYZIRT> _lastSurfaceKDTree;  ///< last surface cloud KD-tree
 
   std::vector<int> _pointSearchCornerInd1;    ///< first corner point search index buffer
   std::vector<int> _pointSearchCornerInd2;    ///< second corner point search index buffer
@@ -187,15 +155,15 @@ private:
   std::vector<int> _pointSearchSurfInd2;    ///< second surface point search index buffer
   std::vector<int> _pointSearchSurfInd3;    ///< third surface point search index buffer
 
+  std::vector<int> _queryOrder;             ///< spatial processing order of the nearest neighbor queries
+  nanoflann::KdTreeFLANN<PointXYZIRT>::SortKeys _queryKeys;   ///< sort key buffer for the query order
+  std::vector<int> _pointSearchInd;         ///< closest point search index buffer, one entry per query point
+  std::vector<float> _pointSearchSqDis;     ///< closest point search squared distance buffer, one entry per query point
+  std::vector<int> _nanIndices;             ///< index buffer for removing NaN points from the input clouds
+
   Twist _transform;     ///< optimized pose transformation
   Twist _transformSum;  ///< accumulated optimized pose transformation
 
-  Angle _imuRollStart, _imuPitchStart, _imuYawStart;
-  Angle _imuRollEnd, _imuPitchEnd, _imuYawEnd;
-
-  Vector3 _imuShiftFromStart;
-  Vector3 _imuVeloFromStart;
-
   nav_msgs::Odometry _laserOdometryMsg;       ///< laser odometry message
   tf::StampedTransform _laserOdometryTrans;   ///< laser odometry transformation
 
@@ -205,12 +173,7 @@ private:
   ros::Publisher _pubLaserOdometry;         ///< laser odometry publisher
   tf::TransformBroadcaster _tfBroadcaster;  ///< laser odometry transform broadcaster
 
-  ros::Subscriber _subCornerPointsSharp;      ///< sharp corner cloud message subscriber
-  ros::Subscriber _subCornerPointsLessSharp;  ///< less sharp corner cloud message subscriber
-  ros::Subscriber _subSurfPointsFlat;         ///< flat surface cloud message subscriber
-  ros::Subscriber _subSurfPointsLessFlat;     ///< less flat surface cloud message subscriber
-  ros::Subscriber _subLaserCloudFullRes;      ///< full resolution cloud message subscriber
-  ros::Subscriber _subImuTrans;               ///< IMU transformation information message subscriber
+  ros::Subscriber _subFeatureFrame;   ///< feature frame message subscriber
 };
 
 } // end namespace loam
@@ -0,0 +1,223 @@
+// Copyright 2013, Ji Zhang, Carnegie Mellon University
+// Further contributions copyright (c) 2016, Southwest Research Institute
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from this
+//    software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// This is an implementation of the algorithm described in the following paper:
+//   J. Zhang and S. Singh. LOAM: Lidar Odometry and Mapping in Real-time.
+//     Robotics: Science and Systems Conference (RSS). Berkeley, CA, July 2014.
+
+#ifndef LOAM_MAPCLOUDPUBLISHER_H
+#define LOAM_MAPCLOUDPUBLISHER_H
+
+
+#include "VoxelGridFilter.h"
+#include "MapTileStore.h"
+
+#include <ros/ros.h>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+namespace loam {
+
+/** \brief Immutable snapshot of the clouds of a single map cube. */
+struct MapCubeSnapshot {
+  MapCubeSnapshot() : released(false) {}
+
+  CubeKey key;                                                 ///< the cube key
+  pcl::PointCloud<PointXYZIRT>::ConstPtr cornerCloud;          ///< corner points of the cube (null if unchanged)
+  pcl::PointCloud<PointXYZIRT>::ConstPtr surfaceCloud;         ///< surface points of the cube (null if unchanged)
+  bool released;                                               ///< flag if the cube was removed from memory
+};
+
+
+
+/** \brief Collect the points of all voxels that changed between two versions of a down sized cloud.
+ *
+ * Each voxel of a down sized cloud holds a single centroid, so adding points to a cube only changes the centroids of
+ * the voxels the new points fall into, while all other centroids stay bitwise identical.
+ *
+ * @param previous the previous version of the cloud
+ * @param current the current version of the cloud
+ * @param invLeafSize the inverse leaf size of the voxel filter the clouds were down sized with
+ * @param changed the cloud for storing the points of all new or changed voxels
+ * @return true if the current cloud equals the previous cloud with the changed voxels replaced, false if a voxel
+ * holds more than one point or lost its point (the cloud has to be sent completely)
+ */
+template <typename PointT>
+bool collectChangedVoxels(const pcl::PointCloud<PointT>& previous,
+                          const pcl::PointCloud<PointT>& current,
+                          const float& invLeafSize,
+                          pcl::PointCloud<PointT>& changed)
+{
+  typedef std::pair<VoxelKey, size_t> VoxelEntry;
+  std::vector<VoxelEntry> previousVoxels(previous.points.size());
+  std::vector<VoxelEntry> currentVoxels(current.points.size());
+  for (size_t i = 0; i < previous.points.size(); i++) {
+    previousVoxels[i] = VoxelEntry(toVoxelKey(previous.points[i], invLeafSize), i);
+  }
+  for (size_t i = 0; i < current.points.size(); i++) {
+    currentVoxels[i] = VoxelEntry(toVoxelKey(current.points[i], invLeafSize), i);
+  }
+  std::sort(previousVoxels.begin(), previousVoxels.end());
+  std::sort(currentVoxels.begin(), currentVoxels.end());
+
+  changed.clear();
+  size_t p = 0;
+  for (size_t c = 0; c < currentVoxels.size(); c++) {
+    const VoxelKey& key = currentVoxels[c].first;
+    if ((c > 0 && key == currentVoxels[c - 1].first) || (p < previousVoxels.size() && previousVoxels[p].first < key)) {
+      // several points in a voxel or a voxel without point anymore
+      return false;
+    }
+
+    const PointT& point = current.points[currentVoxels[c].second];
+    if (p < previousVoxels.size() && previousVoxels[p].first == key) {
+      const PointT& previousPoint = previous.points[previousVoxels[p].second];
+      p++;
+      if (point.x == previousPoint.x && point.y == previousPoint.y && point.z == previousPoint.z
+          && point.intensity == previousPoint.intensity) {
+        continue;
+      }
+    }
+    changed.push_back(point);
+  }
+
+  return p == previousVoxels.size();
+}
+
+
+
+/** \brief Immutable snapshot of a set of map cube clouds. */
+struct MapSnapshot {
+  MapSnapshot() : version(0), baseVersion(0) {}
+
+  ros::Time stamp;                                                     ///< time stamp of the snapshot
+  std::vector<pcl::PointCloud<PointXYZIRT>::ConstPtr> clouds;       ///< the cube clouds forming the map
+
+  uint64_t version;                       ///< map version after applying the delta (0 if the snapshot has no delta)
+  uint64_t baseVersion;                   ///< map version the delta applies to (0 for full updates)
+  std::vector<MapCubeSnapshot> cubes;     ///< the cubes changed since the base version
+};
+
+
+
+/** \brief Assembles, down sizes and publishes map clouds (and optionally map deltas) in a background thread.
+ *
+ * The clouds of a snapshot are shared with the mapping, so they must not be modified once they have been handed to
+ * the publisher. If a new snapshot arrives before the previous one has been published, the previous map cloud is
+ * dropped and the previous delta is merged into the new one.
+ *
+ * Changed cubes are compared against the clouds last sent for them, such that map deltas only contain the voxels
+ * changed since. Cubes sent for the first time (after a full update or after they were released) are sent completely.
+ */
+class MapCloudPublisher {
+public:
+  MapCloudPublisher();
+  ~MapCloudPublisher();
+
+  /** \brief Start the background thread.
+   *
+   * @param publisher the map cloud publisher
+   * @param frameID the frame ID of the published map clouds
+   * @param leafSize the leaf size of the voxel filter applied to the assembled map clouds
+   */
+  void start(const ros::Publisher& publisher,
+             const std::string& frameID,
+             const float& leafSize);
+
+  /** \brief Enable publishing of map deltas (before handing snapshots with deltas to the publisher).
+   *
+   * @param deltaPublisher the map delta publisher
+   * @param cubeSize the edge length of the map cubes
+   * @param cornerLeafSize the leaf size of the voxel filter applied to the corner clouds of the cubes
+   * @param surfaceLeafSize the leaf size of the voxel filter applied to the surface clouds of the cubes
+   */
+  void enableDeltas(const ros::Publisher& deltaPublisher,
+                    const float& cubeSize,
+                    const float& cornerLeafSize,
+                    const float& surfaceLeafSize);
+
+  /** \brief Forget the clouds last sent for all cubes (the next snapshot with a delta has to be a full update). */
+  void resetDeltas();
+
+  /** \brief Stop the background thread (pending snapshots are dropped). */
+  void stop();
+
+  /** \brief Hand a new map snapshot to the background thread for publishing.
+   *
+   * @param snapshot the snapshot to publish (swapped with an empty snapshot)
+   */
+  void publish(MapSnapshot& snapshot);
+
+private:
+  /** \brief Background thread loop. */
+  void run();
+
+  /** \brief Convert the delta of the given snapshot to a map delta message and publish it.
+   *
+   * Cubes known to the client only contain the voxels changed since their last sent clouds.
+   */
+  void publishDelta(const MapSnapshot& snapshot);
+
+  ros::Publisher _publisher;                          ///< the map cloud publisher
+  std::string _frameID;                               ///< frame ID of the published map clouds
+  VoxelGridFilter<PointXYZIRT> _downSizeFilter;    ///< voxel filter for down sizing the assembled map cloud
+  pcl::PointCloud<PointXYZIRT> _mapCloud;          ///< assembled map cloud
+  pcl::PointCloud<PointXYZIRT> _mapCloudDS;        ///< down sized map cloud
+
+  ros::Publisher _deltaPublisher;     ///< the map delta publisher
+  bool _deltasEnabled;                ///< flag if map deltas are published
+  float _cubeSize;                    ///< edge length of the map cubes
+  float _cornerLeafSize;              ///< leaf size of the corner clouds of the cubes
+  float _surfaceLeafSize;             ///< leaf size of the surface clouds of the cubes
+  std::map<CubeKey, MapCubeSnapshot> _sentCubes;    ///< the clouds last sent for each cube in memory
+  pcl::PointCloud<PointXYZIRT> _changedCorners;     ///< corner points of the changed voxels of a cube
+  pcl::PointCloud<PointXYZIRT> _changedSurfaces;    ///< surface points of the changed voxels of a cube
+
+  boost::thread _worker;                    ///< the background thread
+  boost::mutex _mutex;                      ///< mutex guarding the pending snapshot
+  boost::condition_variable _cond;          ///< signaled on new snapshots and stop requests
+  MapSnapshot _pending;                     ///< snapshot waiting to be published
+  bool _hasPending;                         ///< flag if a snapshot is waiting to be published
+  bool _running;                            ///< flag if the background thread is running
+  bool _stopRequested;                      ///< flag if the background thread should stop
+  bool _deltaResetRequested;                ///< flag if the sent cube clouds should be dropped
+};
+
+} // end namespace loam
+
+#endif //LOAM_MAPCLOUDPUBLISHER_H
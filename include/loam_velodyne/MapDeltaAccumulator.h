@@ -0,0 +1,123 @@
+// Copyright 2013, Ji Zhang, Carnegie Mellon University
+// Further contributions copyright (c) 2016, Southwest Research Institute
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from this
+//    software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// This is an implementation of the algorithm described in the following paper:
+//   J. Zhang and S. Singh. LOAM: Lidar Odometry and Mapping in Real-time.
+//     Robotics: Science and Systems Conference (RSS). Berkeley, CA, July 2014.
+
+#ifndef LOAM_MAPDELTAACCUMULATOR_H
+#define LOAM_MAPDELTAACCUMULATOR_H
+
+
+#include "MapTileStore.h"
+#include "VoxelGridFilter.h"
+#include "loam_velodyne/MapDelta.h"
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#include <map>
+
+
+namespace loam {
+
+/** \brief Client side reconstruction of the laser mapping map from map delta messages.
+ *
+ * Deltas have to be applied in order. If a delta is missed, all subsequent deltas are rejected until the next full
+ * update arrives, which clients can request by publishing to /laser_cloud_map_delta_resync. The full update then
+ * replaces the whole accumulated map, so cubes outside of the mapping's memory at that time are lost rather than kept
+ * in a possibly stale state.
+ */
+class MapDeltaAccumulator {
+public:
+  /** \brief The corner and surface clouds of a map cube. */
+  struct Cube {
+    pcl::PointCloud<pcl::PointXYZI> cornerCloud;    ///< corner points of the cube
+    pcl::PointCloud<pcl::PointXYZI> surfaceCloud;   ///< surface points of the cube
+    std::map<VoxelKey, size_t> cornerVoxels;        ///< index of the corner point of each voxel
+    std::map<VoxelKey, size_t> surfaceVoxels;       ///< index of the surface point of each voxel
+  };
+
+  MapDeltaAccumulator();
+
+  /** \brief Apply a map delta message.
+   *
+   * @param delta the map delta
+   * @return true if the delta was applied, false if it doesn't apply to the current map version
+   */
+  bool apply(const loam_velodyne::MapDelta& delta);
+
+  /** \brief Check if the accumulated map is in sync with the map deltas received so far. */
+  bool isSynchronized() const { return _version > 0; }
+
+  /** \brief Retrieve the version of the accumulated map (0 if not synchronized). */
+  const uint64_t& version() const { return _version; }
+
+  /** \brief Retrieve all cubes of the accumulated map. */
+  const std::map<CubeKey, Cube>& cubes() const { return _cubes; }
+
+  /** \brief Assemble the accumulated map into a single cloud.
+   *
+   * @param cloud the cloud for storing all corner and surface points of the map
+   */
+  void getMapCloud(pcl::PointCloud<pcl::PointXYZI>& cloud) const;
+
+  /** \brief Remove all cubes and reset the map version. */
+  void clear();
+
+private:
+  /** \brief Index the points of a complete cube cloud by their voxel.
+   *
+   * @param cloud the cube cloud
+   * @param invLeafSize the inverse leaf size the cloud was down sized with
+   * @param voxels the map for storing the point index of each voxel
+   */
+  static void indexVoxels(const pcl::PointCloud<pcl::PointXYZI>& cloud,
+                          const float& invLeafSize,
+                          std::map<VoxelKey, size_t>& voxels);
+
+  /** \brief Replace the points of the changed voxels of a cube cloud (or add them for new voxels).
+   *
+   * @param changed the points of the changed voxels
+   * @param invLeafSize the inverse leaf size the cloud was down sized with
+   * @param cloud the cube cloud
+   * @param voxels the point index of each voxel of the cube cloud
+   */
+  static void replaceVoxels(const pcl::PointCloud<pcl::PointXYZI>& changed,
+                            const float& invLeafSize,
+                            pcl::PointCloud<pcl::PointXYZI>& cloud,
+                            std::map<VoxelKey, size_t>& voxels);
+
+  pcl::PointCloud<pcl::PointXYZI> _changed;   ///< buffer for the points of changed voxels
+  uint64_t _version;                  ///< current map version (0 if not synchronized)
+  std::map<CubeKey, Cube> _cubes;     ///< the accumulated map cubes
+};
+
+} // end namespace loam
+
+#endif //LOAM_MAPDELTAACCUMULATOR_H
@@ -0,0 +1,195 @@
+// Copyright 2013, Ji Zhang, Carnegie Mellon University
+// Further contributions copyright (c) 2016, Southwest Research Institute
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from this
+//    software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// This is an implementation of the algorithm described in the following paper:
+//   J. Zhang and S. Singh. LOAM: Lidar Odometry and Mapping in Real-time.
+//     Robotics: Science and Systems Conference (RSS). Berkeley, CA, July 2014.
+
+#ifndef LOAM_MAPTILEPAGER_H
+#define LOAM_MAPTILEPAGER_H
+
+
+#include "MapTileStore.h"
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <deque>
+#include <set>
+#include <vector>
+
+
+namespace loam {
+
+/** \brief The corner and surface clouds of a single map cube. */
+struct MapTile {
+  MapTile()
+      : cornerCloud(new pcl::PointCloud<PointXYZIRT>()),
+        surfaceCloud(new pcl::PointCloud<PointXYZIRT>()) {}
+
+  /** \brief Replace the in memory clouds of the paged in cube by the tile clouds, merged with the in memory points.
+   *
+   * The in memory clouds hold the points added to the cube while it was paged out. The tile clouds are not modified,
+   * as they may still be shared (e.g. with a map snapshot, if the tile is handed back after a failed page out).
+   *
+   * @param cubeCornerCloud the in memory corner cloud of the cube
+   * @param cubeSurfaceCloud the in memory surface cloud of the cube
+   */
+  void mergeInto(pcl::PointCloud<PointXYZIRT>::Ptr& cubeCornerCloud,
+                 pcl::PointCloud<PointXYZIRT>::Ptr& cubeSurfaceCloud) const
+  {
+    mergeCloud(cornerCloud, cubeCornerCloud);
+    mergeCloud(surfaceCloud, cubeSurfaceCloud);
+  }
+
+  CubeKey key;                                            ///< the cube key
+  pcl::PointCloud<PointXYZIRT>::Ptr cornerCloud;       ///< corner points of the cube
+  pcl::PointCloud<PointXYZIRT>::Ptr surfaceCloud;      ///< surface points of the cube
+
+private:
+  /** \brief Merge a single in memory cloud, see mergeInto(). */
+  static void mergeCloud(const pcl::PointCloud<PointXYZIRT>::Ptr& tileCloud,
+                         pcl::PointCloud<PointXYZIRT>::Ptr& cubeCloud)
+  {
+    if (cubeCloud->empty()) {
+      cubeCloud = tileCloud;
+      return;
+    }
+
+    pcl::PointCloud<PointXYZIRT>::Ptr merged(new pcl::PointCloud<PointXYZIRT>(*tileCloud));
+    *merged += *cubeCloud;
+    cubeCloud = merged;
+  }
+};
+
+
+
+/** \brief Asynchronous paging of map cubes between memory and a disk backed tile store.
+ *
+ * All file I/O is performed by a single background thread, which processes page out (write) and page in (read)
+ * requests strictly in the order they were issued. Apart from the worker thread, the pager is meant to be used from a
+ * single (mapping) thread.
+ *
+ * A cube whose tile could not be written is handed back like a paged in cube, so it stays in memory and is not paged
+ * out. A cube whose tile could not be read stays paged out, its stored tile is kept and the next page in request
+ * retries reading it.
+ */
+class MapTilePager {
+public:
+  MapTilePager();
+  ~MapTilePager();
+
+  /** \brief Start the background worker.
+   *
+   * @param store the (opened) tile store to page to
+   * @param useExistingTiles if true, tiles already present in the store are treated as paged out cubes
+   * @param readOnly if true, paged out cubes are dropped instead of written, as they are known to be unchanged
+   * copies of stored tiles (e.g. for a static map)
+   * @return true if the pager was started successfully, false otherwise
+   */
+  bool start(const MapTileStore& store,
+             const bool& useExistingTiles,
+             const bool& readOnly = false);
+
+  /** \brief Write all pending tiles and stop the background worker. */
+  void stop();
+
+  /** \brief Check if the background worker is running. */
+  bool isRunning() const { return _running; }
+
+  /** \brief Check if the given cube is currently paged out (or its page in has not been collected yet). */
+  bool isPagedOut(const CubeKey& key) const { return _pagedOut.count(key) > 0; }
+
+  /** \brief Page out the given cube.
+   *
+   * The pager takes over the clouds of the tile, they must not be modified afterwards. The cube must not be paged out
+   * already.
+   *
+   * @param tile the cube to page out
+   */
+  void pageOut(const MapTile& tile);
+
+  /** \brief Request an asynchronous page in of the given cube (ignored if the cube is not paged out).
+   *
+   * @param key the cube key
+   */
+  void requestPageIn(const CubeKey& key);
+
+  /** \brief Collect all cubes paged in since the last call (non blocking).
+   *
+   * The collected cubes include the cubes handed back after a failed page out.
+   *
+   * @param tiles the vector for storing the paged in cubes
+   * @return the number of failed page outs and page ins since the last call
+   */
+  size_t collectPagedIn(std::vector<MapTile>& tiles);
+
+  /** \brief Page in the given paged out cube, waiting for the background worker if necessary.
+   *
+   * @param key the cube key
+   * @param tile the tile for storing the paged in cube (an empty cube if the given cube is not paged out)
+   * @return true if the cube is no longer paged out, false if its tile could not be read
+   */
+  bool pageInNow(const CubeKey& key,
+                 MapTile& tile);
+
+private:
+  /** \brief A single page out or page in request. */
+  struct Task {
+    bool pageOut;   ///< true for writing the tile, false for reading it
+    MapTile tile;   ///< the tile to write or read
+  };
+
+  /** \brief Background worker loop. */
+  void run();
+
+  MapTileStore _store;                  ///< the tile store
+  bool _running;                        ///< flag if the background worker is running
+  bool _readOnly;                       ///< flag if paged out cubes are dropped instead of written
+  boost::thread _worker;                ///< the background worker
+
+  boost::mutex _mutex;                  ///< mutex guarding the task queue and the paged in tiles
+  boost::condition_variable _taskCond;  ///< signaled on new tasks and stop requests
+  boost::condition_variable _doneCond;  ///< signaled on newly paged in tiles
+  std::deque<Task> _tasks;              ///< pending tasks
+  std::vector<MapTile> _pagedIn;        ///< paged in (or not written) tiles, not collected yet
+  std::set<CubeKey> _pageInFailed;      ///< cubes whose tile could not be read, not collected yet
+  std::set<CubeKey> _notWritten;        ///< cubes handed back after a failed page out, pending page ins are skipped
+  size_t _failures;                     ///< number of failed page outs and page ins, not collected yet
+  bool _stopRequested;                  ///< flag if the background worker should stop
+
+  std::set<CubeKey> _pagedOut;          ///< cubes that are not held in memory (mapping thread only)
+  std::set<CubeKey> _pageInRequested;   ///< cubes with pending page in requests (mapping thread only)
+};
+
+} // end namespace loam
+
+#endif //LOAM_MAPTILEPAGER_H
@@ -0,0 +1,220 @@
+// Copyright 2013, Ji Zhang, Carnegie Mellon University
+// Further contributions copyright (c) 2016, Southwest Research Institute
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from this
+//    software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// This is an implementation of the algorithm described in the following paper:
+//   J. Zhang and S. Singh. LOAM: Lidar Odometry and Mapping in Real-time.
+//     Robotics: Science and Systems Conference (RSS). Berkeley, CA, July 2014.
+
+#ifndef LOAM_MAPTILESTORE_H
+#define LOAM_MAPTILESTORE_H
+
+
+#include "PointXYZIRT.h"
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+
+namespace loam {
+
+/** \brief Integer coordinates of a map cube in world (map) space.
+ *
+ * The cube with key (0, 0, 0) is centered at the map origin.
+ */
+struct CubeKey {
+  CubeKey(const int& i_ = 0, const int& j_ = 0, const int& k_ = 0)
+      : i(i_), j(j_), k(k_) {}
+
+  bool operator==(const CubeKey& other) const
+  {
+    return i == other.i && j == other.j && k == other.k;
+  }
+
+  bool operator!=(const CubeKey& other) const
+  {
+    return !(*this == other);
+  }
+
+  bool operator<(const CubeKey& other) const
+  {
+    if (i != other.i) return i < other.i;
+    if (j != other.j) return j < other.j;
+    return k < other.k;
+  }
+
+  int i;
+  int j;
+  int k;
+};
+
+
+
+/** \brief Fixed size header at the beginning of each map tile file.
+ *
+ * The header is followed by cornerCount corner points and surfaceCount surface points, each stored as four packed
+ * little endian floats (x, y, z, intensity). Ring and time of the points are not stored.
+ */
+struct MapTileHeader {
+  char magic[8];           ///< file magic, always "LOAMTILE"
+  uint32_t version;        ///< tile format version
+  uint32_t headerSize;     ///< size of this header in bytes (offset of the first point)
+  float cubeSize;          ///< edge length of the map cube stored in the tile
+  int32_t cubeI;           ///< cube key i coordinate
+  int32_t cubeJ;           ///< cube key j coordinate
+  int32_t cubeK;           ///< cube key k coordinate
+  uint64_t cornerCount;    ///< number of corner points in the tile
+  uint64_t surfaceCount;   ///< number of surface points in the tile
+};
+
+
+
+/** \brief Read only, memory mapped view of a single map tile file.
+ *
+ * The point data is accessed directly in the mapped file without any parsing.
+ */
+class MappedMapTile {
+public:
+  MappedMapTile();
+  ~MappedMapTile();
+
+  /** \brief Map the given tile file into memory and validate its header.
+   *
+   * @param path the tile file path
+   * @return true if the tile was mapped successfully, false otherwise
+   */
+  bool open(const std::string& path);
+
+  /** \brief Unmap the currently mapped tile (if any). */
+  void close();
+
+  /** \brief Check if a tile is currently mapped. */
+  bool isOpen() const { return _data != NULL; }
+
+  /** \brief Retrieve the header of the mapped tile. */
+  const MapTileHeader& header() const { return *reinterpret_cast<const MapTileHeader*>(_data); }
+
+  /** \brief Retrieve the packed (x, y, z, intensity) corner point data of the mapped tile. */
+  const float* cornerPoints() const;
+
+  /** \brief Retrieve the packed (x, y, z, intensity) surface point data of the mapped tile. */
+  const float* surfacePoints() const;
+
+private:
+  MappedMapTile(const MappedMapTile&);
+  MappedMapTile& operator=(const MappedMapTile&);
+
+  const char* _data;   ///< start of the mapped file
+  size_t _size;        ///< size of the mapped file in bytes
+};
+
+
+
+/** \brief Directory based storage of map cube clouds, one versioned binary tile file per cube.
+ *
+ */
+class MapTileStore {
+public:
+  /** The magic bytes at the beginning of each tile file. */
+  static const char MAGIC[8];
+
+  /** The current tile format version. */
+  static const uint32_t VERSION = 1;
+
+  MapTileStore();
+
+  /** \brief Open (and create if necessary) the tile directory.
+   *
+   * @param directory the tile directory
+   * @param cubeSize the edge length of the stored map cubes
+   * @return true if the directory is usable, false otherwise
+   */
+  bool open(const std::string& directory,
+            const float& cubeSize);
+
+  /** \brief Check if the store has been opened successfully. */
+  bool isOpen() const { return !_directory.empty(); }
+
+  /** \brief Retrieve the tile directory. */
+  const std::string& directory() const { return _directory; }
+
+  /** \brief Retrieve the file path of the tile for the given cube. */
+  std::string tilePath(const CubeKey& key) const;
+
+  /** \brief Check if a tile exists for the given cube. */
+  bool hasTile(const CubeKey& key) const;
+
+  /** \brief List the keys of all tiles in the store.
+   *
+   * @param keys the vector for storing the tile keys
+   * @return true if the directory could be read, false otherwise
+   */
+  bool listTiles(std::vector<CubeKey>& keys) const;
+
+  /** \brief Write (replace) the tile of the given cube.
+   *
+   * The tile is written to a temporary file, flushed to disk and then renamed, so readers never see partially written
+   * tiles and a crash leaves either the previous or the new tile.
+   *
+   * @param key the cube key
+   * @param cornerCloud the corner points of the cube
+   * @param surfaceCloud the surface points of the cube
+   * @return true if the tile was written successfully, false otherwise
+   */
+  bool writeTile(const CubeKey& key,
+                 const pcl::PointCloud<PointXYZIRT>& cornerCloud,
+                 const pcl::PointCloud<PointXYZIRT>& surfaceCloud) const;
+
+  /** \brief Read the tile of the given cube.
+   *
+   * @param key the cube key
+   * @param cornerCloud the cloud for storing the corner points of the cube
+   * @param surfaceCloud the cloud for storing the surface points of the cube
+   * @return true if the tile was read successfully, false otherwise
+   */
+  bool readTile(const CubeKey& key,
+                pcl::PointCloud<PointXYZIRT>& cornerCloud,
+                pcl::PointCloud<PointXYZIRT>& surfaceCloud) const;
+
+  /** \brief Remove the tile of the given cube (if it exists). */
+  bool removeTile(const CubeKey& key) const;
+
+private:
+  /** \brief Flush the directory entries (e.g. of renamed tiles) to disk. */
+  bool syncDirectory() const;
+
+  std::string _directory;   ///< tile directory
+  float _cubeSize;          ///< map cube edge length
+};
+
+} // end namespace loam
+
+#endif //LOAM_MAPTILESTORE_H
@@ -0,0 +1,74 @@
+// Copyright 2013, Ji Zhang, Carnegie Mellon University
+// Further contributions copyright (c) 2016, Southwest Research Institute
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from this
+//    software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// This is an implementation of the algorithm described in the following paper:
+//   J. Zhang and S. Singh. LOAM: Lidar Odometry and Mapping in Real-time.
+//     Robotics: Science and Systems Conference (RSS). Berkeley, CA, July 2014.
+
+#ifndef LOAM_MORTONCODE_H
+#define LOAM_MORTONCODE_H
+
+
+#include <stdint.h>
+
+
+namespace loam {
+
+/** \brief Number of bits per axis of a 3D Morton code. */
+static const int MORTON_AXIS_BITS = 21;
+
+/** \brief Spread the lowest 21 bits of the given value such that two zero bits follow each of them. */
+inline uint64_t spreadMortonBits(uint64_t v)
+{
+  v &= 0x1FFFFF;
+  v = (v | (v << 32)) & 0x1F00000000FFFFULL;
+  v = (v | (v << 16)) & 0x1F0000FF0000FFULL;
+  v = (v | (v << 8))  & 0x100F00F00F00F00FULL;
+  v = (v | (v << 4))  & 0x10C30C30C30C30C3ULL;
+  v = (v | (v << 2))  & 0x1249249249249249ULL;
+  return v;
+}
+
+/** \brief Calculate the 3D Morton (Z-order) code of the given cell coordinates.
+ *
+ * Cells with close codes are close in space, so storing points sorted by the code of their cell keeps spatial
+ * neighbors close in memory. The code is monotonic in each coordinate.
+ *
+ * @param x the x cell coordinate (lowest 21 bits are used)
+ * @param y the y cell coordinate (lowest 21 bits are used)
+ * @param z the z cell coordinate (lowest 21 bits are used)
+ * @return the interleaved code
+ */
+inline uint64_t mortonCode(const uint64_t& x, const uint64_t& y, const uint64_t& z)
+{
+  return spreadMortonBits(x) | (spreadMortonBits(y) << 1) | (spreadMortonBits(z) << 2);
+}
+
+} // end namespace loam
+
+#endif //LOAM_MORTONCODE_H
@@ -88,6 +88,9 @@ public:
   /** Multi scan mapper for Velodyne HDL-64E according to data sheet. */
   static inline MultiScanMapper Velodyne_HDL_64E() { return MultiScanMapper(-24.9f, 2, 64); };
 
+  /** Multi scan mapper for Velodyne VLS-128 (linear approximation of the non-uniform ring layout). */
+  static inline MultiScanMapper Velodyne_VLS_128() { return MultiScanMapper(-25, 15, 128); };
+
 
 private:
   float _lowerBound;      ///< the vertical angle of the first scan ring
@@ -126,7 +129,7 @@ public:
    * @param laserCloudIn the new input cloud to process
    * @param scanTime the scan (message) timestamp
    */
-  void process(const pcl::PointCloud<pcl::PointXYZ>& laserCloudIn,
+  void process(const pcl::PointCloud<pcl::PointXYZI>& laserCloudIn,
                const ros::Time& scanTime);
 
 
@@ -134,6 +137,8 @@ protected:
   int _systemDelay;             ///< system startup delay counter
   MultiScanMapper _scanMapper;  ///< mapper for mapping vertical point angles to scan ring IDs
 
+  std::vector<pcl::PointCloud<PointXYZIRT> > _laserCloudScans;   ///< per scan ring point buffers (reused across sweeps)
+
   ros::Subscriber _subLaserCloud;   ///< input cloud message subscriber
 
 
@@ -0,0 +1,71 @@
+// Copyright 2013, Ji Zhang, Carnegie Mellon University
+// Further contributions copyright (c) 2016, Southwest Research Institute
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from this
+//    software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// This is an implementation of the algorithm described in the following paper:
+//   J. Zhang and S. Singh. LOAM: Lidar Odometry and Mapping in Real-time.
+//     Robotics: Science and Systems Conference (RSS). Berkeley, CA, July 2014.
+
+#ifndef LOAM_POINTXYZIRT_H
+#define LOAM_POINTXYZIRT_H
+
+
+#include <pcl/point_types.h>
+#include <pcl/register_point_struct.h>
+
+#include <stdint.h>
+
+
+namespace loam {
+
+/** \brief Point type used throughout the LOAM pipeline.
+ *
+ * In contrast to pcl::PointXYZI, the scan ring and the relative measurement time of a point are stored in dedicated
+ * fields instead of being encoded into the intensity, which keeps the measured intensity intact. The coordinates are
+ * stored packed (without SSE padding), reducing the point size from 32 to 24 bytes.
+ */
+struct PointXYZIRT {
+  float x;            ///< x coordinate
+  float y;            ///< y coordinate
+  float z;            ///< z coordinate
+  float intensity;    ///< measured intensity
+  float time;         ///< measurement time relative to the start of the sweep (in seconds)
+  uint16_t ring;      ///< scan ring (laser) ID
+};
+
+} // end namespace loam
+
+
+POINT_CLOUD_REGISTER_POINT_STRUCT(loam::PointXYZIRT,
+                                  (float, x, x)
+                                  (float, y, y)
+                                  (float, z, z)
+                                  (float, intensity, intensity)
+                                  (float, time, time)
+                                  (uint16_t, ring, ring))
+
+#endif //LOAM_POINTXYZIRT_H
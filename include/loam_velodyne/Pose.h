@@ -0,0 +1,162 @@
+// Copyright 2013, Ji Zhang, Carnegie Mellon University
+// Further contributions copyright (c) 2016, Southwest Research Institute
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from this
+//    software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// This is an implementation of the algorithm described in the following paper:
+//   J. Zhang and S. Singh. LOAM: Lidar Odometry and Mapping in Real-time.
+//     Robotics: Science and Systems Conference (RSS). Berkeley, CA, July 2014.
+
+#ifndef LOAM_POSE_H
+#define LOAM_POSE_H
+
+
+#include "Angle.h"
+#include "Twist.h"
+#include "Vector3.h"
+
+#include <Eigen/Core>
+
+#include <algorithm>
+#include <cmath>
+
+
+namespace loam {
+
+/** \brief Construct the rotation matrix of the given Euler angles.
+ *
+ * LOAM poses rotate around the z-, then the x- and finally the y-axis, i.e. R = Ry * Rx * Rz. The matrix is assembled
+ * from the buffered sine and cosine values of the angles, without evaluating any trigonometric function.
+ *
+ * @param rx the rotation angle around the x-axis
+ * @param ry the rotation angle around the y-axis
+ * @param rz the rotation angle around the z-axis
+ * @return the rotation matrix
+ */
+inline Eigen::Matrix3f rotationFromEuler(const Angle& rx,
+                                         const Angle& ry,
+                                         const Angle& rz)
+{
+  float sx = rx.sin(), cx = rx.cos();
+  float sy = ry.sin(), cy = ry.cos();
+  float sz = rz.sin(), cz = rz.cos();
+
+  Eigen::Matrix3f rot;
+  rot << cy * cz + sy * sx * sz, sy * sx * cz - cy * sz, sy * cx,
+         cx * sz,                cx * cz,                -sx,
+         cy * sx * sz - sy * cz, sy * sz + cy * sx * cz, cy * cx;
+  return rot;
+}
+
+
+
+/** \brief Extract the Euler angles (see rotationFromEuler()) of the given rotation matrix.
+ *
+ * Only the radian values require inverse trigonometric functions, the sine and cosine values of the resulting angles
+ * are taken from the matrix.
+ *
+ * @param rot the rotation matrix
+ * @param rx the rotation angle around the x-axis
+ * @param ry the rotation angle around the y-axis
+ * @param rz the rotation angle around the z-axis
+ */
+inline void eulerFromRotation(const Eigen::Matrix3f& rot,
+                              Angle& rx,
+                              Angle& ry,
+                              Angle& rz)
+{
+  float srx = std::max(-1.0f, std::min(1.0f, -rot(1, 2)));
+  rx = Angle(std::asin(srx), std::sqrt(1 - srx * srx), srx);
+
+  float hy = std::sqrt(rot(0, 2) * rot(0, 2) + rot(2, 2) * rot(2, 2));
+  float hz = std::sqrt(rot(1, 0) * rot(1, 0) + rot(1, 1) * rot(1, 1));
+  if (hy > 0 && hz > 0) {
+    ry = Angle(std::atan2(rot(0, 2), rot(2, 2)), rot(2, 2) / hy, rot(0, 2) / hy);
+    rz = Angle(std::atan2(rot(1, 0), rot(1, 1)), rot(1, 1) / hz, rot(1, 0) / hz);
+  } else {
+    // gimbal lock, the angles are not unique
+    ry = std::atan2(rot(0, 2), rot(2, 2));
+    rz = std::atan2(rot(1, 0), rot(1, 1));
+  }
+}
+
+
+
+/** \brief Rigid body pose (respectively transformation) represented by a rotation matrix and a translation.
+ *
+ * In contrast to Twist, poses can be composed and inverted directly in fixed size matrix form. Conversions from and
+ * to Twist are only required at the boundaries of a computation.
+ */
+class Pose {
+public:
+  Pose()
+      : rot(Eigen::Matrix3f::Identity()),
+        pos(Eigen::Vector3f::Zero()) {}
+
+  Pose(const Eigen::Matrix3f& rotation,
+       const Eigen::Vector3f& position)
+      : rot(rotation),
+        pos(position) {}
+
+  explicit Pose(const Twist& twist)
+      : rot(rotationFromEuler(twist.rot_x, twist.rot_y, twist.rot_z)),
+        pos(twist.pos.x(), twist.pos.y(), twist.pos.z()) {}
+
+  /** \brief Convert the pose to a twist. */
+  Twist toTwist() const
+  {
+    Twist twist;
+    eulerFromRotation(rot, twist.rot_x, twist.rot_y, twist.rot_z);
+    twist.pos = Vector3(pos.x(), pos.y(), pos.z());
+    return twist;
+  }
+
+  /** \brief Calculate the inverse pose. */
+  Pose inverse() const
+  {
+    Eigen::Matrix3f rotT = rot.transpose();
+    return Pose(rotT, -(rotT * pos));
+  }
+
+  /** \brief Compose this pose with the given pose (the given pose is applied first). */
+  Pose operator*(const Pose& other) const
+  {
+    return Pose(rot * other.rot, rot * other.pos + pos);
+  }
+
+  /** \brief Transform the given point. */
+  Eigen::Vector3f operator*(const Eigen::Vector3f& point) const
+  {
+    return rot * point + pos;
+  }
+
+  Eigen::Matrix3f rot;    ///< rotation matrix
+  Eigen::Vector3f pos;    ///< translation
+};
+
+} // end namespace loam
+
+#endif //LOAM_POSE_H
@@ -0,0 +1,128 @@
+// Copyright 2013, Ji Zhang, Carnegie Mellon University
+// Further contributions copyright (c) 2016, Southwest Research Institute
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from this
+//    software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// This is an implementation of the algorithm described in the following paper:
+//   J. Zhang and S. Singh. LOAM: Lidar Odometry and Mapping in Real-time.
+//     Robotics: Science and Systems Conference (RSS). Berkeley, CA, July 2014.
+
+#ifndef LOAM_POSEHISTORY_H
+#define LOAM_POSEHISTORY_H
+
+
+#include "Pose.h"
+
+#include <ros/time.h>
+#include <boost/atomic.hpp>
+#include <boost/noncopyable.hpp>
+
+#include <cstddef>
+#include <vector>
+
+
+namespace loam {
+
+/** \brief Bounded history of time stamped poses with interpolated lookup at arbitrary times.
+ *
+ * The history is written by a single thread (push(), clear(), setCapacity()) and can be read concurrently by any
+ * number of threads without locking. Writers never wait for readers: each write is wrapped in a sequence lock, and a
+ * reader simply retries its lookup if a write happened meanwhile. Lookups are a binary search over the time
+ * ordered ring buffer, i.e. O(log n).
+ */
+class PoseHistory : private boost::noncopyable {
+public:
+  explicit PoseHistory(const size_t& capacity = 1000);
+
+  /** \brief Set the maximum number of stored poses (discards the history, must not be called concurrently with
+   * lookups).
+   *
+   * @param capacity the new capacity (at least 1)
+   */
+  void setCapacity(const size_t& capacity);
+
+  /** \brief Retrieve the maximum number of stored poses. */
+  size_t capacity() const { return _entries.size(); }
+
+  /** \brief Append a new pose, overwriting the oldest pose if the history is full.
+   *
+   * Stored poses which are not older than the new pose are discarded first, such that a jump back in time (e.g. a
+   * restarted bag file) does not corrupt the time order of the history.
+   *
+   * @param stamp the time of the pose
+   * @param pose the pose
+   */
+  void push(const ros::Time& stamp, const Pose& pose);
+
+  /** \brief Remove all poses. */
+  void clear();
+
+  /** \brief Look up the pose at the given time, interpolating between the two closest stored poses.
+   *
+   * @param stamp the time
+   * @param pose the (interpolated) pose at the given time
+   * @return true if the given time lies within the time range of the history, false otherwise
+   */
+  bool lookup(const ros::Time& stamp, Pose& pose) const;
+
+  /** \brief Retrieve the time range covered by the history.
+   *
+   * @param oldest the time of the oldest stored pose
+   * @param newest the time of the newest stored pose
+   * @return false if the history is empty, true otherwise
+   */
+  bool timeRange(ros::Time& oldest, ros::Time& newest) const;
+
+
+private:
+  /** \brief Plain old data representation of a time stamped pose. */
+  struct Entry {
+    double stamp;   ///< time of the pose in seconds
+    float rot[4];   ///< rotation quaternion (x, y, z, w)
+    float pos[3];   ///< translation
+  };
+
+  /** \brief Retrieve the i-th oldest entry (sequence lock must be held). */
+  const Entry& entry(const size_t& i, const size_t& start) const
+  {
+    return _entries[(start + i) % _entries.size()];
+  }
+
+  void beginWrite();
+  void endWrite();
+  uint32_t beginRead() const;
+  bool endRead(const uint32_t& sequence) const;
+
+
+  std::vector<Entry> _entries;        ///< ring buffer of stored poses
+  size_t _start;                      ///< ring buffer index of the oldest pose
+  size_t _size;                       ///< number of stored poses
+  boost::atomic<uint32_t> _sequence;  ///< write sequence counter (odd while a write is in progress)
+};
+
+} // end namespace loam
+
+#endif //LOAM_POSEHISTORY_H
@@ -38,6 +38,9 @@
 #include "Angle.h"
 #include "Vector3.h"
 #include "CircularBuffer.h"
+#include "VoxelGridFilter.h"
+#include "PointXYZIRT.h"
+#include "SweepFeatures.h"
 
 #include <stdint.h>
 #include <vector>
@@ -191,6 +194,9 @@ public:
    */
   virtual void handleIMUMessage(const sensor_msgs::Imu::ConstPtr& imuIn);
 
+  /** \brief Retrieve the latest feature frame (for in-process use). */
+  const loam_velodyne::FeatureFrame& featureFrame() const { return _featureFrameMsg; }
+
 
 protected:
   /** \brief Prepare for next scan / sweep.
@@ -214,7 +220,7 @@ protected:
    *
    * @param point the point to project
    */
-  void transformToStartIMU(pcl::PointXYZI& point);
+  void transformToStartIMU(PointXYZIRT& point);
 
   /** \brief Extract features from current laser cloud.
    *
@@ -230,6 +236,20 @@ protected:
   void setRegionBuffersFor(const size_t& startIdx,
                            const size_t& endIdx);
 
+  /** \brief Calculate the point curvatures of the specified point range and reset the region labels.
+   *
+   * @param startIdx the region start index
+   * @param endIdx the region end index
+   */
+  void calculateRegionCurvature(const size_t& startIdx,
+                                const size_t& endIdx);
+
+  /** \brief Sort the region indices by ascending point curvature.
+   *
+   * @param startIdx the region start index
+   */
+  void sortRegionIndices(const size_t& startIdx);
+
   /** \brief Set up scan buffers for the specified point range.
    *
    * @param startIdx the scan start index
@@ -274,28 +294,25 @@ protected:
   size_t _imuIdx;                         ///< the current index in the IMU history
   CircularBuffer<IMUState> _imuHistory;   ///< history of IMU states for cloud registration
 
-  pcl::PointCloud<pcl::PointXYZI> _laserCloud;   ///< full resolution input cloud
   std::vector<IndexRange> _scanIndices;          ///< start and end indices of the individual scans withing the full resolution cloud
 
-  pcl::PointCloud<pcl::PointXYZI> _cornerPointsSharp;      ///< sharp corner points cloud
-  pcl::PointCloud<pcl::PointXYZI> _cornerPointsLessSharp;  ///< less sharp corner points cloud
-  pcl::PointCloud<pcl::PointXYZI> _surfacePointsFlat;      ///< flat surface points cloud
-  pcl::PointCloud<pcl::PointXYZI> _surfacePointsLessFlat;  ///< less flat surface points cloud
-  pcl::PointCloud<pcl::PointXYZ> _imuTrans;                ///< IMU transformation information
+  SweepFeatures _features;                  ///< full resolution cloud and extracted features of the current sweep
+  loam_velodyne::FeatureFrame _featureFrameMsg;   ///< feature frame message buffer
+  bool _featureOnly;                        ///< flag if the full resolution cloud is left out of the feature frames
 
   std::vector<float> _regionCurvature;      ///< point curvature buffer
   std::vector<PointLabel> _regionLabel;     ///< point label buffer
   std::vector<size_t> _regionSortIndices;   ///< sorted region indices based on point curvature
   std::vector<int> _scanNeighborPicked;     ///< flag if neighboring point was already picked
 
+  pcl::PointCloud<PointXYZIRT> _surfPointsLessFlatScan;     ///< less flat surface points buffer of a single scan
+  pcl::PointCloud<PointXYZIRT> _surfPointsLessFlatScanDS;   ///< down sized less flat surface points buffer of a single scan
+
+  VoxelGridFilter<PointXYZIRT> _lessFlatFilter;   ///< voxel filter for down sizing less flat surface points
+
   ros::Subscriber _subImu;    ///< IMU message subscriber
 
-  ros::Publisher _pubLaserCloud;              ///< full resolution cloud message publisher
-  ros::Publisher _pubCornerPointsSharp;       ///< sharp corner cloud message publisher
-  ros::Publisher _pubCornerPointsLessSharp;   ///< less sharp corner cloud message publisher
-  ros::Publisher _pubSurfPointsFlat;          ///< flat surface cloud message publisher
-  ros::Publisher _pubSurfPointsLessFlat;      ///< less flat surface cloud message publisher
-  ros::Publisher _pubImuTrans;                ///< IMU transformation message publisher
+  ros::Publisher _pubFeatureFrame;    ///< feature frame message publisher
 };
 
 } // end namespace loam
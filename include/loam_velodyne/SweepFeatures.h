@@ -0,0 +1,97 @@
+// Copyright 2013, Ji Zhang, Carnegie Mellon University
+// Further contributions copyright (c) 2016, Southwest Research Institute
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from this
+//    software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// This is an implementation of the algorithm described in the following paper:
+//   J. Zhang and S. Singh. LOAM: Lidar Odometry and Mapping in Real-time.
+//     Robotics: Science and Systems Conference (RSS). Berkeley, CA, July 2014.
+
+#ifndef LOAM_SWEEPFEATURES_H
+#define LOAM_SWEEPFEATURES_H
+
+
+#include "Angle.h"
+#include "PointXYZIRT.h"
+#include "Vector3.h"
+#include "loam_velodyne/FeatureFrame.h"
+
+#include <ros/time.h>
+#include <pcl/point_cloud.h>
+
+
+namespace loam {
+
+/** \brief Features of a single sweep, handed from the scan registration to the laser odometry.
+ *
+ * The features travel as a single FeatureFrame message, i.e. each sweep is serialized and deserialized exactly once
+ * and all parts of the sweep arrive together.
+ */
+class SweepFeatures {
+public:
+  SweepFeatures();
+
+  /** \brief Clear all clouds and reset the IMU information. */
+  void clear();
+
+  /** \brief Pack the sweep features into the given message.
+   *
+   * @param msg the message instance to fill
+   * @param includeFullRes flag if the full resolution cloud should be included
+   */
+  void toMsg(loam_velodyne::FeatureFrame& msg,
+             const bool& includeFullRes = true);
+
+  /** \brief Unpack the sweep features from the given message.
+   *
+   * @param msg the message
+   * @return false if the point counts of the message do not match its packed cloud, true otherwise
+   */
+  bool fromMsg(const loam_velodyne::FeatureFrame& msg);
+
+
+  ros::Time sweepStart;   ///< time of the sweep start
+  float scanPeriod;       ///< time per sweep
+
+  pcl::PointCloud<PointXYZIRT> cornerPointsSharp;      ///< sharp corner points cloud
+  pcl::PointCloud<PointXYZIRT> cornerPointsLessSharp;  ///< less sharp corner points cloud
+  pcl::PointCloud<PointXYZIRT> surfacePointsFlat;      ///< flat surface points cloud
+  pcl::PointCloud<PointXYZIRT> surfacePointsLessFlat;  ///< less flat surface points cloud
+  pcl::PointCloud<PointXYZIRT> laserCloud;             ///< full resolution cloud
+
+  Angle imuRollStart, imuPitchStart, imuYawStart;   ///< IMU orientation at the sweep start
+  Angle imuRollEnd, imuPitchEnd, imuYawEnd;         ///< IMU orientation at the sweep end
+  Vector3 imuShiftFromStart;                        ///< IMU position shift during the sweep (sweep start frame)
+  Vector3 imuVeloFromStart;                         ///< IMU velocity change during the sweep (sweep start frame)
+
+
+private:
+  pcl::PointCloud<PointXYZIRT> _packed;   ///< buffer for the packed cloud
+};
+
+} // end namespace loam
+
+#endif //LOAM_SWEEPFEATURES_H
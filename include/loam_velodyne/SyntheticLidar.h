@@ -0,0 +1,192 @@
+// Copyright 2013, Ji Zhang, Carnegie Mellon University
+// Further contributions copyright (c) 2016, Southwest Research Institute
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from this
+//    software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// This is an implementation of the algorithm described in the following paper:
+//   J. Zhang and S. Singh. LOAM: Lidar Odometry and Mapping in Real-time.
+//     Robotics: Science and Systems Conference (RSS). Berkeley, CA, July 2014.
+
+#ifndef LOAM_SYNTHETICLIDAR_H
+#define LOAM_SYNTHETICLIDAR_H
+
+
+#include "MultiScanRegistration.h"
+
+#include <ros/time.h>
+#include <sensor_msgs/Imu.h>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <boost/random/mersenne_twister.hpp>
+#include <Eigen/Core>
+
+#include <vector>
+
+
+namespace loam {
+
+/** \brief Synthetic scene made of simple geometric primitives (world frame: x forward, y left, z up). */
+class SyntheticScene {
+public:
+  /** \brief Infinite plane n * p = offset. */
+  struct Plane {
+    Eigen::Vector3f normal;
+    float offset;
+    float intensity;
+  };
+
+  /** \brief Vertical cylinder (e.g. a pole or a tree trunk). */
+  struct Pole {
+    Eigen::Vector2f center;
+    float radius;
+    float bottom, top;
+    float intensity;
+  };
+
+  /** \brief Axis aligned box (e.g. a building or a parked car). */
+  struct Box {
+    Eigen::Vector3f min, max;
+    float intensity;
+  };
+
+  /** \brief Create a city like scene: a ground plane and a grid of streets lined with box buildings, parked cars and
+   * poles. The streets run along the x- and y-axis through multiples of the block size, i.e. also along y = 0.
+   *
+   * @param extent the half size of the (square) scene in meters
+   * @param seed the random seed for placing the buildings
+   */
+  static SyntheticScene city(const float& extent = 300,
+                             const unsigned int& seed = 1);
+
+  /** \brief Cast a ray against the planes and the poles and boxes selected by the last call to cull().
+   *
+   * @param origin the ray origin
+   * @param direction the (unit) ray direction
+   * @param maxRange the maximum range
+   * @param range the distance to the closest hit
+   * @param intensity the intensity of the closest hit
+   * @return true if the ray hit a primitive within the maximum range, false otherwise
+   */
+  bool castRay(const Eigen::Vector3f& origin,
+               const Eigen::Vector3f& direction,
+               const float& maxRange,
+               float& range,
+               float& intensity) const;
+
+  /** \brief Select the poles and boxes within the given radius of the given position for ray casting. */
+  void cull(const Eigen::Vector3f& position,
+            const float& radius);
+
+  std::vector<Plane> planes;
+  std::vector<Pole> poles;
+  std::vector<Box> boxes;
+
+
+private:
+  std::vector<size_t> _activePoles;   ///< indices of the poles considered by castRay()
+  std::vector<size_t> _activeBoxes;   ///< indices of the boxes considered by castRay()
+};
+
+
+
+/** \brief Scripted sensor trajectory: driving with constant speed and yaw rate, swaying in roll and pitch. */
+struct SyntheticTrajectory {
+  SyntheticTrajectory()
+      : speed(8),
+        yawRate(0),
+        height(1.8f),
+        swayAmplitude(0.02f),
+        swayFrequency(0.5f) {}
+
+  /** \brief Calculate the sensor pose at the given time (relative to the trajectory start).
+   *
+   * @param time the time in seconds
+   * @param rot the sensor orientation (R = Rz(yaw) * Ry(pitch) * Rx(roll))
+   * @param pos the sensor position
+   */
+  void poseAt(const double& time,
+              Eigen::Matrix3f& rot,
+              Eigen::Vector3f& pos) const;
+
+  float speed;          ///< forward speed in m/s
+  float yawRate;        ///< yaw rate in rad/s
+  float height;         ///< sensor height above the ground
+  float swayAmplitude;  ///< roll and pitch sway amplitude in rad
+  float swayFrequency;  ///< roll and pitch sway frequency in Hz
+};
+
+
+
+/** \brief Ray casting simulation of a multi-laser lidar (and optionally an IMU) moving through a synthetic scene.
+ *
+ * The simulated sweeps match the given MultiScanMapper, i.e. the scan rings are distributed linearly over its vertical
+ * range, and are ordered by firing time like the clouds of the Velodyne driver. As every laser firing happens at its own
+ * sensor pose, the sweeps contain the motion distortion LOAM compensates for.
+ */
+class SyntheticLidar {
+public:
+  /** \brief Construct a new synthetic lidar.
+   *
+   * @param scanMapper the scan ring layout (e.g. MultiScanMapper::Velodyne_VLP_16())
+   * @param nColumns the number of laser firings per ring and sweep (horizontal resolution)
+   * @param scanPeriod the time per sweep
+   */
+  SyntheticLidar(const MultiScanMapper& scanMapper = MultiScanMapper::Velodyne_VLP_16(),
+                 const size_t& nColumns = 1800,
+                 const float& scanPeriod = 0.1);
+
+  /** \brief Simulate the sweep starting at the given time (relative to the trajectory start).
+   *
+   * @param sweepStart the sweep start time
+   * @param cloud the cloud instance for storing the simulated points (sensor frame)
+   */
+  void generateSweep(const double& sweepStart,
+                     pcl::PointCloud<pcl::PointXYZI>& cloud);
+
+  /** \brief Simulate an IMU measurement (orientation, angular velocity and specific force) at the given time.
+   *
+   * @param time the time relative to the trajectory start
+   * @param imu the message instance for storing the measurement (the stamp is left untouched)
+   */
+  void generateImu(const double& time,
+                   sensor_msgs::Imu& imu) const;
+
+  SyntheticScene scene;             ///< the simulated scene
+  SyntheticTrajectory trajectory;   ///< the sensor trajectory
+  float maxRange;                   ///< maximum measurement range
+  float rangeNoise;                 ///< standard deviation of the range noise
+
+
+private:
+  MultiScanMapper _scanMapper;    ///< scan ring layout
+  size_t _nColumns;               ///< laser firings per ring and sweep
+  float _scanPeriod;              ///< time per sweep
+  boost::mt19937 _rng;            ///< random generator for the range noise
+};
+
+} // end namespace loam
+
+#endif //LOAM_SYNTHETICLIDAR_H
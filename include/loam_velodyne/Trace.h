@@ -0,0 +1,154 @@
+// Copyright 2013, Ji Zhang, Carnegie Mellon University
+// Further contributions copyright (c) 2016, Southwest Research Institute
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from this
+//    software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// This is an implementation of the algorithm described in the following paper:
+//   J. Zhang and S. Singh. LOAM: Lidar Odometry and Mapping in Real-time.
+//     Robotics: Science and Systems Conference (RSS). Berkeley, CA, July 2014.
+
+#ifndef LOAM_TRACE_H
+#define LOAM_TRACE_H
+
+
+#include <ros/node_handle.h>
+#include <ros/time.h>
+#include <boost/atomic.hpp>
+
+#include <string>
+
+
+namespace loam {
+
+/** \brief Optional span tracing of the processing stages, exported as Chrome trace JSON (chrome://tracing, Perfetto).
+ *
+ * Spans are recorded into a fixed size ring buffer per thread, i.e. the oldest spans of a thread are overwritten once
+ * its buffer is full. Each span carries the time stamp of the sweep it belongs to as frame ID, such that a single
+ * sweep can be followed through all stages and nodes. Span times are wall clock times, so the traces of different
+ * nodes line up when loaded together.
+ *
+ * Tracing is disabled unless the private "traceFile" parameter is set. The buffers are written to that file on
+ * shutdown and whenever the process receives SIGUSR1. While disabled, a span costs a single atomic load.
+ */
+class Trace {
+public:
+  /** \brief Enable tracing if the "traceFile" (and optionally "traceBufferSize") parameter of the given node is set.
+   *
+   * @param privateNode the private ROS node handle
+   * @return false if a specified parameter is invalid, true otherwise
+   */
+  static bool setup(ros::NodeHandle& privateNode);
+
+  /** \brief Enable tracing.
+   *
+   * @param path the trace file to write on shutdown and on SIGUSR1
+   * @param bufferSize the number of spans kept per thread
+   */
+  static void enable(const std::string& path,
+                     const size_t& bufferSize = 65536);
+
+  /** \brief Check if tracing is enabled. */
+  static bool enabled() { return _enabled.load(boost::memory_order_relaxed); }
+
+  /** \brief Name the calling thread in the trace. */
+  static void setThreadName(const char* name);
+
+  /** \brief Record a finished span of the calling thread.
+   *
+   * @param category the span category (a string literal, typically the component name)
+   * @param name the span name (a string literal)
+   * @param frame the time stamp of the processed sweep (zero if unknown)
+   * @param start the wall clock start time of the span
+   * @param end the wall clock end time of the span
+   */
+  static void record(const char* category,
+                     const char* name,
+                     const ros::Time& frame,
+                     const ros::WallTime& start,
+                     const ros::WallTime& end);
+
+  /** \brief Write the recorded spans of all threads to the trace file and stop tracing (called on shutdown).
+   *
+   * @return false if the trace file could not be written, true otherwise (also if tracing is disabled)
+   */
+  static bool shutdown();
+
+  /** \brief Write the recorded spans of all threads as Chrome trace JSON.
+   *
+   * @param path the output file
+   * @return true if the file was written successfully, false otherwise
+   */
+  static bool write(const std::string& path);
+
+
+private:
+  static boost::atomic<bool> _enabled;   ///< flag if spans are recorded
+};
+
+
+
+/** \brief Scoped span, recorded from its construction to its destruction if tracing is enabled. */
+class TraceSpan {
+public:
+  /** \brief Start a new span.
+   *
+   * @param category the span category (a string literal, typically the component name)
+   * @param name the span name (a string literal)
+   * @param frame the time stamp of the processed sweep (zero if unknown yet, see setFrame())
+   */
+  TraceSpan(const char* category,
+            const char* name,
+            const ros::Time& frame = ros::Time())
+      : _category(category),
+        _name(name),
+        _frame(frame)
+  {
+    if (Trace::enabled()) {
+      _start = ros::WallTime::now();
+    }
+  }
+
+  ~TraceSpan()
+  {
+    if (!_start.isZero() && Trace::enabled()) {
+      Trace::record(_category, _name, _frame, _start, ros::WallTime::now());
+    }
+  }
+
+  /** \brief Set the time stamp of the processed sweep, if it is not known at the start of the span. */
+  void setFrame(const ros::Time& frame) { _frame = frame; }
+
+
+private:
+  const char* _category;   ///< span category
+  const char* _name;       ///< span name
+  ros::Time _frame;        ///< time stamp of the processed sweep
+  ros::WallTime _start;    ///< wall clock start time (zero if tracing was disabled at construction)
+};
+
+} // end namespace loam
+
+#endif //LOAM_TRACE_H
@@ -34,12 +34,48 @@
 #define LOAM_TRANSFORMMAINTENANCE_H
 
 
+#include "CircularBuffer.h"
+#include "PoseHistory.h"
+#include "Twist.h"
+#include "loam_velodyne/GetPoseAt.h"
+
 #include <ros/node_handle.h>
 #include <nav_msgs/Odometry.h>
+#include <sensor_msgs/Imu.h>
 #include <tf/transform_broadcaster.h>
+#include <Eigen/Core>
+#include <Eigen/Geometry>
 
 namespace loam {
 
+/** IMU orientation data. */
+typedef struct IMUOrientation {
+  /** The time of the measurement. */
+  ros::Time stamp;
+
+  /** The IMU orientation, expressed in the camera frame. */
+  Eigen::Matrix3f rot;
+
+  /** \brief Interpolate between two IMU orientations.
+   *
+   * @param start the first IMU orientation
+   * @param end the second IMU orientation
+   * @param ratio the interpolation ratio
+   * @param result the target IMU orientation for storing the interpolation result
+   */
+  static void interpolate(const IMUOrientation& start,
+                          const IMUOrientation& end,
+                          const float& ratio,
+                          IMUOrientation& result)
+  {
+    Eigen::Quaternionf qStart(start.rot);
+    Eigen::Quaternionf qEnd(end.rot);
+    result.stamp = start.stamp + ros::Duration((end.stamp - start.stamp).toSec() * ratio);
+    result.rot = qStart.slerp(ratio, qEnd).toRotationMatrix();
+  }
+} IMUOrientation;
+
+
 /** \brief Implementation of the LOAM transformation maintenance component.
  *
  */
@@ -67,26 +103,80 @@ public:
    */
   void odomAftMappedHandler(const nav_msgs::Odometry::ConstPtr& odomAftMapped);
 
+  /** \brief Handler method for IMU messages.
+   *
+   * The integrated laser odometry is propagated with the IMU orientation change (and the velocity of the laser
+   * odometry) to the time of each IMU message and published on the high rate topic.
+   *
+   * @param imuIn the new IMU message
+   */
+  void imuHandler(const sensor_msgs::Imu::ConstPtr& imuIn);
+
+  /** \brief Service handler for querying the integrated laser odometry at a past time.
+   *
+   * @param req the service request
+   * @param res the service response
+   */
+  bool getPoseAtHandler(loam_velodyne::GetPoseAt::Request& req,
+                        loam_velodyne::GetPoseAt::Response& res);
+
+  /** \brief Retrieve the history of the integrated laser odometry.
+   *
+   * The history can be queried from any thread while the component keeps updating it.
+   */
+  const PoseHistory& poseHistory() const { return _poseHistory; }
+
 
 protected:
   void transformAssociateToMap();
 
+  /** \brief Look up the (interpolated) IMU orientation at the given time.
+   *
+   * @param stamp the time
+   * @param rot the IMU orientation at the given time
+   * @return true if the IMU history covers the given time, false otherwise
+   */
+  bool imuOrientationAt(const ros::Time& stamp, Eigen::Matrix3f& rot);
+
+  /** \brief Publish the given transform as odometry message.
+   *
+   * @param transform the transform to publish
+   * @param stamp the time stamp of the message
+   * @param msg the message instance to fill
+   * @param publisher the publisher
+   */
+  void publishOdometry(const Twist& transform,
+                       const ros::Time& stamp,
+                       nav_msgs::Odometry& msg,
+                       ros::Publisher& publisher);
+
 
 private:
-  float _transformSum[6];
-  float _transformIncre[6];
-  float _transformMapped[6];
-  float _transformBefMapped[6];
-  float _transformAftMapped[6];
+  Twist _transformSum;         ///< latest laser odometry transform
+  Twist _transformMapped;      ///< latest laser odometry transform, corrected by the latest mapping result
+  Twist _transformBefMapped;   ///< laser odometry transform of the latest mapping result
+  Twist _transformAftMapped;   ///< mapping transform of the latest mapping result
+
+  ros::Time _timeSum;              ///< time of the latest laser odometry transform
+  Eigen::Vector3f _velocity;       ///< velocity of the integrated laser odometry (in the map frame)
+  CircularBuffer<IMUOrientation> _imuHistory;   ///< history of IMU orientations
+  Eigen::Matrix3f _imuRotSum;      ///< IMU orientation at the time of the latest laser odometry transform
+  bool _imuRotSumValid;            ///< flag if the IMU orientation at the latest laser odometry time is known
+  float _maxImuPropagation;        ///< maximum time span the integrated laser odometry is propagated with the IMU
+  nav_msgs::Odometry _imuOdometry; ///< latest high rate integrated odometry message
+  PoseHistory _poseHistory;        ///< history of the integrated laser odometry
 
   nav_msgs::Odometry _laserOdometry2;         ///< latest integrated laser odometry message
   tf::StampedTransform _laserOdometryTrans2;  ///< latest integrated laser odometry transformation
 
   ros::Publisher _pubLaserOdometry2;          ///< integrated laser odometry publisher
+  ros::Publisher _pubImuOdometry;             ///< high rate (IMU propagated) integrated odometry publisher
   tf::TransformBroadcaster _tfBroadcaster2;   ///< integrated laser odometry transformation broadcaster
 
   ros::Subscriber _subLaserOdometry;    ///< (high frequency) laser odometry subscriber
   ros::Subscriber _subOdomAftMapped;    ///< (low frequency) mapping odometry subscriber
+  ros::Subscriber _subImu;              ///< IMU message subscriber
+  ros::ServiceServer _srvGetPoseAt;     ///< pose history query service
 };
 
 } // end namespace loam
@@ -2,6 +2,8 @@
 #define LOAM_VECTOR3_H
 
 
+#include "PointXYZIRT.h"
+
 #include <pcl/point_types.h>
 
 
@@ -22,7 +24,7 @@ public:
   Vector3(const Eigen::MatrixBase <OtherDerived> &other)
       : Eigen::Vector4f(other) {}
 
-  Vector3(const pcl::PointXYZI &p)
+  Vector3(const PointXYZIRT &p)
       : Eigen::Vector4f(p.x, p.y, p.z, 0) {}
 
   template<typename OtherDerived>
@@ -38,7 +40,7 @@ public:
     return *this;
   }
 
-  Vector3 &operator=(const pcl::PointXYZI &rhs) {
+  Vector3 &operator=(const PointXYZIRT &rhs) {
     x() = rhs.x;
     y() = rhs.y;
     z() = rhs.z;
@@ -58,12 +60,14 @@ public:
   float &z() { return (*this)(2); }
 
   // easy conversion
-  operator pcl::PointXYZI() {
-    pcl::PointXYZI dst;
+  operator PointXYZIRT() {
+    PointXYZIRT dst;
     dst.x = x();
     dst.y = y();
     dst.z = z();
     dst.intensity = 0;
+    dst.time = 0;
+    dst.ring = 0;
     return dst;
   }
 };
@@ -0,0 +1,360 @@
+#ifndef LOAM_VOXELGRIDFILTER_H
+#define LOAM_VOXELGRIDFILTER_H
+
+
+#include "MortonCode.h"
+#include "PointXYZIRT.h"
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#include <stdint.h>
+#include <cmath>
+#include <vector>
+
+
+namespace loam {
+
+/** \brief Per voxel accumulator for the point fields that are averaged by the voxel grid filter. */
+struct VoxelSum {
+  VoxelSum() : x(0), y(0), z(0), intensity(0), time(0), ring(0) {}
+
+  float x;
+  float y;
+  float z;
+  float intensity;
+  float time;
+  float ring;
+};
+
+/** \brief Add the coordinates of the given point to the voxel sum. */
+template <typename PointT>
+inline void addToVoxelSum(VoxelSum& sum, const PointT& p)
+{
+  sum.x += p.x;
+  sum.y += p.y;
+  sum.z += p.z;
+}
+
+/** \brief Add the coordinates and intensity of the given point to the voxel sum. */
+inline void addToVoxelSum(VoxelSum& sum, const pcl::PointXYZI& p)
+{
+  sum.x += p.x;
+  sum.y += p.y;
+  sum.z += p.z;
+  sum.intensity += p.intensity;
+}
+
+/** \brief Set the coordinates of the given point to the voxel centroid. */
+template <typename PointT>
+inline void setFromVoxelSum(PointT& p, const VoxelSum& sum, const float& n)
+{
+  p.x = sum.x / n;
+  p.y = sum.y / n;
+  p.z = sum.z / n;
+}
+
+/** \brief Set the coordinates and intensity of the given point to the voxel centroid. */
+inline void setFromVoxelSum(pcl::PointXYZI& p, const VoxelSum& sum, const float& n)
+{
+  p.x = sum.x / n;
+  p.y = sum.y / n;
+  p.z = sum.z / n;
+  p.intensity = sum.intensity / n;
+}
+
+/** \brief Add the coordinates, intensity, time and ring of the given point to the voxel sum. */
+inline void addToVoxelSum(VoxelSum& sum, const PointXYZIRT& p)
+{
+  sum.x += p.x;
+  sum.y += p.y;
+  sum.z += p.z;
+  sum.intensity += p.intensity;
+  sum.time += p.time;
+  sum.ring += p.ring;
+}
+
+/** \brief Set the coordinates, intensity and time of the given point to the voxel centroid and its ring to the
+ * (truncated) mean ring.
+ */
+inline void setFromVoxelSum(PointXYZIRT& p, const VoxelSum& sum, const float& n)
+{
+  p.x = sum.x / n;
+  p.y = sum.y / n;
+  p.z = sum.z / n;
+  p.intensity = sum.intensity / n;
+  p.time = sum.time / n;
+  p.ring = uint16_t(sum.ring / n);
+}
+
+
+
+/** \brief Key of a voxel of the (origin aligned) voxel grid used by the voxel grid filter. */
+struct VoxelKey {
+  VoxelKey(const int64_t& x_ = 0, const int64_t& y_ = 0, const int64_t& z_ = 0)
+      : x(x_), y(y_), z(z_) {}
+
+  bool operator==(const VoxelKey& other) const
+  {
+    return x == other.x && y == other.y && z == other.z;
+  }
+
+  bool operator!=(const VoxelKey& other) const
+  {
+    return !(*this == other);
+  }
+
+  bool operator<(const VoxelKey& other) const
+  {
+    if (x != other.x) return x < other.x;
+    if (y != other.y) return y < other.y;
+    return z < other.z;
+  }
+
+  int64_t x;
+  int64_t y;
+  int64_t z;
+};
+
+/** \brief Determine the key of the voxel containing the given point (same discretization as the voxel grid filter).
+ *
+ * @param p the point
+ * @param invLeafSize the inverse voxel edge length
+ */
+template <typename PointT>
+inline VoxelKey toVoxelKey(const PointT& p, const float& invLeafSize)
+{
+  return VoxelKey(int64_t(std::floor(p.x * invLeafSize)),
+                  int64_t(std::floor(p.y * invLeafSize)),
+                  int64_t(std::floor(p.z * invLeafSize)));
+}
+
+
+
+/** \brief Voxel grid filter for down sizing point clouds.
+ *
+ * The filter produces the same result as pcl::VoxelGrid (one centroid per occupied voxel, ordered by voxel index),
+ * but sorts the voxel indices with a radix sort and keeps all intermediate buffers between calls.
+ * Repeated filtering of similarly sized clouds therefore does not allocate any memory.
+ *
+ * Optionally, the centroids are ordered by the Morton code of their voxel instead, which keeps spatially close
+ * centroids close in memory for subsequent KD-tree builds and queries.
+ *
+ * @tparam PointT the point type
+ */
+template <typename PointT>
+class VoxelGridFilter {
+public:
+  explicit VoxelGridFilter(const float& leafSize = 0.2)
+      : _leafSize(leafSize),
+        _invLeafSize(1 / leafSize),
+        _mortonOrder(false) {}
+
+  /** \brief Set the (cubic) voxel size.
+   *
+   * @param leafSize the voxel edge length
+   */
+  void setLeafSize(const float& leafSize)
+  {
+    _leafSize = leafSize;
+    _invLeafSize = 1 / leafSize;
+  }
+
+  /** \brief Retrieve the voxel edge length. */
+  const float& getLeafSize() const { return _leafSize; }
+
+  /** \brief Set if the output centroids are ordered by the Morton code of their voxel instead of the voxel index.
+   *
+   * Grids with more than 2^21 voxels along an axis are always ordered by voxel index.
+   *
+   * @param mortonOrder true for Morton order, false for voxel index order
+   */
+  void setMortonOrder(const bool& mortonOrder) { _mortonOrder = mortonOrder; }
+
+  /** \brief Check if the output centroids are ordered by the Morton code of their voxel. */
+  const bool& getMortonOrder() const { return _mortonOrder; }
+
+  /** \brief Down size the input cloud.
+   *
+   * Non-finite points are ignored. The input and output clouds have to be different instances.
+   *
+   * @param input the cloud to filter
+   * @param output the cloud for storing the voxel centroids
+   */
+  void filter(const pcl::PointCloud<PointT>& input,
+              pcl::PointCloud<PointT>& output);
+
+
+private:
+  /** \brief A voxel index / point index pair. */
+  struct VoxelEntry {
+    uint64_t voxelIdx;   ///< linear index or Morton code of the voxel containing the point
+    uint32_t pointIdx;   ///< index of the point in the input cloud
+  };
+
+  /** \brief Stable sort of the voxel entries by voxel index, considering the lowest bytes only.
+   *
+   * @param nBytes the number of (lowest) voxel index bytes to sort by
+   */
+  void radixSort(const size_t& nBytes);
+
+  float _leafSize;                          ///< voxel edge length
+  float _invLeafSize;                       ///< inverse voxel edge length
+  bool _mortonOrder;                        ///< flag if the centroids are ordered by the Morton code of their voxel
+  std::vector<VoxelEntry> _entries;         ///< voxel entries of the current input cloud
+  std::vector<VoxelEntry> _sortBuffer;      ///< radix sort scratch buffer
+};
+
+
+
+template <typename PointT>
+void VoxelGridFilter<PointT>::filter(const pcl::PointCloud<PointT>& input,
+                                     pcl::PointCloud<PointT>& output)
+{
+  output.points.clear();
+  output.header = input.header;
+  output.height = 1;
+  output.is_dense = true;
+
+  // determine bounding box of all finite points
+  size_t cloudSize = input.points.size();
+  float minX = 0, minY = 0, minZ = 0;
+  float maxX = 0, maxY = 0, maxZ = 0;
+  bool empty = true;
+
+  for (size_t i = 0; i < cloudSize; i++) {
+    const PointT& p = input.points[i];
+    if (!pcl_isfinite(p.x) || !pcl_isfinite(p.y) || !pcl_isfinite(p.z)) {
+      continue;
+    }
+
+    if (empty) {
+      minX = maxX = p.x;
+      minY = maxY = p.y;
+      minZ = maxZ = p.z;
+      empty = false;
+    } else {
+      if (p.x < minX) minX = p.x; else if (p.x > maxX) maxX = p.x;
+      if (p.y < minY) minY = p.y; else if (p.y > maxY) maxY = p.y;
+      if (p.z < minZ) minZ = p.z; else if (p.z > maxZ) maxZ = p.z;
+    }
+  }
+
+  if (empty) {
+    output.width = 0;
+    return;
+  }
+
+  // determine voxel grid dimensions (same discretization as pcl::VoxelGrid)
+  int64_t minBX = int64_t(std::floor(minX * _invLeafSize));
+  int64_t minBY = int64_t(std::floor(minY * _invLeafSize));
+  int64_t minBZ = int64_t(std::floor(minZ * _invLeafSize));
+  uint64_t divX = uint64_t(int64_t(std::floor(maxX * _invLeafSize)) - minBX + 1);
+  uint64_t divY = uint64_t(int64_t(std::floor(maxY * _invLeafSize)) - minBY + 1);
+  uint64_t divZ = uint64_t(int64_t(std::floor(maxZ * _invLeafSize)) - minBZ + 1);
+
+  if (double(divX) * double(divY) * double(divZ) > double(uint64_t(1) << 62)) {
+    // leaf size too small for the extent of the cloud, return input cloud unfiltered
+    output.points = input.points;
+    output.width = output.points.size();
+    output.is_dense = input.is_dense;
+    return;
+  }
+
+  uint64_t divXY = divX * divY;
+  const uint64_t maxMortonDiv = uint64_t(1) << MORTON_AXIS_BITS;
+  bool morton = _mortonOrder && divX <= maxMortonDiv && divY <= maxMortonDiv && divZ <= maxMortonDiv;
+
+  // the Morton code is monotonic in each coordinate, so the last voxel has the largest code
+  uint64_t maxIdx = morton ? mortonCode(divX - 1, divY - 1, divZ - 1) : divXY * divZ - 1;
+
+  // compute voxel entries
+  _entries.clear();
+  for (size_t i = 0; i < cloudSize; i++) {
+    const PointT& p = input.points[i];
+    if (!pcl_isfinite(p.x) || !pcl_isfinite(p.y) || !pcl_isfinite(p.z)) {
+      continue;
+    }
+
+    uint64_t bx = uint64_t(int64_t(std::floor(p.x * _invLeafSize)) - minBX);
+    uint64_t by = uint64_t(int64_t(std::floor(p.y * _invLeafSize)) - minBY);
+    uint64_t bz = uint64_t(int64_t(std::floor(p.z * _invLeafSize)) - minBZ);
+
+    VoxelEntry entry;
+    entry.voxelIdx = morton ? mortonCode(bx, by, bz) : bx + by * divX + bz * divXY;
+    entry.pointIdx = uint32_t(i);
+    _entries.push_back(entry);
+  }
+
+  // sort entries by voxel index, considering only the bytes actually used
+  size_t nBytes = 0;
+  while (nBytes < sizeof(uint64_t) && (maxIdx >> (8 * nBytes)) > 0) {
+    nBytes++;
+  }
+  radixSort(nBytes);
+
+  // compute voxel centroids
+  size_t nEntries = _entries.size();
+  size_t voxelStart = 0;
+  while (voxelStart < nEntries) {
+    const uint64_t voxelIdx = _entries[voxelStart].voxelIdx;
+    VoxelSum sum;
+    size_t voxelEnd = voxelStart;
+
+    while (voxelEnd < nEntries && _entries[voxelEnd].voxelIdx == voxelIdx) {
+      addToVoxelSum(sum, input.points[_entries[voxelEnd].pointIdx]);
+      voxelEnd++;
+    }
+
+    PointT centroid = input.points[_entries[voxelStart].pointIdx];
+    setFromVoxelSum(centroid, sum, float(voxelEnd - voxelStart));
+    output.points.push_back(centroid);
+
+    voxelStart = voxelEnd;
+  }
+
+  output.width = output.points.size();
+}
+
+
+
+template <typename PointT>
+void VoxelGridFilter<PointT>::radixSort(const size_t& nBytes)
+{
+  size_t nEntries = _entries.size();
+  if (nEntries == 0) {
+    return;
+  }
+  _sortBuffer.resize(nEntries);
+
+  for (size_t byte = 0; byte < nBytes; byte++) {
+    const size_t shift = 8 * byte;
+    size_t offsets[256] = {0};
+
+    for (size_t i = 0; i < nEntries; i++) {
+      offsets[(_entries[i].voxelIdx >> shift) & 0xFF]++;
+    }
+
+    // skip passes in which all entries share the same digit
+    if (offsets[(_entries[0].voxelIdx >> shift) & 0xFF] == nEntries) {
+      continue;
+    }
+
+    size_t sum = 0;
+    for (size_t d = 0; d < 256; d++) {
+      size_t count = offsets[d];
+      offsets[d] = sum;
+      sum += count;
+    }
+
+    for (size_t i = 0; i < nEntries; i++) {
+      _sortBuffer[offsets[(_entries[i].voxelIdx >> shift) & 0xFF]++] = _entries[i];
+    }
+
+    _entries.swap(_sortBuffer);
+  }
+}
+
+} // end namespace loam
+
+#endif //LOAM_VOXELGRIDFILTER_H
@@ -42,6 +42,7 @@
 namespace loam {
 
 /** \brief Construct a new point cloud message from the specified information and publish it via the given publisher.
+ * If the publisher has no subscribers, no message is constructed at all.
  *
  * @tparam PointT the point type
  * @param publisher the publisher instance
@@ -54,6 +55,10 @@ inline void publishCloudMsg(ros::Publisher& publisher,
                             const pcl::PointCloud<PointT>& cloud,
                             const ros::Time& stamp,
                             std::string frameID) {
+  if (publisher.getNumSubscribers() == 0) {
+    return;
+  }
+
   sensor_msgs::PointCloud2 msg;
   pcl::toROSMsg(cloud, msg);
   msg.header.stamp = stamp;
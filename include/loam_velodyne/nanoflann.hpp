@@ -55,6 +55,8 @@
 #include <cmath>   // for abs()
 #include <cstdlib> // for abs()
 #include <limits>
+#include <boost/ref.hpp>
+#include <boost/thread/thread.hpp>
 
 // Avoid conflicting declaration of min/max macros in windows headers
 #if !defined(NOMINMAX) && (defined(_WIN32) || defined(_WIN32_)  || defined(WIN32) || defined(_WIN64))
@@ -493,11 +495,15 @@ struct metric_SO3 : public Metric
 /**  Parameters (see README.md) */
 struct KDTreeSingleIndexAdaptorParams
 {
-    KDTreeSingleIndexAdaptorParams(size_t _leaf_max_size = 10) :
-        leaf_max_size(_leaf_max_size)
+    KDTreeSingleIndexAdaptorParams(size_t _leaf_max_size = 10, unsigned int _n_thread_build = 1,
+                                   size_t _parallel_build_min_size = 50000) :
+        leaf_max_size(_leaf_max_size), n_thread_build(_n_thread_build),
+        parallel_build_min_size(_parallel_build_min_size)
     {}
 
     size_t leaf_max_size;
+    unsigned int n_thread_build; //!< number of threads for building the index (0: one per hardware thread)
+    size_t parallel_build_min_size; //!< minimum number of points of a subtree for building its children in parallel
 };
 
 /** Search options for KDTreeSingleIndexAdaptor::findNeighbors() */
@@ -662,6 +668,27 @@ public:
         return mem;
     }
 
+    /**
+         * Takes over all memory blocks of another pool, which is left empty.
+         * Allocations continue in the current block of this pool.
+         */
+    void adopt(PooledAllocator& other)
+    {
+        if (other.base == NULL)
+            return;
+
+        /* Link the oldest block of the other pool to the newest block of this pool. */
+        void* oldest = other.base;
+        while (*static_cast<void**>(oldest) != NULL)
+            oldest = *static_cast<void**>(oldest);
+        *static_cast<void**>(oldest) = base;
+        base = other.base;
+
+        usedMemory += other.usedMemory;
+        wastedMemory += other.wastedMemory + other.remaining;
+        other.internal_init();
+    }
+
 };
 /** @} */
 
@@ -915,7 +942,15 @@ public:
          */
     NodePtr divideTree(Derived &obj, const IndexType left, const IndexType right, BoundingBox& bbox)
     {
-        NodePtr node = obj.pool.template allocate<Node>(); // allocate memory
+        return divideTree(obj, left, right, bbox, obj.pool);
+    }
+
+    /**
+         * Like divideTree() above, but allocates the nodes from the given pool.
+         */
+    NodePtr divideTree(Derived &obj, const IndexType left, const IndexType right, BoundingBox& bbox, PooledAllocator& pool)
+    {
+        NodePtr node = pool.template allocate<Node>(); // allocate memory
 
         /* If too few exemplars remain, then make this a leaf node. */
         if ( (right - left) <= static_cast<IndexType>(obj.m_leaf_max_size) ) {
@@ -945,11 +980,11 @@ public:
 
             BoundingBox left_bbox(bbox);
             left_bbox[cutfeat].high = cutval;
-            node->child1 = divideTree(obj, left, left + idx, left_bbox);
+            node->child1 = divideTree(obj, left, left + idx, left_bbox, pool);
 
             BoundingBox right_bbox(bbox);
             right_bbox[cutfeat].low = cutval;
-            node->child2 = divideTree(obj, left + idx, right, right_bbox);
+            node->child2 = divideTree(obj, left + idx, right, right_bbox, pool);
 
             node->node_type.sub.divlow = left_bbox[cutfeat].high;
             node->node_type.sub.divhigh = right_bbox[cutfeat].low;
@@ -963,6 +998,65 @@ public:
         return node;
     }
 
+    /**
+         * Parallel version of divideTree(). The two children of a node are built by
+         * separate threads as long as threads remain and the node holds at least
+         * parallel_build_min_size points; smaller subtrees are built sequentially.
+         * Sibling subtrees work on disjoint ranges of vind, and each thread allocates
+         * from its own pool, which is merged into the given pool afterwards. The
+         * resulting tree is identical to the one built by divideTree().
+         *
+         * @param n_threads number of threads available for this subtree (including the calling one)
+         */
+    NodePtr divideTreeConcurrent(Derived &obj, const IndexType left, const IndexType right, BoundingBox& bbox,
+                                 PooledAllocator& pool, const unsigned int n_threads)
+    {
+        if (n_threads <= 1 || (right - left) < static_cast<IndexType>(obj.index_params.parallel_build_min_size)
+            || (right - left) <= static_cast<IndexType>(obj.m_leaf_max_size)) {
+            return divideTree(obj, left, right, bbox, pool);
+        }
+
+        NodePtr node = pool.template allocate<Node>();
+
+        IndexType idx;
+        int cutfeat;
+        DistanceType cutval;
+        middleSplit_(obj, &obj.vind[0] + left, right - left, idx, cutfeat, cutval, bbox);
+
+        node->node_type.sub.divfeat = cutfeat;
+
+        BoundingBox left_bbox(bbox);
+        left_bbox[cutfeat].high = cutval;
+        BoundingBox right_bbox(bbox);
+        right_bbox[cutfeat].low = cutval;
+
+        // the left child gets its own thread and pool, the right child continues in this thread
+        const unsigned int n_left = n_threads / 2;
+        PooledAllocator left_pool;
+        boost::thread left_worker(&KDTreeBaseClass::buildChild, this, boost::ref(obj), left, left + idx,
+                                  boost::ref(left_bbox), boost::ref(left_pool), n_left, &node->child1);
+        node->child2 = divideTreeConcurrent(obj, left + idx, right, right_bbox, pool, n_threads - n_left);
+        left_worker.join();
+        pool.adopt(left_pool);
+
+        node->node_type.sub.divlow = left_bbox[cutfeat].high;
+        node->node_type.sub.divhigh = right_bbox[cutfeat].low;
+
+        for (int i = 0; i < (DIM > 0 ? DIM : obj.dim); ++i) {
+            bbox[i].low = std::min(left_bbox[i].low, right_bbox[i].low);
+            bbox[i].high = std::max(left_bbox[i].high, right_bbox[i].high);
+        }
+
+        return node;
+    }
+
+    /** Thread entry point of divideTreeConcurrent(), storing the built subtree in the given child pointer. */
+    void buildChild(Derived &obj, const IndexType left, const IndexType right, BoundingBox& bbox,
+                    PooledAllocator& pool, const unsigned int n_threads, NodePtr* child)
+    {
+        *child = divideTreeConcurrent(obj, left, right, bbox, pool, n_threads);
+    }
+
     void middleSplit_(Derived &obj, IndexType* ind, IndexType count, IndexType& index, int& cutfeat, DistanceType& cutval, const BoundingBox& bbox)
     {
         const DistanceType EPS = static_cast<DistanceType>(0.00001);
@@ -1165,7 +1259,7 @@ public:
          */
     const DatasetAdaptor &dataset; //!< The source of our data
 
-    const KDTreeSingleIndexAdaptorParams index_params;
+    KDTreeSingleIndexAdaptorParams index_params; //!< index parameters, changes take effect at the next buildIndex()
 
     Distance distance;
 
@@ -1225,7 +1319,15 @@ public:
         BaseClassRef::m_size_at_index_build = BaseClassRef::m_size;
         if(BaseClassRef::m_size == 0) return;
         computeBoundingBox(BaseClassRef::root_bbox);
-        BaseClassRef::root_node = this->divideTree(*this, 0, BaseClassRef::m_size, BaseClassRef::root_bbox );   // construct the tree
+
+        unsigned int n_threads = index_params.n_thread_build;
+        if (n_threads == 0)
+            n_threads = std::max(boost::thread::hardware_concurrency(), 1u);
+        if (n_threads > 1)
+            BaseClassRef::root_node = this->divideTreeConcurrent(*this, 0, BaseClassRef::m_size, BaseClassRef::root_bbox,
+                                                                 BaseClassRef::pool, n_threads);
+        else
+            BaseClassRef::root_node = this->divideTree(*this, 0, BaseClassRef::m_size, BaseClassRef::root_bbox );   // construct the tree
     }
 
     /** \name Query methods
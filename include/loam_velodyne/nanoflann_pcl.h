@@ -41,16 +41,23 @@
 #ifndef NANO_KDTREE_KDTREE_FLANN_H_
 #define NANO_KDTREE_KDTREE_FLANN_H_
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdint.h>
 #include <boost/shared_ptr.hpp>
 #include <pcl/point_cloud.h>
 #include <pcl/point_types.h>
 #include "nanoflann.hpp"
+#include "MortonCode.h"
 
 namespace nanoflann
 {
 
 // Adapter class to give to nanoflann the same "look and fell" of pcl::KdTreeFLANN.
 // limited to squared distance between 3D points
+// All search methods are const and keep no state between calls, so a tree may be
+// queried from several threads at once.
 template <typename PointT>
 class KdTreeFLANN
 {
@@ -66,14 +73,31 @@ public:
     typedef boost::shared_ptr<std::vector<int> > IndicesPtr;
     typedef boost::shared_ptr<const std::vector<int> > IndicesConstPtr;
 
+    /** \brief Scratch buffer of spatialOrder(): sort key / point index pairs. */
+    typedef std::vector<std::pair<uint64_t, int> > SortKeys;
+
     KdTreeFLANN (bool sorted = true);
 
     KdTreeFLANN (const KdTreeFLANN<PointT> &k);
 
+    /** \brief Set the approximation factor of the searches.
+     *
+     * A branch of the tree is only visited if (1 + eps) times its minimum squared distance to the query is below
+     * the squared distance of the current worst neighbor, so the returned neighbors may be missing closer points
+     * than themselves by that factor. Zero (the default) searches exactly.
+     */
     void  setEpsilon (float eps);
 
     void  setSortedResults (bool sorted);
 
+    /** \brief Set the number of threads for building the tree in setInputCloud() (0: one per hardware thread).
+     *
+     * Subtrees are only split across threads above a size of KDTreeSingleIndexAdaptorParams::parallel_build_min_size
+     * points, so small clouds are always built in the calling thread. The built tree does not depend on the number
+     * of threads.
+     */
+    void  setBuildThreads (unsigned int nThreads);
+
     inline Ptr makeShared () { return Ptr (new KdTreeFLANN<PointT> (*this)); }
 
     void setInputCloud (const PointCloudPtr &cloud, const IndicesConstPtr &indices = IndicesConstPtr ());
@@ -84,6 +108,47 @@ public:
     int radiusSearch (const PointT &point, double radius, std::vector<int> &k_indices,
                       std::vector<float> &k_sqr_distances) const;
 
+    /** \brief Search the k nearest neighbors of a batch of query points.
+     *
+     * The neighbors of query i are written to entries [i*k, (i+1)*k) of the flat output
+     * arrays, sorted by ascending distance. Entries that could not be filled because the
+     * tree holds fewer than k points get index -1 and the maximum float distance. No memory
+     * is allocated, so the arrays can be reused across frames.
+     *
+     * @param queries the first query point
+     * @param nQueries the number of query points
+     * @param k the number of neighbors per query
+     * @param k_indices the output array of at least nQueries * k neighbor indices
+     * @param k_sqr_distances the output array of at least nQueries * k squared distances
+     * @param order optional processing order of the queries (see spatialOrder()), which only
+     * affects the memory access pattern and not the results
+     * @return the total number of neighbors found
+     */
+    size_t nearestKSearch (const PointT *queries, size_t nQueries, int k,
+                           int *k_indices, float *k_sqr_distances,
+                           const std::vector<int> *order = NULL) const;
+
+    /** \brief Compute a processing order that visits spatially close points one after another.
+     *
+     * The points are sorted by the Morton (Z-order) code of the grid cell of the given size they
+     * fall into. Querying a tree in this order keeps the visited tree nodes hot in the cache, and
+     * storing points in this order keeps spatial neighbors close in memory. As the order only
+     * depends on the relative positions of the points, it stays (approximately) valid under rigid
+     * transformations.
+     *
+     * @param points the first point
+     * @param nPoints the number of points
+     * @param order the output order, a permutation of [0, nPoints)
+     * @param keys the scratch buffer for the sort keys, keep it across calls to avoid allocations
+     * @param cellSize the grid cell size
+     */
+    static void spatialOrder (const PointT *points, size_t nPoints, std::vector<int> &order,
+                              SortKeys &keys, float cellSize = 1.0f);
+
+    /** \brief Like spatialOrder() above, but with a temporary scratch buffer. */
+    static void spatialOrder (const PointT *points, size_t nPoints, std::vector<int> &order,
+                              float cellSize = 1.0f);
+
 private:
 
     nanoflann::SearchParams _params;
@@ -98,12 +163,15 @@ private:
     };
 
     typedef nanoflann::KDTreeSingleIndexAdaptor<
-      nanoflann::SO3_Adaptor<float, PointCloud_Adaptor > ,
-      PointCloud_Adaptor, 3, int> KDTreeFlann_PCL_SO3;
+      nanoflann::L2_Simple_Adaptor<float, PointCloud_Adaptor > ,
+      PointCloud_Adaptor, 3, int> KDTreeFlann_PCL_L2;
+
+    /** \brief Search the k nearest neighbors of a single point into the given output arrays. */
+    inline size_t searchInto (const PointT &point, int k, int *k_indices, float *k_sqr_distances) const;
 
     PointCloud_Adaptor _adaptor;
 
-    KDTreeFlann_PCL_SO3 _kdtree;
+    KDTreeFlann_PCL_L2 _kdtree;
 
 };
 
@@ -128,6 +196,12 @@ void KdTreeFLANN<PointT>::setSortedResults(bool sorted)
     _params.sorted = sorted;
 }
 
+template<typename PointT> inline
+void KdTreeFLANN<PointT>::setBuildThreads(unsigned int nThreads)
+{
+    _kdtree.index_params.n_thread_build = nThreads;
+}
+
 template<typename PointT> inline
 void KdTreeFLANN<PointT>::setInputCloud(const KdTreeFLANN::PointCloudPtr &cloud,
                                         const IndicesConstPtr &indices)
@@ -142,13 +216,13 @@ int KdTreeFLANN<PointT>::nearestKSearch(const PointT &point, int num_closest,
                                 std::vector<int> &k_indices,
                                 std::vector<float> &k_sqr_distances) const
 {
+    // resizing to the size of the previous call does not allocate
     k_indices.resize(num_closest);
     k_sqr_distances.resize(num_closest);
+    if (num_closest <= 0)
+        return 0;
 
-    nanoflann::KNNResultSet<float,int> resultSet(num_closest);
-    resultSet.init( k_indices.data(), k_sqr_distances.data());
-    _kdtree.findNeighbors(resultSet, point.data, nanoflann::SearchParams() );
-    return resultSet.size();
+    return searchInto(point, num_closest, &k_indices[0], &k_sqr_distances[0]);
 }
 
 template<typename PointT> inline
@@ -156,11 +230,14 @@ int KdTreeFLANN<PointT>::radiusSearch(const PointT &point, double radius,
                               std::vector<int> &k_indices,
                               std::vector<float> &k_sqr_distances) const
 {
-    static std::vector<std::pair<int, float> > indices_dist;
+    std::vector<std::pair<int, float> > indices_dist;
     indices_dist.reserve( 128 );
 
-    RadiusResultSet<float, int> resultSet(radius, indices_dist);
-    const size_t nFound = _kdtree.findNeighbors(resultSet, point.data, _params);
+    // the tree works on squared distances, findNeighbors() only reports whether the result set is full
+    RadiusResultSet<float, int> resultSet(radius * radius, indices_dist);
+    const float query[3] = { point.x, point.y, point.z };
+    _kdtree.findNeighbors(resultSet, query, _params);
+    const size_t nFound = resultSet.size();
 
     if (_params.sorted)
         std::sort(indices_dist.begin(), indices_dist.end(), IndexDist_Sorter() );
@@ -174,6 +251,69 @@ int KdTreeFLANN<PointT>::radiusSearch(const PointT &point, double radius,
     return nFound;
 }
 
+template<typename PointT> inline
+size_t KdTreeFLANN<PointT>::nearestKSearch(const PointT *queries, size_t nQueries, int k,
+                                           int *k_indices, float *k_sqr_distances,
+                                           const std::vector<int> *order) const
+{
+    if (k <= 0)
+        return 0;
+
+    size_t nFound = 0;
+    for (size_t i = 0; i < nQueries; i++) {
+        const size_t q = order ? (*order)[i] : i;
+        nFound += searchInto(queries[q], k, k_indices + q * k, k_sqr_distances + q * k);
+    }
+    return nFound;
+}
+
+template<typename PointT> inline
+void KdTreeFLANN<PointT>::spatialOrder(const PointT *points, size_t nPoints,
+                                       std::vector<int> &order, float cellSize)
+{
+    SortKeys keys;
+    spatialOrder(points, nPoints, order, keys, cellSize);
+}
+
+template<typename PointT> inline
+void KdTreeFLANN<PointT>::spatialOrder(const PointT *points, size_t nPoints,
+                                       std::vector<int> &order, SortKeys &keys, float cellSize)
+{
+    // cell coordinates are offset to be non-negative and wrap around beyond +-2^20 cells
+    keys.resize(nPoints);
+    const float invCellSize = 1.0f / cellSize;
+    const int64_t offset = int64_t(1) << (loam::MORTON_AXIS_BITS - 1);
+    for (size_t i = 0; i < nPoints; i++) {
+        const PointT& p = points[i];
+        const uint64_t cx = uint64_t(int64_t(std::floor(p.x * invCellSize)) + offset);
+        const uint64_t cy = uint64_t(int64_t(std::floor(p.y * invCellSize)) + offset);
+        const uint64_t cz = uint64_t(int64_t(std::floor(p.z * invCellSize)) + offset);
+        keys[i] = std::make_pair(loam::mortonCode(cx, cy, cz), int(i));
+    }
+    std::sort(keys.begin(), keys.end());
+
+    order.resize(nPoints);
+    for (size_t i = 0; i < nPoints; i++)
+        order[i] = keys[i].second;
+}
+
+template<typename PointT> inline
+size_t KdTreeFLANN<PointT>::searchInto(const PointT &point, int k,
+                                       int *k_indices, float *k_sqr_distances) const
+{
+    nanoflann::KNNResultSet<float,int> resultSet(k);
+    resultSet.init(k_indices, k_sqr_distances);
+    const float query[3] = { point.x, point.y, point.z };
+    _kdtree.findNeighbors(resultSet, query, _params);
+
+    const size_t nFound = resultSet.size();
+    for (size_t i = nFound; i < size_t(k); i++) {
+        k_indices[i] = -1;
+        k_sqr_distances[i] = std::numeric_limits<float>::max();
+    }
+    return nFound;
+}
+
 template<typename PointT> inline
 size_t KdTreeFLANN<PointT>::PointCloud_Adaptor::kdtree_get_point_count() const {
     if( indices ) return indices->size();
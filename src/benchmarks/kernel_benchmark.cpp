@@ -0,0 +1,827 @@
+#include <ros/ros.h>
+#include "loam_velodyne/ScanRegistration.h"
+#include "loam_velodyne/SyntheticLidar.h"
+#include "loam_velodyne/VoxelGridFilter.h"
+#include "loam_velodyne/nanoflann_pcl.h"
+#include "../lib/math_utils.h"
+
+#include <stdint.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+
+using namespace loam;
+
+typedef pcl::PointCloud<PointXYZIRT> Cloud;
+
+
+/** \brief Canned input data shared by all kernels, generated deterministically from a synthetic HDL-32 scene. */
+struct CannedData {
+  CannedData() : sweep(new Cloud()), map(new Cloud()) {}
+
+  Cloud::Ptr sweep;                           ///< ring ordered full resolution sweep (camera axes)
+  Cloud::Ptr map;                             ///< map sized cloud of ten sweep copies along the driving direction
+  std::vector<IndexRange> scanIndices;        ///< start and end indices of the scan rings within the sweep
+  Cloud queries;                              ///< points of the following sweep, used as search queries
+  std::vector<std::vector<int> > neighbors;   ///< indices of the five nearest sweep points of each query
+  Cloud planePoints;                          ///< queries with a valid plane fit
+  Cloud planeCoeffs;                          ///< plane residual coefficients of the plane points
+  Twist motion;                               ///< sweep motion used by the transformation kernels
+};
+
+
+/** \brief Convert a synthetic sweep into a ring ordered cloud in camera axes (like MultiScanRegistration). */
+void toRingOrdered(const pcl::PointCloud<pcl::PointXYZI>& sweep,
+                   MultiScanMapper& scanMapper,
+                   const float& scanPeriod,
+                   Cloud& cloud,
+                   std::vector<IndexRange>& scanIndices)
+{
+  float lowerBound = scanMapper.getLowerBound();
+  float factor = (scanMapper.getNumberOfScanRings() - 1) / (scanMapper.getUpperBound() - lowerBound);
+  std::vector<Cloud> scans(scanMapper.getNumberOfScanRings());
+
+  for (size_t i = 0; i < sweep.size(); i++) {
+    const pcl::PointXYZI& p = sweep[i];
+    float elevation = std::atan2(p.z, std::sqrt(p.x * p.x + p.y * p.y)) * 180 / float(M_PI);
+    int ring = int((elevation - lowerBound) * factor + 0.5f);
+    if (ring < 0 || ring >= int(scans.size())) {
+      continue;
+    }
+
+    // the sweep starts behind the sensor
+    float ori = -std::atan2(p.y, p.x);
+    if (ori > float(M_PI) - 1e-4f) {
+      ori -= 2 * float(M_PI);
+    }
+
+    PointXYZIRT point;
+    point.x = p.y;
+    point.y = p.z;
+    point.z = p.x;
+    point.intensity = p.intensity;
+    point.time = scanPeriod * (ori + float(M_PI)) / (2 * float(M_PI));
+    point.ring = uint16_t(ring);
+    scans[ring].push_back(point);
+  }
+
+  cloud.clear();
+  scanIndices.clear();
+  for (size_t i = 0; i < scans.size(); i++) {
+    size_t start = cloud.size();
+    cloud += scans[i];
+    scanIndices.push_back(IndexRange(start, cloud.size() > 0 ? cloud.size() - 1 : 0));
+  }
+}
+
+
+/** \brief Generate the canned kernel input data. */
+void generateCannedData(CannedData& data)
+{
+  const float scanPeriod = 0.1f;
+  MultiScanMapper scanMapper = MultiScanMapper::Velodyne_HDL_32();
+  SyntheticLidar lidar(scanMapper, 1800, scanPeriod);
+  lidar.scene = SyntheticScene::city(200);
+
+  pcl::PointCloud<pcl::PointXYZI> sweep;
+  lidar.generateSweep(0, sweep);
+  toRingOrdered(sweep, scanMapper, scanPeriod, *data.sweep, data.scanIndices);
+
+  // every fourth point of the next sweep serves as search query
+  Cloud nextSweep;
+  std::vector<IndexRange> nextScanIndices;
+  lidar.generateSweep(scanPeriod, sweep);
+  toRingOrdered(sweep, scanMapper, scanPeriod, nextSweep, nextScanIndices);
+  for (size_t i = 0; i < nextSweep.size(); i += 4) {
+    data.queries.push_back(nextSweep[i]);
+  }
+
+  nanoflann::KdTreeFLANN<PointXYZIRT> tree;
+  tree.setInputCloud(data.sweep);
+  std::vector<float> sqDistances;
+  data.neighbors.resize(data.queries.size());
+  for (size_t i = 0; i < data.queries.size(); i++) {
+    tree.nearestKSearch(data.queries[i], 5, data.neighbors[i], sqDistances);
+
+    PointXYZIRT coeff;
+    if (fitPlaneCoefficients(*data.sweep, &data.neighbors[i][0], 0.2f, data.queries[i], coeff)) {
+      data.planePoints.push_back(data.queries[i]);
+      data.planeCoeffs.push_back(coeff);
+    }
+  }
+
+  data.motion.rot_x = 0.01f;
+  data.motion.rot_y = 0.05f;
+  data.motion.rot_z = -0.005f;
+  data.motion.pos = Vector3(0.02f, 0.01f, 0.8f);
+
+  // map sized cloud for the KD-tree build kernels (the camera z axis points forward)
+  for (int copy = 0; copy < 10; copy++) {
+    for (size_t i = 0; i < data.sweep->size(); i++) {
+      PointXYZIRT p = data.sweep->points[i];
+      p.z += 5.0f * copy;
+      data.map->push_back(p);
+    }
+  }
+}
+
+
+/** \brief Append the coordinates and intensities of the given cloud to the given values. */
+void appendCloud(const Cloud& cloud, std::vector<float>& values)
+{
+  values.push_back(float(cloud.size()));
+  for (size_t i = 0; i < cloud.size(); i++) {
+    values.push_back(cloud[i].x);
+    values.push_back(cloud[i].y);
+    values.push_back(cloud[i].z);
+    values.push_back(cloud[i].intensity);
+  }
+}
+
+
+/** \brief Copy the given cloud in Morton order of its points.
+ *
+ * @param cloud the cloud to copy
+ * @param sorted the output cloud
+ * @param order the output order, sorted[j] is cloud[order[j]]
+ */
+void mortonSort(const Cloud& cloud, Cloud& sorted, std::vector<int>& order)
+{
+  nanoflann::KdTreeFLANN<PointXYZIRT>::spatialOrder(&cloud.points[0], cloud.size(), order, 0.2f);
+  sorted.resize(cloud.size());
+  for (size_t j = 0; j < order.size(); j++) {
+    sorted[j] = cloud[order[j]];
+  }
+}
+
+
+
+/** \brief Base class of a benchmarked kernel. */
+class Kernel {
+public:
+  /** \brief Construct a new kernel.
+   *
+   * @param name the kernel name
+   * @param tolerance the maximum relative deviation from the golden output
+   */
+  Kernel(const char* name, const float& tolerance) : name(name), tolerance(tolerance) {}
+  virtual ~Kernel() {}
+
+  /** \brief The number of items (points, queries, ...) processed by a single run. */
+  virtual size_t items() const = 0;
+
+  /** \brief Run the kernel once. */
+  virtual void run() = 0;
+
+  /** \brief Run the kernel once and collect its output for the golden output check. */
+  virtual void output(std::vector<float>& values) = 0;
+
+  const char* name;   ///< kernel name
+  float tolerance;    ///< maximum relative deviation from the golden output (0 = bit exact)
+};
+
+
+
+/** \brief Scan registration exposing its per scan and per region kernels. */
+class RegistrationKernels : public ScanRegistration {
+public:
+  explicit RegistrationKernels(const CannedData& data)
+  {
+    _features.laserCloud = *data.sweep;
+    _scanIndices = data.scanIndices;
+
+    // keep unsorted copies of all region curvatures and indices for benchmarking the sort in isolation
+    for (size_t i = 0; i < _scanIndices.size(); i++) {
+      for (int j = 0; j < _config.nFeatureRegions; j++) {
+        size_t sp, ep;
+        if (regionBounds(i, j, sp, ep)) {
+          calculateRegionCurvature(sp, ep);
+          _curvatures.push_back(_regionCurvature);
+          _sortIndices.push_back(_regionSortIndices);
+          _regionStarts.push_back(sp);
+        }
+      }
+    }
+  }
+
+  size_t size() const { return _features.laserCloud.size(); }
+
+  void curvature(std::vector<float>* values)
+  {
+    for (size_t i = 0; i < _scanIndices.size(); i++) {
+      for (int j = 0; j < _config.nFeatureRegions; j++) {
+        size_t sp, ep;
+        if (regionBounds(i, j, sp, ep)) {
+          calculateRegionCurvature(sp, ep);
+          if (values) {
+            values->insert(values->end(), _regionCurvature.begin(), _regionCurvature.end());
+          }
+        }
+      }
+    }
+  }
+
+  void sort(std::vector<float>* values)
+  {
+    for (size_t i = 0; i < _regionStarts.size(); i++) {
+      _regionCurvature = _curvatures[i];
+      _regionSortIndices = _sortIndices[i];
+      sortRegionIndices(_regionStarts[i]);
+      if (values) {
+        for (size_t k = 0; k < _regionSortIndices.size(); k++) {
+          values->push_back(float(_regionSortIndices[k]));
+        }
+      }
+    }
+  }
+
+  void occlusion(std::vector<float>* values)
+  {
+    for (size_t i = 0; i < _scanIndices.size(); i++) {
+      if (scanIsEmpty(i)) {
+        continue;
+      }
+
+      setScanBuffersFor(_scanIndices[i].first, _scanIndices[i].second);
+      if (values) {
+        values->insert(values->end(), _scanNeighborPicked.begin(), _scanNeighborPicked.end());
+      }
+    }
+  }
+
+  void selection(std::vector<float>* values)
+  {
+    _features.cornerPointsSharp.clear();
+    _features.cornerPointsLessSharp.clear();
+    _features.surfacePointsFlat.clear();
+    _features.surfacePointsLessFlat.clear();
+    extractFeatures();
+
+    if (values) {
+      appendCloud(_features.cornerPointsSharp, *values);
+      appendCloud(_features.cornerPointsLessSharp, *values);
+      appendCloud(_features.surfacePointsFlat, *values);
+      appendCloud(_features.surfacePointsLessFlat, *values);
+    }
+  }
+
+private:
+  bool scanIsEmpty(const size_t& scan) const
+  {
+    return _scanIndices[scan].second <= _scanIndices[scan].first + 2 * _config.curvatureRegion;
+  }
+
+  /** \brief Calculate the bounds of the given feature region of the given scan (see extractFeatures()). */
+  bool regionBounds(const size_t& scan, const int& j, size_t& sp, size_t& ep) const
+  {
+    if (scanIsEmpty(scan)) {
+      return false;
+    }
+
+    size_t scanStartIdx = _scanIndices[scan].first;
+    size_t scanEndIdx = _scanIndices[scan].second;
+    sp = ((scanStartIdx + _config.curvatureRegion) * (_config.nFeatureRegions - j)
+          + (scanEndIdx - _config.curvatureRegion) * j) / _config.nFeatureRegions;
+    ep = ((scanStartIdx + _config.curvatureRegion) * (_config.nFeatureRegions - 1 - j)
+          + (scanEndIdx - _config.curvatureRegion) * (j + 1)) / _config.nFeatureRegions - 1;
+    return ep > sp;
+  }
+
+  std::vector<std::vector<float> > _curvatures;     ///< unsorted region curvatures
+  std::vector<std::vector<size_t> > _sortIndices;   ///< unsorted region indices
+  std::vector<size_t> _regionStarts;                ///< region start indices
+};
+
+
+
+/** \brief Point curvature calculation of all feature regions of a sweep. */
+class CurvatureKernel : public Kernel {
+public:
+  explicit CurvatureKernel(const CannedData& data) : Kernel("curvature", 1e-6f), _registration(data) {}
+  size_t items() const { return _registration.size(); }
+  void run() { _registration.curvature(NULL); }
+  void output(std::vector<float>& values) { _registration.curvature(&values); }
+private:
+  RegistrationKernels _registration;
+};
+
+
+/** \brief Curvature sorting of all feature regions of a sweep. */
+class RegionSortKernel : public Kernel {
+public:
+  explicit RegionSortKernel(const CannedData& data) : Kernel("region_sort", 0), _registration(data) {}
+  size_t items() const { return _registration.size(); }
+  void run() { _registration.sort(NULL); }
+  void output(std::vector<float>& values) { _registration.sort(&values); }
+private:
+  RegistrationKernels _registration;
+};
+
+
+/** \brief Occluded and unreliable point marking of all scans of a sweep. */
+class OcclusionKernel : public Kernel {
+public:
+  explicit OcclusionKernel(const CannedData& data) : Kernel("occlusion", 0), _registration(data) {}
+  size_t items() const { return _registration.size(); }
+  void run() { _registration.occlusion(NULL); }
+  void output(std::vector<float>& values) { _registration.occlusion(&values); }
+private:
+  RegistrationKernels _registration;
+};
+
+
+/** \brief Complete feature extraction (curvature, sort, selection and less flat down sizing) of a sweep. */
+class SelectionKernel : public Kernel {
+public:
+  explicit SelectionKernel(const CannedData& data) : Kernel("feature_selection", 1e-6f), _registration(data) {}
+  size_t items() const { return _registration.size(); }
+  void run() { _registration.selection(NULL); }
+  void output(std::vector<float>& values) { _registration.selection(&values); }
+private:
+  RegistrationKernels _registration;
+};
+
+
+/** \brief K nearest neighbor search of the queries in the KD-tree of the sweep. */
+class KdTreeKernel : public Kernel {
+public:
+  KdTreeKernel(const CannedData& data, const char* name, const int& k)
+      : Kernel(name, 1e-6f), _queries(data.queries), _k(k)
+  {
+    _tree.setInputCloud(data.sweep);
+  }
+
+  size_t items() const { return _queries.size(); }
+
+  void run()
+  {
+    for (size_t i = 0; i < _queries.size(); i++) {
+      _tree.nearestKSearch(_queries[i], _k, _indices, _sqDistances);
+    }
+  }
+
+  void output(std::vector<float>& values)
+  {
+    for (size_t i = 0; i < _queries.size(); i++) {
+      _tree.nearestKSearch(_queries[i], _k, _indices, _sqDistances);
+      for (int j = 0; j < _k; j++) {
+        values.push_back(float(_indices[j]));
+        values.push_back(_sqDistances[j]);
+      }
+    }
+  }
+
+private:
+  const Cloud& _queries;
+  int _k;
+  nanoflann::KdTreeFLANN<PointXYZIRT> _tree;
+  std::vector<int> _indices;
+  std::vector<float> _sqDistances;
+};
+
+
+
+/** \brief Batched k nearest neighbor search of the spatially ordered queries in the KD-tree of the sweep. */
+class KdTreeBatchKernel : public Kernel {
+public:
+  KdTreeBatchKernel(const CannedData& data, const char* name, const int& k)
+      : Kernel(name, 1e-6f), _queries(data.queries), _k(k),
+        _indices(data.queries.size() * k), _sqDistances(data.queries.size() * k)
+  {
+    _tree.setInputCloud(data.sweep);
+    nanoflann::KdTreeFLANN<PointXYZIRT>::spatialOrder(&_queries[0], _queries.size(), _order);
+  }
+
+  size_t items() const { return _queries.size(); }
+
+  void run()
+  {
+    _tree.nearestKSearch(&_queries[0], _queries.size(), _k, &_indices[0], &_sqDistances[0], &_order);
+  }
+
+  void output(std::vector<float>& values)
+  {
+    run();
+    for (size_t i = 0; i < _indices.size(); i++) {
+      values.push_back(float(_indices[i]));
+      values.push_back(_sqDistances[i]);
+    }
+  }
+
+private:
+  const Cloud& _queries;
+  int _k;
+  nanoflann::KdTreeFLANN<PointXYZIRT> _tree;
+  std::vector<int> _order;
+  std::vector<int> _indices;
+  std::vector<float> _sqDistances;
+};
+
+
+/** \brief Sweep de-skewing followed by a rigid transformation (like LaserOdometry::transformToEnd()). */
+class DeskewKernel : public Kernel {
+public:
+  explicit DeskewKernel(const CannedData& data)
+      : Kernel("deskew", 1e-5f), _sweep(*data.sweep), _motion(data.motion) {}
+
+  size_t items() const { return _sweep.size(); }
+
+  void run()
+  {
+    _cloud = _sweep;
+    deskewCloud(_cloud, _motion, 0.1f, rotationYXZ(_motion.rot_y, _motion.rot_x, _motion.rot_z),
+                Eigen::Vector3f(_motion.pos.x(), _motion.pos.y(), _motion.pos.z()));
+  }
+
+  void output(std::vector<float>& values)
+  {
+    run();
+    appendCloud(_cloud, values);
+  }
+
+private:
+  const Cloud& _sweep;
+  const Twist& _motion;
+  Cloud _cloud;
+};
+
+
+/** \brief Rigid transformation of a sweep (like LaserMapping::pointAssociateToMap()). */
+class TransformKernel : public Kernel {
+public:
+  explicit TransformKernel(const CannedData& data)
+      : Kernel("transform", 1e-5f), _sweep(*data.sweep), _motion(data.motion) {}
+
+  size_t items() const { return _sweep.size(); }
+
+  void run()
+  {
+    _cloud = _sweep;
+    transformCloud(_cloud, rotationZXY(_motion.rot_z, _motion.rot_x, _motion.rot_y),
+                   Eigen::Vector3f(_motion.pos.x(), _motion.pos.y(), _motion.pos.z()));
+  }
+
+  void output(std::vector<float>& values)
+  {
+    run();
+    appendCloud(_cloud, values);
+  }
+
+private:
+  const Cloud& _sweep;
+  const Twist& _motion;
+  Cloud _cloud;
+};
+
+
+/** \brief KD-tree build over the given cloud, either in its original order or in Morton order. */
+class KdTreeBuildKernel : public Kernel {
+public:
+  KdTreeBuildKernel(const CannedData& data, const char* name, const Cloud& cloud, const bool& morton,
+                    const unsigned int& nThreads = 1)
+      : Kernel(name, 1e-6f), _cloud(new Cloud()), _queries(data.queries)
+  {
+    if (morton) {
+      std::vector<int> order;
+      mortonSort(cloud, *_cloud, order);
+    } else {
+      *_cloud = cloud;
+    }
+    _tree.setBuildThreads(nThreads);
+  }
+
+  size_t items() const { return _cloud->size(); }
+  void run() { _tree.setInputCloud(_cloud); }
+
+  void output(std::vector<float>& values)
+  {
+    // the neighbor indices depend on the storage order, so only the distances are compared
+    run();
+    std::vector<int> indices;
+    std::vector<float> sqDistances;
+    for (size_t i = 0; i < _queries.size(); i++) {
+      _tree.nearestKSearch(_queries[i], 1, indices, sqDistances);
+      values.push_back(sqDistances[0]);
+    }
+  }
+
+private:
+  Cloud::Ptr _cloud;
+  const Cloud& _queries;
+  nanoflann::KdTreeFLANN<PointXYZIRT> _tree;
+};
+
+
+/** \brief Batched k nearest neighbor search of Morton ordered queries in the KD-tree of the Morton ordered sweep. */
+class KdTreeMortonKernel : public Kernel {
+public:
+  KdTreeMortonKernel(const CannedData& data, const char* name, const int& k)
+      : Kernel(name, 1e-6f), _sweep(new Cloud()), _k(k),
+        _indices(data.queries.size() * k), _sqDistances(data.queries.size() * k)
+  {
+    std::vector<int> sweepOrder;
+    mortonSort(*data.sweep, *_sweep, sweepOrder);
+    mortonSort(data.queries, _queries, _queryOrder);
+    _tree.setInputCloud(_sweep);
+  }
+
+  size_t items() const { return _queries.size(); }
+
+  void run()
+  {
+    _tree.nearestKSearch(&_queries[0], _queries.size(), _k, &_indices[0], &_sqDistances[0]);
+  }
+
+  void output(std::vector<float>& values)
+  {
+    // report the distances in the original query order, the indices depend on the storage order
+    run();
+    std::vector<float> sqDistances(_sqDistances.size());
+    for (size_t j = 0; j < _queryOrder.size(); j++) {
+      std::copy(&_sqDistances[j * _k], &_sqDistances[j * _k] + _k, &sqDistances[_queryOrder[j] * _k]);
+    }
+    values.insert(values.end(), sqDistances.begin(), sqDistances.end());
+  }
+
+private:
+  Cloud::Ptr _sweep;
+  Cloud _queries;
+  std::vector<int> _queryOrder;
+  int _k;
+  nanoflann::KdTreeFLANN<PointXYZIRT> _tree;
+  std::vector<int> _indices;
+  std::vector<float> _sqDistances;
+};
+
+
+/** \brief Voxel grid down sampling of a sweep. */
+class VoxelKernel : public Kernel {
+public:
+  VoxelKernel(const CannedData& data, const char* name, const bool& morton)
+      : Kernel(name, 1e-5f), _sweep(*data.sweep), _filter(0.2f)
+  {
+    _filter.setMortonOrder(morton);
+  }
+
+  size_t items() const { return _sweep.size(); }
+  void run() { _filter.filter(_sweep, _cloud); }
+
+  void output(std::vector<float>& values)
+  {
+    run();
+    appendCloud(_cloud, values);
+  }
+
+private:
+  const Cloud& _sweep;
+  VoxelGridFilter<PointXYZIRT> _filter;
+  Cloud _cloud;
+};
+
+
+/** \brief Normal equation (Jacobian) assembly of the odometry optimization. */
+class OdometryNormalsKernel : public Kernel {
+public:
+  explicit OdometryNormalsKernel(const CannedData& data)
+      : Kernel("odometry_normals", 1e-5f), _points(data.planePoints), _coeffs(data.planeCoeffs), _motion(data.motion) {}
+
+  size_t items() const { return _points.size(); }
+
+  void run()
+  {
+    _matAtA.setZero();
+    _matAtB.setZero();
+    accumulateOdometryNormals(_motion, _points, _coeffs, _matAtA, _matAtB);
+  }
+
+  void output(std::vector<float>& values)
+  {
+    run();
+    values.insert(values.end(), _matAtA.data(), _matAtA.data() + 36);
+    values.insert(values.end(), _matAtB.data(), _matAtB.data() + 6);
+  }
+
+private:
+  const Cloud& _points;
+  const Cloud& _coeffs;
+  const Twist& _motion;
+  Eigen::Matrix<float, 6, 6> _matAtA;
+  Eigen::Matrix<float, 6, 1> _matAtB;
+};
+
+
+/** \brief Line or plane fits of the mapping optimization to the five nearest sweep points of each query. */
+class FitKernel : public Kernel {
+public:
+  FitKernel(const CannedData& data, const char* name, const bool& planes)
+      : Kernel(name, 1e-4f), _data(data), _planes(planes) {}
+
+  size_t items() const { return _data.queries.size(); }
+  void run() { fit(NULL); }
+  void output(std::vector<float>& values) { fit(&values); }
+
+private:
+  void fit(std::vector<float>* values)
+  {
+    PointXYZIRT coeff;
+    for (size_t i = 0; i < _data.queries.size(); i++) {
+      bool valid = _planes
+                   ? fitPlaneCoefficients(*_data.sweep, &_data.neighbors[i][0], 0.2f, _data.queries[i], coeff)
+                   : fitLineCoefficients(*_data.sweep, &_data.neighbors[i][0], _data.queries[i], coeff);
+      if (values) {
+        values->push_back(valid ? 1 : 0);
+        if (valid) {
+          values->push_back(coeff.x);
+          values->push_back(coeff.y);
+          values->push_back(coeff.z);
+          values->push_back(coeff.intensity);
+        }
+      }
+    }
+  }
+
+  const CannedData& _data;
+  bool _planes;
+};
+
+
+
+/** \brief Write the given golden output values to the given file. */
+bool writeGolden(const std::string& path, const std::vector<float>& values)
+{
+  FILE* file = std::fopen(path.c_str(), "wb");
+  if (!file) {
+    return false;
+  }
+
+  uint64_t count = values.size();
+  bool success = std::fwrite(&count, sizeof(count), 1, file) == 1
+                 && (values.empty() || std::fwrite(&values[0], sizeof(float), values.size(), file) == values.size());
+  std::fclose(file);
+  return success;
+}
+
+
+/** \brief Read the golden output values from the given file. */
+bool readGolden(const std::string& path, std::vector<float>& values)
+{
+  FILE* file = std::fopen(path.c_str(), "rb");
+  if (!file) {
+    return false;
+  }
+
+  uint64_t count = 0;
+  bool success = std::fread(&count, sizeof(count), 1, file) == 1;
+  if (success) {
+    values.resize(count);
+    success = values.empty() || std::fread(&values[0], sizeof(float), values.size(), file) == values.size();
+  }
+  std::fclose(file);
+  return success;
+}
+
+
+/** \brief Compute the maximum relative deviation of the given values from the golden values (INFINITY if the
+ * number of values differs, 0 for bit identical values).
+ */
+double maxDeviation(const std::vector<float>& values, const std::vector<float>& golden)
+{
+  if (values.size() != golden.size()) {
+    return INFINITY;
+  }
+
+  double maxDev = 0;
+  for (size_t i = 0; i < values.size(); i++) {
+    if (std::memcmp(&values[i], &golden[i], sizeof(float)) == 0) {
+      continue;
+    }
+
+    double dev = std::fabs(double(values[i]) - golden[i]) / std::max(1.0, std::fabs(double(golden[i])));
+    maxDev = std::max(maxDev, dev == dev ? dev : INFINITY);
+  }
+
+  return maxDev;
+}
+
+
+
+/** Benchmark entry point.
+ *
+ * Times the individual hot kernels on canned (synthetic) data. With -r, the outputs of all selected kernels are
+ * recorded as golden outputs; with -c, they are checked against previously recorded golden outputs, e.g. to validate
+ * a vectorized or multithreaded rewrite of a kernel against the original implementation.
+ *
+ * Usage: kernelBenchmark [-n <iterations>] [-r <golden dir> | -c <golden dir>] [<kernel> ...]
+ */
+int main(int argc, char **argv)
+{
+  int nIterations = 20;
+  std::string recordDir, checkDir;
+  std::vector<std::string> selected;
+
+  for (int arg = 1; arg < argc; arg++) {
+    std::string option = argv[arg];
+    if ((option == "-n" || option == "-r" || option == "-c") && arg + 1 < argc) {
+      std::string value = argv[++arg];
+      if (option == "-n") {
+        nIterations = std::atoi(value.c_str());
+      } else if (option == "-r") {
+        recordDir = value;
+      } else {
+        checkDir = value;
+      }
+    } else if (option[0] == '-') {
+      std::printf("Usage: %s [-n <iterations>] [-r <golden dir> | -c <golden dir>] [<kernel> ...]\n", argv[0]);
+      return 1;
+    } else {
+      selected.push_back(option);
+    }
+  }
+
+  if (nIterations < 1 || (!recordDir.empty() && !checkDir.empty())) {
+    std::printf("Invalid number of iterations (%d) or both -r and -c specified\n", nIterations);
+    return 1;
+  }
+
+  CannedData data;
+  generateCannedData(data);
+  std::printf("Canned data: %lu sweep points, %lu queries, %lu plane points\n\n",
+              (unsigned long) data.sweep->size(), (unsigned long) data.queries.size(),
+              (unsigned long) data.planePoints.size());
+
+  std::vector<Kernel*> kernels;
+  kernels.push_back(new CurvatureKernel(data));
+  kernels.push_back(new RegionSortKernel(data));
+  kernels.push_back(new OcclusionKernel(data));
+  kernels.push_back(new SelectionKernel(data));
+  kernels.push_back(new KdTreeKernel(data, "kdtree_k1", 1));
+  kernels.push_back(new KdTreeKernel(data, "kdtree_k5", 5));
+  kernels.push_back(new KdTreeBatchKernel(data, "kdtree_k5_batch", 5));
+  kernels.push_back(new KdTreeMortonKernel(data, "kdtree_k5_morton", 5));
+  kernels.push_back(new KdTreeBuildKernel(data, "kdtree_build", *data.sweep, false));
+  kernels.push_back(new KdTreeBuildKernel(data, "kdtree_build_morton", *data.sweep, true));
+  kernels.push_back(new KdTreeBuildKernel(data, "kdtree_build_map", *data.map, false));
+  kernels.push_back(new KdTreeBuildKernel(data, "kdtree_build_map_par", *data.map, false, 0));
+  kernels.push_back(new DeskewKernel(data));
+  kernels.push_back(new TransformKernel(data));
+  kernels.push_back(new VoxelKernel(data, "voxel_filter", false));
+  kernels.push_back(new VoxelKernel(data, "voxel_filter_morton", true));
+  kernels.push_back(new OdometryNormalsKernel(data));
+  kernels.push_back(new FitKernel(data, "line_fit", false));
+  kernels.push_back(new FitKernel(data, "plane_fit", true));
+
+  std::printf("%-20s %10s %12s %12s  %s\n", "kernel", "items", "run [us]", "item [ns]", "golden");
+
+  int nFailed = 0;
+  for (size_t i = 0; i < kernels.size(); i++) {
+    Kernel& kernel = *kernels[i];
+    if (!selected.empty() && std::find(selected.begin(), selected.end(), kernel.name) == selected.end()) {
+      continue;
+    }
+
+    // warm up once before timing
+    kernel.run();
+
+    ros::WallTime start = ros::WallTime::now();
+    for (int j = 0; j < nIterations; j++) {
+      kernel.run();
+    }
+    double runTime = (ros::WallTime::now() - start).toSec() * 1e6 / nIterations;
+
+    std::string golden = "-";
+    std::vector<float> values;
+    if (!recordDir.empty()) {
+      kernel.output(values);
+      golden = writeGolden(recordDir + "/" + kernel.name + ".golden", values) ? "recorded" : "write failed";
+      nFailed += golden == "recorded" ? 0 : 1;
+    } else if (!checkDir.empty()) {
+      std::vector<float> goldenValues;
+      kernel.output(values);
+      if (!readGolden(checkDir + "/" + kernel.name + ".golden", goldenValues)) {
+        golden = "read failed";
+        nFailed++;
+      } else {
+        double deviation = maxDeviation(values, goldenValues);
+        char buffer[64];
+        snprintf(buffer, sizeof(buffer), "%s (max dev %g, tolerance %g)",
+               deviation <= kernel.tolerance ? "pass" : "FAIL", deviation, kernel.tolerance);
+        golden = buffer;
+        nFailed += deviation <= kernel.tolerance ? 0 : 1;
+      }
+    }
+
+    std::printf("%-20s %10lu %12.1f %12.2f  %s\n", kernel.name, (unsigned long) kernel.items(),
+                runTime, runTime * 1000 / std::max(kernel.items(), size_t(1)), golden.c_str());
+  }
+
+  for (size_t i = 0; i < kernels.size(); i++) {
+    delete kernels[i];
+  }
+
+  return nFailed > 0 ? 1 : 0;
+}
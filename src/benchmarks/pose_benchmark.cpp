@@ -0,0 +1,157 @@
+#include <ros/ros.h>
+#include "loam_velodyne/Pose.h"
+#include "euler_closed_forms.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+
+using namespace loam;
+
+
+/** \brief Draw a random twist (pitch limited to +/- 80 degrees to stay clear of the gimbal lock). */
+Twist randomTwist()
+{
+  Twist twist;
+  twist.rot_x = 1.4f * (2.0f * std::rand() / RAND_MAX - 1.0f);
+  twist.rot_y = float(M_PI) * (2.0f * std::rand() / RAND_MAX - 1.0f);
+  twist.rot_z = float(M_PI) * (2.0f * std::rand() / RAND_MAX - 1.0f);
+  twist.pos = Vector3(100.0f * std::rand() / RAND_MAX, 100.0f * std::rand() / RAND_MAX, 10.0f * std::rand() / RAND_MAX);
+  return twist;
+}
+
+
+/** \brief Maximum absolute difference of the rotation matrices of the given twists. */
+float rotationDeviation(const Twist& a, const Twist& b)
+{
+  return (rotationFromEuler(a.rot_x, a.rot_y, a.rot_z) - rotationFromEuler(b.rot_x, b.rot_y, b.rot_z)).cwiseAbs().maxCoeff();
+}
+
+
+void printResult(const char* name, double closedFormTime, double poseTime, int nCompositions, float maxDeviation)
+{
+  double closedFormNs = closedFormTime * 1e9 / nCompositions;
+  double poseNs = poseTime * 1e9 / nCompositions;
+  std::printf("%-26s %16.1f %12.1f %8.2f %12.2e\n",
+              name, closedFormNs, poseNs, poseNs > 0 ? closedFormNs / poseNs : 0.0, maxDeviation);
+}
+
+
+
+/** Benchmark entry point.
+ *
+ * Compares the hand expanded Euler angle compositions to their Pose library replacements.
+ *
+ * Usage: poseBenchmark <iterations>
+ */
+int main(int argc, char **argv)
+{
+  if (argc < 2) {
+    std::printf("Usage: %s <iterations>\n", argv[0]);
+    return 1;
+  }
+
+  int nIterations = std::atoi(argv[1]);
+  if (nIterations < 1) {
+    std::printf("Invalid number of iterations (%d)\n", nIterations);
+    return 1;
+  }
+
+  const int nSamples = 1024;
+  std::vector<Twist> a, b, c;
+  for (int i = 0; i < nSamples; i++) {
+    a.push_back(randomTwist());
+    b.push_back(randomTwist());
+    c.push_back(randomTwist());
+  }
+  std::vector<Twist> closedFormResult(nSamples), poseResult(nSamples);
+  int nCompositions = nSamples * nIterations;
+
+  std::printf("%-26s %16s %12s %8s %12s\n", "composition", "closed form [ns]", "pose [ns]", "speedup", "max dev");
+
+  // accumulateRotation
+  ros::WallTime start = ros::WallTime::now();
+  for (int it = 0; it < nIterations; it++) {
+    for (int i = 0; i < nSamples; i++) {
+      Twist& r = closedFormResult[i];
+      closed_form::accumulateRotation(a[i].rot_x, a[i].rot_y, a[i].rot_z, b[i].rot_x, b[i].rot_y, b[i].rot_z,
+                                      r.rot_x, r.rot_y, r.rot_z);
+    }
+  }
+  double closedFormTime = (ros::WallTime::now() - start).toSec();
+
+  start = ros::WallTime::now();
+  for (int it = 0; it < nIterations; it++) {
+    for (int i = 0; i < nSamples; i++) {
+      Twist& r = poseResult[i];
+      eulerFromRotation(rotationFromEuler(a[i].rot_x, a[i].rot_y, a[i].rot_z)
+                        * rotationFromEuler(b[i].rot_x, b[i].rot_y, b[i].rot_z),
+                        r.rot_x, r.rot_y, r.rot_z);
+    }
+  }
+  double poseTime = (ros::WallTime::now() - start).toSec();
+
+  float maxDeviation = 0;
+  for (int i = 0; i < nSamples; i++) {
+    maxDeviation = std::max(maxDeviation, rotationDeviation(closedFormResult[i], poseResult[i]));
+  }
+  printResult("accumulateRotation", closedFormTime, poseTime, nCompositions, maxDeviation);
+
+  // pluginIMURotation
+  start = ros::WallTime::now();
+  for (int it = 0; it < nIterations; it++) {
+    for (int i = 0; i < nSamples; i++) {
+      Twist& r = closedFormResult[i];
+      closed_form::pluginIMURotation(a[i].rot_x, a[i].rot_y, a[i].rot_z,
+                                     b[i].rot_x, b[i].rot_y, b[i].rot_z,
+                                     c[i].rot_x, c[i].rot_y, c[i].rot_z,
+                                     r.rot_x, r.rot_y, r.rot_z);
+    }
+  }
+  closedFormTime = (ros::WallTime::now() - start).toSec();
+
+  start = ros::WallTime::now();
+  for (int it = 0; it < nIterations; it++) {
+    for (int i = 0; i < nSamples; i++) {
+      Twist& r = poseResult[i];
+      eulerFromRotation(rotationFromEuler(a[i].rot_x, a[i].rot_y, a[i].rot_z)
+                        * rotationFromEuler(b[i].rot_x, b[i].rot_y, b[i].rot_z).transpose()
+                        * rotationFromEuler(c[i].rot_x, c[i].rot_y, c[i].rot_z),
+                        r.rot_x, r.rot_y, r.rot_z);
+    }
+  }
+  poseTime = (ros::WallTime::now() - start).toSec();
+
+  maxDeviation = 0;
+  for (int i = 0; i < nSamples; i++) {
+    maxDeviation = std::max(maxDeviation, rotationDeviation(closedFormResult[i], poseResult[i]));
+  }
+  printResult("pluginIMURotation", closedFormTime, poseTime, nCompositions, maxDeviation);
+
+  // transformAssociateToMap
+  start = ros::WallTime::now();
+  for (int it = 0; it < nIterations; it++) {
+    for (int i = 0; i < nSamples; i++) {
+      closedFormResult[i] = closed_form::transformAssociateToMap(a[i], b[i], c[i]);
+    }
+  }
+  closedFormTime = (ros::WallTime::now() - start).toSec();
+
+  start = ros::WallTime::now();
+  for (int it = 0; it < nIterations; it++) {
+    for (int i = 0; i < nSamples; i++) {
+      poseResult[i] = (Pose(c[i]) * Pose(b[i]).inverse() * Pose(a[i])).toTwist();
+    }
+  }
+  poseTime = (ros::WallTime::now() - start).toSec();
+
+  maxDeviation = 0;
+  for (int i = 0; i < nSamples; i++) {
+    maxDeviation = std::max(maxDeviation, rotationDeviation(closedFormResult[i], poseResult[i]));
+  }
+  printResult("transformAssociateToMap", closedFormTime, poseTime, nCompositions, maxDeviation);
+
+  return 0;
+}
@@ -0,0 +1,535 @@
+#include <ros/ros.h>
+#include <rosbag/bag.h>
+#include <rosbag/view.h>
+#include <pcl_conversions/pcl_conversions.h>
+#include "loam_velodyne/MultiScanRegistration.h"
+#include "loam_velodyne/LaserOdometry.h"
+#include "loam_velodyne/LaserMapping.h"
+
+#include <malloc.h>
+#include <sys/resource.h>
+#include <boost/atomic.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+
+static boost::atomic<size_t> nAllocations(0);   ///< number of heap allocations of this process so far
+
+
+// Count all heap allocations of this process by interposing the C allocation functions of glibc. operator new as
+// well as Eigen's aligned allocator (used for the PCL point buffers) allocate through these functions.
+extern "C" {
+
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t n, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+
+void* malloc(size_t size) __THROW
+{
+  nAllocations.fetch_add(1, boost::memory_order_relaxed);
+  return __libc_malloc(size);
+}
+
+void* calloc(size_t n, size_t size) __THROW
+{
+  nAllocations.fetch_add(1, boost::memory_order_relaxed);
+  return __libc_calloc(n, size);
+}
+
+void* realloc(void* ptr, size_t size) __THROW
+{
+  nAllocations.fetch_add(1, boost::memory_order_relaxed);
+  return __libc_realloc(ptr, size);
+}
+
+void* memalign(size_t alignment, size_t size) __THROW
+{
+  nAllocations.fetch_add(1, boost::memory_order_relaxed);
+  return __libc_memalign(alignment, size);
+}
+
+void* aligned_alloc(size_t alignment, size_t size) __THROW
+{
+  nAllocations.fetch_add(1, boost::memory_order_relaxed);
+  return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void** ptr, size_t alignment, size_t size) __THROW
+{
+  if (alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0) {
+    return EINVAL;
+  }
+
+  nAllocations.fetch_add(1, boost::memory_order_relaxed);
+  void* mem = __libc_memalign(alignment, size);
+  if (!mem) {
+    return ENOMEM;
+  }
+  *ptr = mem;
+  return 0;
+}
+
+} // extern "C"
+
+
+
+/** \brief Latency samples of a single processing stage. */
+struct StageLatency {
+  explicit StageLatency(const char* name_)
+      : name(name_) {}
+
+  /** \brief Retrieve the given percentile (nearest rank) of the samples in milliseconds. */
+  double percentile(const double& p) const
+  {
+    if (samples.empty()) {
+      return 0;
+    }
+
+    std::vector<double> sorted(samples);
+    std::sort(sorted.begin(), sorted.end());
+    size_t rank = size_t(std::ceil(p / 100 * sorted.size()));
+    return sorted[std::max(rank, size_t(1)) - 1] * 1000;
+  }
+
+  /** \brief Retrieve the mean of the samples in milliseconds. */
+  double mean() const
+  {
+    double sum = 0;
+    for (size_t i = 0; i < samples.size(); i++) {
+      sum += samples[i];
+    }
+    return samples.empty() ? 0 : sum * 1000 / samples.size();
+  }
+
+  /** \brief Retrieve the median number of heap allocations per frame, or 0 if not counted. */
+  size_t medianAllocations() const
+  {
+    if (allocations.empty()) {
+      return 0;
+    }
+
+    std::vector<size_t> sorted(allocations);
+    std::nth_element(sorted.begin(), sorted.begin() + sorted.size() / 2, sorted.end());
+    return sorted[sorted.size() / 2];
+  }
+
+  void print() const
+  {
+    std::printf("%-14s %8lu %10.3f %10.3f %10.3f %10.3f %10.3f %10lu\n",
+                name, (unsigned long) samples.size(), mean(),
+                percentile(50), percentile(95), percentile(99), percentile(100),
+                (unsigned long) medianAllocations());
+  }
+
+  const char* name;                 ///< stage name
+  std::vector<double> samples;      ///< latencies in seconds
+  std::vector<size_t> allocations;  ///< heap allocations of the stage processing per frame
+};
+
+
+/** \brief Recorded input message, either a point cloud or an IMU message. */
+struct InputMessage {
+  sensor_msgs::PointCloud2::ConstPtr cloud;
+  sensor_msgs::Imu::ConstPtr imu;
+};
+
+
+/** \brief Serialize the given cloud like the laser odometry does for its cloud topics. */
+sensor_msgs::PointCloud2::ConstPtr toCloudMsg(const pcl::PointCloud<loam::PointXYZIRT>& cloud,
+                                              const ros::Time& stamp)
+{
+  sensor_msgs::PointCloud2::Ptr msg(new sensor_msgs::PointCloud2());
+  pcl::toROSMsg(cloud, *msg);
+  msg->header.stamp = stamp;
+  msg->header.frame_id = "/camera";
+  return msg;
+}
+
+
+/** \brief Retrieve the peak resident set size of this process in MB. */
+double peakRSS()
+{
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
+  }
+  return usage.ru_maxrss / 1024.0;  // kB on Linux
+}
+
+
+/** \brief Mapped pose of a single sweep. */
+struct TrajectoryPose {
+  ros::Time stamp;
+  geometry_msgs::Pose pose;
+};
+
+
+/** \brief Nearest neighbor search accuracy of the laser odometry and laser mapping (see their searchEpsilon). */
+struct SearchSetting {
+  float odometryEpsilon;
+  float mappingEpsilon;
+};
+
+
+/** \brief Latencies and mapped trajectory of a single replay. */
+struct ReplayResult {
+  ReplayResult()
+      : registration("registration"), odometry("odometry"), mapping("mapping"), total("total"),
+        nMapped(0), replayTime(0) {}
+
+  StageLatency registration;
+  StageLatency odometry;
+  StageLatency mapping;
+  StageLatency total;
+  std::vector<TrajectoryPose> trajectory;   ///< mapped poses in sweep order
+  size_t nMapped;                           ///< number of mapped sweeps
+  double replayTime;                        ///< wall time of the replay in seconds
+};
+
+
+
+/** \brief Drive the scan registration, laser odometry and laser mapping through the given input messages.
+ *
+ * @param input the input messages
+ * @param node the node handle for advertising topics
+ * @param privateNode the private node handle for retrieving parameters
+ * @param setting the search setting to apply, or NULL to keep the configured one
+ * @param result the output latencies and trajectory
+ * @return false if a component could not be set up, true otherwise
+ */
+bool replay(const std::vector<InputMessage>& input,
+            ros::NodeHandle& node,
+            ros::NodeHandle& privateNode,
+            const SearchSetting* setting,
+            ReplayResult& result)
+{
+  // the components share the private namespace, so the per-stage settings are applied right before their setup
+  loam::MultiScanRegistration registration;
+  loam::LaserOdometry odometry;
+  loam::LaserMapping mapping;
+  if (!registration.setup(node, privateNode)) {
+    return false;
+  }
+  if (setting) {
+    privateNode.setParam("searchEpsilon", setting->odometryEpsilon);
+  }
+  if (!odometry.setup(node, privateNode)) {
+    return false;
+  }
+  if (setting) {
+    privateNode.setParam("searchEpsilon", setting->mappingEpsilon);
+  }
+  if (!mapping.setup(node, privateNode)) {
+    return false;
+  }
+
+  ros::Time lastFrameTime, lastOdometryTime, lastMappingTime;
+
+  ros::WallTime replayStart = ros::WallTime::now();
+  for (size_t i = 0; i < input.size(); i++) {
+    if (input[i].imu) {
+      registration.handleIMUMessage(input[i].imu);
+      mapping.imuHandler(input[i].imu);
+      continue;
+    }
+
+    // scan registration
+    ros::WallTime start = ros::WallTime::now();
+    size_t allocStart = nAllocations;
+    registration.handleCloudMessage(input[i].cloud);
+    size_t registrationAllocs = nAllocations - allocStart;
+    double registrationTime = (ros::WallTime::now() - start).toSec();
+
+    const loam_velodyne::FeatureFrame& frame = registration.featureFrame();
+    if (frame.header.stamp == lastFrameTime) {
+      // no sweep completed (e.g. during the registration startup delay)
+      continue;
+    }
+    lastFrameTime = frame.header.stamp;
+    result.registration.samples.push_back(registrationTime);
+    result.registration.allocations.push_back(registrationAllocs);
+
+    // laser odometry
+    loam_velodyne::FeatureFrame::ConstPtr frameMsg(new loam_velodyne::FeatureFrame(frame));
+    start = ros::WallTime::now();
+    odometry.featureFrameHandler(frameMsg);
+    allocStart = nAllocations;
+    odometry.process();
+    result.odometry.allocations.push_back(nAllocations - allocStart);
+    double odometryTime = (ros::WallTime::now() - start).toSec();
+    result.odometry.samples.push_back(odometryTime);
+
+    const nav_msgs::Odometry& laserOdometry = odometry.laserOdometry();
+    if (laserOdometry.header.stamp == lastOdometryTime) {
+      // odometry initialization
+      result.total.samples.push_back(registrationTime + odometryTime);
+      continue;
+    }
+    lastOdometryTime = laserOdometry.header.stamp;
+
+    // laser mapping
+    sensor_msgs::PointCloud2::ConstPtr cornerMsg = toCloudMsg(odometry.lastCornerCloud(), lastOdometryTime);
+    sensor_msgs::PointCloud2::ConstPtr surfMsg = toCloudMsg(odometry.lastSurfaceCloud(), lastOdometryTime);
+    nav_msgs::Odometry::ConstPtr odometryMsg(new nav_msgs::Odometry(laserOdometry));
+    start = ros::WallTime::now();
+    mapping.laserCloudCornerLastHandler(cornerMsg);
+    mapping.laserCloudSurfLastHandler(surfMsg);
+    mapping.laserOdometryHandler(odometryMsg);
+    allocStart = nAllocations;
+    mapping.process();
+    result.mapping.allocations.push_back(nAllocations - allocStart);
+    double mappingTime = (ros::WallTime::now() - start).toSec();
+    result.mapping.samples.push_back(mappingTime);
+    result.total.samples.push_back(registrationTime + odometryTime + mappingTime);
+
+    const nav_msgs::Odometry& mapped = mapping.odomAftMapped();
+    if (mapped.header.stamp != lastMappingTime) {
+      lastMappingTime = mapped.header.stamp;
+      result.nMapped++;
+
+      TrajectoryPose pose;
+      pose.stamp = lastMappingTime;
+      pose.pose = mapped.pose.pose;
+      result.trajectory.push_back(pose);
+    }
+  }
+  result.replayTime = (ros::WallTime::now() - replayStart).toSec();
+
+  return true;
+}
+
+
+
+/** \brief Compare the given trajectory against the given reference trajectory at their common stamps.
+ *
+ * Both trajectories start at the same origin, so no alignment is applied.
+ *
+ * @param trajectory the trajectory to evaluate
+ * @param reference the reference trajectory
+ * @param rmsPosition the output RMS position error in m
+ * @param maxPosition the output maximum position error in m
+ * @param maxRotation the output maximum rotation error in degrees
+ * @return the number of compared poses
+ */
+size_t trajectoryDrift(const std::vector<TrajectoryPose>& trajectory,
+                       const std::vector<TrajectoryPose>& reference,
+                       double& rmsPosition,
+                       double& maxPosition,
+                       double& maxRotation)
+{
+  size_t nCompared = 0;
+  double sqSum = 0;
+  maxPosition = 0;
+  maxRotation = 0;
+
+  size_t j = 0;
+  for (size_t i = 0; i < trajectory.size(); i++) {
+    while (j < reference.size() && reference[j].stamp < trajectory[i].stamp) {
+      j++;
+    }
+    if (j == reference.size()) {
+      break;
+    }
+    if (reference[j].stamp != trajectory[i].stamp) {
+      continue;
+    }
+
+    const geometry_msgs::Pose& a = trajectory[i].pose;
+    const geometry_msgs::Pose& b = reference[j].pose;
+    double dx = a.position.x - b.position.x;
+    double dy = a.position.y - b.position.y;
+    double dz = a.position.z - b.position.z;
+    double sqDist = dx * dx + dy * dy + dz * dz;
+    double dot = std::fabs(a.orientation.x * b.orientation.x + a.orientation.y * b.orientation.y
+                           + a.orientation.z * b.orientation.z + a.orientation.w * b.orientation.w);
+
+    sqSum += sqDist;
+    maxPosition = std::max(maxPosition, std::sqrt(sqDist));
+    maxRotation = std::max(maxRotation, 2 * std::acos(std::min(dot, 1.0)) * 180 / M_PI);
+    nCompared++;
+  }
+
+  rmsPosition = nCompared > 0 ? std::sqrt(sqSum / nCompared) : 0;
+  return nCompared;
+}
+
+
+
+/** Benchmark entry point.
+ *
+ * Loads all point clouds and IMU messages of a bag file into memory and drives the scan registration, laser odometry
+ * and laser mapping back-to-back in a single thread, without any message transport in between. Reports the latency
+ * percentiles of each stage, the throughput and the peak memory usage, and optionally writes the mapped trajectory
+ * (TUM format: stamp x y z qx qy qz qw) for comparisons against a baseline.
+ *
+ * The "allocs p50" column reports the median number of heap allocations per frame of the registration cloud handler
+ * and of the odometry and mapping process() calls, counted by interposing the C allocation functions (malloc,
+ * realloc, ...), through which operator new and the aligned PCL point buffers allocate as well. It includes the
+ * allocations of publishing the results, so it measures how far the steady state is from allocation free.
+ *
+ * With one or more -e options, the replay is instead repeated for each given approximate nearest neighbor search
+ * setting (searchEpsilon of the laser odometry and laser mapping), preceded by an exact search baseline. For each
+ * setting, the mean stage latencies, the speedup over the baseline and the drift of the mapped trajectory from the
+ * baseline trajectory are reported, and the trajectory file receives the baseline trajectory.
+ *
+ * The components read their parameters from the private namespace of the benchmark as usual, except that the mapping
+ * always runs synchronously, every odometry frame is handed to the mapping and no full resolution clouds are
+ * registered. The input topics can be set via the cloudTopic and imuTopic parameters.
+ * Requires a running ROS master, as the components advertise their topics during setup.
+ *
+ * Usage: replayBenchmark [-e <odometry epsilon>:<mapping epsilon> ...] <input.bag> [<trajectory.txt>]
+ */
+int main(int argc, char **argv)
+{
+  ros::init(argc, argv, "replayBenchmark");
+
+  std::vector<SearchSetting> settings;
+  std::vector<const char*> args;
+  for (int i = 1; i < argc; i++) {
+    SearchSetting setting;
+    if (std::strcmp(argv[i], "-e") == 0 && i + 1 < argc
+        && std::sscanf(argv[i + 1], "%f:%f", &setting.odometryEpsilon, &setting.mappingEpsilon) == 2
+        && setting.odometryEpsilon >= 0 && setting.mappingEpsilon >= 0) {
+      settings.push_back(setting);
+      i++;
+    } else if (argv[i][0] == '-') {
+      args.clear();
+      break;
+    } else {
+      args.push_back(argv[i]);
+    }
+  }
+  if (args.empty() || args.size() > 2) {
+    std::printf("Usage: %s [-e <odometry epsilon>:<mapping epsilon> ...] <input.bag> [<trajectory.txt>]\n", argv[0]);
+    return 1;
+  }
+  const char* bagFile = args[0];
+
+  ros::NodeHandle node;
+  ros::NodeHandle privateNode("~");
+
+  privateNode.setParam("threadedMapping", false);
+  privateNode.setParam("ioRatio", 1);
+  privateNode.setParam("featureOnly", true);
+
+  std::string cloudTopic = "/velodyne_points";
+  std::string imuTopic = "/imu/data";
+  privateNode.getParam("cloudTopic", cloudTopic);
+  privateNode.getParam("imuTopic", imuTopic);
+
+
+  // load the input messages into memory
+  std::vector<InputMessage> input;
+  size_t nClouds = 0;
+  try {
+    rosbag::Bag bag(bagFile, rosbag::bagmode::Read);
+    std::vector<std::string> topics;
+    topics.push_back(cloudTopic);
+    topics.push_back(imuTopic);
+    rosbag::View view(bag, rosbag::TopicQuery(topics));
+
+    for (rosbag::View::iterator it = view.begin(); it != view.end(); ++it) {
+      InputMessage msg;
+      msg.cloud = it->instantiate<sensor_msgs::PointCloud2>();
+      msg.imu = it->instantiate<sensor_msgs::Imu>();
+      if (msg.cloud || msg.imu) {
+        nClouds += msg.cloud ? 1 : 0;
+        input.push_back(msg);
+      }
+    }
+    bag.close();
+  } catch (rosbag::BagException& e) {
+    std::printf("Failed to read bag file \"%s\": %s\n", bagFile, e.what());
+    return 1;
+  }
+  std::printf("Loaded %lu point clouds and %lu IMU messages\n",
+              (unsigned long) nClouds, (unsigned long) (input.size() - nClouds));
+
+  FILE* trajectory = NULL;
+  if (args.size() > 1) {
+    trajectory = std::fopen(args[1], "w");
+    if (trajectory == NULL) {
+      std::printf("Failed to open trajectory file \"%s\"\n", args[1]);
+      return 1;
+    }
+  }
+
+
+  // the first replay is the exact search baseline of the search settings, if any
+  SearchSetting exact;
+  exact.odometryEpsilon = 0;
+  exact.mappingEpsilon = 0;
+  ReplayResult result;
+  if (!replay(input, node, privateNode, settings.empty() ? NULL : &exact, result)) {
+    return 1;
+  }
+
+  if (trajectory) {
+    for (size_t i = 0; i < result.trajectory.size(); i++) {
+      const geometry_msgs::Pose& pose = result.trajectory[i].pose;
+      std::fprintf(trajectory, "%.6f %.6f %.6f %.6f %.6f %.6f %.6f %.6f\n", result.trajectory[i].stamp.toSec(),
+                   pose.position.x, pose.position.y, pose.position.z,
+                   pose.orientation.x, pose.orientation.y, pose.orientation.z, pose.orientation.w);
+    }
+    std::fclose(trajectory);
+  }
+
+
+  std::printf("\n%-14s %8s %10s %10s %10s %10s %10s %10s\n",
+              "stage", "frames", "mean [ms]", "p50 [ms]", "p95 [ms]", "p99 [ms]", "max [ms]", "allocs p50");
+  result.registration.print();
+  result.odometry.print();
+  result.mapping.print();
+  result.total.print();
+
+  size_t nSweeps = result.registration.samples.size();
+  std::printf("\nsweeps: %lu, mapped: %lu, replay time: %.3f s, throughput: %.2f frames/s, peak RSS: %.1f MB\n",
+              (unsigned long) nSweeps, (unsigned long) result.nMapped, result.replayTime,
+              result.replayTime > 0 ? nSweeps / result.replayTime : 0.0, peakRSS());
+
+  if (!result.trajectory.empty()) {
+    const geometry_msgs::Point& position = result.trajectory.back().pose.position;
+    std::printf("final position: %.3f %.3f %.3f\n", position.x, position.y, position.z);
+  }
+
+  if (settings.empty()) {
+    return 0;
+  }
+
+
+  // repeat the replay for each search setting and compare it against the exact baseline
+  std::printf("\n%8s %8s %10s %10s %10s %8s %9s %9s %9s %7s\n",
+              "odom eps", "map eps", "odom [ms]", "map [ms]", "total [ms]", "speedup",
+              "rms [m]", "max [m]", "max [deg]", "poses");
+  std::printf("%8g %8g %10.3f %10.3f %10.3f %8.2f %9.4f %9.4f %9.4f %7lu\n",
+              exact.odometryEpsilon, exact.mappingEpsilon,
+              result.odometry.mean(), result.mapping.mean(), result.total.mean(), 1.0, 0.0, 0.0, 0.0,
+              (unsigned long) result.trajectory.size());
+
+  for (size_t i = 0; i < settings.size(); i++) {
+    ReplayResult approximate;
+    if (!replay(input, node, privateNode, &settings[i], approximate)) {
+      return 1;
+    }
+
+    double rmsPosition, maxPosition, maxRotation;
+    size_t nCompared = trajectoryDrift(approximate.trajectory, result.trajectory,
+                                       rmsPosition, maxPosition, maxRotation);
+    double totalMean = approximate.total.mean();
+    std::printf("%8g %8g %10.3f %10.3f %10.3f %8.2f %9.4f %9.4f %9.4f %7lu\n",
+                settings[i].odometryEpsilon, settings[i].mappingEpsilon,
+                approximate.odometry.mean(), approximate.mapping.mean(), totalMean,
+                totalMean > 0 ? result.total.mean() / totalMean : 0.0,
+                rmsPosition, maxPosition, maxRotation, (unsigned long) nCompared);
+  }
+
+  return 0;
+}
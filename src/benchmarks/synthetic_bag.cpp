@@ -0,0 +1,98 @@
+#include <ros/ros.h>
+#include <rosbag/bag.h>
+#include <sensor_msgs/Imu.h>
+#include <sensor_msgs/PointCloud2.h>
+#include <pcl_conversions/pcl_conversions.h>
+#include "loam_velodyne/SyntheticLidar.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+
+/** Synthetic data set generator.
+ *
+ * Writes a deterministic bag file with motion distorted sweeps (/velodyne_points) of a procedurally generated city
+ * scene and, optionally, matching IMU measurements (/imu/data), e.g. as input for the replay benchmark.
+ *
+ * Usage: syntheticBag <output.bag> <lidar> <sweeps> [<columns>] [<imu rate, 0 = none>]
+ */
+int main(int argc, char **argv)
+{
+  if (argc < 4) {
+    std::printf("Usage: %s <output.bag> <VLP-16|HDL-32|HDL-64E|VLS-128> <sweeps> [<columns>] [<imu rate, 0 = none>]\n",
+                argv[0]);
+    return 1;
+  }
+
+  std::string lidarName = argv[2];
+  loam::MultiScanMapper scanMapper;
+  if (lidarName == "VLP-16") {
+    scanMapper = loam::MultiScanMapper::Velodyne_VLP_16();
+  } else if (lidarName == "HDL-32") {
+    scanMapper = loam::MultiScanMapper::Velodyne_HDL_32();
+  } else if (lidarName == "HDL-64E") {
+    scanMapper = loam::MultiScanMapper::Velodyne_HDL_64E();
+  } else if (lidarName == "VLS-128") {
+    scanMapper = loam::MultiScanMapper::Velodyne_VLS_128();
+  } else {
+    std::printf("Invalid lidar: %s\n", lidarName.c_str());
+    return 1;
+  }
+
+  int nSweeps = std::atoi(argv[3]);
+  int nColumns = argc > 4 ? std::atoi(argv[4]) : 1800;
+  double imuRate = argc > 5 ? std::atof(argv[5]) : 200;
+  if (nSweeps < 1 || nColumns < 1 || imuRate < 0) {
+    std::printf("Invalid number of sweeps (%d), columns (%d) or IMU rate (%g)\n", nSweeps, nColumns, imuRate);
+    return 1;
+  }
+
+  const float scanPeriod = 0.1f;
+  const double startTime = 1000;   // bag files do not accept zero time stamps
+
+  loam::SyntheticLidar lidar(scanMapper, nColumns, scanPeriod);
+  lidar.scene = loam::SyntheticScene::city();
+  lidar.trajectory.yawRate = 0.05f;
+
+  rosbag::Bag bag;
+  try {
+    bag.open(argv[1], rosbag::bagmode::Write);
+  } catch (const rosbag::BagException&) {
+    std::printf("Failed to open bag file \"%s\"\n", argv[1]);
+    return 1;
+  }
+
+  pcl::PointCloud<pcl::PointXYZI> sweep;
+  sensor_msgs::PointCloud2 cloudMsg;
+  sensor_msgs::Imu imuMsg;
+  imuMsg.header.frame_id = "/imu";
+  size_t nImu = 0;
+  size_t nPoints = 0;
+
+  for (int i = 0; i < nSweeps; i++) {
+    double sweepStart = i * scanPeriod;
+
+    // IMU measurements are written in time order ahead of the sweep they overlap with
+    for (; imuRate > 0 && nImu / imuRate < sweepStart + scanPeriod; nImu++) {
+      double time = nImu / imuRate;
+      lidar.generateImu(time, imuMsg);
+      imuMsg.header.stamp = ros::Time(startTime + time);
+      bag.write("/imu/data", imuMsg.header.stamp, imuMsg);
+    }
+
+    // the driver stamps each sweep with the time of its last firing
+    lidar.generateSweep(sweepStart, sweep);
+    pcl::toROSMsg(sweep, cloudMsg);
+    cloudMsg.header.stamp = ros::Time(startTime + sweepStart + scanPeriod);
+    cloudMsg.header.frame_id = "/velodyne";
+    bag.write("/velodyne_points", cloudMsg.header.stamp, cloudMsg);
+    nPoints += sweep.size();
+  }
+
+  bag.close();
+
+  std::printf("Wrote %d sweeps (%lu points) and %lu IMU messages to %s\n",
+              nSweeps, (unsigned long) nPoints, (unsigned long) nImu, argv[1]);
+  return 0;
+}
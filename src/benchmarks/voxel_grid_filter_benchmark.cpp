@@ -0,0 +1,109 @@
+#include <ros/ros.h>
+#include <pcl/io/pcd_io.h>
+#include <pcl/filters/voxel_grid.h>
+#include "loam_velodyne/VoxelGridFilter.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+
+typedef pcl::PointCloud<pcl::PointXYZI> Cloud;
+
+
+/** \brief Compute the maximum distance of any point in the given cloud to its nearest neighbor in the reference cloud
+ * (brute force, only intended for comparing filter results).
+ */
+double maxDeviation(const Cloud& cloud, const Cloud& reference)
+{
+  double maxSqDist = 0;
+  for (size_t i = 0; i < cloud.points.size(); i++) {
+    const pcl::PointXYZI& p = cloud.points[i];
+    double minSqDist = INFINITY;
+    for (size_t j = 0; j < reference.points.size(); j++) {
+      const pcl::PointXYZI& q = reference.points[j];
+      double dx = p.x - q.x;
+      double dy = p.y - q.y;
+      double dz = p.z - q.z;
+      double sqDist = dx * dx + dy * dy + dz * dz;
+      if (sqDist < minSqDist) {
+        minSqDist = sqDist;
+      }
+    }
+    if (minSqDist > maxSqDist) {
+      maxSqDist = minSqDist;
+    }
+  }
+
+  return std::sqrt(maxSqDist);
+}
+
+
+
+/** Benchmark entry point.
+ *
+ * Usage: voxelGridFilterBenchmark <leaf size> <iterations> <cloud.pcd> [<cloud.pcd> ...]
+ */
+int main(int argc, char **argv)
+{
+  if (argc < 4) {
+    std::printf("Usage: %s <leaf size> <iterations> <cloud.pcd> [<cloud.pcd> ...]\n", argv[0]);
+    return 1;
+  }
+
+  float leafSize = float(std::atof(argv[1]));
+  int nIterations = std::atoi(argv[2]);
+  if (leafSize <= 0 || nIterations < 1) {
+    std::printf("Invalid leaf size (%g) or number of iterations (%d)\n", leafSize, nIterations);
+    return 1;
+  }
+
+  pcl::VoxelGrid<pcl::PointXYZI> pclFilter;
+  pclFilter.setLeafSize(leafSize, leafSize, leafSize);
+  loam::VoxelGridFilter<pcl::PointXYZI> loamFilter(leafSize);
+
+  std::printf("%-40s %10s %10s %10s %12s %12s %8s %12s\n",
+              "cloud", "points", "pcl size", "loam size", "pcl [ms]", "loam [ms]", "speedup", "max dev [m]");
+
+  for (int arg = 3; arg < argc; arg++) {
+    Cloud::Ptr cloud(new Cloud());
+    if (pcl::io::loadPCDFile<pcl::PointXYZI>(argv[arg], *cloud) != 0) {
+      std::printf("Failed to load point cloud \"%s\"\n", argv[arg]);
+      continue;
+    }
+
+    Cloud pclResult;
+    Cloud loamResult;
+
+    // warm up both filters once before timing
+    pclFilter.setInputCloud(cloud);
+    pclFilter.filter(pclResult);
+    loamFilter.filter(*cloud, loamResult);
+
+    ros::WallTime start = ros::WallTime::now();
+    for (int i = 0; i < nIterations; i++) {
+      pclFilter.setInputCloud(cloud);
+      pclFilter.filter(pclResult);
+    }
+    double pclTime = (ros::WallTime::now() - start).toSec() * 1000 / nIterations;
+
+    start = ros::WallTime::now();
+    for (int i = 0; i < nIterations; i++) {
+      loamFilter.filter(*cloud, loamResult);
+    }
+    double loamTime = (ros::WallTime::now() - start).toSec() * 1000 / nIterations;
+
+    std::printf("%-40s %10lu %10lu %10lu %12.3f %12.3f %8.2f %12.6f\n",
+                argv[arg],
+                (unsigned long) cloud->size(),
+                (unsigned long) pclResult.size(),
+                (unsigned long) loamResult.size(),
+                pclTime,
+                loamTime,
+                loamTime > 0 ? pclTime / loamTime : 0.0,
+                maxDeviation(loamResult, pclResult));
+  }
+
+  return 0;
+}
@@ -31,10 +31,10 @@
 //     Robotics: Science and Systems Conference (RSS). Berkeley, CA, July 2014.
 
 #include "loam_velodyne/CtRot2DScanRegistration.h"
+#include "loam_velodyne/Trace.h"
 #include "math_utils.h"
 
 #include <pcl_conversions/pcl_conversions.h>
-#include <pcl/filters/voxel_grid.h>
 
 
 namespace loam {
@@ -83,13 +83,15 @@ bool CtRot2DScanRegistration::setup(ros::NodeHandle& node,
 
 void CtRot2DScanRegistration::handleCloudMessage(const sensor_msgs::PointCloud2ConstPtr &laserCloudMsg)
 {
+  TraceSpan span("scanRegistration", "handleCloudMessage", laserCloudMsg->header.stamp);
+
   if (_systemDelay > 0) {
     _systemDelay--;
     return;
   }
 
   // fetch new input cloud
-  pcl::PointCloud<pcl::PointXYZ> laserCloudIn;
+  pcl::PointCloud<pcl::PointXYZI> laserCloudIn;
   pcl::fromROSMsg(*laserCloudMsg, laserCloudIn);
 
   process(laserCloudIn, laserCloudMsg->header.stamp);
@@ -97,14 +99,14 @@ void CtRot2DScanRegistration::handleCloudMessage(const sensor_msgs::PointCloud2C
 
 
 
-void CtRot2DScanRegistration::process(const pcl::PointCloud<pcl::PointXYZ>& laserCloudIn,
+void CtRot2DScanRegistration::process(const pcl::PointCloud<pcl::PointXYZI>& laserCloudIn,
                                     const ros::Time& scanTime)
 {
   size_t cloudSize = laserCloudIn.size();
 
   // original loam_continous
-  pcl::PointXYZ laserPointFirst = laserCloudIn.points[0];
-  pcl::PointXYZ laserPointLast = laserCloudIn.points[cloudSize - 1];
+  pcl::PointXYZI laserPointFirst = laserCloudIn.points[0];
+  pcl::PointXYZI laserPointLast = laserCloudIn.points[cloudSize - 1];
 
   float rangeFirst = calcPointDistance(laserPointFirst);
   laserPointFirst.x /= rangeFirst;
@@ -130,14 +132,16 @@ void CtRot2DScanRegistration::process(const pcl::PointCloud<pcl::PointXYZ>& lase
   // reset internal buffers and set IMU start state based on current scan time
   reset(scanTime, newSweep);
 
-  pcl::PointXYZI point;
-  pcl::PointCloud<pcl::PointXYZI> laserCloudScan;
+  PointXYZIRT point;
+  _features.laserCloud.clear();
 
   // extract valid points from input cloud
   for (int i = 0; i < cloudSize; i++) {
     point.x = laserCloudIn[i].y;
     point.y = laserCloudIn[i].z;
     point.z = laserCloudIn[i].x;
+    point.intensity = laserCloudIn[i].intensity;
+    point.ring = 0;
 
     // skip NaN and INF valued points
     if (!pcl_isfinite(point.x) ||
@@ -153,6 +157,7 @@ void CtRot2DScanRegistration::process(const pcl::PointCloud<pcl::PointXYZ>& lase
 
     // calculate relative scan time based on point orientation
     float relTime = 0;
+    point.time = relTime;
 
     // project point to the start of the sweep using corresponding IMU data
     if (hasIMUData()) {
@@ -160,11 +165,9 @@ void CtRot2DScanRegistration::process(const pcl::PointCloud<pcl::PointXYZ>& lase
       transformToStartIMU(point);
     }
 
-    laserCloudScan.push_back(point);
+    _features.laserCloud.push_back(point);
   }
 
-  _laserCloud = laserCloudScan;
-
   // extract features
   extractFeatures();
 
@@ -175,7 +178,7 @@ void CtRot2DScanRegistration::process(const pcl::PointCloud<pcl::PointXYZ>& lase
 
 void CtRot2DScanRegistration::extractFeatures()
 {
-  size_t cloudSize = _laserCloud.size();
+  size_t cloudSize = _features.laserCloud.size();
   size_t startPoints[4] = {5,
                            6 + int((cloudSize - 10) / 4.0),
                            6 + int((cloudSize - 10) / 2.0),
@@ -186,7 +189,7 @@ void CtRot2DScanRegistration::extractFeatures()
                          cloudSize - 6};
 
   // extract features from individual scans
-  pcl::PointCloud<pcl::PointXYZI>::Ptr surfPointsLessFlatScan(new pcl::PointCloud<pcl::PointXYZI>);
+  _surfPointsLessFlatScan.clear();
 
   // reset scan buffers. Exclude invalid points
   setScanBuffersFor(0, cloudSize);
@@ -212,10 +215,10 @@ void CtRot2DScanRegistration::extractFeatures()
         largestPickedNum++;
         if (largestPickedNum <= _config.maxCornerSharp) {
           _regionLabel[regionIdx] = CORNER_SHARP;
-          _cornerPointsSharp.push_back(_laserCloud[scanIdx]);
+          _features.cornerPointsSharp.push_back(_features.laserCloud[scanIdx]);
         } else if (largestPickedNum <= _config.maxCornerSharp*10) {
           _regionLabel[regionIdx] = CORNER_LESS_SHARP;
-          _cornerPointsLessSharp.push_back(_laserCloud[scanIdx]);
+          _features.cornerPointsLessSharp.push_back(_features.laserCloud[scanIdx]);
         }
         else {
           break;
@@ -236,7 +239,7 @@ void CtRot2DScanRegistration::extractFeatures()
 
         smallestPickedNum++;
         _regionLabel[regionIdx] = SURFACE_FLAT;
-        _surfacePointsFlat.push_back(_laserCloud[scanIdx]);
+        _features.surfacePointsFlat.push_back(_features.laserCloud[scanIdx]);
 
         markAsPicked(scanIdx, scanIdx);
       }
@@ -245,19 +248,16 @@ void CtRot2DScanRegistration::extractFeatures()
     // extract less flat surface features
     for (size_t j = 0; j < regionSize; j++) {
       if (_regionLabel[j] <= SURFACE_LESS_FLAT) {
-        surfPointsLessFlatScan->push_back(_laserCloud[sp + j]);
+        _surfPointsLessFlatScan.push_back(_features.laserCloud[sp + j]);
       }
     }
   }
 
   // down size less flat surface point cloud of current scan
-  pcl::PointCloud<pcl::PointXYZI> surfPointsLessFlatScanDS;
-  pcl::VoxelGrid<pcl::PointXYZI> downSizeFilter;
-  downSizeFilter.setInputCloud(surfPointsLessFlatScan);
-  downSizeFilter.setLeafSize(_config.lessFlatFilterSize, _config.lessFlatFilterSize, _config.lessFlatFilterSize);
-  downSizeFilter.filter(surfPointsLessFlatScanDS);
+  _lessFlatFilter.setLeafSize(_config.lessFlatFilterSize);
+  _lessFlatFilter.filter(_surfPointsLessFlatScan, _surfPointsLessFlatScanDS);
 
-  _surfacePointsLessFlat += surfPointsLessFlatScanDS;
+  _features.surfacePointsLessFlat += _surfPointsLessFlatScanDS;
 }
 
 
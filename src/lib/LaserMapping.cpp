@@ -32,12 +32,19 @@
 
 #include "loam_velodyne/LaserMapping.h"
 #include "loam_velodyne/common.h"
+#include "loam_velodyne/Pose.h"
 #include "loam_velodyne/nanoflann_pcl.h"
+#include "loam_velodyne/MapDelta.h"
+#include "loam_velodyne/Trace.h"
 #include "math_utils.h"
 
 #include <Eigen/Eigenvalues>
 #include <Eigen/QR>
 
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
 
 namespace loam {
 
@@ -48,16 +55,43 @@ using std::atan2;
 using std::pow;
 
 
+/** \brief Ensure the given cloud is not shared (e.g. with a published map snapshot) before modifying it.
+ *
+ * @param cloud the cloud to modify
+ */
+inline void makeCloudUnique(pcl::PointCloud<PointXYZIRT>::Ptr& cloud)
+{
+  if (!cloud.unique()) {
+    cloud.reset(new pcl::PointCloud<PointXYZIRT>(*cloud));
+  }
+}
+
+
+/** \brief Clear the given cloud, reusing its capacity unless it is shared (e.g. with a published map snapshot).
+ *
+ * @param cloud the cloud to clear
+ */
+inline void clearCloud(pcl::PointCloud<PointXYZIRT>::Ptr& cloud)
+{
+  if (cloud.unique()) {
+    cloud->clear();
+  } else {
+    cloud.reset(new pcl::PointCloud<PointXYZIRT>());
+  }
+}
+
+
 LaserMapping::LaserMapping(const float& scanPeriod,
                            const size_t& maxIterations)
       : _scanPeriod(scanPeriod),
         _stackFrameNum(1),
+        _maxStackFrameNum(5),
         _mapFrameNum(5),
-        _frameCount(0),
         _mapFrameCount(0),
         _maxIterations(maxIterations),
         _deltaTAbort(0.05),
         _deltaRAbort(0.05),
+        _budgetStops(0),
         _laserCloudCenWidth(10),
         _laserCloudCenHeight(5),
         _laserCloudCenDepth(10),
@@ -65,17 +99,37 @@ LaserMapping::LaserMapping(const float& scanPeriod,
         _laserCloudHeight(11),
         _laserCloudDepth(21),
         _laserCloudNum(_laserCloudWidth * _laserCloudHeight * _laserCloudDepth),
-        _laserCloudCornerLast(new pcl::PointCloud<pcl::PointXYZI>()),
-        _laserCloudSurfLast(new pcl::PointCloud<pcl::PointXYZI>()),
-        _laserCloudFullRes(new pcl::PointCloud<pcl::PointXYZI>()),
-        _laserCloudCornerStack(new pcl::PointCloud<pcl::PointXYZI>()),
-        _laserCloudSurfStack(new pcl::PointCloud<pcl::PointXYZI>()),
-        _laserCloudCornerStackDS(new pcl::PointCloud<pcl::PointXYZI>()),
-        _laserCloudSurfStackDS(new pcl::PointCloud<pcl::PointXYZI>()),
-        _laserCloudSurround(new pcl::PointCloud<pcl::PointXYZI>()),
-        _laserCloudSurroundDS(new pcl::PointCloud<pcl::PointXYZI>()),
-        _laserCloudCornerFromMap(new pcl::PointCloud<pcl::PointXYZI>()),
-        _laserCloudSurfFromMap(new pcl::PointCloud<pcl::PointXYZI>())
+        _laserCloudCornerLast(new pcl::PointCloud<PointXYZIRT>()),
+        _laserCloudSurfLast(new pcl::PointCloud<PointXYZIRT>()),
+        _laserCloudFullRes(new pcl::PointCloud<PointXYZIRT>()),
+        _laserCloudCornerStack(new pcl::PointCloud<PointXYZIRT>()),
+        _laserCloudSurfStack(new pcl::PointCloud<PointXYZIRT>()),
+        _laserCloudCornerStackMapping(new pcl::PointCloud<PointXYZIRT>()),
+        _laserCloudSurfStackMapping(new pcl::PointCloud<PointXYZIRT>()),
+        _laserCloudCornerStackDS(new pcl::PointCloud<PointXYZIRT>()),
+        _laserCloudSurfStackDS(new pcl::PointCloud<PointXYZIRT>()),
+        _laserCloudCornerFromMap(new pcl::PointCloud<PointXYZIRT>()),
+        _laserCloudSurfFromMap(new pcl::PointCloud<PointXYZIRT>()),
+        _mapIndexDirty(true),
+        _mapResolutionLevels(1),
+        _mortonOrder(false),
+        _localizationMode(false),
+        _surroundChanged(false),
+        _mapSubscribers(0),
+        _featureOnly(false),
+        _loadMapOnStartup(false),
+        _saveMapOnShutdown(false),
+        _mapPagingRadius(0),
+        _threadedMapping(true),
+        _stopMapping(false),
+        _stackedFrames(0),
+        _stackFullRes(new pcl::PointCloud<PointXYZIRT>()),
+        _mappingFullRes(new pcl::PointCloud<PointXYZIRT>()),
+        _solveTimeAvg(0),
+        _mapVersion(0),
+        _mapDeltaSubscribers(0),
+        _mapDeltaResync(false),
+        _mapDeltaResyncRequested(false)
 {
   // initialize mapping odometry and odometry tf messages
   _odomAftMapped.header.frame_id = "/camera_init";
@@ -85,7 +139,6 @@ LaserMapping::LaserMapping(const float& scanPeriod,
   _aftMappedTrans.child_frame_id_ = "/aft_mapped";
 
   // initialize frame counter
-  _frameCount = _stackFrameNum - 1;
   _mapFrameCount = _mapFrameNum - 1;
 
   // setup cloud vectors
@@ -95,16 +148,16 @@ LaserMapping::LaserMapping(const float& scanPeriod,
   _laserCloudSurfDSArray.resize(_laserCloudNum);
 
   for (size_t i = 0; i < _laserCloudNum; i++) {
-    _laserCloudCornerArray[i].reset(new pcl::PointCloud<pcl::PointXYZI>());
-    _laserCloudSurfArray[i].reset(new pcl::PointCloud<pcl::PointXYZI>());
-    _laserCloudCornerDSArray[i].reset(new pcl::PointCloud<pcl::PointXYZI>());
-    _laserCloudSurfDSArray[i].reset(new pcl::PointCloud<pcl::PointXYZI>());
+    _laserCloudCornerArray[i].reset(new pcl::PointCloud<PointXYZIRT>());
+    _laserCloudSurfArray[i].reset(new pcl::PointCloud<PointXYZIRT>());
+    _laserCloudCornerDSArray[i].reset(new pcl::PointCloud<PointXYZIRT>());
+    _laserCloudSurfDSArray[i].reset(new pcl::PointCloud<PointXYZIRT>());
   }
 
   // setup down size filters
-  _downSizeFilterCorner.setLeafSize(0.2, 0.2, 0.2);
-  _downSizeFilterSurf.setLeafSize(0.4, 0.4, 0.4);
-  _downSizeFilterMap.setLeafSize(0.6, 0.6, 0.6);
+  _downSizeFilterCorner.setLeafSize(0.2);
+  _downSizeFilterSurf.setLeafSize(0.4);
+  _downSizeFilterMap.setLeafSize(0.6);
 }
 
 
@@ -136,6 +189,18 @@ bool LaserMapping::setup(ros::NodeHandle& node,
     }
   }
 
+  privateNode.getParam("threadedMapping", _threadedMapping);
+
+  if (privateNode.getParam("maxStackFrameNum", iParam)) {
+    if (iParam < 1) {
+      ROS_ERROR("Invalid maxStackFrameNum parameter: %d (expected > 0)", iParam);
+      return false;
+    } else {
+      _maxStackFrameNum = iParam;
+      ROS_INFO("Set maxStackFrameNum: %d", iParam);
+    }
+  }
+
   if (privateNode.getParam("deltaTAbort", fParam)) {
     if (fParam <= 0) {
       ROS_ERROR("Invalid deltaTAbort parameter: %f (expected > 0)", fParam);
@@ -156,12 +221,53 @@ bool LaserMapping::setup(ros::NodeHandle& node,
     }
   }
 
+  if (privateNode.getParam("maxSolveTime", fParam)) {
+    if (fParam < 0) {
+      ROS_ERROR("Invalid maxSolveTime parameter: %f (expected >= 0)", fParam);
+      return false;
+    } else {
+      _solveBudget.setBudget(fParam);
+      ROS_INFO("Set maxSolveTime: %g", fParam);
+    }
+  }
+
+  if (privateNode.getParam("searchEpsilon", fParam)) {
+    if (fParam < 0) {
+      ROS_ERROR("Invalid searchEpsilon parameter: %f (expected >= 0)", fParam);
+      return false;
+    } else {
+      _kdtreeCornerFromMap.setEpsilon(fParam);
+      _kdtreeSurfFromMap.setEpsilon(fParam);
+      for (int level = 1; level < MAX_MAP_RESOLUTION_LEVELS; level++) {
+        _coarseMapLevels[level - 1].cornerTree.setEpsilon(fParam);
+        _coarseMapLevels[level - 1].surfTree.setEpsilon(fParam);
+      }
+      ROS_INFO("Set searchEpsilon: %g", fParam);
+    }
+  }
+
+  if (privateNode.getParam("kdTreeBuildThreads", iParam)) {
+    if (iParam < 0) {
+      ROS_ERROR("Invalid kdTreeBuildThreads parameter: %d (expected >= 0)", iParam);
+      return false;
+    } else {
+      // only large map clouds are split across threads, e.g. full rebuilds after loading a map
+      _kdtreeCornerFromMap.setBuildThreads(iParam);
+      _kdtreeSurfFromMap.setBuildThreads(iParam);
+      for (int level = 1; level < MAX_MAP_RESOLUTION_LEVELS; level++) {
+        _coarseMapLevels[level - 1].cornerTree.setBuildThreads(iParam);
+        _coarseMapLevels[level - 1].surfTree.setBuildThreads(iParam);
+      }
+      ROS_INFO("Set kdTreeBuildThreads: %d", iParam);
+    }
+  }
+
   if (privateNode.getParam("cornerFilterSize", fParam)) {
     if (fParam < 0.001) {
       ROS_ERROR("Invalid cornerFilterSize parameter: %f (expected >= 0.001)", fParam);
       return false;
     } else {
-      _downSizeFilterCorner.setLeafSize(fParam, fParam, fParam);
+      _downSizeFilterCorner.setLeafSize(fParam);
       ROS_INFO("Set corner down size filter leaf size: %g", fParam);
     }
   }
@@ -171,7 +277,7 @@ bool LaserMapping::setup(ros::NodeHandle& node,
       ROS_ERROR("Invalid surfaceFilterSize parameter: %f (expected >= 0.001)", fParam);
       return false;
     } else {
-      _downSizeFilterSurf.setLeafSize(fParam, fParam, fParam);
+      _downSizeFilterSurf.setLeafSize(fParam);
       ROS_INFO("Set surface down size filter leaf size: %g", fParam);
     }
   }
@@ -181,16 +287,106 @@ bool LaserMapping::setup(ros::NodeHandle& node,
       ROS_ERROR("Invalid mapFilterSize parameter: %f (expected >= 0.001)", fParam);
       return false;
     } else {
-      _downSizeFilterMap.setLeafSize(fParam, fParam, fParam);
+      _downSizeFilterMap.setLeafSize(fParam);
       ROS_INFO("Set map down size filter leaf size: %g", fParam);
     }
   }
 
+  if (privateNode.getParam("mapResolutionLevels", iParam)) {
+    if (iParam < 1 || iParam > MAX_MAP_RESOLUTION_LEVELS) {
+      ROS_ERROR("Invalid mapResolutionLevels parameter: %d (expected 1 - %d)", iParam, MAX_MAP_RESOLUTION_LEVELS);
+      return false;
+    } else {
+      _mapResolutionLevels = iParam;
+      ROS_INFO("Set mapResolutionLevels: %d", iParam);
+    }
+  }
+
+  // each coarser resolution level doubles the leaf sizes of the next finer one
+  for (int level = 1; level < _mapResolutionLevels; level++) {
+    MapResolutionLevel& coarse = _coarseMapLevels[level - 1];
+    coarse.scale = float(1 << level);
+    coarse.cornerFilter.setLeafSize(_downSizeFilterCorner.getLeafSize() * coarse.scale);
+    coarse.surfFilter.setLeafSize(_downSizeFilterSurf.getLeafSize() * coarse.scale);
+  }
+
+  // the filters produce the map cube clouds and feature stacks, so their output order is the storage order
+  privateNode.getParam("mortonOrder", _mortonOrder);
+  _downSizeFilterCorner.setMortonOrder(_mortonOrder);
+  _downSizeFilterSurf.setMortonOrder(_mortonOrder);
+  _downSizeFilterMap.setMortonOrder(_mortonOrder);
+  for (int level = 1; level < MAX_MAP_RESOLUTION_LEVELS; level++) {
+    _coarseMapLevels[level - 1].cornerFilter.setMortonOrder(_mortonOrder);
+    _coarseMapLevels[level - 1].surfFilter.setMortonOrder(_mortonOrder);
+  }
+
+  privateNode.getParam("loadMap", _loadMapOnStartup);
+  privateNode.getParam("saveMap", _saveMapOnShutdown);
+  privateNode.getParam("localizationMode", _localizationMode);
+  privateNode.getParam("featureOnly", _featureOnly);
+
+  if (!Trace::setup(privateNode)) {
+    return false;
+  }
+
+  std::string mapDirectory;
+  if (privateNode.getParam("mapDirectory", mapDirectory)) {
+    if (!_mapTileStore.open(mapDirectory, 50.0f)) {
+      return false;
+    }
+    ROS_INFO("Set mapDirectory: %s", mapDirectory.c_str());
+  }
+
+  if (privateNode.getParam("mapPagingRadius", iParam)) {
+    if (iParam != 0 && (iParam < 2 || iParam > 7)) {
+      ROS_ERROR("Invalid mapPagingRadius parameter: %d (expected 0 or 2 - 7)", iParam);
+      return false;
+    } else {
+      _mapPagingRadius = iParam;
+      ROS_INFO("Set mapPagingRadius: %d", iParam);
+    }
+  }
+
+  if ((_loadMapOnStartup || _saveMapOnShutdown || _mapPagingRadius > 0 || _localizationMode)
+      && !_mapTileStore.isOpen()) {
+    ROS_ERROR("Invalid mapDirectory parameter: required for loading / saving / paging the map and localization mode");
+    return false;
+  }
+
+  if (_localizationMode) {
+    // localize against the static map in the map directory, which is paged in on demand and never written back
+    ROS_INFO("Localization mode: map insertion disabled");
+    if (_saveMapOnShutdown) {
+      ROS_WARN("Ignoring saveMap parameter in localization mode");
+      _saveMapOnShutdown = false;
+    }
+    if (_mapPagingRadius == 0) {
+      _mapPagingRadius = 7;
+    }
+    if (!_mapTilePager.start(_mapTileStore, true, true)) {
+      return false;
+    }
+  } else if (_mapPagingRadius > 0) {
+    // with paging, stored tiles are paged in on demand instead of loading them upfront
+    if (!_mapTilePager.start(_mapTileStore, _loadMapOnStartup)) {
+      return false;
+    }
+  } else if (_loadMapOnStartup && !loadMap()) {
+    return false;
+  }
 
   // advertise laser mapping topics
   _pubLaserCloudSurround = node.advertise<sensor_msgs::PointCloud2> ("/laser_cloud_surround", 1);
-  _pubLaserCloudFullRes = node.advertise<sensor_msgs::PointCloud2> ("/velodyne_cloud_registered", 2);
+  if (!_featureOnly) {
+    _pubLaserCloudFullRes = node.advertise<sensor_msgs::PointCloud2> ("/velodyne_cloud_registered", 2);
+  }
   _pubOdomAftMapped = node.advertise<nav_msgs::Odometry> ("/aft_mapped_to_init", 5);
+  _pubMapDelta = node.advertise<loam_velodyne::MapDelta> ("/laser_cloud_map_delta", 5);
+
+  // the map cloud is down sized with the corner filter leaf size
+  _mapCloudPublisher.start(_pubLaserCloudSurround, "/camera_init", _downSizeFilterCorner.getLeafSize());
+  _mapCloudPublisher.enableDeltas(_pubMapDelta, 50.0f,
+                                  _downSizeFilterCorner.getLeafSize(), _downSizeFilterSurf.getLeafSize());
 
 
   // subscribe to laser odometry topics
@@ -203,12 +399,18 @@ bool LaserMapping::setup(ros::NodeHandle& node,
   _subLaserOdometry = node.subscribe<nav_msgs::Odometry>
       ("/laser_odom_to_init", 5, &LaserMapping::laserOdometryHandler, this);
 
-  _subLaserCloudFullRes = node.subscribe<sensor_msgs::PointCloud2>
-      ("/velodyne_cloud_3", 2, &LaserMapping::laserCloudFullResHandler, this);
+  if (!_featureOnly) {
+    _subLaserCloudFullRes = node.subscribe<sensor_msgs::PointCloud2>
+        ("/velodyne_cloud_3", 2, &LaserMapping::laserCloudFullResHandler, this);
+  }
 
   // subscribe to IMU topic
   _subImu = node.subscribe<sensor_msgs::Imu> ("/imu/data", 50, &LaserMapping::imuHandler, this);
 
+  // subscribe to map delta resynchronization requests
+  _subMapDeltaResync = node.subscribe<std_msgs::Empty>
+      ("/laser_cloud_map_delta_resync", 5, &LaserMapping::mapDeltaResyncHandler, this);
+
   return true;
 }
 
@@ -216,88 +418,30 @@ bool LaserMapping::setup(ros::NodeHandle& node,
 
 void LaserMapping::transformAssociateToMap()
 {
-  _transformIncre.pos = _transformBefMapped.pos - _transformSum.pos;
-  rotateYXZ(_transformIncre.pos, -(_transformSum.rot_y), -(_transformSum.rot_x), -(_transformSum.rot_z));
-
-  float sbcx = _transformSum.rot_x.sin();
-  float cbcx = _transformSum.rot_x.cos();
-  float sbcy = _transformSum.rot_y.sin();
-  float cbcy = _transformSum.rot_y.cos();
-  float sbcz = _transformSum.rot_z.sin();
-  float cbcz = _transformSum.rot_z.cos();
-
-  float sblx = _transformBefMapped.rot_x.sin();
-  float cblx = _transformBefMapped.rot_x.cos();
-  float sbly = _transformBefMapped.rot_y.sin();
-  float cbly = _transformBefMapped.rot_y.cos();
-  float sblz = _transformBefMapped.rot_z.sin();
-  float cblz = _transformBefMapped.rot_z.cos();
-
-  float salx = _transformAftMapped.rot_x.sin();
-  float calx = _transformAftMapped.rot_x.cos();
-  float saly = _transformAftMapped.rot_y.sin();
-  float caly = _transformAftMapped.rot_y.cos();
-  float salz = _transformAftMapped.rot_z.sin();
-  float calz = _transformAftMapped.rot_z.cos();
-
-  float srx = -sbcx*(salx*sblx + calx*cblx*salz*sblz + calx*calz*cblx*cblz)
-              - cbcx*sbcy*(calx*calz*(cbly*sblz - cblz*sblx*sbly)
-                           - calx*salz*(cbly*cblz + sblx*sbly*sblz) + cblx*salx*sbly)
-              - cbcx*cbcy*(calx*salz*(cblz*sbly - cbly*sblx*sblz)
-                           - calx*calz*(sbly*sblz + cbly*cblz*sblx) + cblx*cbly*salx);
-  _transformTobeMapped.rot_x = -asin(srx);
-
-  float srycrx = sbcx*(cblx*cblz*(caly*salz - calz*salx*saly)
-                       - cblx*sblz*(caly*calz + salx*saly*salz) + calx*saly*sblx)
-                 - cbcx*cbcy*((caly*calz + salx*saly*salz)*(cblz*sbly - cbly*sblx*sblz)
-                              + (caly*salz - calz*salx*saly)*(sbly*sblz + cbly*cblz*sblx) - calx*cblx*cbly*saly)
-                 + cbcx*sbcy*((caly*calz + salx*saly*salz)*(cbly*cblz + sblx*sbly*sblz)
-                              + (caly*salz - calz*salx*saly)*(cbly*sblz - cblz*sblx*sbly) + calx*cblx*saly*sbly);
-  float crycrx = sbcx*(cblx*sblz*(calz*saly - caly*salx*salz)
-                       - cblx*cblz*(saly*salz + caly*calz*salx) + calx*caly*sblx)
-                 + cbcx*cbcy*((saly*salz + caly*calz*salx)*(sbly*sblz + cbly*cblz*sblx)
-                              + (calz*saly - caly*salx*salz)*(cblz*sbly - cbly*sblx*sblz) + calx*caly*cblx*cbly)
-                 - cbcx*sbcy*((saly*salz + caly*calz*salx)*(cbly*sblz - cblz*sblx*sbly)
-                              + (calz*saly - caly*salx*salz)*(cbly*cblz + sblx*sbly*sblz) - calx*caly*cblx*sbly);
-  _transformTobeMapped.rot_y = atan2(srycrx / _transformTobeMapped.rot_x.cos(),
-                                    crycrx / _transformTobeMapped.rot_x.cos());
-
-  float srzcrx = (cbcz*sbcy - cbcy*sbcx*sbcz)*(calx*salz*(cblz*sbly - cbly*sblx*sblz)
-                                               - calx*calz*(sbly*sblz + cbly*cblz*sblx) + cblx*cbly*salx)
-                 - (cbcy*cbcz + sbcx*sbcy*sbcz)*(calx*calz*(cbly*sblz - cblz*sblx*sbly)
-                                                 - calx*salz*(cbly*cblz + sblx*sbly*sblz) + cblx*salx*sbly)
-                 + cbcx*sbcz*(salx*sblx + calx*cblx*salz*sblz + calx*calz*cblx*cblz);
-  float crzcrx = (cbcy*sbcz - cbcz*sbcx*sbcy)*(calx*calz*(cbly*sblz - cblz*sblx*sbly)
-                                               - calx*salz*(cbly*cblz + sblx*sbly*sblz) + cblx*salx*sbly)
-                 - (sbcy*sbcz + cbcy*cbcz*sbcx)*(calx*salz*(cblz*sbly - cbly*sblx*sblz)
-                                                 - calx*calz*(sbly*sblz + cbly*cblz*sblx) + cblx*cbly*salx)
-                 + cbcx*cbcz*(salx*sblx + calx*cblx*salz*sblz + calx*calz*cblx*cblz);
-  _transformTobeMapped.rot_z = atan2(srzcrx / _transformTobeMapped.rot_x.cos(),
-                                    crzcrx / _transformTobeMapped.rot_x.cos());
-
-  Vector3 v = _transformIncre.pos;
-  rotateZXY(v, _transformTobeMapped.rot_z, _transformTobeMapped.rot_x, _transformTobeMapped.rot_y);
-  _transformTobeMapped.pos = _transformAftMapped.pos - v;
+  // apply the last mapping correction (mapped pose after optimization relative to before) to the current odometry
+  Pose transformTobeMapped = Pose(_transformAftMapped) * Pose(_transformBefMapped).inverse() * Pose(_transformSum);
+  _stackTransformTobeMapped = transformTobeMapped.toTwist();
 }
 
 
 
 void LaserMapping::transformUpdate()
 {
+  boost::unique_lock<boost::mutex> imuLock(_imuMutex);
   if (_imuHistory.size() > 0) {
     size_t imuIdx = 0;
 
-    while (imuIdx < _imuHistory.size() - 1 && (_timeLaserOdometry - _imuHistory[imuIdx].stamp).toSec() + _scanPeriod > 0) {
+    while (imuIdx < _imuHistory.size() - 1 && (_mappingTime - _imuHistory[imuIdx].stamp).toSec() + _scanPeriod > 0) {
       imuIdx++;
     }
 
     IMUState2 imuCur;
 
-    if (imuIdx == 0 || (_timeLaserOdometry - _imuHistory[imuIdx].stamp).toSec() + _scanPeriod > 0) {
+    if (imuIdx == 0 || (_mappingTime - _imuHistory[imuIdx].stamp).toSec() + _scanPeriod > 0) {
       // scan time newer then newest or older than oldest IMU message
       imuCur = _imuHistory[imuIdx];
     } else {
-      float ratio = ((_imuHistory[imuIdx].stamp - _timeLaserOdometry).toSec() - _scanPeriod)
+      float ratio = ((_imuHistory[imuIdx].stamp - _mappingTime).toSec() - _scanPeriod)
                         / (_imuHistory[imuIdx].stamp - _imuHistory[imuIdx - 1].stamp).toSec();
 
       IMUState2::interpolate(_imuHistory[imuIdx], _imuHistory[imuIdx - 1], ratio, imuCur);
@@ -307,42 +451,43 @@ void LaserMapping::transformUpdate()
     _transformTobeMapped.rot_z = 0.998 * _transformTobeMapped.rot_z.rad() + 0.002 * imuCur.roll.rad();
   }
 
-  _transformBefMapped = _transformSum;
+  imuLock.unlock();
+
+  boost::lock_guard<boost::mutex> lock(_stackMutex);
+  _transformBefMapped = _mappingTransformSum;
   _transformAftMapped = _transformTobeMapped;
 }
 
 
 
-void LaserMapping::pointAssociateToMap(const pcl::PointXYZI& pi, pcl::PointXYZI& po)
+void LaserMapping::pointAssociateToMap(const PointXYZIRT& pi, PointXYZIRT& po)
 {
-  po.x = pi.x;
-  po.y = pi.y;
-  po.z = pi.z;
-  po.intensity = pi.intensity;
-
-  rotateZXY(po, _transformTobeMapped.rot_z, _transformTobeMapped.rot_x, _transformTobeMapped.rot_y);
-
-  po.x += _transformTobeMapped.pos.x();
-  po.y += _transformTobeMapped.pos.y();
-  po.z += _transformTobeMapped.pos.z();
+  pointAssociateToMap(pi, po, _transformTobeMapped);
 }
 
 
 
-void LaserMapping::pointAssociateTobeMapped(const pcl::PointXYZI& pi, pcl::PointXYZI& po)
+void LaserMapping::pointAssociateToMap(const PointXYZIRT& pi, PointXYZIRT& po, const Twist& transform)
 {
-  po.x = pi.x - _transformTobeMapped.pos.x();
-  po.y = pi.y - _transformTobeMapped.pos.y();
-  po.z = pi.z - _transformTobeMapped.pos.z();
+  po.x = pi.x;
+  po.y = pi.y;
+  po.z = pi.z;
   po.intensity = pi.intensity;
+  po.time = pi.time;
+  po.ring = pi.ring;
 
-  rotateYXZ(po, -_transformTobeMapped.rot_y, -_transformTobeMapped.rot_x, -_transformTobeMapped.rot_z);
+  rotateZXY(po, transform.rot_z, transform.rot_x, transform.rot_y);
+
+  po.x += transform.pos.x();
+  po.y += transform.pos.y();
+  po.z += transform.pos.z();
 }
 
 
 
 void LaserMapping::laserCloudCornerLastHandler(const sensor_msgs::PointCloud2ConstPtr& cornerPointsLastMsg)
 {
+  TraceSpan span("laserMapping", "laserCloudCornerLastHandler", cornerPointsLastMsg->header.stamp);
   _timeLaserCloudCornerLast = cornerPointsLastMsg->header.stamp;
 
   _laserCloudCornerLast->clear();
@@ -355,6 +500,7 @@ void LaserMapping::laserCloudCornerLastHandler(const sensor_msgs::PointCloud2Con
 
 void LaserMapping::laserCloudSurfLastHandler(const sensor_msgs::PointCloud2ConstPtr& surfacePointsLastMsg)
 {
+  TraceSpan span("laserMapping", "laserCloudSurfLastHandler", surfacePointsLastMsg->header.stamp);
   _timeLaserCloudSurfLast = surfacePointsLastMsg->header.stamp;
 
   _laserCloudSurfLast->clear();
@@ -367,6 +513,7 @@ void LaserMapping::laserCloudSurfLastHandler(const sensor_msgs::PointCloud2Const
 
 void LaserMapping::laserCloudFullResHandler(const sensor_msgs::PointCloud2ConstPtr& laserCloudFullResMsg)
 {
+  TraceSpan span("laserMapping", "laserCloudFullResHandler", laserCloudFullResMsg->header.stamp);
   _timeLaserCloudFullRes = laserCloudFullResMsg->header.stamp;
 
   _laserCloudFullRes->clear();
@@ -411,15 +558,30 @@ void LaserMapping::imuHandler(const sensor_msgs::Imu::ConstPtr& imuIn)
   newState.roll = roll;
   newState.pitch = pitch;
 
+  boost::lock_guard<boost::mutex> lock(_imuMutex);
   _imuHistory.push(newState);
 }
 
 
 
+void LaserMapping::mapDeltaResyncHandler(const std_msgs::Empty::ConstPtr& request)
+{
+  // handled with the next map publishing in the mapping thread
+  _mapDeltaResyncRequested = true;
+}
+
+
+
 void LaserMapping::spin()
 {
   ros::Rate rate(100);
   bool status = ros::ok();
+  Trace::setThreadName("main");
+
+  if (_threadedMapping) {
+    _stopMapping = false;
+    _mappingThread = boost::thread(&LaserMapping::runMapping, this);
+  }
 
   while (status) {
     ros::spinOnce();
@@ -430,9 +592,341 @@ void LaserMapping::spin()
     status = ros::ok();
     rate.sleep();
   }
+
+  if (_threadedMapping) {
+    {
+      boost::lock_guard<boost::mutex> lock(_stackMutex);
+      _stopMapping = true;
+    }
+    _stackCond.notify_all();
+    _mappingThread.join();
+  }
+
+  _mapCloudPublisher.stop();
+
+  if (_saveMapOnShutdown) {
+    saveMap();
+  }
+  _mapTilePager.stop();
+}
+
+
+
+bool LaserMapping::saveMap()
+{
+  ros::WallTime start = ros::WallTime::now();
+  size_t nTiles = 0;
+  bool success = true;
+  std::set<CubeKey> savedKeys;
+
+  // take back cubes whose page out failed meanwhile
+  if (_mapTilePager.isRunning()) {
+    installPagedInTiles();
+  }
+
+  for (int i = 0; i < _laserCloudWidth; i++) {
+    for (int j = 0; j < _laserCloudHeight; j++) {
+      for (int k = 0; k < _laserCloudDepth; k++) {
+        size_t cubeInd = toIndex(i, j, k);
+        if (_laserCloudCornerArray[cubeInd]->empty() && _laserCloudSurfArray[cubeInd]->empty()) {
+          continue;
+        }
+
+        // merge with paged out points of the cube, if any, and keep the stored tile if they can't be read
+        CubeKey key = toCubeKey(i, j, k);
+        savedKeys.insert(key);
+        if (!restoreCube(i, j, k)) {
+          success = false;
+          continue;
+        }
+
+        if (_mapTileStore.writeTile(key, *_laserCloudCornerArray[cubeInd], *_laserCloudSurfArray[cubeInd])) {
+          nTiles++;
+        } else {
+          success = false;
+        }
+      }
+    }
+  }
+
+  // remove tiles of earlier sessions, which may have been mapped relative to a different origin
+  size_t nRemoved = 0;
+  std::vector<CubeKey> keys;
+  if (!_loadMapOnStartup && _mapTileStore.listTiles(keys)) {
+    for (size_t n = 0; n < keys.size(); n++) {
+      if (savedKeys.count(keys[n]) > 0 || _mapTilePager.isPagedOut(keys[n])) {
+        continue;
+      }
+      if (_mapTileStore.removeTile(keys[n])) {
+        nRemoved++;
+      } else {
+        success = false;
+      }
+    }
+  }
+
+  ROS_INFO("Saved %lu map tiles to %s in %.3f s (%lu stale tiles removed)",
+           (unsigned long) nTiles, _mapTileStore.directory().c_str(), (ros::WallTime::now() - start).toSec(),
+           (unsigned long) nRemoved);
+
+  return success;
+}
+
+
+
+bool LaserMapping::loadMap()
+{
+  ros::WallTime start = ros::WallTime::now();
+
+  std::vector<CubeKey> keys;
+  if (!_mapTileStore.listTiles(keys)) {
+    return false;
+  }
+
+  size_t nLoaded = 0;
+  size_t nSkipped = 0;
+  for (size_t n = 0; n < keys.size(); n++) {
+    int i = keys[n].i + _laserCloudCenWidth;
+    int j = keys[n].j + _laserCloudCenHeight;
+    int k = keys[n].k + _laserCloudCenDepth;
+
+    if (i < 0 || i >= _laserCloudWidth ||
+        j < 0 || j >= _laserCloudHeight ||
+        k < 0 || k >= _laserCloudDepth) {
+      // tile outside of the current map cube grid
+      nSkipped++;
+      continue;
+    }
+
+    size_t cubeInd = toIndex(i, j, k);
+    if (_mapTileStore.readTile(keys[n], *_laserCloudCornerArray[cubeInd], *_laserCloudSurfArray[cubeInd])) {
+      invalidateCoarseCube(keys[n]);
+      nLoaded++;
+    }
+  }
+
+  ROS_INFO("Loaded %lu map tiles from %s in %.3f s (%lu tiles outside of the map grid)",
+           (unsigned long) nLoaded, _mapTileStore.directory().c_str(), (ros::WallTime::now() - start).toSec(),
+           (unsigned long) nSkipped);
+
+  return true;
+}
+
+
+void LaserMapping::releaseCube(int i, int j, int k)
+{
+  size_t cubeInd = toIndex(i, j, k);
+  if (_laserCloudCornerArray[cubeInd]->empty() && _laserCloudSurfArray[cubeInd]->empty()) {
+    return;
+  }
+
+  // merge with previously paged out points (if any) before the cube is written again, the stored tile must not be
+  // replaced by the points added since otherwise
+  if (!restoreCube(i, j, k)) {
+    return;
+  }
+
+  // keep released cube (and its clouds if it changed) for the next map delta, such that the map cloud publisher can
+  // release the clouds last sent for it
+  CubeKey key = toCubeKey(i, j, k);
+  MapCubeSnapshot cube;
+  cube.key = key;
+  cube.released = true;
+  if (_dirtyCubes.erase(key) > 0) {
+    cube.cornerCloud = _laserCloudCornerArray[cubeInd];
+    cube.surfaceCloud = _laserCloudSurfArray[cubeInd];
+  }
+  _releasedCubes.push_back(cube);
+  invalidateCoarseCube(key, true);
+
+  if (!_mapTilePager.isRunning()) {
+    // drop the points, but keep the capacity of clouds not shared with a map snapshot or delta for the next cube
+    clearCloud(_laserCloudCornerArray[cubeInd]);
+    clearCloud(_laserCloudSurfArray[cubeInd]);
+    return;
+  }
+
+  MapTile tile;
+  tile.key = key;
+  tile.cornerCloud.swap(_laserCloudCornerArray[cubeInd]);
+  tile.surfaceCloud.swap(_laserCloudSurfArray[cubeInd]);
+  _mapTilePager.pageOut(tile);
+}
+
+
+
+bool LaserMapping::restoreCube(int i, int j, int k)
+{
+  CubeKey key = toCubeKey(i, j, k);
+  if (!_mapTilePager.isRunning() || !_mapTilePager.isPagedOut(key)) {
+    return true;
+  }
+
+  MapTile tile;
+  if (!_mapTilePager.pageInNow(key, tile)) {
+    ROS_WARN("Failed to page in map cube %d/%d/%d, keeping it paged out", key.i, key.j, key.k);
+    return false;
+  }
+  installTile(tile);
+  return true;
+}
+
+
+
+void LaserMapping::installTile(const MapTile& tile)
+{
+  int i = tile.key.i + _laserCloudCenWidth;
+  int j = tile.key.j + _laserCloudCenHeight;
+  int k = tile.key.k + _laserCloudCenDepth;
+
+  if (i < 0 || i >= _laserCloudWidth ||
+      j < 0 || j >= _laserCloudHeight ||
+      k < 0 || k >= _laserCloudDepth) {
+    // cube left the grid while paging in
+    _mapTilePager.pageOut(tile);
+    return;
+  }
+
+  // keep points added to the cube while it was paged out
+  size_t cubeInd = toIndex(i, j, k);
+  _mapIndexDirty = true;
+  tile.mergeInto(_laserCloudCornerArray[cubeInd], _laserCloudSurfArray[cubeInd]);
+  invalidateCoarseCube(tile.key);
+}
+
+
+
+void LaserMapping::invalidateCoarseCube(const CubeKey& key, const bool& release)
+{
+  for (int level = 1; level < _mapResolutionLevels; level++) {
+    std::map<CubeKey, CoarseMapCube>& cubes = _coarseMapLevels[level - 1].cubes;
+    std::map<CubeKey, CoarseMapCube>::iterator cube = cubes.find(key);
+    if (cube == cubes.end()) {
+      continue;
+    }
+
+    if (release) {
+      cubes.erase(cube);
+    } else {
+      // keep the clouds for reusing their capacity
+      cube->second.upToDate = false;
+    }
+  }
+}
+
+
+
+void LaserMapping::installPagedInTiles()
+{
+  size_t nFailures = _mapTilePager.collectPagedIn(_pagedInTiles);
+  if (nFailures > 0) {
+    ROS_WARN("%lu map tile page outs / page ins failed, affected cubes stay in memory / paged out",
+             (unsigned long) nFailures);
+  }
+
+  for (size_t n = 0; n < _pagedInTiles.size(); n++) {
+    installTile(_pagedInTiles[n]);
+  }
+  _pagedInTiles.clear();
+}
+
+
+
+void LaserMapping::updateMapPaging(int centerCubeI, int centerCubeJ, int centerCubeK)
+{
+  TraceSpan span("laserMapping", "updateMapPaging", _mappingTime);
+  if (!_mapTilePager.isRunning()) {
+    return;
+  }
+
+  // merge cubes paged in since the last update
+  installPagedInTiles();
+
+  // page out cubes beyond the paging radius (with one cube hysteresis to avoid thrashing at the border),
+  // page in cubes within the radius, blocking for the cubes used in this frame
+  for (int i = 0; i < _laserCloudWidth; i++) {
+    for (int j = 0; j < _laserCloudHeight; j++) {
+      for (int k = 0; k < _laserCloudDepth; k++) {
+        int dist = std::max(std::abs(i - centerCubeI), std::max(std::abs(j - centerCubeJ), std::abs(k - centerCubeK)));
+        if (dist > _mapPagingRadius + 1) {
+          releaseCube(i, j, k);
+        } else if (dist <= 2) {
+          restoreCube(i, j, k);
+        } else if (dist <= _mapPagingRadius) {
+          _mapTilePager.requestPageIn(toCubeKey(i, j, k));
+        }
+      }
+    }
+  }
+
+  // prefetch the cubes around the position one cube ahead in the direction of travel
+  Vector3 motion = _transformTobeMapped.pos - _lastPagingPos;
+  float motionNorm = motion.norm();
+  _lastPagingPos = _transformTobeMapped.pos;
+  if (motionNorm < 0.01) {
+    return;
+  }
+
+  Vector3 ahead = _transformTobeMapped.pos + motion * (50.0f / motionNorm);
+  int aheadCubeI = int(std::floor((ahead.x() + 25.0f) / 50.0f)) + _laserCloudCenWidth;
+  int aheadCubeJ = int(std::floor((ahead.y() + 25.0f) / 50.0f)) + _laserCloudCenHeight;
+  int aheadCubeK = int(std::floor((ahead.z() + 25.0f) / 50.0f)) + _laserCloudCenDepth;
+
+  for (int i = std::max(aheadCubeI - _mapPagingRadius, 0); i <= std::min(aheadCubeI + _mapPagingRadius, int(_laserCloudWidth) - 1); i++) {
+    for (int j = std::max(aheadCubeJ - _mapPagingRadius, 0); j <= std::min(aheadCubeJ + _mapPagingRadius, int(_laserCloudHeight) - 1); j++) {
+      for (int k = std::max(aheadCubeK - _mapPagingRadius, 0); k <= std::min(aheadCubeK + _mapPagingRadius, int(_laserCloudDepth) - 1); k++) {
+        _mapTilePager.requestPageIn(toCubeKey(i, j, k));
+      }
+    }
+  }
 }
 
 
+
+void LaserMapping::collectMapDelta()
+{
+  _mapVersion++;
+  bool fullUpdate = _mapVersion == 1 || _mapDeltaResync;
+  _mapDeltaResync = false;
+
+  _mapSnapshot.version = _mapVersion;
+  _mapSnapshot.baseVersion = fullUpdate ? 0 : _mapVersion - 1;
+  _mapSnapshot.cubes.swap(_releasedCubes);
+  _releasedCubes.clear();
+  std::vector<CubeKey> retryCubes;
+
+  for (int i = 0; i < _laserCloudWidth; i++) {
+    for (int j = 0; j < _laserCloudHeight; j++) {
+      for (int k = 0; k < _laserCloudDepth; k++) {
+        size_t cubeInd = toIndex(i, j, k);
+        CubeKey key = toCubeKey(i, j, k);
+        if ((!fullUpdate && _dirtyCubes.count(key) == 0)
+            || (_laserCloudCornerArray[cubeInd]->empty() && _laserCloudSurfArray[cubeInd]->empty())) {
+          continue;
+        }
+
+        // cubes are compared against their last sent clouds, so merge with paged out points first (or retry with the
+        // next delta)
+        if (!restoreCube(i, j, k)) {
+          retryCubes.push_back(key);
+          continue;
+        }
+
+        MapCubeSnapshot cube;
+        cube.key = key;
+        cube.cornerCloud = _laserCloudCornerArray[cubeInd];
+        cube.surfaceCloud = _laserCloudSurfArray[cubeInd];
+        _mapSnapshot.cubes.push_back(cube);
+      }
+    }
+  }
+
+  _dirtyCubes.clear();
+  _dirtyCubes.insert(retryCubes.begin(), retryCubes.end());
+}
+
+
+
 void LaserMapping::reset()
 {
   _newLaserCloudCornerLast = false;
@@ -445,11 +939,11 @@ void LaserMapping::reset()
 
 bool LaserMapping::hasNewData()
 {
-  return _newLaserCloudCornerLast && _newLaserCloudSurfLast &&
-         _newLaserCloudFullRes && _newLaserOdometry &&
+  return _newLaserCloudCornerLast && _newLaserCloudSurfLast && _newLaserOdometry &&
          fabs((_timeLaserCloudCornerLast - _timeLaserOdometry).toSec()) < 0.005 &&
          fabs((_timeLaserCloudSurfLast - _timeLaserOdometry).toSec()) < 0.005 &&
-         fabs((_timeLaserCloudFullRes - _timeLaserOdometry).toSec()) < 0.005;
+         (_featureOnly || (_newLaserCloudFullRes &&
+                           fabs((_timeLaserCloudFullRes - _timeLaserOdometry).toSec()) < 0.005));
 }
 
 
@@ -464,32 +958,124 @@ void LaserMapping::process()
   // reset flags, etc.
   reset();
 
-  // skip some frames?!?
-  _frameCount++;
-  if (_frameCount < _stackFrameNum) {
+  // merge new frame into feature stack
+  stackFrame();
+
+  if (_threadedMapping) {
+    // processed by mapping thread
     return;
   }
-  _frameCount = 0;
 
-  pcl::PointXYZI pointSel;
+  {
+    boost::lock_guard<boost::mutex> lock(_stackMutex);
+    if (_stackedFrames < _stackFrameNum) {
+      return;
+    }
+    takeStack();
+  }
+
+  processStack();
+}
 
-  // relate incoming data to map
-  transformAssociateToMap();
 
-  size_t laserCloudCornerLastNum = _laserCloudCornerLast->points.size();
-  for (int i = 0; i < laserCloudCornerLastNum; i++) {
-    pointAssociateToMap(_laserCloudCornerLast->points[i], pointSel);
-    _laserCloudCornerStack->push_back(pointSel);
+
+void LaserMapping::stackFrame()
+{
+  TraceSpan span("laserMapping", "stackFrame", _timeLaserOdometry);
+  {
+    boost::lock_guard<boost::mutex> lock(_stackMutex);
+    if (_stackedFrames == 0) {
+      _stackWallStart = ros::WallTime::now();
+    }
+
+    // relate incoming data to map
+    _stackTransformSum = _transformSum;
+    transformAssociateToMap();
+
+    Eigen::Matrix3f rot = rotationZXY(_stackTransformTobeMapped.rot_z,
+                                      _stackTransformTobeMapped.rot_x,
+                                      _stackTransformTobeMapped.rot_y);
+    Eigen::Vector3f trans = _stackTransformTobeMapped.pos.head<3>();
+
+    size_t laserCloudCornerStackNum = _laserCloudCornerStack->points.size();
+    *_laserCloudCornerStack += *_laserCloudCornerLast;
+    transformCloud(*_laserCloudCornerStack, rot, trans, laserCloudCornerStackNum);
+
+    size_t laserCloudSurfStackNum = _laserCloudSurfStack->points.size();
+    *_laserCloudSurfStack += *_laserCloudSurfLast;
+    transformCloud(*_laserCloudSurfStack, rot, trans, laserCloudSurfStackNum);
+
+    // only the full resolution cloud of the newest stacked frame is registered and published
+    _stackTime = _timeLaserOdometry;
+    _stackFullRes.swap(_laserCloudFullRes);
+    _stackedFrames++;
   }
 
-  size_t laserCloudSurfLastNum = _laserCloudSurfLast->points.size();
-  for (int i = 0; i < laserCloudSurfLastNum; i++) {
-    pointAssociateToMap(_laserCloudSurfLast->points[i], pointSel);
-    _laserCloudSurfStack->push_back(pointSel);
+  _stackCond.notify_one();
+}
+
+
+
+void LaserMapping::takeStack()
+{
+  // time the stacked frames waited for being processed
+  if (Trace::enabled()) {
+    Trace::record("laserMapping", "stackQueued", _stackTime, _stackWallStart, ros::WallTime::now());
+  }
+
+  _laserCloudCornerStack.swap(_laserCloudCornerStackMapping);
+  _laserCloudSurfStack.swap(_laserCloudSurfStackMapping);
+  _mappingFullRes.swap(_stackFullRes);
+  _mappingTime = _stackTime;
+  _mappingTransformSum = _stackTransformSum;
+  _transformTobeMapped = _stackTransformTobeMapped;
+  _stackedFrames = 0;
+}
+
+
+
+void LaserMapping::runMapping()
+{
+  Trace::setThreadName("mapping");
+  while (true) {
+    {
+      boost::unique_lock<boost::mutex> lock(_stackMutex);
+      while (!_stopMapping && _stackedFrames < _stackFrameNum) {
+        _stackCond.wait(lock);
+      }
+
+      if (_stopMapping) {
+        break;
+      }
+
+      takeStack();
+    }
+
+    ros::WallTime start = ros::WallTime::now();
+    processStack();
+    double solveTime = (ros::WallTime::now() - start).toSec();
+
+    // adapt the number of frames merged into the stack to the processing time, such that mapping keeps up with the
+    // incoming frames instead of falling behind
+    _solveTimeAvg = _solveTimeAvg > 0 ? 0.9 * _solveTimeAvg + 0.1 * solveTime : solveTime;
+    int stackFrameNum = std::min(std::max(int(std::ceil(_solveTimeAvg / _scanPeriod)), 1), _maxStackFrameNum);
+
+    boost::lock_guard<boost::mutex> lock(_stackMutex);
+    if (stackFrameNum != _stackFrameNum) {
+      ROS_DEBUG("Mapping takes %.1f ms per stack, merging %d frames per stack", _solveTimeAvg * 1000, stackFrameNum);
+      _stackFrameNum = stackFrameNum;
+    }
   }
+}
+
 
 
-  pcl::PointXYZI pointOnYAxis;
+void LaserMapping::processStack()
+{
+  TraceSpan span("laserMapping", "processStack", _mappingTime);
+  _solveBudget.start();
+
+  PointXYZIRT pointOnYAxis;
   pointOnYAxis.x = 0.0;
   pointOnYAxis.y = 10.0;
   pointOnYAxis.z = 0.0;
@@ -503,9 +1089,11 @@ void LaserMapping::process()
   if (_transformTobeMapped.pos.y() + 25.0 < 0) centerCubeJ--;
   if (_transformTobeMapped.pos.z() + 25.0 < 0) centerCubeK--;
 
+  // shift the cube grid if the center cube gets close to its border, releasing the cubes falling off the grid
   while (centerCubeI < 3) {
     for (int j = 0; j < _laserCloudHeight; j++) {
       for (int k = 0; k < _laserCloudDepth; k++) {
+        releaseCube(_laserCloudWidth - 1, j, k);
       for (int i = _laserCloudWidth - 1; i >= 1; i--) {
         const size_t indexA = toIndex(i, j, k);
         const size_t indexB = toIndex(i-1, j, k);
@@ -521,6 +1109,7 @@ void LaserMapping::process()
   while (centerCubeI >= _laserCloudWidth - 3) {
     for (int j = 0; j < _laserCloudHeight; j++) {
       for (int k = 0; k < _laserCloudDepth; k++) {
+        releaseCube(0, j, k);
        for (int i = 0; i < _laserCloudWidth - 1; i++) {
          const size_t indexA = toIndex(i, j, k);
          const size_t indexB = toIndex(i+1, j, k);
@@ -536,6 +1125,7 @@ void LaserMapping::process()
   while (centerCubeJ < 3) {
     for (int i = 0; i < _laserCloudWidth; i++) {
       for (int k = 0; k < _laserCloudDepth; k++) {
+        releaseCube(i, _laserCloudHeight - 1, k);
         for (int j = _laserCloudHeight - 1; j >= 1; j--) {
           const size_t indexA = toIndex(i, j, k);
           const size_t indexB = toIndex(i, j-1, k);
@@ -551,6 +1141,7 @@ void LaserMapping::process()
   while (centerCubeJ >= _laserCloudHeight - 3) {
     for (int i = 0; i < _laserCloudWidth; i++) {
       for (int k = 0; k < _laserCloudDepth; k++) {
+        releaseCube(i, 0, k);
         for (int j = 0; j < _laserCloudHeight - 1; j++) {
           const size_t indexA = toIndex(i, j, k);
           const size_t indexB = toIndex(i, j+1, k);
@@ -566,6 +1157,7 @@ void LaserMapping::process()
   while (centerCubeK < 3) {
     for (int i = 0; i < _laserCloudWidth; i++) {
       for (int j = 0; j < _laserCloudHeight; j++) {
+        releaseCube(i, j, _laserCloudDepth - 1);
         for (int k = _laserCloudDepth - 1; k >= 1; k--) {
           const size_t indexA = toIndex(i, j, k);
           const size_t indexB = toIndex(i, j, k-1);
@@ -581,6 +1173,7 @@ void LaserMapping::process()
   while (centerCubeK >= _laserCloudDepth - 3) {
     for (int i = 0; i < _laserCloudWidth; i++) {
       for (int j = 0; j < _laserCloudHeight; j++) {
+        releaseCube(i, j, 0);
         for (int k = 0; k < _laserCloudDepth - 1; k++) {
           const size_t indexA = toIndex(i, j, k);
           const size_t indexB = toIndex(i, j, k+1);
@@ -593,8 +1186,13 @@ void LaserMapping::process()
     _laserCloudCenDepth--;
   }
 
+  // page map cubes in / out around the new center cube
+  updateMapPaging(centerCubeI, centerCubeJ, centerCubeK);
+
   _laserCloudValidInd.clear();
   _laserCloudSurroundInd.clear();
+  _validCubes.clear();
+  _surroundCubes.clear();
   for (int i = centerCubeI - 2; i <= centerCubeI + 2; i++) {
     for (int j = centerCubeJ - 2; j <= centerCubeJ + 2; j++) {
       for (int k = centerCubeK - 2; k <= centerCubeK + 2; k++) {
@@ -606,13 +1204,13 @@ void LaserMapping::process()
           float centerY = 50.0f * (j - _laserCloudCenHeight);
           float centerZ = 50.0f * (k - _laserCloudCenDepth);
 
-          pcl::PointXYZI transform_pos = (pcl::PointXYZI) _transformTobeMapped.pos;
+          PointXYZIRT transform_pos = (PointXYZIRT) _transformTobeMapped.pos;
 
           bool isInLaserFOV = false;
           for (int ii = -1; ii <= 1; ii += 2) {
             for (int jj = -1; jj <= 1; jj += 2) {
               for (int kk = -1; kk <= 1; kk += 2) {
-                pcl::PointXYZI corner;
+                PointXYZIRT corner;
                 corner.x = centerX + 25.0f * ii;
                 corner.y = centerY + 25.0f * jj;
                 corner.z = centerZ + 25.0f * kk;
@@ -636,52 +1234,110 @@ void LaserMapping::process()
           size_t cubeIdx = i + _laserCloudWidth*j + _laserCloudWidth * _laserCloudHeight * k;
           if (isInLaserFOV) {
             _laserCloudValidInd.push_back(cubeIdx);
+            _validCubes.push_back(toCubeKey(i, j, k));
           }
           _laserCloudSurroundInd.push_back(cubeIdx);
+          _surroundCubes.push_back(toCubeKey(i, j, k));
         }
       }
     }
   }
 
-  // prepare valid map corner and surface cloud for pose optimization
-  _laserCloudCornerFromMap->clear();
-  _laserCloudSurfFromMap->clear();
-  size_t laserCloudValidNum = _laserCloudValidInd.size();
-  for (int i = 0; i < laserCloudValidNum; i++) {
-    *_laserCloudCornerFromMap += *_laserCloudCornerArray[_laserCloudValidInd[i]];
-    *_laserCloudSurfFromMap += *_laserCloudSurfArray[_laserCloudValidInd[i]];
-  }
+  // prepare valid map corner and surface cloud and their KD-trees for pose optimization
+  // (a static map only needs to be indexed again if other cubes are selected)
+  if (!_localizationMode || _mapIndexDirty || _validCubes != _mapIndexCubes) {
+    TraceSpan indexSpan("laserMapping", "buildMapIndex", _mappingTime);
+    _laserCloudCornerFromMap->clear();
+    _laserCloudSurfFromMap->clear();
+    size_t laserCloudValidNum = _laserCloudValidInd.size();
+    for (int i = 0; i < laserCloudValidNum; i++) {
+      *_laserCloudCornerFromMap += *_laserCloudCornerArray[_laserCloudValidInd[i]];
+      *_laserCloudSurfFromMap += *_laserCloudSurfArray[_laserCloudValidInd[i]];
+    }
+
+    if (_laserCloudCornerFromMap->points.size() > 10 && _laserCloudSurfFromMap->points.size() > 100) {
+      _kdtreeCornerFromMap.setInputCloud(_laserCloudCornerFromMap);
+      _kdtreeSurfFromMap.setInputCloud(_laserCloudSurfFromMap);
+    }
+
+    // assemble the coarse resolution levels from the down sized clouds of the valid cubes, only cubes changed since
+    // their last use need to be down sized again
+    for (int level = 1; level < _mapResolutionLevels; level++) {
+      MapResolutionLevel& coarse = _coarseMapLevels[level - 1];
+      coarse.cornerMap->clear();
+      coarse.surfMap->clear();
+      for (int i = 0; i < laserCloudValidNum; i++) {
+        CoarseMapCube& cube = coarse.cubes[_validCubes[i]];
+        if (!cube.upToDate) {
+          coarse.cornerFilter.filter(*_laserCloudCornerArray[_laserCloudValidInd[i]], *cube.cornerCloud);
+          coarse.surfFilter.filter(*_laserCloudSurfArray[_laserCloudValidInd[i]], *cube.surfCloud);
+          cube.upToDate = true;
+        }
+        *coarse.cornerMap += *cube.cornerCloud;
+        *coarse.surfMap += *cube.surfCloud;
+      }
 
-  // prepare feature stack clouds for pose optimization
-  size_t laserCloudCornerStackNum2 = _laserCloudCornerStack->points.size();
-  for (int i = 0; i < laserCloudCornerStackNum2; i++) {
-    pointAssociateTobeMapped(_laserCloudCornerStack->points[i], _laserCloudCornerStack->points[i]);
+      if (coarse.cornerMap->points.size() > 10 && coarse.surfMap->points.size() > 100) {
+        coarse.cornerTree.setInputCloud(coarse.cornerMap);
+        coarse.surfTree.setInputCloud(coarse.surfMap);
+      }
+    }
+
+    _mapIndexCubes.swap(_validCubes);
+    _mapIndexDirty = false;
   }
 
-  size_t laserCloudSurfStackNum2 = _laserCloudSurfStack->points.size();
-  for (int i = 0; i < laserCloudSurfStackNum2; i++) {
-    pointAssociateTobeMapped(_laserCloudSurfStack->points[i], _laserCloudSurfStack->points[i]);
+  // a static map only needs to be published again if other cubes surround the current position
+  if (_surroundCubes != _publishedSurroundCubes) {
+    _publishedSurroundCubes.swap(_surroundCubes);
+    _surroundChanged = true;
   }
 
+  // prepare feature stack clouds for pose optimization (transform back from the map to the current frame)
+  Eigen::Matrix3f rotTobeMapped = rotationYXZ(-_transformTobeMapped.rot_y,
+                                              -_transformTobeMapped.rot_x,
+                                              -_transformTobeMapped.rot_z);
+  Eigen::Vector3f transTobeMapped = -(rotTobeMapped * _transformTobeMapped.pos.head<3>());
+  transformCloud(*_laserCloudCornerStackMapping, rotTobeMapped, transTobeMapped);
+  transformCloud(*_laserCloudSurfStackMapping, rotTobeMapped, transTobeMapped);
+
   // down sample feature stack clouds
-  _laserCloudCornerStackDS->clear();
-  _downSizeFilterCorner.setInputCloud(_laserCloudCornerStack);
-  _downSizeFilterCorner.filter(*_laserCloudCornerStackDS);
-  size_t laserCloudCornerStackNum = _laserCloudCornerStackDS->points.size();
+  _downSizeFilterCorner.filter(*_laserCloudCornerStackMapping, *_laserCloudCornerStackDS);
+  _downSizeFilterSurf.filter(*_laserCloudSurfStackMapping, *_laserCloudSurfStackDS);
 
-  _laserCloudSurfStackDS->clear();
-  _downSizeFilterSurf.setInputCloud(_laserCloudSurfStack);
-  _downSizeFilterSurf.filter(*_laserCloudSurfStackDS);
-  size_t laserCloudSurfStackNum = _laserCloudSurfStackDS->points.size();
+  for (int level = 1; level < _mapResolutionLevels; level++) {
+    MapResolutionLevel& coarse = _coarseMapLevels[level - 1];
+    coarse.cornerFilter.filter(*_laserCloudCornerStackDS, *coarse.cornerStack);
+    coarse.surfFilter.filter(*_laserCloudSurfStackDS, *coarse.surfStack);
+  }
 
-  _laserCloudCornerStack->clear();
-  _laserCloudSurfStack->clear();
+  _laserCloudCornerStackMapping->clear();
+  _laserCloudSurfStackMapping->clear();
 
 
   // run pose optimization
   optimizeTransformTobeMapped();
 
 
+  // add the feature stack to the map (the map is static in localization mode)
+  if (!_localizationMode) {
+    insertFeatureStack();
+  }
+
+
+  // publish result
+  publishResult();
+}
+
+
+
+void LaserMapping::insertFeatureStack()
+{
+  TraceSpan span("laserMapping", "insertFeatureStack", _mappingTime);
+  PointXYZIRT pointSel;
+  size_t laserCloudCornerStackNum = _laserCloudCornerStackDS->points.size();
+  size_t laserCloudSurfStackNum = _laserCloudSurfStackDS->points.size();
+
   // store down sized corner stack points in corresponding cube clouds
   for (int i = 0; i < laserCloudCornerStackNum; i++) {
     pointAssociateToMap(_laserCloudCornerStackDS->points[i], pointSel);
@@ -698,7 +1354,11 @@ void LaserMapping::process()
         cubeJ >= 0 && cubeJ < _laserCloudHeight &&
         cubeK >= 0 && cubeK < _laserCloudDepth) {
       size_t cubeInd = cubeI + _laserCloudWidth * cubeJ + _laserCloudWidth * _laserCloudHeight * cubeK;
+      CubeKey key = toCubeKey(cubeI, cubeJ, cubeK);
+      makeCloudUnique(_laserCloudCornerArray[cubeInd]);
       _laserCloudCornerArray[cubeInd]->push_back(pointSel);
+      _dirtyCubes.insert(key);
+      invalidateCoarseCube(key);
     }
   }
 
@@ -718,218 +1378,166 @@ void LaserMapping::process()
         cubeJ >= 0 && cubeJ < _laserCloudHeight &&
         cubeK >= 0 && cubeK < _laserCloudDepth) {
       size_t cubeInd = cubeI + _laserCloudWidth * cubeJ + _laserCloudWidth * _laserCloudHeight * cubeK;
+      CubeKey key = toCubeKey(cubeI, cubeJ, cubeK);
+      makeCloudUnique(_laserCloudSurfArray[cubeInd]);
       _laserCloudSurfArray[cubeInd]->push_back(pointSel);
+      _dirtyCubes.insert(key);
+      invalidateCoarseCube(key);
     }
   }
 
   // down size all valid (within field of view) feature cube clouds
+  size_t laserCloudValidNum = _laserCloudValidInd.size();
   for (int i = 0; i < laserCloudValidNum; i++) {
     size_t ind = _laserCloudValidInd[i];
 
-    _laserCloudCornerDSArray[ind]->clear();
-    _downSizeFilterCorner.setInputCloud(_laserCloudCornerArray[ind]);
-    _downSizeFilterCorner.filter(*_laserCloudCornerDSArray[ind]);
+    // the down sized clouds are swapped in below, so previous cube clouds still shared with a map snapshot
+    // must not be reused as filter output
+    if (!_laserCloudCornerDSArray[ind].unique()) {
+      _laserCloudCornerDSArray[ind].reset(new pcl::PointCloud<PointXYZIRT>());
+    }
+    if (!_laserCloudSurfDSArray[ind].unique()) {
+      _laserCloudSurfDSArray[ind].reset(new pcl::PointCloud<PointXYZIRT>());
+    }
+
+    _downSizeFilterCorner.filter(*_laserCloudCornerArray[ind], *_laserCloudCornerDSArray[ind]);
+    _downSizeFilterSurf.filter(*_laserCloudSurfArray[ind], *_laserCloudSurfDSArray[ind]);
 
-    _laserCloudSurfDSArray[ind]->clear();
-    _downSizeFilterSurf.setInputCloud(_laserCloudSurfArray[ind]);
-    _downSizeFilterSurf.filter(*_laserCloudSurfDSArray[ind]);
+    if (_laserCloudCornerDSArray[ind]->size() != _laserCloudCornerArray[ind]->size()
+        || _laserCloudSurfDSArray[ind]->size() != _laserCloudSurfArray[ind]->size()) {
+      // points added while the cube was outside of the field of view got merged
+      invalidateCoarseCube(toCubeKey(ind % _laserCloudWidth,
+                                     (ind / _laserCloudWidth) % _laserCloudHeight,
+                                     ind / (_laserCloudWidth * _laserCloudHeight)));
+    }
 
     // swap cube clouds for next processing
     _laserCloudCornerArray[ind].swap(_laserCloudCornerDSArray[ind]);
     _laserCloudSurfArray[ind].swap(_laserCloudSurfDSArray[ind]);
   }
-
-
-  // publish result
-  publishResult();
 }
 
 
 
 void LaserMapping::optimizeTransformTobeMapped()
 {
+  TraceSpan span("laserMapping", "optimizeTransformTobeMapped", _mappingTime);
   if (_laserCloudCornerFromMap->points.size() <= 10 || _laserCloudSurfFromMap->points.size() <= 100) {
     return;
   }
 
-  pcl::PointXYZI pointSel, pointOri, pointProj, coeff;
+  _solveBudget.startIterations();
 
-  std::vector<int> pointSearchInd(5, 0);
-  std::vector<float> pointSearchSqDis(5, 0);
+  // match against the coarse levels first, such that the finest level starts close to the optimum and only needs few
+  // (expensive) iterations for refinement
+  bool withinBudget = true;
+  for (int level = _mapResolutionLevels - 1; level > 0 && withinBudget; level--) {
+    const MapResolutionLevel& coarse = _coarseMapLevels[level - 1];
+    if (coarse.cornerMap->points.size() <= 10 || coarse.surfMap->points.size() <= 100) {
+      continue;
+    }
+
+    withinBudget = optimizeTransformAtLevel(*coarse.cornerStack, *coarse.surfStack,
+                                            *coarse.cornerMap, *coarse.surfMap,
+                                            coarse.cornerTree, coarse.surfTree,
+                                            coarse.scale, false);
+  }
+
+  if (withinBudget) {
+    optimizeTransformAtLevel(*_laserCloudCornerStackDS, *_laserCloudSurfStackDS,
+                             *_laserCloudCornerFromMap, *_laserCloudSurfFromMap,
+                             _kdtreeCornerFromMap, _kdtreeSurfFromMap,
+                             1.0f, true);
+  }
 
-  nanoflann::KdTreeFLANN<pcl::PointXYZI> kdtreeCornerFromMap;
-  nanoflann::KdTreeFLANN<pcl::PointXYZI> kdtreeSurfFromMap;
+  transformUpdate();
+}
 
-  kdtreeCornerFromMap.setInputCloud(_laserCloudCornerFromMap);
-  kdtreeSurfFromMap.setInputCloud(_laserCloudSurfFromMap);
 
-  Eigen::Matrix<float, 5, 3> matA0;
-  Eigen::Matrix<float, 5, 1> matB0;
-  Eigen::Vector3f matX0;
-  Eigen::Matrix3f matA1;
-  Eigen::Matrix<float, 1, 3> matD1;
-  Eigen::Matrix3f matV1;
 
-  matA0.setZero();
-  matB0.setConstant(-1);
-  matX0.setZero();
+bool LaserMapping::optimizeTransformAtLevel(const pcl::PointCloud<PointXYZIRT>& cornerStack,
+                                            const pcl::PointCloud<PointXYZIRT>& surfStack,
+                                            const pcl::PointCloud<PointXYZIRT>& cornerMap,
+                                            const pcl::PointCloud<PointXYZIRT>& surfMap,
+                                            const nanoflann::KdTreeFLANN<PointXYZIRT>& cornerTree,
+                                            const nanoflann::KdTreeFLANN<PointXYZIRT>& surfTree,
+                                            const float& scale,
+                                            const bool& finestLevel)
+{
+  // neighborhood and plane fit thresholds grow with the leaf size of the level
+  const float maxSqDis = 1.0f * scale * scale;
+  const float maxPlaneDis = 0.2f * scale;
 
-  matA1.setZero();
-  matD1.setZero();
-  matV1.setZero();
+  PointXYZIRT pointSel, pointOri, coeff;
 
   bool isDegenerate = false;
   Eigen::Matrix<float, 6, 6> matP;
 
-  size_t laserCloudCornerStackNum = _laserCloudCornerStackDS->points.size();
-  size_t laserCloudSurfStackNum = _laserCloudSurfStackDS->points.size();
-
-  pcl::PointCloud<pcl::PointXYZI> laserCloudOri;
-  pcl::PointCloud<pcl::PointXYZI> coeffSel;
+  size_t laserCloudCornerStackNum = cornerStack.points.size();
+  size_t laserCloudSurfStackNum = surfStack.points.size();
+
+  // selected points and their coefficients, kept as members to reuse their capacity across frames
+  pcl::PointCloud<PointXYZIRT>& laserCloudOri = _laserCloudOri;
+  pcl::PointCloud<PointXYZIRT>& coeffSel = _coeffSel;
+
+  // the stacks only move rigidly between iterations, so their spatial query order stays valid
+  // (Morton ordered stacks are already stored in such an order)
+  const std::vector<int>* cornerQueryOrder = NULL;
+  const std::vector<int>* surfQueryOrder = NULL;
+  if (!_mortonOrder && laserCloudCornerStackNum > 0) {
+    nanoflann::KdTreeFLANN<PointXYZIRT>::spatialOrder(&cornerStack.points[0], laserCloudCornerStackNum, _cornerQueryOrder,
+                                                      _queryKeys);
+    cornerQueryOrder = &_cornerQueryOrder;
+  }
+  if (!_mortonOrder && laserCloudSurfStackNum > 0) {
+    nanoflann::KdTreeFLANN<PointXYZIRT>::spatialOrder(&surfStack.points[0], laserCloudSurfStackNum, _surfQueryOrder,
+                                                      _queryKeys);
+    surfQueryOrder = &_surfQueryOrder;
+  }
 
   for (size_t iterCount = 0; iterCount < _maxIterations; iterCount++) {
     laserCloudOri.clear();
     coeffSel.clear();
 
+    searchMapNeighbors(cornerStack, cornerTree, cornerQueryOrder);
     for (int i = 0; i < laserCloudCornerStackNum; i++) {
-      pointOri = _laserCloudCornerStackDS->points[i];
-      pointAssociateToMap(pointOri, pointSel);
-      kdtreeCornerFromMap.nearestKSearch(pointSel, 5, pointSearchInd, pointSearchSqDis );
-
-      if (pointSearchSqDis[4] < 1.0) {
-        Vector3 vc(0,0,0);
+      pointOri = cornerStack.points[i];
+      pointSel = _pointsSel.points[i];
+      const int* pointSearchInd = &_pointSearchInd[i * 5];
 
-        for (int j = 0; j < 5; j++) {
-          vc += Vector3(_laserCloudCornerFromMap->points[pointSearchInd[j]]);
-        }
-        vc /= 5.0;
-
-        Eigen::Matrix3f mat_a;
-        mat_a.setZero();
+      if (_pointSearchSqDis[i * 5 + 4] < maxSqDis && fitLineCoefficients(cornerMap, pointSearchInd, pointSel, coeff)) {
+        float s = 1 - 0.9f * fabs(coeff.intensity);
 
-        for (int j = 0; j < 5; j++) {
-          Vector3 a = Vector3(_laserCloudCornerFromMap->points[pointSearchInd[j]]) - vc;
+        coeff.x *= s;
+        coeff.y *= s;
+        coeff.z *= s;
+        coeff.intensity *= s;
 
-          mat_a(0,0) += a.x() * a.x();
-          mat_a(0,1) += a.x() * a.y();
-          mat_a(0,2) += a.x() * a.z();
-          mat_a(1,1) += a.y() * a.y();
-          mat_a(1,2) += a.y() * a.z();
-          mat_a(2,2) += a.z() * a.z();
-        }
-        matA1 = mat_a / 5.0;
-
-        Eigen::SelfAdjointEigenSolver<Eigen::Matrix3f> esolver(matA1);
-        matD1 = esolver.eigenvalues().real();
-        matV1 = esolver.eigenvectors().real();
-
-        if (matD1(0, 0) > 3 * matD1(0, 1)) {
-
-          float x0 = pointSel.x;
-          float y0 = pointSel.y;
-          float z0 = pointSel.z;
-          float x1 = vc.x() + 0.1 * matV1(0, 0);
-          float y1 = vc.y() + 0.1 * matV1(0, 1);
-          float z1 = vc.z() + 0.1 * matV1(0, 2);
-          float x2 = vc.x() - 0.1 * matV1(0, 0);
-          float y2 = vc.y() - 0.1 * matV1(0, 1);
-          float z2 = vc.z() - 0.1 * matV1(0, 2);
-
-          float a012 = sqrt(((x0 - x1)*(y0 - y2) - (x0 - x2)*(y0 - y1))
-                            * ((x0 - x1)*(y0 - y2) - (x0 - x2)*(y0 - y1))
-                            + ((x0 - x1)*(z0 - z2) - (x0 - x2)*(z0 - z1))
-                              * ((x0 - x1)*(z0 - z2) - (x0 - x2)*(z0 - z1))
-                            + ((y0 - y1)*(z0 - z2) - (y0 - y2)*(z0 - z1))
-                              * ((y0 - y1)*(z0 - z2) - (y0 - y2)*(z0 - z1)));
-
-          float l12 = sqrt((x1 - x2)*(x1 - x2) + (y1 - y2)*(y1 - y2) + (z1 - z2)*(z1 - z2));
-
-          float la = ((y1 - y2)*((x0 - x1)*(y0 - y2) - (x0 - x2)*(y0 - y1))
-                      + (z1 - z2)*((x0 - x1)*(z0 - z2) - (x0 - x2)*(z0 - z1))) / a012 / l12;
-
-          float lb = -((x1 - x2)*((x0 - x1)*(y0 - y2) - (x0 - x2)*(y0 - y1))
-                       - (z1 - z2)*((y0 - y1)*(z0 - z2) - (y0 - y2)*(z0 - z1))) / a012 / l12;
-
-          float lc = -((x1 - x2)*((x0 - x1)*(z0 - z2) - (x0 - x2)*(z0 - z1))
-                       + (y1 - y2)*((y0 - y1)*(z0 - z2) - (y0 - y2)*(z0 - z1))) / a012 / l12;
-
-          float ld2 = a012 / l12;
-
-          // TODO: Why writing to a variable that's never read? Maybe it should be used afterwards?
-          pointProj = pointSel;
-          pointProj.x -= la * ld2;
-          pointProj.y -= lb * ld2;
-          pointProj.z -= lc * ld2;
-
-          float s = 1 - 0.9f * fabs(ld2);
-
-          coeff.x = s * la;
-          coeff.y = s * lb;
-          coeff.z = s * lc;
-          coeff.intensity = s * ld2;
-
-          if (s > 0.1) {
-            laserCloudOri.push_back(pointOri);
-            coeffSel.push_back(coeff);
-          }
+        if (s > 0.1) {
+          laserCloudOri.push_back(pointOri);
+          coeffSel.push_back(coeff);
         }
       }
     }
 
+    searchMapNeighbors(surfStack, surfTree, surfQueryOrder);
     for (int i = 0; i < laserCloudSurfStackNum; i++) {
-      pointOri = _laserCloudSurfStackDS->points[i];
-      pointAssociateToMap(pointOri, pointSel);
-      kdtreeSurfFromMap.nearestKSearch(pointSel, 5, pointSearchInd, pointSearchSqDis );
-
-      if (pointSearchSqDis[4] < 1.0) {
-        for (int j = 0; j < 5; j++) {
-          matA0(j, 0) = _laserCloudSurfFromMap->points[pointSearchInd[j]].x;
-          matA0(j, 1) = _laserCloudSurfFromMap->points[pointSearchInd[j]].y;
-          matA0(j, 2) = _laserCloudSurfFromMap->points[pointSearchInd[j]].z;
-        }
-        matX0 = matA0.colPivHouseholderQr().solve(matB0);
-
-        float pa = matX0(0, 0);
-        float pb = matX0(1, 0);
-        float pc = matX0(2, 0);
-        float pd = 1;
-
-        float ps = sqrt(pa * pa + pb * pb + pc * pc);
-        pa /= ps;
-        pb /= ps;
-        pc /= ps;
-        pd /= ps;
-
-        bool planeValid = true;
-        for (int j = 0; j < 5; j++) {
-          if (fabs(pa * _laserCloudSurfFromMap->points[pointSearchInd[j]].x +
-                   pb * _laserCloudSurfFromMap->points[pointSearchInd[j]].y +
-                   pc * _laserCloudSurfFromMap->points[pointSearchInd[j]].z + pd) > 0.2) {
-            planeValid = false;
-            break;
-          }
-        }
-
-        if (planeValid) {
-          float pd2 = pa * pointSel.x + pb * pointSel.y + pc * pointSel.z + pd;
-
-          // TODO: Why writing to a variable that's never read? Maybe it should be used afterwards?
-          pointProj = pointSel;
-          pointProj.x -= pa * pd2;
-          pointProj.y -= pb * pd2;
-          pointProj.z -= pc * pd2;
-
-          float s = 1 - 0.9f * fabs(pd2) / sqrt(calcPointDistance(pointSel));
-
-          coeff.x = s * pa;
-          coeff.y = s * pb;
-          coeff.z = s * pc;
-          coeff.intensity = s * pd2;
-
-          if (s > 0.1) {
-            laserCloudOri.push_back(pointOri);
-            coeffSel.push_back(coeff);
-          }
+      pointOri = surfStack.points[i];
+      pointSel = _pointsSel.points[i];
+      const int* pointSearchInd = &_pointSearchInd[i * 5];
+
+      if (_pointSearchSqDis[i * 5 + 4] < maxSqDis
+          && fitPlaneCoefficients(surfMap, pointSearchInd, maxPlaneDis, pointSel, coeff)) {
+        float s = 1 - 0.9f * fabs(coeff.intensity) / sqrt(calcPointDistance(pointSel));
+
+        coeff.x *= s;
+        coeff.y *= s;
+        coeff.z *= s;
+        coeff.intensity *= s;
+
+        if (s > 0.1) {
+          laserCloudOri.push_back(pointOri);
+          coeffSel.push_back(coeff);
         }
       }
     }
@@ -943,15 +1551,15 @@ void LaserMapping::optimizeTransformTobeMapped()
 
     size_t laserCloudSelNum = laserCloudOri.points.size();
     if (laserCloudSelNum < 50) {
-      continue;
+      // the transform is not updated, so further iterations would select the same points again
+      break;
     }
 
-    Eigen::Matrix<float, Eigen::Dynamic, 6> matA(laserCloudSelNum, 6);
-    Eigen::Matrix<float, 6, Eigen::Dynamic> matAt(6, laserCloudSelNum);
-    Eigen::Matrix<float, 6, 6> matAtA;
-    Eigen::VectorXf matB(laserCloudSelNum);
-    Eigen::VectorXf matAtB;
-    Eigen::VectorXf matX;
+    // accumulate the normal equations directly instead of building the (dynamically sized) Jacobian
+    Eigen::Matrix<float, 6, 6> matAtA = Eigen::Matrix<float, 6, 6>::Zero();
+    Eigen::Matrix<float, 6, 1> matAtB = Eigen::Matrix<float, 6, 1>::Zero();
+    Eigen::Matrix<float, 6, 1> matA;
+    Eigen::Matrix<float, 6, 1> matX;
 
     for (int i = 0; i < laserCloudSelNum; i++) {
       pointOri = laserCloudOri.points[i];
@@ -970,18 +1578,16 @@ void LaserMapping::optimizeTransformTobeMapped()
                   + (crx*crz*pointOri.x - crx*srz*pointOri.y) * coeff.y
                   + ((sry*srz + cry*crz*srx)*pointOri.x + (crz*sry-cry*srx*srz)*pointOri.y)*coeff.z;
 
-      matA(i, 0) = arx;
-      matA(i, 1) = ary;
-      matA(i, 2) = arz;
-      matA(i, 3) = coeff.x;
-      matA(i, 4) = coeff.y;
-      matA(i, 5) = coeff.z;
-      matB(i, 0) = -coeff.intensity;
+      matA(0) = arx;
+      matA(1) = ary;
+      matA(2) = arz;
+      matA(3) = coeff.x;
+      matA(4) = coeff.y;
+      matA(5) = coeff.z;
+      matAtA.noalias() += matA * matA.transpose();
+      matAtB += matA * -coeff.intensity;
     }
 
-    matAt = matA.transpose();
-    matAtA = matAt * matA;
-    matAtB = matAt * matB;
     matX = matAtA.colPivHouseholderQr().solve(matAtB);
 
     if (iterCount == 0) {
@@ -1032,47 +1638,110 @@ void LaserMapping::optimizeTransformTobeMapped()
     if (deltaR < _deltaRAbort && deltaT < _deltaTAbort) {
       break;
     }
+
+    // stop early if a further iteration (on this or a finer level) would exceed the time budget of this stack
+    if (!_solveBudget.nextIteration() && (iterCount + 1 < _maxIterations || !finestLevel)) {
+      _budgetStops++;
+      ROS_DEBUG("Mapping stopped after %lu iterations at resolution level %g (%.1f ms of %.1f ms budget used)",
+                (unsigned long) _solveBudget.iterations(), scale,
+                _solveBudget.elapsed() * 1000, _solveBudget.budget() * 1000);
+      ROS_WARN_THROTTLE(10, "Mapping solver hit its time budget %ld times", _budgetStops);
+      return false;
+    }
   }
 
-  transformUpdate();
+  return true;
+}
+
+
+
+void LaserMapping::searchMapNeighbors(const pcl::PointCloud<PointXYZIRT>& features,
+                                      const nanoflann::KdTreeFLANN<PointXYZIRT>& tree,
+                                      const std::vector<int>* order)
+{
+  size_t nFeatures = features.points.size();
+  _pointsSel.resize(nFeatures);
+  _pointSearchInd.resize(nFeatures * 5);
+  _pointSearchSqDis.resize(nFeatures * 5);
+  if (nFeatures == 0) {
+    return;
+  }
+
+  for (size_t i = 0; i < nFeatures; i++) {
+    pointAssociateToMap(features.points[i], _pointsSel.points[i]);
+  }
+  tree.nearestKSearch(&_pointsSel.points[0], nFeatures, 5, &_pointSearchInd[0], &_pointSearchSqDis[0], order);
 }
 
 
 
 void LaserMapping::publishResult()
 {
+  TraceSpan span("laserMapping", "publishResult", _mappingTime);
+  uint32_t mapSubscribers = _pubLaserCloudSurround.getNumSubscribers();
+  uint32_t mapDeltaSubscribers = _pubMapDelta.getNumSubscribers();
+  bool publishDeltas = mapDeltaSubscribers > 0;
+
+  if (mapSubscribers > _mapSubscribers) {
+    // new subscribers need a map cloud, even if the static map did not change
+    _surroundChanged = true;
+  }
+  _mapSubscribers = mapSubscribers;
+
+  bool resyncRequested = _mapDeltaResyncRequested.exchange(false);
+  if (mapDeltaSubscribers > _mapDeltaSubscribers || resyncRequested) {
+    // new subscribers and clients that missed a delta need a full update, even if the static map did not change
+    _mapDeltaResync = true;
+    _surroundChanged = true;
+  }
+  if (!publishDeltas && _mapDeltaSubscribers > 0) {
+    // the last subscriber left, release the clouds last sent to it
+    _mapCloudPublisher.resetDeltas();
+  }
+  _mapDeltaSubscribers = mapDeltaSubscribers;
+
+  if (!publishDeltas) {
+    // nobody tracks the map deltas, so drop the changes and start over with a full update once somebody does
+    _dirtyCubes.clear();
+    _releasedCubes.clear();
+    _mapDeltaResync = true;
+  }
+
   // publish new map cloud according to the input output ratio
   _mapFrameCount++;
-  if (_mapFrameCount >= _mapFrameNum) {
+  if (_mapFrameCount >= _mapFrameNum && (!_localizationMode || _surroundChanged)
+      && (mapSubscribers > 0 || publishDeltas)) {
     _mapFrameCount = 0;
-
-    // accumulate map cloud
-    _laserCloudSurround->clear();
-    size_t laserCloudSurroundNum = _laserCloudSurroundInd.size();
-    for (int i = 0; i < laserCloudSurroundNum; i++) {
-      size_t ind = _laserCloudSurroundInd[i];
-      *_laserCloudSurround += *_laserCloudCornerArray[ind];
-      *_laserCloudSurround += *_laserCloudSurfArray[ind];
+    _surroundChanged = false;
+
+    // collect snapshot of the surrounding map cubes, which are assembled, down sized and published asynchronously
+    _mapSnapshot.stamp = _mappingTime;
+    _mapSnapshot.clouds.clear();
+    if (mapSubscribers > 0) {
+      size_t laserCloudSurroundNum = _laserCloudSurroundInd.size();
+      for (int i = 0; i < laserCloudSurroundNum; i++) {
+        size_t ind = _laserCloudSurroundInd[i];
+        _mapSnapshot.clouds.push_back(_laserCloudCornerArray[ind]);
+        _mapSnapshot.clouds.push_back(_laserCloudSurfArray[ind]);
+      }
     }
 
-    // down size map cloud
-    _laserCloudSurroundDS->clear();
-    _downSizeFilterCorner.setInputCloud(_laserCloudSurround);
-    _downSizeFilterCorner.filter(*_laserCloudSurroundDS);
+    if (publishDeltas) {
+      collectMapDelta();
+    }
 
-    // publish new map cloud
-    publishCloudMsg(_pubLaserCloudSurround, *_laserCloudSurroundDS, _timeLaserOdometry, "/camera_init");
+    _mapCloudPublisher.publish(_mapSnapshot);
   }
 
 
-  // transform full resolution input cloud to map
-  size_t laserCloudFullResNum = _laserCloudFullRes->points.size();
-  for (int i = 0; i < laserCloudFullResNum; i++) {
-    pointAssociateToMap(_laserCloudFullRes->points[i], _laserCloudFullRes->points[i]);
-  }
+  // transform and publish full resolution input cloud (only if somebody listens)
+  if (!_featureOnly && _pubLaserCloudFullRes.getNumSubscribers() > 0) {
+    transformCloud(*_mappingFullRes,
+                   rotationZXY(_transformTobeMapped.rot_z, _transformTobeMapped.rot_x, _transformTobeMapped.rot_y),
+                   _transformTobeMapped.pos.head<3>());
 
-  // publish transformed full resolution input cloud
-  publishCloudMsg(_pubLaserCloudFullRes, *_laserCloudFullRes, _timeLaserOdometry, "/camera_init");
+    publishCloudMsg(_pubLaserCloudFullRes, *_mappingFullRes, _mappingTime, "/camera_init");
+  }
 
 
   // publish odometry after mapped transformations
@@ -1081,7 +1750,7 @@ void LaserMapping::publishResult()
         -_transformAftMapped.rot_x.rad(),
         -_transformAftMapped.rot_y.rad());
 
-  _odomAftMapped.header.stamp = _timeLaserOdometry;
+  _odomAftMapped.header.stamp = _mappingTime;
   _odomAftMapped.pose.pose.orientation.x = -geoQuat.y;
   _odomAftMapped.pose.pose.orientation.y = -geoQuat.z;
   _odomAftMapped.pose.pose.orientation.z = geoQuat.x;
@@ -1097,7 +1766,7 @@ void LaserMapping::publishResult()
   _odomAftMapped.twist.twist.linear.z = _transformBefMapped.pos.z();
   _pubOdomAftMapped.publish(_odomAftMapped);
 
-  _aftMappedTrans.stamp_ = _timeLaserOdometry;
+  _aftMappedTrans.stamp_ = _mappingTime;
   _aftMappedTrans.setRotation(tf::Quaternion(-geoQuat.y, -geoQuat.z, geoQuat.x, geoQuat.w));
   _aftMappedTrans.setOrigin(tf::Vector3(_transformAftMapped.pos.x(),
                                         _transformAftMapped.pos.y(),
@@ -32,9 +32,12 @@
 
 #include "loam_velodyne/LaserOdometry.h"
 #include "loam_velodyne/common.h"
+#include "loam_velodyne/Pose.h"
+#include "loam_velodyne/Trace.h"
 #include "math_utils.h"
 
 #include <pcl/filters/filter.h>
+#include <pcl/filters/impl/filter.hpp>  // removeNaNFromPointCloud is not precompiled for custom point types
 #include <Eigen/Eigenvalues>
 #include <Eigen/QR>
 
@@ -60,15 +63,13 @@ LaserOdometry::LaserOdometry(const float& scanPeriod,
         _maxIterations(maxIterations),
         _deltaTAbort(0.1),
         _deltaRAbort(0.1),
-        _cornerPointsSharp(new pcl::PointCloud<pcl::PointXYZI>()),
-        _cornerPointsLessSharp(new pcl::PointCloud<pcl::PointXYZI>()),
-        _surfPointsFlat(new pcl::PointCloud<pcl::PointXYZI>()),
-        _surfPointsLessFlat(new pcl::PointCloud<pcl::PointXYZI>()),
-        _laserCloud(new pcl::PointCloud<pcl::PointXYZI>()),
-        _lastCornerCloud(new pcl::PointCloud<pcl::PointXYZI>()),
-        _lastSurfaceCloud(new pcl::PointCloud<pcl::PointXYZI>()),
-        _laserCloudOri(new pcl::PointCloud<pcl::PointXYZI>()),
-        _coeffSel(new pcl::PointCloud<pcl::PointXYZI>())
+        _budgetStops(0),
+        _featureOnly(false),
+        _newFeatures(false),
+        _lastCornerCloud(new pcl::PointCloud<PointXYZIRT>()),
+        _lastSurfaceCloud(new pcl::PointCloud<PointXYZIRT>()),
+        _laserCloudOri(new pcl::PointCloud<PointXYZIRT>()),
+        _coeffSel(new pcl::PointCloud<PointXYZIRT>())
 {
   // initialize odometry and odometry tf messages
   _laserOdometryMsg.header.frame_id = "/camera_init";
@@ -137,264 +138,113 @@ bool LaserOdometry::setup(ros::NodeHandle &node,
     }
   }
 
+  if (privateNode.getParam("maxSolveTime", fParam)) {
+    if (fParam < 0) {
+      ROS_ERROR("Invalid maxSolveTime parameter: %f (expected >= 0)", fParam);
+      return false;
+    } else {
+      _solveBudget.setBudget(fParam);
+      ROS_INFO("Set maxSolveTime: %g", fParam);
+    }
+  }
 
-  // advertise laser odometry topics
-  _pubLaserCloudCornerLast = node.advertise<sensor_msgs::PointCloud2>("/laser_cloud_corner_last", 2);
-  _pubLaserCloudSurfLast   = node.advertise<sensor_msgs::PointCloud2>("/laser_cloud_surf_last", 2);
-  _pubLaserCloudFullRes    = node.advertise<sensor_msgs::PointCloud2>("/velodyne_cloud_3", 2);
-  _pubLaserOdometry        = node.advertise<nav_msgs::Odometry>("/laser_odom_to_init", 5);
-
-
-  // subscribe to scan registration topics
-  _subCornerPointsSharp = node.subscribe<sensor_msgs::PointCloud2>
-      ("/laser_cloud_sharp", 2, &LaserOdometry::laserCloudSharpHandler, this);
-
-  _subCornerPointsLessSharp = node.subscribe<sensor_msgs::PointCloud2>
-      ("/laser_cloud_less_sharp", 2, &LaserOdometry::laserCloudLessSharpHandler, this);
-
-  _subSurfPointsFlat = node.subscribe<sensor_msgs::PointCloud2>
-      ("/laser_cloud_flat", 2, &LaserOdometry::laserCloudFlatHandler, this);
-
-  _subSurfPointsLessFlat = node.subscribe<sensor_msgs::PointCloud2>
-      ("/laser_cloud_less_flat", 2, &LaserOdometry::laserCloudLessFlatHandler, this);
-
-  _subLaserCloudFullRes = node.subscribe<sensor_msgs::PointCloud2>
-      ("/velodyne_cloud_2", 2, &LaserOdometry::laserCloudFullResHandler, this);
-
-  _subImuTrans = node.subscribe<sensor_msgs::PointCloud2>
-      ("/imu_trans", 5, &LaserOdometry::imuTransHandler, this);
-
-  return true;
-}
-
-
-
-void LaserOdometry::transformToStart(const pcl::PointXYZI& pi, pcl::PointXYZI& po)
-{
-  float s = 10 * (pi.intensity - int(pi.intensity));
-
-  po.x = pi.x - s * _transform.pos.x();
-  po.y = pi.y - s * _transform.pos.y();
-  po.z = pi.z - s * _transform.pos.z();
-  po.intensity = pi.intensity;
-
-  Angle rx = -s * _transform.rot_x.rad();
-  Angle ry = -s * _transform.rot_y.rad();
-  Angle rz = -s * _transform.rot_z.rad();
-  rotateZXY(po, rz, rx, ry);
-}
-
-
-
-size_t LaserOdometry::transformToEnd(pcl::PointCloud<pcl::PointXYZI>::Ptr& cloud)
-{
-  size_t cloudSize = cloud->points.size();
-
-  for (size_t i = 0; i < cloudSize; i++) {
-    pcl::PointXYZI& point = cloud->points[i];
-
-    float s = 10 * (point.intensity - int(point.intensity));
-
-    point.x -= s * _transform.pos.x();
-    point.y -= s * _transform.pos.y();
-    point.z -= s * _transform.pos.z();
-    point.intensity = int(point.intensity);
-
-    Angle rx = -s * _transform.rot_x.rad();
-    Angle ry = -s * _transform.rot_y.rad();
-    Angle rz = -s * _transform.rot_z.rad();
-    rotateZXY(point, rz, rx, ry);
-    rotateYXZ(point, _transform.rot_y, _transform.rot_x, _transform.rot_z);
-
-    point.x += _transform.pos.x() - _imuShiftFromStart.x();
-    point.y += _transform.pos.y() - _imuShiftFromStart.y();
-    point.z += _transform.pos.z() - _imuShiftFromStart.z();
-
-    rotateZXY(point, _imuRollStart, _imuPitchStart, _imuYawStart);
-    rotateYXZ(point, -_imuYawEnd, -_imuPitchEnd, -_imuRollEnd);
+  if (privateNode.getParam("searchEpsilon", fParam)) {
+    if (fParam < 0) {
+      ROS_ERROR("Invalid searchEpsilon parameter: %f (expected >= 0)", fParam);
+      return false;
+    } else {
+      _lastCornerKDTree.setEpsilon(fParam);
+      _lastSurfaceKDTree.setEpsilon(fParam);
+      ROS_INFO("Set searchEpsilon: %g", fParam);
+    }
   }
 
-  return cloudSize;
-}
+  privateNode.getParam("featureOnly", _featureOnly);
 
+  if (!Trace::setup(privateNode)) {
+    return false;
+  }
 
 
-void LaserOdometry::pluginIMURotation(const Angle& bcx, const Angle& bcy, const Angle& bcz,
-                                      const Angle& blx, const Angle& bly, const Angle& blz,
-                                      const Angle& alx, const Angle& aly, const Angle& alz,
-                                      Angle &acx, Angle &acy, Angle &acz)
-{
-  float sbcx = bcx.sin();
-  float cbcx = bcx.cos();
-  float sbcy = bcy.sin();
-  float cbcy = bcy.cos();
-  float sbcz = bcz.sin();
-  float cbcz = bcz.cos();
-
-  float sblx = blx.sin();
-  float cblx = blx.cos();
-  float sbly = bly.sin();
-  float cbly = bly.cos();
-  float sblz = blz.sin();
-  float cblz = blz.cos();
-
-  float salx = alx.sin();
-  float calx = alx.cos();
-  float saly = aly.sin();
-  float caly = aly.cos();
-  float salz = alz.sin();
-  float calz = alz.cos();
-
-  float srx = -sbcx*(salx*sblx + calx*caly*cblx*cbly + calx*cblx*saly*sbly)
-            - cbcx*cbcz*(calx*saly*(cbly*sblz - cblz*sblx*sbly)
-                         - calx*caly*(sbly*sblz + cbly*cblz*sblx) + cblx*cblz*salx)
-            - cbcx*sbcz*(calx*caly*(cblz*sbly - cbly*sblx*sblz)
-                         - calx*saly*(cbly*cblz + sblx*sbly*sblz) + cblx*salx*sblz);
-  acx = -asin(srx);
-
-  float srycrx = (cbcy*sbcz - cbcz*sbcx*sbcy)*(calx*saly*(cbly*sblz - cblz*sblx*sbly)
-                                               - calx*caly*(sbly*sblz + cbly*cblz*sblx) + cblx*cblz*salx)
-                 - (cbcy*cbcz + sbcx*sbcy*sbcz)*(calx*caly*(cblz*sbly - cbly*sblx*sblz)
-                                                 - calx*saly*(cbly*cblz + sblx*sbly*sblz) + cblx*salx*sblz)
-                 + cbcx*sbcy*(salx*sblx + calx*caly*cblx*cbly + calx*cblx*saly*sbly);
-  float crycrx = (cbcz*sbcy - cbcy*sbcx*sbcz)*(calx*caly*(cblz*sbly - cbly*sblx*sblz)
-                                               - calx*saly*(cbly*cblz + sblx*sbly*sblz) + cblx*salx*sblz)
-                 - (sbcy*sbcz + cbcy*cbcz*sbcx)*(calx*saly*(cbly*sblz - cblz*sblx*sbly)
-                                                 - calx*caly*(sbly*sblz + cbly*cblz*sblx) + cblx*cblz*salx)
-                 + cbcx*cbcy*(salx*sblx + calx*caly*cblx*cbly + calx*cblx*saly*sbly);
-  acy = atan2(srycrx / acx.cos(), crycrx / acx.cos());
-
-  float srzcrx = sbcx*(cblx*cbly*(calz*saly - caly*salx*salz) - cblx*sbly*(caly*calz + salx*saly*salz) + calx*salz*sblx)
-                 - cbcx*cbcz*((caly*calz + salx*saly*salz)*(cbly*sblz - cblz*sblx*sbly)
-                              + (calz*saly - caly*salx*salz)*(sbly*sblz + cbly*cblz*sblx)
-                              - calx*cblx*cblz*salz)
-                 + cbcx*sbcz*((caly*calz + salx*saly*salz)*(cbly*cblz + sblx*sbly*sblz)
-                              + (calz*saly - caly*salx*salz)*(cblz*sbly - cbly*sblx*sblz)
-                              + calx*cblx*salz*sblz);
-  float crzcrx = sbcx*(cblx*sbly*(caly*salz - calz*salx*saly) - cblx*cbly*(saly*salz + caly*calz*salx) + calx*calz*sblx)
-                 + cbcx*cbcz*((saly*salz + caly*calz*salx)*(sbly*sblz + cbly*cblz*sblx)
-                              + (caly*salz - calz*salx*saly)*(cbly*sblz - cblz*sblx*sbly)
-                              + calx*calz*cblx*cblz)
-                 - cbcx*sbcz*((saly*salz + caly*calz*salx)*(cblz*sbly - cbly*sblx*sblz)
-                              + (caly*salz - calz*salx*saly)*(cbly*cblz + sblx*sbly*sblz)
-                              - calx*calz*cblx*sblz);
-  acz = atan2(srzcrx / acx.cos(), crzcrx / acx.cos());
-}
+  // advertise laser odometry topics
+  _pubLaserCloudCornerLast = node.advertise<sensor_msgs::PointCloud2>("/laser_cloud_corner_last", 2);
+  _pubLaserCloudSurfLast   = node.advertise<sensor_msgs::PointCloud2>("/laser_cloud_surf_last", 2);
+  if (!_featureOnly) {
+    _pubLaserCloudFullRes  = node.advertise<sensor_msgs::PointCloud2>("/velodyne_cloud_3", 2);
+  }
+  _pubLaserOdometry        = node.advertise<nav_msgs::Odometry>("/laser_odom_to_init", 5);
 
 
+  // subscribe to scan registration topic
+  _subFeatureFrame = node.subscribe<loam_velodyne::FeatureFrame>
+      ("/feature_frame", 2, &LaserOdometry::featureFrameHandler, this);
 
-void LaserOdometry::accumulateRotation(Angle cx, Angle cy, Angle cz,
-                                       Angle lx, Angle ly, Angle lz,
-                                       Angle &ox, Angle &oy, Angle &oz)
-{
-  float srx = lx.cos()*cx.cos()*ly.sin()*cz.sin()
-            - cx.cos()*cz.cos()*lx.sin()
-            - lx.cos()*ly.cos()*cx.sin();
-  ox = -asin(srx);
-
-  float srycrx = lx.sin()*(cy.cos()*cz.sin() - cz.cos()*cx.sin()*cy.sin())
-               + lx.cos()*ly.sin()*(cy.cos()*cz.cos() + cx.sin()*cy.sin()*cz.sin())
-               + lx.cos()*ly.cos()*cx.cos()*cy.sin();
-  float crycrx = lx.cos()*ly.cos()*cx.cos()*cy.cos()
-               - lx.cos()*ly.sin()*(cz.cos()*cy.sin() - cy.cos()*cx.sin()*cz.sin())
-               - lx.sin()*(cy.sin()*cz.sin() + cy.cos()*cz.cos()*cx.sin());
-  oy = atan2(srycrx / ox.cos(), crycrx / ox.cos());
-
-  float srzcrx = cx.sin()*(lz.cos()*ly.sin() - ly.cos()*lx.sin()*lz.sin())
-               + cx.cos()*cz.sin()*(ly.cos()*lz.cos() + lx.sin()*ly.sin()*lz.sin())
-               + lx.cos()*cx.cos()*cz.cos()*lz.sin();
-  float crzcrx = lx.cos()*lz.cos()*cx.cos()*cz.cos()
-               - cx.cos()*cz.sin()*(ly.cos()*lz.sin() - lz.cos()*lx.sin()*ly.sin())
-               - cx.sin()*(ly.sin()*lz.sin() + ly.cos()*lz.cos()*lx.sin());
-  oz = atan2(srzcrx / ox.cos(), crzcrx / ox.cos());
+  return true;
 }
 
 
 
-void LaserOdometry::laserCloudSharpHandler(const sensor_msgs::PointCloud2ConstPtr& cornerPointsSharpMsg)
+void LaserOdometry::transformToStart(const pcl::PointCloud<PointXYZIRT>& cloudIn,
+                                     pcl::PointCloud<PointXYZIRT>& cloudOut)
 {
-  _timeCornerPointsSharp = cornerPointsSharpMsg->header.stamp;
-
-  _cornerPointsSharp->clear();
-  pcl::fromROSMsg(*cornerPointsSharpMsg, *_cornerPointsSharp);
-  std::vector<int> indices;
-  pcl::removeNaNFromPointCloud(*_cornerPointsSharp, *_cornerPointsSharp, indices);
-  _newCornerPointsSharp = true;
+  cloudOut = cloudIn;
+  deskewCloud(cloudOut, _transform, _scanPeriod, Eigen::Matrix3f::Identity(), Eigen::Vector3f::Zero());
 }
 
 
 
-void LaserOdometry::laserCloudLessSharpHandler(const sensor_msgs::PointCloud2ConstPtr& cornerPointsLessSharpMsg)
-{
-  _timeCornerPointsLessSharp = cornerPointsLessSharpMsg->header.stamp;
-
-  _cornerPointsLessSharp->clear();
-  pcl::fromROSMsg(*cornerPointsLessSharpMsg, *_cornerPointsLessSharp);
-  std::vector<int> indices;
-  pcl::removeNaNFromPointCloud(*_cornerPointsLessSharp, *_cornerPointsLessSharp, indices);
-  _newCornerPointsLessSharp = true;
-}
 
-
-
-void LaserOdometry::laserCloudFlatHandler(const sensor_msgs::PointCloud2ConstPtr& surfPointsFlatMsg)
+void LaserOdometry::searchClosestPoints(const nanoflann::KdTreeFLANN<PointXYZIRT>& tree)
 {
-  _timeSurfPointsFlat = surfPointsFlatMsg->header.stamp;
+  size_t nPoints = _pointsToStart.points.size();
+  _pointSearchInd.resize(nPoints);
+  _pointSearchSqDis.resize(nPoints);
+  if (nPoints == 0) {
+    return;
+  }
 
-  _surfPointsFlat->clear();
-  pcl::fromROSMsg(*surfPointsFlatMsg, *_surfPointsFlat);
-  std::vector<int> indices;
-  pcl::removeNaNFromPointCloud(*_surfPointsFlat, *_surfPointsFlat, indices);
-  _newSurfPointsFlat = true;
+  nanoflann::KdTreeFLANN<PointXYZIRT>::spatialOrder(&_pointsToStart.points[0], nPoints, _queryOrder, _queryKeys);
+  tree.nearestKSearch(&_pointsToStart.points[0], nPoints, 1, &_pointSearchInd[0], &_pointSearchSqDis[0], &_queryOrder);
 }
 
 
 
-void LaserOdometry::laserCloudLessFlatHandler(const sensor_msgs::PointCloud2ConstPtr& surfPointsLessFlatMsg)
+size_t LaserOdometry::transformToEnd(pcl::PointCloud<PointXYZIRT>& cloud)
 {
-  _timeSurfPointsLessFlat = surfPointsLessFlatMsg->header.stamp;
-
-  _surfPointsLessFlat->clear();
-  pcl::fromROSMsg(*surfPointsLessFlatMsg, *_surfPointsLessFlat);
-  std::vector<int> indices;
-  pcl::removeNaNFromPointCloud(*_surfPointsLessFlat, *_surfPointsLessFlat, indices);
-  _newSurfPointsLessFlat = true;
-}
+  size_t cloudSize = cloud.points.size();
 
+  // after de-skewing to the sweep start, the points are rotated by the sweep motion, shifted and rotated by the IMU
+  // start / end orientations, which is combined into a single rigid transformation
+  Eigen::Matrix3f imuRot = rotationYXZ(-_features.imuYawEnd, -_features.imuPitchEnd, -_features.imuRollEnd)
+                           * rotationZXY(_features.imuRollStart, _features.imuPitchStart, _features.imuYawStart);
+  Eigen::Matrix3f rot = imuRot * rotationYXZ(_transform.rot_y, _transform.rot_x, _transform.rot_z);
+  Eigen::Vector3f trans = imuRot * Eigen::Vector3f((_transform.pos - _features.imuShiftFromStart).head<3>());
 
+  deskewCloud(cloud, _transform, _scanPeriod, rot, trans);
 
-void LaserOdometry::laserCloudFullResHandler(const sensor_msgs::PointCloud2ConstPtr& laserCloudFullResMsg)
-{
-  _timeLaserCloudFullRes = laserCloudFullResMsg->header.stamp;
+  for (size_t i = 0; i < cloudSize; i++) {
+    cloud.points[i].time = 0;
+  }
 
-  _laserCloud->clear();
-  pcl::fromROSMsg(*laserCloudFullResMsg, *_laserCloud);
-  std::vector<int> indices;
-  pcl::removeNaNFromPointCloud(*_laserCloud, *_laserCloud, indices);
-  _newLaserCloudFullRes = true;
+  return cloudSize;
 }
 
 
 
-void LaserOdometry::imuTransHandler(const sensor_msgs::PointCloud2ConstPtr& imuTransMsg)
+void LaserOdometry::featureFrameHandler(const loam_velodyne::FeatureFrame::ConstPtr& featureFrameMsg)
 {
-  _timeImuTrans = imuTransMsg->header.stamp;
-
-  pcl::PointCloud<pcl::PointXYZ> imuTrans;
-  pcl::fromROSMsg(*imuTransMsg, imuTrans);
-
-  _imuPitchStart = imuTrans.points[0].x;
-  _imuYawStart = imuTrans.points[0].y;
-  _imuRollStart = imuTrans.points[0].z;
-
-  _imuPitchEnd = imuTrans.points[1].x;
-  _imuYawEnd = imuTrans.points[1].y;
-  _imuRollEnd = imuTrans.points[1].z;
-
-  _imuShiftFromStart = imuTrans.points[2];
-  _imuVeloFromStart = imuTrans.points[3];
+  TraceSpan span("laserOdometry", "featureFrameHandler", featureFrameMsg->header.stamp);
+  if (!_features.fromMsg(*featureFrameMsg)) {
+    ROS_WARN("Dropping feature frame with inconsistent point counts");
+    return;
+  }
 
-  _newImuTrans = true;
+  pcl::removeNaNFromPointCloud(_features.cornerPointsSharp, _features.cornerPointsSharp, _nanIndices);
+  pcl::removeNaNFromPointCloud(_features.cornerPointsLessSharp, _features.cornerPointsLessSharp, _nanIndices);
+  pcl::removeNaNFromPointCloud(_features.surfacePointsFlat, _features.surfacePointsFlat, _nanIndices);
+  pcl::removeNaNFromPointCloud(_features.surfacePointsLessFlat, _features.surfacePointsLessFlat, _nanIndices);
+  pcl::removeNaNFromPointCloud(_features.laserCloud, _features.laserCloud, _nanIndices);
+  _newFeatures = true;
 }
 
 
@@ -403,6 +253,7 @@ void LaserOdometry::spin()
 {
   ros::Rate rate(100);
   bool status = ros::ok();
+  Trace::setThreadName("main");
 
   // loop until shutdown
   while (status) {
@@ -420,25 +271,14 @@ void LaserOdometry::spin()
 
 void LaserOdometry::reset()
 {
-  _newCornerPointsSharp = false;
-  _newCornerPointsLessSharp = false;
-  _newSurfPointsFlat = false;
-  _newSurfPointsLessFlat = false;
-  _newLaserCloudFullRes = false;
-  _newImuTrans = false;
+  _newFeatures = false;
 }
 
 
 
 bool LaserOdometry::hasNewData()
 {
-  return _newCornerPointsSharp && _newCornerPointsLessSharp && _newSurfPointsFlat &&
-         _newSurfPointsLessFlat && _newLaserCloudFullRes && _newImuTrans &&
-         fabs((_timeCornerPointsSharp - _timeSurfPointsLessFlat).toSec()) < 0.005 &&
-         fabs((_timeCornerPointsLessSharp - _timeSurfPointsLessFlat).toSec()) < 0.005 &&
-         fabs((_timeSurfPointsFlat - _timeSurfPointsLessFlat).toSec()) < 0.005 &&
-         fabs((_timeLaserCloudFullRes - _timeSurfPointsLessFlat).toSec()) < 0.005 &&
-         fabs((_timeImuTrans - _timeSurfPointsLessFlat).toSec()) < 0.005;
+  return _newFeatures;
 }
 
 
@@ -450,42 +290,45 @@ void LaserOdometry::process()
     return;
   }
 
+  TraceSpan span("laserOdometry", "process", _features.sweepStart);
+
   // reset flags, etc.
   reset();
+  _solveBudget.start();
+
+  if (_features.scanPeriod > 0) {
+    _scanPeriod = _features.scanPeriod;
+  }
 
   if (!_systemInited) {
-    _cornerPointsLessSharp.swap(_lastCornerCloud);
-    _surfPointsLessFlat.swap(_lastSurfaceCloud);
+    _lastCornerCloud->swap(_features.cornerPointsLessSharp);
+    _lastSurfaceCloud->swap(_features.surfacePointsLessFlat);
 
     _lastCornerKDTree.setInputCloud(_lastCornerCloud);
     _lastSurfaceKDTree.setInputCloud(_lastSurfaceCloud);
 
-    _transformSum.rot_x += _imuPitchStart;
-    _transformSum.rot_z += _imuRollStart;
+    _transformSum.rot_x += _features.imuPitchStart;
+    _transformSum.rot_z += _features.imuRollStart;
 
     _systemInited = true;
     return;
   }
 
-  pcl::PointXYZI coeff;
+  PointXYZIRT coeff;
   bool isDegenerate = false;
   Eigen::Matrix<float,6,6> matP;
 
   _frameCount++;
-  _transform.pos -= _imuVeloFromStart * _scanPeriod;
+  _transform.pos -= _features.imuVeloFromStart * _scanPeriod;
 
 
   size_t lastCornerCloudSize = _lastCornerCloud->points.size();
   size_t lastSurfaceCloudSize = _lastSurfaceCloud->points.size();
 
   if (lastCornerCloudSize > 10 && lastSurfaceCloudSize > 100) {
-    std::vector<int> pointSearchInd(1);
-    std::vector<float> pointSearchSqDis(1);
-    std::vector<int> indices;
-
-    pcl::removeNaNFromPointCloud(*_cornerPointsSharp, *_cornerPointsSharp, indices);
-    size_t cornerPointsSharpNum = _cornerPointsSharp->points.size();
-    size_t surfPointsFlatNum = _surfPointsFlat->points.size();
+    // the input clouds are already free of NaN points (see handlers), as is the last corner cloud of the KD-tree
+    size_t cornerPointsSharpNum = _features.cornerPointsSharp.points.size();
+    size_t surfPointsFlatNum = _features.surfacePointsFlat.points.size();
 
     _pointSearchCornerInd1.resize(cornerPointsSharpNum);
     _pointSearchCornerInd2.resize(cornerPointsSharpNum);
@@ -493,32 +336,35 @@ void LaserOdometry::process()
     _pointSearchSurfInd2.resize(surfPointsFlatNum);
     _pointSearchSurfInd3.resize(surfPointsFlatNum);
 
+    TraceSpan solveSpan("laserOdometry", "solve", _features.sweepStart);
+    _solveBudget.startIterations();
     for (size_t iterCount = 0; iterCount < _maxIterations; iterCount++) {
-      pcl::PointXYZI pointSel, pointProj, tripod1, tripod2, tripod3;
+      PointXYZIRT pointSel, pointProj, tripod1, tripod2, tripod3;
       _laserCloudOri->clear();
       _coeffSel->clear();
 
+      transformToStart(_features.cornerPointsSharp, _pointsToStart);
+      if (iterCount % 5 == 0) {
+        searchClosestPoints(_lastCornerKDTree);
+      }
       for (int i = 0; i < cornerPointsSharpNum; i++) {
-        transformToStart(_cornerPointsSharp->points[i], pointSel);
+        pointSel = _pointsToStart.points[i];
 
         if (iterCount % 5 == 0) {
-          pcl::removeNaNFromPointCloud(*_lastCornerCloud, *_lastCornerCloud, indices);
-          _lastCornerKDTree.nearestKSearch(pointSel, 1, pointSearchInd, pointSearchSqDis);
-
           int closestPointInd = -1, minPointInd2 = -1;
-          if (pointSearchSqDis[0] < 25) {
-            closestPointInd = pointSearchInd[0];
-            int closestPointScan = int(_lastCornerCloud->points[closestPointInd].intensity);
+          if (_pointSearchSqDis[i] < 25) {
+            closestPointInd = _pointSearchInd[i];
+            int closestPointScan = _lastCornerCloud->points[closestPointInd].ring;
 
             float pointSqDis, minPointSqDis2 = 25;
             for (int j = closestPointInd + 1; j < cornerPointsSharpNum; j++) {
-              if (int(_lastCornerCloud->points[j].intensity) > closestPointScan + 2.5) {
+              if (_lastCornerCloud->points[j].ring > closestPointScan + 2.5) {
                 break;
               }
 
               pointSqDis = calcSquaredDiff(_lastCornerCloud->points[j], pointSel);
 
-              if (int(_lastCornerCloud->points[j].intensity) > closestPointScan) {
+              if (_lastCornerCloud->points[j].ring > closestPointScan) {
                 if (pointSqDis < minPointSqDis2) {
                   minPointSqDis2 = pointSqDis;
                   minPointInd2 = j;
@@ -526,13 +372,13 @@ void LaserOdometry::process()
               }
             }
             for (int j = closestPointInd - 1; j >= 0; j--) {
-              if (int(_lastCornerCloud->points[j].intensity) < closestPointScan - 2.5) {
+              if (_lastCornerCloud->points[j].ring < closestPointScan - 2.5) {
                 break;
               }
 
               pointSqDis = calcSquaredDiff(_lastCornerCloud->points[j], pointSel);
 
-              if (int(_lastCornerCloud->points[j].intensity) < closestPointScan) {
+              if (_lastCornerCloud->points[j].ring < closestPointScan) {
                 if (pointSqDis < minPointSqDis2) {
                   minPointSqDis2 = pointSqDis;
                   minPointInd2 = j;
@@ -596,31 +442,34 @@ void LaserOdometry::process()
           coeff.intensity = s * ld2;
 
           if (s > 0.1 && ld2 != 0) {
-            _laserCloudOri->push_back(_cornerPointsSharp->points[i]);
+            _laserCloudOri->push_back(_features.cornerPointsSharp.points[i]);
             _coeffSel->push_back(coeff);
           }
         }
       }
 
+      transformToStart(_features.surfacePointsFlat, _pointsToStart);
+      if (iterCount % 5 == 0) {
+        searchClosestPoints(_lastSurfaceKDTree);
+      }
       for (int i = 0; i < surfPointsFlatNum; i++) {
-        transformToStart(_surfPointsFlat->points[i], pointSel);
+        pointSel = _pointsToStart.points[i];
 
         if (iterCount % 5 == 0) {
-          _lastSurfaceKDTree.nearestKSearch(pointSel, 1, pointSearchInd, pointSearchSqDis);
           int closestPointInd = -1, minPointInd2 = -1, minPointInd3 = -1;
-          if (pointSearchSqDis[0] < 25) {
-            closestPointInd = pointSearchInd[0];
-            int closestPointScan = int(_lastSurfaceCloud->points[closestPointInd].intensity);
+          if (_pointSearchSqDis[i] < 25) {
+            closestPointInd = _pointSearchInd[i];
+            int closestPointScan = _lastSurfaceCloud->points[closestPointInd].ring;
 
             float pointSqDis, minPointSqDis2 = 25, minPointSqDis3 = 25;
             for (int j = closestPointInd + 1; j < surfPointsFlatNum; j++) {
-              if (int(_lastSurfaceCloud->points[j].intensity) > closestPointScan + 2.5) {
+              if (_lastSurfaceCloud->points[j].ring > closestPointScan + 2.5) {
                 break;
               }
 
               pointSqDis = calcSquaredDiff(_lastSurfaceCloud->points[j], pointSel);
 
-              if (int(_lastSurfaceCloud->points[j].intensity) <= closestPointScan) {
+              if (_lastSurfaceCloud->points[j].ring <= closestPointScan) {
                 if (pointSqDis < minPointSqDis2) {
                   minPointSqDis2 = pointSqDis;
                   minPointInd2 = j;
@@ -633,13 +482,13 @@ void LaserOdometry::process()
               }
             }
             for (int j = closestPointInd - 1; j >= 0; j--) {
-              if (int(_lastSurfaceCloud->points[j].intensity) < closestPointScan - 2.5) {
+              if (_lastSurfaceCloud->points[j].ring < closestPointScan - 2.5) {
                 break;
               }
 
               pointSqDis = calcSquaredDiff(_lastSurfaceCloud->points[j], pointSel);
 
-              if (int(_lastSurfaceCloud->points[j].intensity) >= closestPointScan) {
+              if (_lastSurfaceCloud->points[j].ring >= closestPointScan) {
                 if (pointSqDis < minPointSqDis2) {
                   minPointSqDis2 = pointSqDis;
                   minPointInd2 = j;
@@ -696,7 +545,7 @@ void LaserOdometry::process()
           coeff.intensity = s * pd2;
 
           if (s > 0.1 && pd2 != 0) {
-            _laserCloudOri->push_back(_surfPointsFlat->points[i]);
+            _laserCloudOri->push_back(_features.surfacePointsFlat.points[i]);
             _coeffSel->push_back(coeff);
           }
         }
@@ -707,73 +556,11 @@ void LaserOdometry::process()
         continue;
       }
 
-      Eigen::Matrix<float,Eigen::Dynamic,6> matA(pointSelNum, 6);
-      Eigen::Matrix<float,6,Eigen::Dynamic> matAt(6,pointSelNum);
-      Eigen::Matrix<float,6,6> matAtA;
-      Eigen::VectorXf matB(pointSelNum);
-      Eigen::Matrix<float,6,1> matAtB;
+      // accumulate the normal equations directly instead of building the (dynamically sized) Jacobian
+      Eigen::Matrix<float,6,6> matAtA = Eigen::Matrix<float,6,6>::Zero();
+      Eigen::Matrix<float,6,1> matAtB = Eigen::Matrix<float,6,1>::Zero();
       Eigen::Matrix<float,6,1> matX;
-
-      for (int i = 0; i < pointSelNum; i++) {
-        const pcl::PointXYZI& pointOri = _laserCloudOri->points[i];
-        coeff = _coeffSel->points[i];
-
-        float s = 1;
-
-        float srx = sin(s * _transform.rot_x.rad());
-        float crx = cos(s * _transform.rot_x.rad());
-        float sry = sin(s * _transform.rot_y.rad());
-        float cry = cos(s * _transform.rot_y.rad());
-        float srz = sin(s * _transform.rot_z.rad());
-        float crz = cos(s * _transform.rot_z.rad());
-        float tx = s * _transform.pos.x();
-        float ty = s * _transform.pos.y();
-        float tz = s * _transform.pos.z();
-
-        float arx = (-s*crx*sry*srz*pointOri.x + s*crx*crz*sry*pointOri.y + s*srx*sry*pointOri.z
-                     + s*tx*crx*sry*srz - s*ty*crx*crz*sry - s*tz*srx*sry) * coeff.x
-                    + (s*srx*srz*pointOri.x - s*crz*srx*pointOri.y + s*crx*pointOri.z
-                       + s*ty*crz*srx - s*tz*crx - s*tx*srx*srz) * coeff.y
-                    + (s*crx*cry*srz*pointOri.x - s*crx*cry*crz*pointOri.y - s*cry*srx*pointOri.z
-                       + s*tz*cry*srx + s*ty*crx*cry*crz - s*tx*crx*cry*srz) * coeff.z;
-
-        float ary = ((-s*crz*sry - s*cry*srx*srz)*pointOri.x
-                     + (s*cry*crz*srx - s*sry*srz)*pointOri.y - s*crx*cry*pointOri.z
-                     + tx*(s*crz*sry + s*cry*srx*srz) + ty*(s*sry*srz - s*cry*crz*srx)
-                     + s*tz*crx*cry) * coeff.x
-                    + ((s*cry*crz - s*srx*sry*srz)*pointOri.x
-                       + (s*cry*srz + s*crz*srx*sry)*pointOri.y - s*crx*sry*pointOri.z
-                       + s*tz*crx*sry - ty*(s*cry*srz + s*crz*srx*sry)
-                       - tx*(s*cry*crz - s*srx*sry*srz)) * coeff.z;
-
-        float arz = ((-s*cry*srz - s*crz*srx*sry)*pointOri.x + (s*cry*crz - s*srx*sry*srz)*pointOri.y
-                     + tx*(s*cry*srz + s*crz*srx*sry) - ty*(s*cry*crz - s*srx*sry*srz)) * coeff.x
-                    + (-s*crx*crz*pointOri.x - s*crx*srz*pointOri.y
-                       + s*ty*crx*srz + s*tx*crx*crz) * coeff.y
-                    + ((s*cry*crz*srx - s*sry*srz)*pointOri.x + (s*crz*sry + s*cry*srx*srz)*pointOri.y
-                       + tx*(s*sry*srz - s*cry*crz*srx) - ty*(s*crz*sry + s*cry*srx*srz)) * coeff.z;
-
-        float atx = -s*(cry*crz - srx*sry*srz) * coeff.x + s*crx*srz * coeff.y
-                    - s*(crz*sry + cry*srx*srz) * coeff.z;
-
-        float aty = -s*(cry*srz + crz*srx*sry) * coeff.x - s*crx*crz * coeff.y
-                    - s*(sry*srz - cry*crz*srx) * coeff.z;
-
-        float atz = s*crx*sry * coeff.x - s*srx * coeff.y - s*crx*cry * coeff.z;
-
-        float d2 = coeff.intensity;
-
-        matA(i, 0) = arx;
-        matA(i, 1) = ary;
-        matA(i, 2) = arz;
-        matA(i, 3) = atx;
-        matA(i, 4) = aty;
-        matA(i, 5) = atz;
-        matB(i, 0) = -0.05 * d2;
-      }
-      matAt = matA.transpose();
-      matAtA = matAt * matA;
-      matAtB = matAt * matB;
+      accumulateOdometryNormals(_transform, *_laserCloudOri, *_coeffSel, matAtA, matAtB);
 
       matX = matAtA.colPivHouseholderQr().solve(matAtB);
 
@@ -834,44 +621,50 @@ void LaserOdometry::process()
       if (deltaR < _deltaRAbort && deltaT < _deltaTAbort) {
         break;
       }
+
+      // stop early if a further iteration would exceed the time budget of this frame
+      if (!_solveBudget.nextIteration() && iterCount + 1 < _maxIterations) {
+        _budgetStops++;
+        ROS_DEBUG("Odometry stopped after %lu of %lu iterations (%.1f ms of %.1f ms budget used)",
+                  (unsigned long) _solveBudget.iterations(), (unsigned long) _maxIterations,
+                  _solveBudget.elapsed() * 1000, _solveBudget.budget() * 1000);
+        ROS_WARN_THROTTLE(10, "Odometry solver hit its time budget in %ld of %ld frames",
+                          _budgetStops, _frameCount);
+        break;
+      }
     }
   }
 
-  Angle rx, ry, rz;
-  accumulateRotation(_transformSum.rot_x,
-                     _transformSum.rot_y,
-                     _transformSum.rot_z,
-                     -_transform.rot_x,
-                     -_transform.rot_y.rad() * 1.05,
-                     -_transform.rot_z,
-                     rx, ry, rz);
-
-  Vector3 v( _transform.pos.x()        - _imuShiftFromStart.x(),
-             _transform.pos.y()        - _imuShiftFromStart.y(),
-             _transform.pos.z() * 1.05 - _imuShiftFromStart.z() );
-  rotateZXY(v, rz, rx, ry);
-  Vector3 trans = _transformSum.pos - v;
-
-  pluginIMURotation(rx, ry, rz,
-                    _imuPitchStart, _imuYawStart, _imuRollStart,
-                    _imuPitchEnd, _imuYawEnd, _imuRollEnd,
-                    rx, ry, rz);
-
-  _transformSum.rot_x = rx;
-  _transformSum.rot_y = ry;
-  _transformSum.rot_z = rz;
-  _transformSum.pos = trans;
-
-  transformToEnd(_cornerPointsLessSharp);
-  transformToEnd(_surfPointsLessFlat);
-
-  _cornerPointsLessSharp.swap(_lastCornerCloud);
-  _surfPointsLessFlat.swap(_lastSurfaceCloud);
+  // accumulate the inverse sweep motion
+  Eigen::Matrix3f rotSum = rotationFromEuler(_transformSum.rot_x, _transformSum.rot_y, _transformSum.rot_z)
+                           * rotationFromEuler(-_transform.rot_x,
+                                               Angle(-_transform.rot_y.rad() * 1.05),
+                                               -_transform.rot_z);
+
+  Eigen::Vector3f v(_transform.pos.x()        - _features.imuShiftFromStart.x(),
+                    _transform.pos.y()        - _features.imuShiftFromStart.y(),
+                    _transform.pos.z() * 1.05 - _features.imuShiftFromStart.z());
+  Eigen::Vector3f trans = _transformSum.pos.head<3>() - rotSum * v;
+
+  // plug in the IMU orientation change over the sweep
+  rotSum = rotSum
+           * rotationFromEuler(_features.imuPitchStart, _features.imuYawStart, _features.imuRollStart).transpose()
+           * rotationFromEuler(_features.imuPitchEnd, _features.imuYawEnd, _features.imuRollEnd);
+
+  eulerFromRotation(rotSum, _transformSum.rot_x, _transformSum.rot_y, _transformSum.rot_z);
+  _transformSum.pos = Vector3(trans.x(), trans.y(), trans.z());
+
+  transformToEnd(_features.cornerPointsLessSharp);
+  transformToEnd(_features.surfacePointsLessFlat);
+
+  _lastCornerCloud->swap(_features.cornerPointsLessSharp);
+  _lastSurfaceCloud->swap(_features.surfacePointsLessFlat);
 
   lastCornerCloudSize = _lastCornerCloud->points.size();
   lastSurfaceCloudSize = _lastSurfaceCloud->points.size();
 
   if (lastCornerCloudSize > 10 && lastSurfaceCloudSize > 100) {
+    TraceSpan treeSpan("laserOdometry", "buildKdTree", _features.sweepStart);
     _lastCornerKDTree.setInputCloud(_lastCornerCloud);
     _lastSurfaceKDTree.setInputCloud(_lastSurfaceCloud);
   }
@@ -883,12 +676,14 @@ void LaserOdometry::process()
 
 void LaserOdometry::publishResult()
 {
+  TraceSpan span("laserOdometry", "publishResult", _features.sweepStart);
+
   // publish odometry tranformations
   geometry_msgs::Quaternion geoQuat = tf::createQuaternionMsgFromRollPitchYaw(_transformSum.rot_z.rad(),
                                                                               -_transformSum.rot_x.rad(),
                                                                               -_transformSum.rot_y.rad());
 
-  _laserOdometryMsg.header.stamp = _timeSurfPointsLessFlat;
+  _laserOdometryMsg.header.stamp = _features.sweepStart;
   _laserOdometryMsg.pose.pose.orientation.x = -geoQuat.y;
   _laserOdometryMsg.pose.pose.orientation.y = -geoQuat.z;
   _laserOdometryMsg.pose.pose.orientation.z = geoQuat.x;
@@ -898,7 +693,7 @@ void LaserOdometry::publishResult()
   _laserOdometryMsg.pose.pose.position.z = _transformSum.pos.z();
   _pubLaserOdometry.publish(_laserOdometryMsg);
 
-  _laserOdometryTrans.stamp_ = _timeSurfPointsLessFlat;
+  _laserOdometryTrans.stamp_ = _features.sweepStart;
   _laserOdometryTrans.setRotation(tf::Quaternion(-geoQuat.y, -geoQuat.z, geoQuat.x, geoQuat.w));
   _laserOdometryTrans.setOrigin(tf::Vector3( _transformSum.pos.x(), _transformSum.pos.y(), _transformSum.pos.z()) );
   _tfBroadcaster.sendTransform(_laserOdometryTrans);
@@ -906,12 +701,16 @@ void LaserOdometry::publishResult()
 
   // publish cloud results according to the input output ratio
   if (_ioRatio < 2 || _frameCount % _ioRatio == 1) {
-    ros::Time sweepTime = _timeSurfPointsLessFlat;
-    transformToEnd(_laserCloud);  // transform full resolution cloud to sweep end before sending it
+    ros::Time sweepTime = _features.sweepStart;
 
     publishCloudMsg(_pubLaserCloudCornerLast, *_lastCornerCloud, sweepTime, "/camera");
     publishCloudMsg(_pubLaserCloudSurfLast, *_lastSurfaceCloud, sweepTime, "/camera");
-    publishCloudMsg(_pubLaserCloudFullRes, *_laserCloud, sweepTime, "/camera");
+
+    // the full resolution cloud is only transformed if somebody listens
+    if (!_featureOnly && _pubLaserCloudFullRes.getNumSubscribers() > 0) {
+      transformToEnd(_features.laserCloud);  // transform full resolution cloud to sweep end before sending it
+      publishCloudMsg(_pubLaserCloudFullRes, _features.laserCloud, sweepTime, "/camera");
+    }
   }
 }
 
@@ -0,0 +1,320 @@
+// Copyright 2013, Ji Zhang, Carnegie Mellon University
+// Further contributions copyright (c) 2016, Southwest Research Institute
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from this
+//    software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// This is an implementation of the algorithm described in the following paper:
+//   J. Zhang and S. Singh. LOAM: Lidar Odometry and Mapping in Real-time.
+//     Robotics: Science and Systems Conference (RSS). Berkeley, CA, July 2014.
+
+#include "loam_velodyne/MapCloudPublisher.h"
+#include "loam_velodyne/common.h"
+#include "loam_velodyne/MapDelta.h"
+#include "loam_velodyne/Trace.h"
+
+#include <set>
+
+
+namespace loam {
+
+MapCloudPublisher::MapCloudPublisher()
+    : _deltasEnabled(false),
+      _cubeSize(50),
+      _cornerLeafSize(0.2),
+      _surfaceLeafSize(0.4),
+      _hasPending(false),
+      _running(false),
+      _stopRequested(false),
+      _deltaResetRequested(false)
+{
+
+}
+
+
+
+MapCloudPublisher::~MapCloudPublisher()
+{
+  stop();
+}
+
+
+
+void MapCloudPublisher::start(const ros::Publisher& publisher,
+                              const std::string& frameID,
+                              const float& leafSize)
+{
+  stop();
+
+  _publisher = publisher;
+  _frameID = frameID;
+  _downSizeFilter.setLeafSize(leafSize);
+
+  _hasPending = false;
+  _stopRequested = false;
+  _worker = boost::thread(&MapCloudPublisher::run, this);
+  _running = true;
+}
+
+
+
+void MapCloudPublisher::enableDeltas(const ros::Publisher& deltaPublisher,
+                                     const float& cubeSize,
+                                     const float& cornerLeafSize,
+                                     const float& surfaceLeafSize)
+{
+  boost::lock_guard<boost::mutex> lock(_mutex);
+  _deltaPublisher = deltaPublisher;
+  _cubeSize = cubeSize;
+  _cornerLeafSize = cornerLeafSize;
+  _surfaceLeafSize = surfaceLeafSize;
+  _deltasEnabled = true;
+}
+
+
+
+void MapCloudPublisher::resetDeltas()
+{
+  {
+    boost::lock_guard<boost::mutex> lock(_mutex);
+    _pending.version = 0;
+    _pending.baseVersion = 0;
+    _pending.cubes.clear();
+    _deltaResetRequested = true;
+    _hasPending = true;
+  }
+  _cond.notify_one();
+}
+
+
+
+void MapCloudPublisher::stop()
+{
+  if (!_running) {
+    return;
+  }
+
+  {
+    boost::lock_guard<boost::mutex> lock(_mutex);
+    _stopRequested = true;
+  }
+  _cond.notify_all();
+  _worker.join();
+
+  _pending.clouds.clear();
+  _pending.cubes.clear();
+  _sentCubes.clear();
+  _hasPending = false;
+  _deltaResetRequested = false;
+  _running = false;
+}
+
+
+
+void MapCloudPublisher::publish(MapSnapshot& snapshot)
+{
+  {
+    boost::lock_guard<boost::mutex> lock(_mutex);
+
+    if (_hasPending && _pending.version > 0 && snapshot.version > 0) {
+      // the pending delta was not published yet, merge it into the new one (newer cubes take precedence, but cubes
+      // released without further changes keep their pending clouds)
+      std::map<CubeKey, size_t> pendingIndices;
+      for (size_t i = 0; i < _pending.cubes.size(); i++) {
+        pendingIndices[_pending.cubes[i].key] = i;
+      }
+      std::set<CubeKey> newKeys;
+      for (size_t i = 0; i < snapshot.cubes.size(); i++) {
+        MapCubeSnapshot& cube = snapshot.cubes[i];
+        std::map<CubeKey, size_t>::const_iterator pending = pendingIndices.find(cube.key);
+        if (!cube.cornerCloud && pending != pendingIndices.end() && newKeys.count(cube.key) == 0) {
+          cube.cornerCloud = _pending.cubes[pending->second].cornerCloud;
+          cube.surfaceCloud = _pending.cubes[pending->second].surfaceCloud;
+        }
+        newKeys.insert(cube.key);
+      }
+      for (size_t i = 0; i < _pending.cubes.size(); i++) {
+        if (newKeys.count(_pending.cubes[i].key) == 0) {
+          snapshot.cubes.push_back(_pending.cubes[i]);
+        }
+      }
+      if (snapshot.baseVersion != 0) {
+        snapshot.baseVersion = _pending.baseVersion;
+      }
+    } else if (_hasPending && _pending.version > 0) {
+      // keep the pending delta
+      snapshot.version = _pending.version;
+      snapshot.baseVersion = _pending.baseVersion;
+      snapshot.cubes.swap(_pending.cubes);
+    }
+
+    _pending.stamp = snapshot.stamp;
+    _pending.clouds.swap(snapshot.clouds);
+    _pending.version = snapshot.version;
+    _pending.baseVersion = snapshot.baseVersion;
+    _pending.cubes.swap(snapshot.cubes);
+    _hasPending = true;
+  }
+  snapshot.clouds.clear();
+  snapshot.cubes.clear();
+  snapshot.version = 0;
+  snapshot.baseVersion = 0;
+  _cond.notify_one();
+}
+
+
+
+void MapCloudPublisher::run()
+{
+  Trace::setThreadName("mapCloudPublisher");
+  MapSnapshot snapshot;
+
+  while (true) {
+    bool resetDeltas;
+    {
+      boost::unique_lock<boost::mutex> lock(_mutex);
+      while (!_hasPending && !_stopRequested) {
+        _cond.wait(lock);
+      }
+
+      if (_stopRequested) {
+        break;
+      }
+
+      snapshot.stamp = _pending.stamp;
+      snapshot.clouds.swap(_pending.clouds);
+      snapshot.version = _pending.version;
+      snapshot.baseVersion = _pending.baseVersion;
+      snapshot.cubes.swap(_pending.cubes);
+      _pending.clouds.clear();
+      _pending.cubes.clear();
+      _pending.version = 0;
+      _hasPending = false;
+      resetDeltas = _deltaResetRequested;
+      _deltaResetRequested = false;
+    }
+
+    if (resetDeltas) {
+      // release the sent cube clouds, the next delta is a full update anyway
+      _sentCubes.clear();
+    }
+
+    if (_deltasEnabled && snapshot.version > 0) {
+      TraceSpan span("laserMapping", "publishMapDelta", snapshot.stamp);
+      publishDelta(snapshot);
+    }
+    snapshot.cubes.clear();
+
+    if (snapshot.clouds.empty()) {
+      continue;
+    }
+
+    TraceSpan span("laserMapping", "publishMapCloud", snapshot.stamp);
+
+    // accumulate map cloud
+    _mapCloud.clear();
+    for (size_t i = 0; i < snapshot.clouds.size(); i++) {
+      _mapCloud += *snapshot.clouds[i];
+    }
+
+    // release the snapshot clouds as early as possible to avoid copies on write in the mapping
+    snapshot.clouds.clear();
+
+    // down size and publish map cloud
+    _downSizeFilter.filter(_mapCloud, _mapCloudDS);
+    publishCloudMsg(_publisher, _mapCloudDS, snapshot.stamp, _frameID);
+  }
+}
+
+
+
+
+void MapCloudPublisher::publishDelta(const MapSnapshot& snapshot)
+{
+  loam_velodyne::MapDelta msg;
+  msg.header.stamp = snapshot.stamp;
+  msg.header.frame_id = _frameID;
+  msg.version = snapshot.version;
+  msg.baseVersion = snapshot.baseVersion;
+  msg.cubeSize = _cubeSize;
+  msg.cornerLeafSize = _cornerLeafSize;
+  msg.surfaceLeafSize = _surfaceLeafSize;
+
+  if (snapshot.baseVersion == 0) {
+    // full update, all cubes are sent completely
+    _sentCubes.clear();
+  }
+
+  msg.cubes.reserve(snapshot.cubes.size());
+  for (size_t i = 0; i < snapshot.cubes.size(); i++) {
+    const MapCubeSnapshot& cube = snapshot.cubes[i];
+    std::map<CubeKey, MapCubeSnapshot>::iterator sent = _sentCubes.find(cube.key);
+
+    if (!cube.cornerCloud) {
+      // released without changes, the client already has the cube
+      if (sent != _sentCubes.end()) {
+        _sentCubes.erase(sent);
+      }
+      continue;
+    }
+
+    // send only the changed voxels of cubes known to the client
+    bool complete = sent == _sentCubes.end()
+                    || !collectChangedVoxels(*sent->second.cornerCloud, *cube.cornerCloud,
+                                             1 / _cornerLeafSize, _changedCorners)
+                    || !collectChangedVoxels(*sent->second.surfaceCloud, *cube.surfaceCloud,
+                                             1 / _surfaceLeafSize, _changedSurfaces);
+
+    if (cube.released) {
+      // the cube is sent completely again once it is back in memory
+      if (sent != _sentCubes.end()) {
+        _sentCubes.erase(sent);
+      }
+    } else {
+      _sentCubes[cube.key] = cube;
+    }
+
+    if (!complete && _changedCorners.empty() && _changedSurfaces.empty()) {
+      continue;
+    }
+
+    msg.cubes.push_back(loam_velodyne::MapCube());
+    loam_velodyne::MapCube& cubeMsg = msg.cubes.back();
+
+    cubeMsg.i = cube.key.i;
+    cubeMsg.j = cube.key.j;
+    cubeMsg.k = cube.key.k;
+    cubeMsg.complete = complete;
+
+    pcl::toROSMsg(complete ? *cube.cornerCloud : _changedCorners, cubeMsg.cornerCloud);
+    cubeMsg.cornerCloud.header = msg.header;
+    pcl::toROSMsg(complete ? *cube.surfaceCloud : _changedSurfaces, cubeMsg.surfaceCloud);
+    cubeMsg.surfaceCloud.header = msg.header;
+  }
+
+  _deltaPublisher.publish(msg);
+}
+
+} // end namespace loam
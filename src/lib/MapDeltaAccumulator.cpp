@@ -0,0 +1,136 @@
+// Copyright 2013, Ji Zhang, Carnegie Mellon University
+// Further contributions copyright (c) 2016, Southwest Research Institute
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from this
+//    software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// This is an implementation of the algorithm described in the following paper:
+//   J. Zhang and S. Singh. LOAM: Lidar Odometry and Mapping in Real-time.
+//     Robotics: Science and Systems Conference (RSS). Berkeley, CA, July 2014.
+
+#include "loam_velodyne/MapDeltaAccumulator.h"
+
+#include <pcl_conversions/pcl_conversions.h>
+
+
+namespace loam {
+
+MapDeltaAccumulator::MapDeltaAccumulator()
+    : _version(0)
+{
+
+}
+
+
+
+bool MapDeltaAccumulator::apply(const loam_velodyne::MapDelta& delta)
+{
+  if (delta.baseVersion != 0 && delta.baseVersion != _version) {
+    // missed a delta, wait for the next full update
+    _version = 0;
+    return false;
+  }
+
+  if (_version == 0) {
+    // (re)synchronization, cubes changed by missed deltas may be stale
+    _cubes.clear();
+  }
+
+  float invCornerLeafSize = 1 / delta.cornerLeafSize;
+  float invSurfaceLeafSize = 1 / delta.surfaceLeafSize;
+
+  for (size_t i = 0; i < delta.cubes.size(); i++) {
+    const loam_velodyne::MapCube& cubeMsg = delta.cubes[i];
+    Cube& cube = _cubes[CubeKey(cubeMsg.i, cubeMsg.j, cubeMsg.k)];
+
+    if (cubeMsg.complete) {
+      pcl::fromROSMsg(cubeMsg.cornerCloud, cube.cornerCloud);
+      pcl::fromROSMsg(cubeMsg.surfaceCloud, cube.surfaceCloud);
+      indexVoxels(cube.cornerCloud, invCornerLeafSize, cube.cornerVoxels);
+      indexVoxels(cube.surfaceCloud, invSurfaceLeafSize, cube.surfaceVoxels);
+    } else {
+      pcl::fromROSMsg(cubeMsg.cornerCloud, _changed);
+      replaceVoxels(_changed, invCornerLeafSize, cube.cornerCloud, cube.cornerVoxels);
+      pcl::fromROSMsg(cubeMsg.surfaceCloud, _changed);
+      replaceVoxels(_changed, invSurfaceLeafSize, cube.surfaceCloud, cube.surfaceVoxels);
+    }
+  }
+  _version = delta.version;
+
+  return true;
+}
+
+
+
+void MapDeltaAccumulator::getMapCloud(pcl::PointCloud<pcl::PointXYZI>& cloud) const
+{
+  cloud.clear();
+  for (std::map<CubeKey, Cube>::const_iterator it = _cubes.begin(); it != _cubes.end(); ++it) {
+    cloud += it->second.cornerCloud;
+    cloud += it->second.surfaceCloud;
+  }
+}
+
+
+
+void MapDeltaAccumulator::clear()
+{
+  _cubes.clear();
+  _version = 0;
+}
+
+
+
+void MapDeltaAccumulator::indexVoxels(const pcl::PointCloud<pcl::PointXYZI>& cloud,
+                                      const float& invLeafSize,
+                                      std::map<VoxelKey, size_t>& voxels)
+{
+  voxels.clear();
+  for (size_t i = 0; i < cloud.points.size(); i++) {
+    voxels[toVoxelKey(cloud.points[i], invLeafSize)] = i;
+  }
+}
+
+
+
+void MapDeltaAccumulator::replaceVoxels(const pcl::PointCloud<pcl::PointXYZI>& changed,
+                                        const float& invLeafSize,
+                                        pcl::PointCloud<pcl::PointXYZI>& cloud,
+                                        std::map<VoxelKey, size_t>& voxels)
+{
+  for (size_t i = 0; i < changed.points.size(); i++) {
+    const pcl::PointXYZI& point = changed.points[i];
+    std::pair<std::map<VoxelKey, size_t>::iterator, bool> voxel =
+        voxels.insert(std::make_pair(toVoxelKey(point, invLeafSize), cloud.points.size()));
+
+    if (voxel.second) {
+      cloud.push_back(point);
+    } else {
+      cloud.points[voxel.first->second] = point;
+    }
+  }
+}
+
+} // end namespace loam
@@ -0,0 +1,280 @@
+// Copyright 2013, Ji Zhang, Carnegie Mellon University
+// Further contributions copyright (c) 2016, Southwest Research Institute
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from this
+//    software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// This is an implementation of the algorithm described in the following paper:
+//   J. Zhang and S. Singh. LOAM: Lidar Odometry and Mapping in Real-time.
+//     Robotics: Science and Systems Conference (RSS). Berkeley, CA, July 2014.
+
+#include "loam_velodyne/MapTilePager.h"
+#include "loam_velodyne/Trace.h"
+
+#include <ros/ros.h>
+
+
+namespace loam {
+
+MapTilePager::MapTilePager()
+    : _running(false),
+      _readOnly(false),
+      _failures(0),
+      _stopRequested(false)
+{
+
+}
+
+
+
+MapTilePager::~MapTilePager()
+{
+  stop();
+}
+
+
+
+bool MapTilePager::start(const MapTileStore& store,
+                         const bool& useExistingTiles,
+                         const bool& readOnly)
+{
+  stop();
+
+  if (!store.isOpen()) {
+    ROS_ERROR("Can't start map tile pager without tile store");
+    return false;
+  }
+
+  _store = store;
+  _readOnly = readOnly;
+  _pagedOut.clear();
+  _pageInRequested.clear();
+
+  if (useExistingTiles) {
+    std::vector<CubeKey> keys;
+    if (!_store.listTiles(keys)) {
+      return false;
+    }
+    _pagedOut.insert(keys.begin(), keys.end());
+  }
+
+  _stopRequested = false;
+  _worker = boost::thread(&MapTilePager::run, this);
+  _running = true;
+
+  return true;
+}
+
+
+
+void MapTilePager::stop()
+{
+  if (!_running) {
+    return;
+  }
+
+  {
+    boost::lock_guard<boost::mutex> lock(_mutex);
+    _stopRequested = true;
+  }
+  _taskCond.notify_all();
+  _worker.join();
+
+  for (size_t i = 0; i < _pagedIn.size(); i++) {
+    if (_notWritten.count(_pagedIn[i].key) > 0) {
+      CubeKey key = _pagedIn[i].key;
+      ROS_ERROR("Discarding map cube %d/%d/%d, its tile could not be written", key.i, key.j, key.k);
+    }
+  }
+
+  _tasks.clear();
+  _pagedIn.clear();
+  _pageInFailed.clear();
+  _notWritten.clear();
+  _failures = 0;
+  _running = false;
+}
+
+
+
+void MapTilePager::pageOut(const MapTile& tile)
+{
+  _pagedOut.insert(tile.key);
+  if (_readOnly) {
+    // the stored tile is still up to date
+    return;
+  }
+
+  Task task;
+  task.pageOut = true;
+  task.tile = tile;
+
+  {
+    boost::lock_guard<boost::mutex> lock(_mutex);
+    _tasks.push_back(task);
+  }
+  _taskCond.notify_one();
+}
+
+
+
+void MapTilePager::requestPageIn(const CubeKey& key)
+{
+  if (!isPagedOut(key) || _pageInRequested.count(key) > 0) {
+    return;
+  }
+  _pageInRequested.insert(key);
+
+  Task task;
+  task.pageOut = false;
+  task.tile.key = key;
+
+  {
+    boost::lock_guard<boost::mutex> lock(_mutex);
+    _tasks.push_back(task);
+  }
+  _taskCond.notify_one();
+}
+
+
+
+size_t MapTilePager::collectPagedIn(std::vector<MapTile>& tiles)
+{
+  tiles.clear();
+  std::set<CubeKey> failed;
+  size_t failures;
+  {
+    boost::lock_guard<boost::mutex> lock(_mutex);
+    tiles.swap(_pagedIn);
+    failed.swap(_pageInFailed);
+    failures = _failures;
+    _failures = 0;
+  }
+
+  for (size_t i = 0; i < tiles.size(); i++) {
+    _pagedOut.erase(tiles[i].key);
+    _pageInRequested.erase(tiles[i].key);
+  }
+
+  // failed cubes stay paged out, allow retrying them
+  for (std::set<CubeKey>::const_iterator it = failed.begin(); it != failed.end(); ++it) {
+    _pageInRequested.erase(*it);
+  }
+
+  return failures;
+}
+
+
+
+bool MapTilePager::pageInNow(const CubeKey& key,
+                             MapTile& tile)
+{
+  if (!isPagedOut(key)) {
+    tile = MapTile();
+    tile.key = key;
+    return true;
+  }
+  requestPageIn(key);
+
+  boost::unique_lock<boost::mutex> lock(_mutex);
+  while (true) {
+    for (std::vector<MapTile>::iterator it = _pagedIn.begin(); it != _pagedIn.end(); ++it) {
+      if (it->key == key) {
+        tile = *it;
+        _pagedIn.erase(it);
+        _pagedOut.erase(key);
+        _pageInRequested.erase(key);
+        return true;
+      }
+    }
+
+    if (_pageInFailed.erase(key) > 0) {
+      _pageInRequested.erase(key);
+      return false;
+    }
+    _doneCond.wait(lock);
+  }
+}
+
+
+
+void MapTilePager::run()
+{
+  Trace::setThreadName("mapTilePager");
+  boost::unique_lock<boost::mutex> lock(_mutex);
+
+  while (true) {
+    while (_tasks.empty() && !_stopRequested) {
+      _taskCond.wait(lock);
+    }
+
+    if (_tasks.empty()) {
+      // stop requested and all pending tasks done
+      break;
+    }
+
+    Task task = _tasks.front();
+    _tasks.pop_front();
+
+    if (task.pageOut) {
+      // a new page out supersedes a previously failed one
+      _notWritten.erase(task.tile.key);
+    } else if (_notWritten.erase(task.tile.key) > 0) {
+      // the cube was already handed back after its failed page out
+      continue;
+    }
+    lock.unlock();
+
+    bool success;
+    if (task.pageOut) {
+      TraceSpan span("laserMapping", "pageOutTile");
+      success = _store.writeTile(task.tile.key, *task.tile.cornerCloud, *task.tile.surfaceCloud);
+    } else {
+      TraceSpan span("laserMapping", "pageInTile");
+      success = _store.readTile(task.tile.key, *task.tile.cornerCloud, *task.tile.surfaceCloud);
+    }
+
+    lock.lock();
+    if (task.pageOut) {
+      if (success) {
+        continue;
+      }
+
+      // hand the cube back, so it stays in memory
+      _failures++;
+      _notWritten.insert(task.tile.key);
+      _pagedIn.push_back(task.tile);
+    } else if (success) {
+      _pagedIn.push_back(task.tile);
+    } else {
+      // keep the stored tile, rather than delivering an empty cube that would overwrite it on the next page out
+      _failures++;
+      _pageInFailed.insert(task.tile.key);
+    }
+    _doneCond.notify_all();
+  }
+}
+
+} // end namespace loam
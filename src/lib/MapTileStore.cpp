@@ -0,0 +1,408 @@
+// Copyright 2013, Ji Zhang, Carnegie Mellon University
+// Further contributions copyright (c) 2016, Southwest Research Institute
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from this
+//    software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// This is an implementation of the algorithm described in the following paper:
+//   J. Zhang and S. Singh. LOAM: Lidar Odometry and Mapping in Real-time.
+//     Robotics: Science and Systems Conference (RSS). Berkeley, CA, July 2014.
+
+#include "loam_velodyne/MapTileStore.h"
+
+#include <ros/ros.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+namespace loam {
+
+const char MapTileStore::MAGIC[8] = {'L', 'O', 'A', 'M', 'T', 'I', 'L', 'E'};
+const uint32_t MapTileStore::VERSION;
+
+
+/** \brief Number of floats stored per point in a tile file. */
+static const size_t TILE_POINT_FLOATS = 4;
+
+
+
+MappedMapTile::MappedMapTile()
+    : _data(NULL),
+      _size(0)
+{
+
+}
+
+
+
+MappedMapTile::~MappedMapTile()
+{
+  close();
+}
+
+
+
+bool MappedMapTile::open(const std::string& path)
+{
+  close();
+
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    ROS_ERROR("Failed to open map tile \"%s\": %s", path.c_str(), std::strerror(errno));
+    return false;
+  }
+
+  struct stat fileStat;
+  if (fstat(fd, &fileStat) != 0 || size_t(fileStat.st_size) < sizeof(MapTileHeader)) {
+    ROS_ERROR("Invalid map tile \"%s\": file too small", path.c_str());
+    ::close(fd);
+    return false;
+  }
+
+  void* data = mmap(NULL, size_t(fileStat.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (data == MAP_FAILED) {
+    ROS_ERROR("Failed to map tile \"%s\": %s", path.c_str(), std::strerror(errno));
+    return false;
+  }
+
+  _data = static_cast<const char*>(data);
+  _size = size_t(fileStat.st_size);
+
+  // validate header
+  const MapTileHeader& head = header();
+  if (std::memcmp(head.magic, MapTileStore::MAGIC, sizeof(head.magic)) != 0) {
+    ROS_ERROR("Invalid map tile \"%s\": bad magic", path.c_str());
+    close();
+    return false;
+  }
+
+  if (head.version != MapTileStore::VERSION) {
+    ROS_ERROR("Unsupported map tile \"%s\": version %u (expected %u)",
+              path.c_str(), head.version, MapTileStore::VERSION);
+    close();
+    return false;
+  }
+
+  // check the point counts against the available bytes one by one, as their sum or byte size may overflow
+  const uint64_t pointSize = TILE_POINT_FLOATS * sizeof(float);
+  bool valid = head.headerSize >= sizeof(MapTileHeader) && head.headerSize % sizeof(float) == 0
+               && head.headerSize <= _size;
+  if (valid) {
+    uint64_t maxPoints = (_size - head.headerSize) / pointSize;
+    valid = head.cornerCount <= maxPoints && head.surfaceCount <= maxPoints - head.cornerCount;
+  }
+  if (!valid) {
+    ROS_ERROR("Invalid map tile \"%s\": truncated or corrupted", path.c_str());
+    close();
+    return false;
+  }
+
+  return true;
+}
+
+
+
+void MappedMapTile::close()
+{
+  if (_data != NULL) {
+    munmap(const_cast<char*>(_data), _size);
+    _data = NULL;
+    _size = 0;
+  }
+}
+
+
+
+const float* MappedMapTile::cornerPoints() const
+{
+  return reinterpret_cast<const float*>(_data + header().headerSize);
+}
+
+
+
+const float* MappedMapTile::surfacePoints() const
+{
+  return cornerPoints() + header().cornerCount * TILE_POINT_FLOATS;
+}
+
+
+
+
+
+/** \brief Copy packed tile point data into a point cloud.
+ *
+ * @param data the packed (x, y, z, intensity) point data
+ * @param count the number of points
+ * @param cloud the target cloud
+ */
+static void unpackPoints(const float* data,
+                         const size_t& count,
+                         pcl::PointCloud<PointXYZIRT>& cloud)
+{
+  cloud.points.resize(count);
+  for (size_t i = 0; i < count; i++) {
+    const float* p = data + i * TILE_POINT_FLOATS;
+    PointXYZIRT& point = cloud.points[i];
+    point.x = p[0];
+    point.y = p[1];
+    point.z = p[2];
+    point.intensity = p[3];
+    point.time = 0;
+    point.ring = 0;
+  }
+  cloud.width = uint32_t(count);
+  cloud.height = 1;
+  cloud.is_dense = true;
+}
+
+
+
+/** \brief Write the given cloud as packed tile point data.
+ *
+ * @param file the target file
+ * @param cloud the cloud to write
+ * @return true if all points were written, false otherwise
+ */
+static bool packPoints(FILE* file,
+                       const pcl::PointCloud<PointXYZIRT>& cloud)
+{
+  // write in chunks to keep the number of write calls low
+  static const size_t CHUNK_SIZE = 1024;
+  float buffer[CHUNK_SIZE * TILE_POINT_FLOATS];
+
+  size_t cloudSize = cloud.points.size();
+  for (size_t start = 0; start < cloudSize; start += CHUNK_SIZE) {
+    size_t count = std::min(CHUNK_SIZE, cloudSize - start);
+    for (size_t i = 0; i < count; i++) {
+      const PointXYZIRT& point = cloud.points[start + i];
+      float* p = buffer + i * TILE_POINT_FLOATS;
+      p[0] = point.x;
+      p[1] = point.y;
+      p[2] = point.z;
+      p[3] = point.intensity;
+    }
+
+    if (std::fwrite(buffer, sizeof(float) * TILE_POINT_FLOATS, count, file) != count) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
+
+MapTileStore::MapTileStore()
+    : _cubeSize(50)
+{
+
+}
+
+
+
+bool MapTileStore::open(const std::string& directory,
+                        const float& cubeSize)
+{
+  _directory.clear();
+
+  if (directory.empty()) {
+    ROS_ERROR("Invalid map tile directory: empty path");
+    return false;
+  }
+
+  // create directory (including parents) if necessary
+  for (size_t pos = directory.find('/', 1); ; pos = directory.find('/', pos + 1)) {
+    std::string path = directory.substr(0, pos);
+    if (mkdir(path.c_str(), 0755) != 0 && errno != EEXIST) {
+      ROS_ERROR("Failed to create map tile directory \"%s\": %s", path.c_str(), std::strerror(errno));
+      return false;
+    }
+
+    if (pos == std::string::npos) {
+      break;
+    }
+  }
+
+  _directory = directory;
+  if (_directory[_directory.size() - 1] != '/') {
+    _directory += '/';
+  }
+  _cubeSize = cubeSize;
+
+  return true;
+}
+
+
+
+std::string MapTileStore::tilePath(const CubeKey& key) const
+{
+  char name[64];
+  std::snprintf(name, sizeof(name), "tile_%d_%d_%d.bin", key.i, key.j, key.k);
+  return _directory + name;
+}
+
+
+
+bool MapTileStore::hasTile(const CubeKey& key) const
+{
+  return access(tilePath(key).c_str(), R_OK) == 0;
+}
+
+
+
+bool MapTileStore::listTiles(std::vector<CubeKey>& keys) const
+{
+  keys.clear();
+
+  DIR* dir = opendir(_directory.c_str());
+  if (dir == NULL) {
+    ROS_ERROR("Failed to read map tile directory \"%s\": %s", _directory.c_str(), std::strerror(errno));
+    return false;
+  }
+
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != NULL) {
+    CubeKey key;
+    int nameLength = -1;
+    if (std::sscanf(entry->d_name, "tile_%d_%d_%d.bin%n", &key.i, &key.j, &key.k, &nameLength) == 3
+        && nameLength == int(std::strlen(entry->d_name))) {
+      keys.push_back(key);
+    }
+  }
+  closedir(dir);
+
+  return true;
+}
+
+
+
+bool MapTileStore::writeTile(const CubeKey& key,
+                             const pcl::PointCloud<PointXYZIRT>& cornerCloud,
+                             const pcl::PointCloud<PointXYZIRT>& surfaceCloud) const
+{
+  MapTileHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, MAGIC, sizeof(header.magic));
+  header.version = VERSION;
+  header.headerSize = sizeof(MapTileHeader);
+  header.cubeSize = _cubeSize;
+  header.cubeI = key.i;
+  header.cubeJ = key.j;
+  header.cubeK = key.k;
+  header.cornerCount = cornerCloud.points.size();
+  header.surfaceCount = surfaceCloud.points.size();
+
+  std::string path = tilePath(key);
+  std::string tmpPath = path + ".tmp";
+
+  FILE* file = std::fopen(tmpPath.c_str(), "wb");
+  if (file == NULL) {
+    ROS_ERROR("Failed to write map tile \"%s\": %s", tmpPath.c_str(), std::strerror(errno));
+    return false;
+  }
+
+  bool success = std::fwrite(&header, sizeof(header), 1, file) == 1
+                 && packPoints(file, cornerCloud)
+                 && packPoints(file, surfaceCloud);
+  // the tile data has to be on disk before the rename can replace the previous tile
+  success = success && std::fflush(file) == 0 && fsync(fileno(file)) == 0;
+  success = (std::fclose(file) == 0) && success;
+
+  if (!success || std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+    ROS_ERROR("Failed to write map tile \"%s\": %s", path.c_str(), std::strerror(errno));
+    std::remove(tmpPath.c_str());
+    return false;
+  }
+
+  if (!syncDirectory()) {
+    ROS_ERROR("Failed to sync map tile directory \"%s\": %s", _directory.c_str(), std::strerror(errno));
+    return false;
+  }
+
+  return true;
+}
+
+
+
+bool MapTileStore::syncDirectory() const
+{
+  int fd = ::open(_directory.c_str(), O_RDONLY | O_DIRECTORY);
+  if (fd < 0) {
+    return false;
+  }
+
+  bool success = fsync(fd) == 0;
+  ::close(fd);
+  return success;
+}
+
+
+
+bool MapTileStore::readTile(const CubeKey& key,
+                            pcl::PointCloud<PointXYZIRT>& cornerCloud,
+                            pcl::PointCloud<PointXYZIRT>& surfaceCloud) const
+{
+  std::string path = tilePath(key);
+  MappedMapTile tile;
+  if (!tile.open(path)) {
+    return false;
+  }
+
+  const MapTileHeader& header = tile.header();
+  if (header.cubeSize != _cubeSize || CubeKey(header.cubeI, header.cubeJ, header.cubeK) != key) {
+    ROS_ERROR("Map tile \"%s\" does not match the expected cube (size %g, key %d/%d/%d)",
+              path.c_str(), _cubeSize, key.i, key.j, key.k);
+    return false;
+  }
+
+  unpackPoints(tile.cornerPoints(), header.cornerCount, cornerCloud);
+  unpackPoints(tile.surfacePoints(), header.surfaceCount, surfaceCloud);
+
+  return true;
+}
+
+
+
+bool MapTileStore::removeTile(const CubeKey& key) const
+{
+  std::string path = tilePath(key);
+  if (std::remove(path.c_str()) != 0 && errno != ENOENT) {
+    ROS_ERROR("Failed to remove map tile \"%s\": %s", path.c_str(), std::strerror(errno));
+    return false;
+  }
+
+  return true;
+}
+
+} // end namespace loam
@@ -31,6 +31,7 @@
 //     Robotics: Science and Systems Conference (RSS). Berkeley, CA, July 2014.
 
 #include "loam_velodyne/MultiScanRegistration.h"
+#include "loam_velodyne/Trace.h"
 #include "math_utils.h"
 
 #include <pcl_conversions/pcl_conversions.h>
@@ -98,8 +99,10 @@ bool MultiScanRegistration::setup(ros::NodeHandle& node,
       _scanMapper = MultiScanMapper::Velodyne_HDL_32();
     } else if (lidarName == "HDL-64E") {
       _scanMapper = MultiScanMapper::Velodyne_HDL_64E();
+    } else if (lidarName == "VLS-128") {
+      _scanMapper = MultiScanMapper::Velodyne_VLS_128();
     } else {
-      ROS_ERROR("Invalid lidar parameter: %s (only \"VLP-16\", \"HDL-32\" and \"HDL-64E\" are supported)", lidarName.c_str());
+      ROS_ERROR("Invalid lidar parameter: %s (only \"VLP-16\", \"HDL-32\", \"HDL-64E\" and \"VLS-128\" are supported)", lidarName.c_str());
       return false;
     }
 
@@ -140,13 +143,15 @@ bool MultiScanRegistration::setup(ros::NodeHandle& node,
 
 void MultiScanRegistration::handleCloudMessage(const sensor_msgs::PointCloud2ConstPtr &laserCloudMsg)
 {
+  TraceSpan span("scanRegistration", "handleCloudMessage", laserCloudMsg->header.stamp);
+
   if (_systemDelay > 0) {
     _systemDelay--;
     return;
   }
 
   // fetch new input cloud
-  pcl::PointCloud<pcl::PointXYZ> laserCloudIn;
+  pcl::PointCloud<pcl::PointXYZI> laserCloudIn;
   pcl::fromROSMsg(*laserCloudMsg, laserCloudIn);
 
   process(laserCloudIn, laserCloudMsg->header.stamp);
@@ -154,7 +159,7 @@ void MultiScanRegistration::handleCloudMessage(const sensor_msgs::PointCloud2Con
 
 
 
-void MultiScanRegistration::process(const pcl::PointCloud<pcl::PointXYZ>& laserCloudIn,
+void MultiScanRegistration::process(const pcl::PointCloud<pcl::PointXYZI>& laserCloudIn,
                                     const ros::Time& scanTime)
 {
   size_t cloudSize = laserCloudIn.size();
@@ -173,14 +178,18 @@ void MultiScanRegistration::process(const pcl::PointCloud<pcl::PointXYZ>& laserC
   }
 
   bool halfPassed = false;
-  pcl::PointXYZI point;
-  std::vector<pcl::PointCloud<pcl::PointXYZI> > laserCloudScans(_scanMapper.getNumberOfScanRings());
+  PointXYZIRT point;
+  _laserCloudScans.resize(_scanMapper.getNumberOfScanRings());
+  for (size_t i = 0; i < _laserCloudScans.size(); i++) {
+    _laserCloudScans[i].clear();
+  }
 
   // extract valid points from input cloud
   for (int i = 0; i < cloudSize; i++) {
     point.x = laserCloudIn[i].y;
     point.y = laserCloudIn[i].z;
     point.z = laserCloudIn[i].x;
+    point.intensity = laserCloudIn[i].intensity;
 
     // skip NaN and INF valued points
     if (!pcl_isfinite(point.x) ||
@@ -225,7 +234,8 @@ void MultiScanRegistration::process(const pcl::PointCloud<pcl::PointXYZ>& laserC
 
     // calculate relative scan time based on point orientation
     float relTime = _config.scanPeriod * (ori - startOri) / (endOri - startOri);
-    point.intensity = scanID + relTime;
+    point.time = relTime;
+    point.ring = scanID;
 
     // project point to the start of the sweep using corresponding IMU data
     if (hasIMUData()) {
@@ -233,16 +243,16 @@ void MultiScanRegistration::process(const pcl::PointCloud<pcl::PointXYZ>& laserC
       transformToStartIMU(point);
     }
 
-    laserCloudScans[scanID].push_back(point);
+    _laserCloudScans[scanID].push_back(point);
   }
 
   // construct sorted full resolution cloud
   cloudSize = 0;
   for (int i = 0; i < _scanMapper.getNumberOfScanRings(); i++) {
-    _laserCloud += laserCloudScans[i];
+    _features.laserCloud += _laserCloudScans[i];
 
     IndexRange range(cloudSize, 0);
-    cloudSize += laserCloudScans[i].size();
+    cloudSize += _laserCloudScans[i].size();
     range.second = cloudSize > 0 ? cloudSize - 1 : 0;
     _scanIndices.push_back(range);
   }
@@ -0,0 +1,225 @@
+// Copyright 2013, Ji Zhang, Carnegie Mellon University
+// Further contributions copyright (c) 2016, Southwest Research Institute
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from this
+//    software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// This is an implementation of the algorithm described in the following paper:
+//   J. Zhang and S. Singh. LOAM: Lidar Odometry and Mapping in Real-time.
+//     Robotics: Science and Systems Conference (RSS). Berkeley, CA, July 2014.
+
+#include "loam_velodyne/PoseHistory.h"
+
+#include <Eigen/Geometry>
+
+#include <algorithm>
+
+
+namespace loam {
+
+PoseHistory::PoseHistory(const size_t& capacity)
+    : _entries(std::max(capacity, size_t(1))),
+      _start(0),
+      _size(0),
+      _sequence(0)
+{
+  // nothing to do
+}
+
+
+
+void PoseHistory::setCapacity(const size_t& capacity)
+{
+  beginWrite();
+  _entries.resize(std::max(capacity, size_t(1)));
+  _start = 0;
+  _size = 0;
+  endWrite();
+}
+
+
+
+void PoseHistory::push(const ros::Time& stamp, const Pose& pose)
+{
+  Entry newEntry;
+  newEntry.stamp = stamp.toSec();
+
+  Eigen::Quaternionf quat(pose.rot);
+  quat.normalize();
+  newEntry.rot[0] = quat.x();
+  newEntry.rot[1] = quat.y();
+  newEntry.rot[2] = quat.z();
+  newEntry.rot[3] = quat.w();
+  newEntry.pos[0] = pose.pos.x();
+  newEntry.pos[1] = pose.pos.y();
+  newEntry.pos[2] = pose.pos.z();
+
+  beginWrite();
+
+  // keep the history strictly ordered in time
+  while (_size > 0 && entry(_size - 1, _start).stamp >= newEntry.stamp) {
+    _size--;
+  }
+
+  if (_size < _entries.size()) {
+    _entries[(_start + _size) % _entries.size()] = newEntry;
+    _size++;
+  } else {
+    _entries[_start] = newEntry;
+    _start = (_start + 1) % _entries.size();
+  }
+
+  endWrite();
+}
+
+
+
+void PoseHistory::clear()
+{
+  beginWrite();
+  _start = 0;
+  _size = 0;
+  endWrite();
+}
+
+
+
+bool PoseHistory::lookup(const ros::Time& stamp, Pose& pose) const
+{
+  double time = stamp.toSec();
+  Entry prev, next;
+  bool found;
+
+  uint32_t sequence;
+  do {
+    sequence = beginRead();
+    found = false;
+
+    // indices may be torn by a concurrent write, so they are bounded before use (the result is discarded anyway)
+    size_t start = _start % _entries.size();
+    size_t size = std::min(_size, _entries.size());
+    if (size == 0 || time < entry(0, start).stamp || time > entry(size - 1, start).stamp) {
+      continue;
+    }
+
+    // binary search for the first pose not older than the requested time
+    size_t lower = 0;
+    size_t upper = size - 1;
+    while (lower < upper) {
+      size_t mid = lower + (upper - lower) / 2;
+      if (entry(mid, start).stamp < time) {
+        lower = mid + 1;
+      } else {
+        upper = mid;
+      }
+    }
+
+    next = entry(lower, start);
+    prev = lower > 0 ? entry(lower - 1, start) : next;
+    found = true;
+  } while (!endRead(sequence));
+
+  if (!found) {
+    return false;
+  }
+
+  Eigen::Quaternionf prevRot(prev.rot[3], prev.rot[0], prev.rot[1], prev.rot[2]);
+  Eigen::Quaternionf nextRot(next.rot[3], next.rot[0], next.rot[1], next.rot[2]);
+  Eigen::Vector3f prevPos(prev.pos[0], prev.pos[1], prev.pos[2]);
+  Eigen::Vector3f nextPos(next.pos[0], next.pos[1], next.pos[2]);
+
+  float ratio = 1;
+  if (next.stamp > prev.stamp) {
+    ratio = float((time - prev.stamp) / (next.stamp - prev.stamp));
+  }
+
+  pose.rot = prevRot.slerp(ratio, nextRot).toRotationMatrix();
+  pose.pos = prevPos + ratio * (nextPos - prevPos);
+
+  return true;
+}
+
+
+
+bool PoseHistory::timeRange(ros::Time& oldest, ros::Time& newest) const
+{
+  double oldestTime = 0, newestTime = 0;
+  bool found;
+
+  uint32_t sequence;
+  do {
+    sequence = beginRead();
+    size_t start = _start % _entries.size();
+    size_t size = std::min(_size, _entries.size());
+    found = size > 0;
+    if (found) {
+      oldestTime = entry(0, start).stamp;
+      newestTime = entry(size - 1, start).stamp;
+    }
+  } while (!endRead(sequence));
+
+  if (found) {
+    oldest.fromSec(oldestTime);
+    newest.fromSec(newestTime);
+  }
+
+  return found;
+}
+
+
+
+void PoseHistory::beginWrite()
+{
+  _sequence.store(_sequence.load(boost::memory_order_relaxed) + 1, boost::memory_order_relaxed);
+  boost::atomic_thread_fence(boost::memory_order_release);
+}
+
+
+
+void PoseHistory::endWrite()
+{
+  _sequence.store(_sequence.load(boost::memory_order_relaxed) + 1, boost::memory_order_release);
+}
+
+
+
+uint32_t PoseHistory::beginRead() const
+{
+  uint32_t sequence;
+  while ((sequence = _sequence.load(boost::memory_order_acquire)) & 1) {
+    // a write is in progress
+  }
+  return sequence;
+}
+
+
+
+bool PoseHistory::endRead(const uint32_t& sequence) const
+{
+  boost::atomic_thread_fence(boost::memory_order_acquire);
+  return _sequence.load(boost::memory_order_relaxed) == sequence;
+}
+
+} // end namespace loam
@@ -31,9 +31,9 @@
 //     Robotics: Science and Systems Conference (RSS). Berkeley, CA, July 2014.
 
 #include "loam_velodyne/ScanRegistration.h"
+#include "loam_velodyne/Trace.h"
 #include "math_utils.h"
 
-#include <pcl/filters/voxel_grid.h>
 #include <tf/transform_datatypes.h>
 
 
@@ -175,12 +175,7 @@ ScanRegistration::ScanRegistration(const RegistrationParams& config)
         _imuCur(),
         _imuIdx(0),
         _imuHistory(_config.imuHistorySize),
-        _laserCloud(),
-        _cornerPointsSharp(),
-        _cornerPointsLessSharp(),
-        _surfacePointsFlat(),
-        _surfacePointsLessFlat(),
-        _imuTrans(4, 1),
+        _featureOnly(false),
         _regionCurvature(),
         _regionLabel(),
         _regionSortIndices(),
@@ -199,17 +194,18 @@ bool ScanRegistration::setup(ros::NodeHandle& node,
   }
   _imuHistory.ensureCapacity(_config.imuHistorySize);
 
+  privateNode.getParam("featureOnly", _featureOnly);
+
+  if (!Trace::setup(privateNode)) {
+    return false;
+  }
+
   // subscribe to IMU topic
   _subImu = node.subscribe<sensor_msgs::Imu>("/imu/data", 50, &ScanRegistration::handleIMUMessage, this);
 
 
-  // advertise scan registration topics
-  _pubLaserCloud = node.advertise<sensor_msgs::PointCloud2>("/velodyne_cloud_2", 2);
-  _pubCornerPointsSharp = node.advertise<sensor_msgs::PointCloud2>("/laser_cloud_sharp", 2);
-  _pubCornerPointsLessSharp = node.advertise<sensor_msgs::PointCloud2>("/laser_cloud_less_sharp", 2);
-  _pubSurfPointsFlat = node.advertise<sensor_msgs::PointCloud2>("/laser_cloud_flat", 2);
-  _pubSurfPointsLessFlat = node.advertise<sensor_msgs::PointCloud2>("/laser_cloud_less_flat", 2);
-  _pubImuTrans = node.advertise<sensor_msgs::PointCloud2>("/imu_trans", 5);
+  // advertise scan registration topic
+  _pubFeatureFrame = node.advertise<loam_velodyne::FeatureFrame>("/feature_frame", 2);
 
   return true;
 }
@@ -269,11 +265,7 @@ void ScanRegistration::reset(const ros::Time& scanTime,
     _sweepStart = scanTime;
 
     // clear cloud buffers
-    _laserCloud.clear();
-    _cornerPointsSharp.clear();
-    _cornerPointsLessSharp.clear();
-    _surfacePointsFlat.clear();
-    _surfacePointsLessFlat.clear();
+    _features.clear();
 
     // clear scan indices vector
     _scanIndices.clear();
@@ -292,7 +284,7 @@ void ScanRegistration::setIMUTransformFor(const float& relTime)
 
 
 
-void ScanRegistration::transformToStartIMU(pcl::PointXYZI& point)
+void ScanRegistration::transformToStartIMU(PointXYZIRT& point)
 {
   // rotate point to global IMU system
   rotateZXY(point, _imuCur.roll, _imuCur.pitch, _imuCur.yaw);
@@ -329,10 +321,12 @@ void ScanRegistration::interpolateIMUStateFor(const float &relTime,
 
 void ScanRegistration::extractFeatures(const uint16_t& beginIdx)
 {
+  TraceSpan span("scanRegistration", "extractFeatures", _sweepStart);
+
   // extract features from individual scans
   size_t nScans = _scanIndices.size();
   for (size_t i = beginIdx; i < nScans; i++) {
-    pcl::PointCloud<pcl::PointXYZI>::Ptr surfPointsLessFlatScan(new pcl::PointCloud<pcl::PointXYZI>);
+    _surfPointsLessFlatScan.clear();
     size_t scanStartIdx = _scanIndices[i].first;
     size_t scanEndIdx = _scanIndices[i].second;
 
@@ -344,7 +338,7 @@ void ScanRegistration::extractFeatures(const uint16_t& beginIdx)
     // Quick&Dirty fix for relative point time calculation without IMU data
     /*float scanSize = scanEndIdx - scanStartIdx + 1;
     for (int j = scanStartIdx; j <= scanEndIdx; j++) {
-      _laserCloud[j].intensity = i + _scanPeriod * (j - scanStartIdx) / scanSize;
+      _features.laserCloud[j].intensity = i + _scanPeriod * (j - scanStartIdx) / scanSize;
     }*/
 
     // reset scan buffers
@@ -381,11 +375,11 @@ void ScanRegistration::extractFeatures(const uint16_t& beginIdx)
           largestPickedNum++;
           if (largestPickedNum <= _config.maxCornerSharp) {
             _regionLabel[regionIdx] = CORNER_SHARP;
-            _cornerPointsSharp.push_back(_laserCloud[idx]);
+            _features.cornerPointsSharp.push_back(_features.laserCloud[idx]);
           } else {
             _regionLabel[regionIdx] = CORNER_LESS_SHARP;
           }
-          _cornerPointsLessSharp.push_back(_laserCloud[idx]);
+          _features.cornerPointsLessSharp.push_back(_features.laserCloud[idx]);
 
           markAsPicked(idx, scanIdx);
         }
@@ -403,7 +397,7 @@ void ScanRegistration::extractFeatures(const uint16_t& beginIdx)
 
           smallestPickedNum++;
           _regionLabel[regionIdx] = SURFACE_FLAT;
-          _surfacePointsFlat.push_back(_laserCloud[idx]);
+          _features.surfacePointsFlat.push_back(_features.laserCloud[idx]);
 
           markAsPicked(idx, scanIdx);
         }
@@ -412,19 +406,16 @@ void ScanRegistration::extractFeatures(const uint16_t& beginIdx)
       // extract less flat surface features
       for (int k = 0; k < regionSize; k++) {
         if (_regionLabel[k] <= SURFACE_LESS_FLAT) {
-          surfPointsLessFlatScan->push_back(_laserCloud[sp + k]);
+          _surfPointsLessFlatScan.push_back(_features.laserCloud[sp + k]);
         }
       }
     }
 
     // down size less flat surface point cloud of current scan
-    pcl::PointCloud<pcl::PointXYZI> surfPointsLessFlatScanDS;
-    pcl::VoxelGrid<pcl::PointXYZI> downSizeFilter;
-    downSizeFilter.setInputCloud(surfPointsLessFlatScan);
-    downSizeFilter.setLeafSize(_config.lessFlatFilterSize, _config.lessFlatFilterSize, _config.lessFlatFilterSize);
-    downSizeFilter.filter(surfPointsLessFlatScanDS);
+    _lessFlatFilter.setLeafSize(_config.lessFlatFilterSize);
+    _lessFlatFilter.filter(_surfPointsLessFlatScan, _surfPointsLessFlatScanDS);
 
-    _surfacePointsLessFlat += surfPointsLessFlatScanDS;
+    _features.surfacePointsLessFlat += _surfPointsLessFlatScanDS;
   }
 }
 
@@ -432,6 +423,15 @@ void ScanRegistration::extractFeatures(const uint16_t& beginIdx)
 
 void ScanRegistration::setRegionBuffersFor(const size_t& startIdx,
                                            const size_t& endIdx)
+{
+  calculateRegionCurvature(startIdx, endIdx);
+  sortRegionIndices(startIdx);
+}
+
+
+
+void ScanRegistration::calculateRegionCurvature(const size_t& startIdx,
+                                                const size_t& endIdx)
 {
   // resize buffers
   size_t regionSize = endIdx - startIdx + 1;
@@ -443,21 +443,27 @@ void ScanRegistration::setRegionBuffersFor(const size_t& startIdx,
   float pointWeight = -2 * _config.curvatureRegion;
 
   for (size_t i = startIdx, regionIdx = 0; i <= endIdx; i++, regionIdx++) {
-    float diffX = pointWeight * _laserCloud[i].x;
-    float diffY = pointWeight * _laserCloud[i].y;
-    float diffZ = pointWeight * _laserCloud[i].z;
+    float diffX = pointWeight * _features.laserCloud[i].x;
+    float diffY = pointWeight * _features.laserCloud[i].y;
+    float diffZ = pointWeight * _features.laserCloud[i].z;
 
     for (int j = 1; j <= _config.curvatureRegion; j++) {
-      diffX += _laserCloud[i + j].x + _laserCloud[i - j].x;
-      diffY += _laserCloud[i + j].y + _laserCloud[i - j].y;
-      diffZ += _laserCloud[i + j].z + _laserCloud[i - j].z;
+      diffX += _features.laserCloud[i + j].x + _features.laserCloud[i - j].x;
+      diffY += _features.laserCloud[i + j].y + _features.laserCloud[i - j].y;
+      diffZ += _features.laserCloud[i + j].z + _features.laserCloud[i - j].z;
     }
 
     _regionCurvature[regionIdx] = diffX * diffX + diffY * diffY + diffZ * diffZ;
     _regionSortIndices[regionIdx] = i;
   }
+}
+
 
+
+void ScanRegistration::sortRegionIndices(const size_t& startIdx)
+{
   // sort point curvatures
+  size_t regionSize = _regionSortIndices.size();
   for (size_t i = 1; i < regionSize; i++) {
     for (size_t j = i; j >= 1; j--) {
       if (_regionCurvature[_regionSortIndices[j] - startIdx] < _regionCurvature[_regionSortIndices[j - 1] - startIdx]) {
@@ -478,9 +484,9 @@ void ScanRegistration::setScanBuffersFor(const size_t& startIdx,
 
   // mark unreliable points as picked
   for (size_t i = startIdx + _config.curvatureRegion; i < endIdx - _config.curvatureRegion; i++) {
-    const pcl::PointXYZI& previousPoint = (_laserCloud[i - 1]);
-    const pcl::PointXYZI& point = (_laserCloud[i]);
-    const pcl::PointXYZI& nextPoint = (_laserCloud[i + 1]);
+    const PointXYZIRT& previousPoint = (_features.laserCloud[i - 1]);
+    const PointXYZIRT& point = (_features.laserCloud[i]);
+    const PointXYZIRT& nextPoint = (_features.laserCloud[i + 1]);
 
     float diffNext = calcSquaredDiff(nextPoint, point);
 
@@ -522,7 +528,7 @@ void ScanRegistration::markAsPicked(const size_t& cloudIdx,
   _scanNeighborPicked[scanIdx] = 1;
 
   for (int i = 1; i <= _config.curvatureRegion; i++) {
-    if (calcSquaredDiff(_laserCloud[cloudIdx + i], _laserCloud[cloudIdx + i - 1]) > 0.05) {
+    if (calcSquaredDiff(_features.laserCloud[cloudIdx + i], _features.laserCloud[cloudIdx + i - 1]) > 0.05) {
       break;
     }
 
@@ -530,7 +536,7 @@ void ScanRegistration::markAsPicked(const size_t& cloudIdx,
   }
 
   for (int i = 1; i <= _config.curvatureRegion; i++) {
-    if (calcSquaredDiff(_laserCloud[cloudIdx - i], _laserCloud[cloudIdx - i + 1]) > 0.05) {
+    if (calcSquaredDiff(_features.laserCloud[cloudIdx - i], _features.laserCloud[cloudIdx - i + 1]) > 0.05) {
       break;
     }
 
@@ -542,38 +548,28 @@ void ScanRegistration::markAsPicked(const size_t& cloudIdx,
 
 void ScanRegistration::publishResult()
 {
-  // publish full resolution and feature point clouds
-  publishCloudMsg(_pubLaserCloud,            _laserCloud,            _sweepStart, "/camera");
-  publishCloudMsg(_pubCornerPointsSharp,     _cornerPointsSharp,     _sweepStart, "/camera");
-  publishCloudMsg(_pubCornerPointsLessSharp, _cornerPointsLessSharp, _sweepStart, "/camera");
-  publishCloudMsg(_pubSurfPointsFlat,        _surfacePointsFlat,     _sweepStart, "/camera");
-  publishCloudMsg(_pubSurfPointsLessFlat,    _surfacePointsLessFlat, _sweepStart, "/camera");
-
-
-  // publish corresponding IMU transformation information
-  _imuTrans[0].x = _imuStart.pitch.rad();
-  _imuTrans[0].y = _imuStart.yaw.rad();
-  _imuTrans[0].z = _imuStart.roll.rad();
+  TraceSpan span("scanRegistration", "publishResult", _sweepStart);
 
-  _imuTrans[1].x = _imuCur.pitch.rad();
-  _imuTrans[1].y = _imuCur.yaw.rad();
-  _imuTrans[1].z = _imuCur.roll.rad();
+  // bundle the full resolution and feature point clouds with the corresponding IMU transformation information
+  _features.sweepStart = _sweepStart;
+  _features.scanPeriod = _config.scanPeriod;
 
-  Vector3 imuShiftFromStart = _imuPositionShift;
-  rotateYXZ(imuShiftFromStart, -_imuStart.yaw, -_imuStart.pitch, -_imuStart.roll);
+  _features.imuRollStart = _imuStart.roll;
+  _features.imuPitchStart = _imuStart.pitch;
+  _features.imuYawStart = _imuStart.yaw;
 
-  _imuTrans[2].x = imuShiftFromStart.x();
-  _imuTrans[2].y = imuShiftFromStart.y();
-  _imuTrans[2].z = imuShiftFromStart.z();
+  _features.imuRollEnd = _imuCur.roll;
+  _features.imuPitchEnd = _imuCur.pitch;
+  _features.imuYawEnd = _imuCur.yaw;
 
-  Vector3 imuVelocityFromStart = _imuCur.velocity - _imuStart.velocity;
-  rotateYXZ(imuVelocityFromStart, -_imuStart.yaw, -_imuStart.pitch, -_imuStart.roll);
+  _features.imuShiftFromStart = _imuPositionShift;
+  rotateYXZ(_features.imuShiftFromStart, -_imuStart.yaw, -_imuStart.pitch, -_imuStart.roll);
 
-  _imuTrans[3].x = imuVelocityFromStart.x();
-  _imuTrans[3].y = imuVelocityFromStart.y();
-  _imuTrans[3].z = imuVelocityFromStart.z();
+  _features.imuVeloFromStart = _imuCur.velocity - _imuStart.velocity;
+  rotateYXZ(_features.imuVeloFromStart, -_imuStart.yaw, -_imuStart.pitch, -_imuStart.roll);
 
-  publishCloudMsg(_pubImuTrans, _imuTrans, _sweepStart, "/camera");
+  _features.toMsg(_featureFrameMsg, !_featureOnly);
+  _pubFeatureFrame.publish(_featureFrameMsg);
 }
 
 } // end namespace loam
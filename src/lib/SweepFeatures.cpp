@@ -0,0 +1,162 @@
+// Copyright 2013, Ji Zhang, Carnegie Mellon University
+// Further contributions copyright (c) 2016, Southwest Research Institute
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from this
+//    software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// This is an implementation of the algorithm described in the following paper:
+//   J. Zhang and S. Singh. LOAM: Lidar Odometry and Mapping in Real-time.
+//     Robotics: Science and Systems Conference (RSS). Berkeley, CA, July 2014.
+
+#include "loam_velodyne/SweepFeatures.h"
+
+#include <pcl_conversions/pcl_conversions.h>
+
+
+namespace loam {
+
+/** \brief Append a range of the packed cloud to the given cloud. */
+static size_t unpackCloud(const pcl::PointCloud<PointXYZIRT>& packed,
+                          const size_t& offset,
+                          const size_t& count,
+                          pcl::PointCloud<PointXYZIRT>& cloud)
+{
+  cloud.points.assign(packed.points.begin() + offset, packed.points.begin() + offset + count);
+  cloud.width = count;
+  cloud.height = 1;
+  cloud.is_dense = packed.is_dense;
+  return offset + count;
+}
+
+
+
+SweepFeatures::SweepFeatures()
+    : scanPeriod(0)
+{
+  // nothing to do
+}
+
+
+
+void SweepFeatures::clear()
+{
+  cornerPointsSharp.clear();
+  cornerPointsLessSharp.clear();
+  surfacePointsFlat.clear();
+  surfacePointsLessFlat.clear();
+  laserCloud.clear();
+
+  imuRollStart = 0;
+  imuPitchStart = 0;
+  imuYawStart = 0;
+  imuRollEnd = 0;
+  imuPitchEnd = 0;
+  imuYawEnd = 0;
+  imuShiftFromStart = Vector3();
+  imuVeloFromStart = Vector3();
+}
+
+
+
+void SweepFeatures::toMsg(loam_velodyne::FeatureFrame& msg,
+                          const bool& includeFullRes)
+{
+  msg.header.stamp = sweepStart;
+  msg.header.frame_id = "/camera";
+  msg.scanPeriod = scanPeriod;
+
+  msg.cornerPointsSharp = cornerPointsSharp.size();
+  msg.cornerPointsLessSharp = cornerPointsLessSharp.size();
+  msg.surfacePointsFlat = surfacePointsFlat.size();
+  msg.surfacePointsLessFlat = surfacePointsLessFlat.size();
+  msg.laserCloud = includeFullRes ? laserCloud.size() : 0;
+
+  _packed.clear();
+  _packed.reserve(msg.cornerPointsSharp + msg.cornerPointsLessSharp + msg.surfacePointsFlat
+                  + msg.surfacePointsLessFlat + msg.laserCloud);
+  _packed += cornerPointsSharp;
+  _packed += cornerPointsLessSharp;
+  _packed += surfacePointsFlat;
+  _packed += surfacePointsLessFlat;
+  if (includeFullRes) {
+    _packed += laserCloud;
+  }
+  pcl::toROSMsg(_packed, msg.points);
+  msg.points.header = msg.header;
+
+  msg.imuStart.x = imuPitchStart.rad();
+  msg.imuStart.y = imuYawStart.rad();
+  msg.imuStart.z = imuRollStart.rad();
+
+  msg.imuEnd.x = imuPitchEnd.rad();
+  msg.imuEnd.y = imuYawEnd.rad();
+  msg.imuEnd.z = imuRollEnd.rad();
+
+  msg.imuShiftFromStart.x = imuShiftFromStart.x();
+  msg.imuShiftFromStart.y = imuShiftFromStart.y();
+  msg.imuShiftFromStart.z = imuShiftFromStart.z();
+
+  msg.imuVeloFromStart.x = imuVeloFromStart.x();
+  msg.imuVeloFromStart.y = imuVeloFromStart.y();
+  msg.imuVeloFromStart.z = imuVeloFromStart.z();
+}
+
+
+
+bool SweepFeatures::fromMsg(const loam_velodyne::FeatureFrame& msg)
+{
+  pcl::fromROSMsg(msg.points, _packed);
+
+  size_t numPoints = size_t(msg.cornerPointsSharp) + msg.cornerPointsLessSharp + msg.surfacePointsFlat
+                     + msg.surfacePointsLessFlat + msg.laserCloud;
+  if (numPoints != _packed.size()) {
+    return false;
+  }
+
+  sweepStart = msg.header.stamp;
+  scanPeriod = msg.scanPeriod;
+
+  size_t offset = 0;
+  offset = unpackCloud(_packed, offset, msg.cornerPointsSharp, cornerPointsSharp);
+  offset = unpackCloud(_packed, offset, msg.cornerPointsLessSharp, cornerPointsLessSharp);
+  offset = unpackCloud(_packed, offset, msg.surfacePointsFlat, surfacePointsFlat);
+  offset = unpackCloud(_packed, offset, msg.surfacePointsLessFlat, surfacePointsLessFlat);
+  unpackCloud(_packed, offset, msg.laserCloud, laserCloud);
+
+  imuPitchStart = msg.imuStart.x;
+  imuYawStart = msg.imuStart.y;
+  imuRollStart = msg.imuStart.z;
+
+  imuPitchEnd = msg.imuEnd.x;
+  imuYawEnd = msg.imuEnd.y;
+  imuRollEnd = msg.imuEnd.z;
+
+  imuShiftFromStart = Vector3(msg.imuShiftFromStart.x, msg.imuShiftFromStart.y, msg.imuShiftFromStart.z);
+  imuVeloFromStart = Vector3(msg.imuVeloFromStart.x, msg.imuVeloFromStart.y, msg.imuVeloFromStart.z);
+
+  return true;
+}
+
+} // end namespace loam
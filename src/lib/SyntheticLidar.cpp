@@ -0,0 +1,394 @@
+// Copyright 2013, Ji Zhang, Carnegie Mellon University
+// Further contributions copyright (c) 2016, Southwest Research Institute
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from this
+//    software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// This is an implementation of the algorithm described in the following paper:
+//   J. Zhang and S. Singh. LOAM: Lidar Odometry and Mapping in Real-time.
+//     Robotics: Science and Systems Conference (RSS). Berkeley, CA, July 2014.
+
+#include "loam_velodyne/SyntheticLidar.h"
+
+#include <Eigen/Geometry>
+
+#include <algorithm>
+#include <cmath>
+
+
+namespace loam {
+
+/** \brief Draw a uniformly distributed random number in [min, max). */
+static float uniform(boost::mt19937& rng, const float& min, const float& max)
+{
+  return min + (max - min) * float(rng() / 4294967296.0);
+}
+
+/** \brief Draw a standard normally distributed random number (Box-Muller transform). */
+static float gaussian(boost::mt19937& rng)
+{
+  double u1 = (rng() + 1.0) / 4294967297.0;
+  double u2 = rng() / 4294967296.0;
+  return float(std::sqrt(-2 * std::log(u1)) * std::cos(2 * M_PI * u2));
+}
+
+/** \brief Add an axis aligned box with the given footprint and height range. */
+static void addBox(std::vector<SyntheticScene::Box>& boxes,
+                   const float& minX, const float& minY, const float& maxX, const float& maxY,
+                   const float& bottom, const float& top, const float& intensity)
+{
+  SyntheticScene::Box box;
+  box.min = Eigen::Vector3f(minX, minY, bottom);
+  box.max = Eigen::Vector3f(maxX, maxY, top);
+  box.intensity = intensity;
+  boxes.push_back(box);
+}
+
+
+
+SyntheticScene SyntheticScene::city(const float& extent,
+                                    const unsigned int& seed)
+{
+  const float blockSize = 50;       // distance between parallel streets
+  const float streetWidth = 16;     // street width including the sidewalks
+  const float poleSpacing = 12.5f;
+  const float carSpacing = 6;
+
+  SyntheticScene scene;
+  boost::mt19937 rng(seed);
+
+  Plane ground;
+  ground.normal = Eigen::Vector3f::UnitZ();
+  ground.offset = 0;
+  ground.intensity = 20;
+  scene.planes.push_back(ground);
+
+  int nBlocks = int(std::ceil(extent / blockSize));
+  for (int i = -nBlocks; i < nBlocks; i++) {
+    for (int j = -nBlocks; j < nBlocks; j++) {
+      float minX = i * blockSize + streetWidth / 2;
+      float minY = j * blockSize + streetWidth / 2;
+      float maxX = (i + 1) * blockSize - streetWidth / 2;
+      float maxY = (j + 1) * blockSize - streetWidth / 2;
+      float midX = (minX + maxX) / 2;
+      float midY = (minY + maxY) / 2;
+
+      // up to four buildings per block, one per lot
+      float lots[4][4] = { { minX, minY, midX, midY }, { midX, minY, maxX, midY },
+                           { minX, midY, midX, maxY }, { midX, midY, maxX, maxY } };
+      for (int k = 0; k < 4; k++) {
+        if (uniform(rng, 0, 1) < 0.8f) {
+          addBox(scene.boxes,
+                 lots[k][0] + uniform(rng, 0.5f, 4), lots[k][1] + uniform(rng, 0.5f, 4),
+                 lots[k][2] - uniform(rng, 0.5f, 4), lots[k][3] - uniform(rng, 0.5f, 4),
+                 0, uniform(rng, 4, 30), 60);
+        }
+      }
+
+      // poles along the sidewalks of the block
+      for (float d = 0; d <= maxX - minX; d += poleSpacing) {
+        for (int side = 0; side < 4; side++) {
+          Pole pole;
+          switch (side) {
+            case 0: pole.center = Eigen::Vector2f(minX + d, minY - 1); break;
+            case 1: pole.center = Eigen::Vector2f(minX + d, maxY + 1); break;
+            case 2: pole.center = Eigen::Vector2f(minX - 1, minY + d); break;
+            default: pole.center = Eigen::Vector2f(maxX + 1, minY + d); break;
+          }
+          pole.radius = 0.15f;
+          pole.bottom = 0;
+          pole.top = 6;
+          pole.intensity = 120;
+          scene.poles.push_back(pole);
+        }
+      }
+
+      // cars parked along the curbs of the block
+      for (float d = 0; d + carSpacing <= maxX - minX; d += carSpacing) {
+        if (uniform(rng, 0, 1) < 0.3f) {
+          addBox(scene.boxes, minX + d + 0.7f, minY - 4.3f, minX + d + 5.2f, minY - 2.5f, 0.2f, 1.6f, 90);
+        }
+        if (uniform(rng, 0, 1) < 0.3f) {
+          addBox(scene.boxes, minX + d + 0.7f, maxY + 2.5f, minX + d + 5.2f, maxY + 4.3f, 0.2f, 1.6f, 90);
+        }
+        if (uniform(rng, 0, 1) < 0.3f) {
+          addBox(scene.boxes, minX - 4.3f, minY + d + 0.7f, minX - 2.5f, minY + d + 5.2f, 0.2f, 1.6f, 90);
+        }
+        if (uniform(rng, 0, 1) < 0.3f) {
+          addBox(scene.boxes, maxX + 2.5f, minY + d + 0.7f, maxX + 4.3f, minY + d + 5.2f, 0.2f, 1.6f, 90);
+        }
+      }
+    }
+  }
+
+  return scene;
+}
+
+
+
+bool SyntheticScene::castRay(const Eigen::Vector3f& origin,
+                             const Eigen::Vector3f& direction,
+                             const float& maxRange,
+                             float& range,
+                             float& intensity) const
+{
+  float closest = maxRange;
+  bool hit = false;
+
+  for (size_t i = 0; i < planes.size(); i++) {
+    const Plane& plane = planes[i];
+    float denom = plane.normal.dot(direction);
+    if (std::fabs(denom) < 1e-6f) {
+      continue;
+    }
+
+    float t = (plane.offset - plane.normal.dot(origin)) / denom;
+    if (t > 0 && t < closest) {
+      closest = t;
+      intensity = plane.intensity;
+      hit = true;
+    }
+  }
+
+  for (size_t i = 0; i < _activePoles.size(); i++) {
+    const Pole& pole = poles[_activePoles[i]];
+    float ox = origin.x() - pole.center.x();
+    float oy = origin.y() - pole.center.y();
+    float a = direction.x() * direction.x() + direction.y() * direction.y();
+    float b = ox * direction.x() + oy * direction.y();
+    float c = ox * ox + oy * oy - pole.radius * pole.radius;
+    float disc = b * b - a * c;
+    if (a < 1e-9f || disc < 0) {
+      continue;
+    }
+
+    float t = (-b - std::sqrt(disc)) / a;
+    float z = origin.z() + t * direction.z();
+    if (t > 0 && t < closest && z >= pole.bottom && z <= pole.top) {
+      closest = t;
+      intensity = pole.intensity;
+      hit = true;
+    }
+  }
+
+  for (size_t i = 0; i < _activeBoxes.size(); i++) {
+    const Box& box = boxes[_activeBoxes[i]];
+    float tEnter = 0;
+    float tExit = closest;
+    bool miss = false;
+
+    for (int axis = 0; axis < 3 && !miss; axis++) {
+      if (std::fabs(direction[axis]) < 1e-9f) {
+        miss = origin[axis] < box.min[axis] || origin[axis] > box.max[axis];
+        continue;
+      }
+
+      float t1 = (box.min[axis] - origin[axis]) / direction[axis];
+      float t2 = (box.max[axis] - origin[axis]) / direction[axis];
+      tEnter = std::max(tEnter, std::min(t1, t2));
+      tExit = std::min(tExit, std::max(t1, t2));
+      miss = tEnter > tExit;
+    }
+
+    if (!miss && tEnter > 0 && tEnter < closest) {
+      closest = tEnter;
+      intensity = box.intensity;
+      hit = true;
+    }
+  }
+
+  range = closest;
+  return hit;
+}
+
+
+
+void SyntheticScene::cull(const Eigen::Vector3f& position,
+                          const float& radius)
+{
+  _activePoles.clear();
+  for (size_t i = 0; i < poles.size(); i++) {
+    if ((poles[i].center - position.head<2>()).norm() <= radius + poles[i].radius) {
+      _activePoles.push_back(i);
+    }
+  }
+
+  _activeBoxes.clear();
+  for (size_t i = 0; i < boxes.size(); i++) {
+    Eigen::Vector3f closestPoint = position.cwiseMax(boxes[i].min).cwiseMin(boxes[i].max);
+    if ((closestPoint - position).norm() <= radius) {
+      _activeBoxes.push_back(i);
+    }
+  }
+}
+
+
+
+/** \brief Calculate the heading, position, velocity and acceleration along the trajectory (without sway). */
+static void trajectoryState(const SyntheticTrajectory& trajectory,
+                            const double& time,
+                            double& yaw,
+                            Eigen::Vector3d& pos,
+                            Eigen::Vector3d& vel,
+                            Eigen::Vector3d& acc)
+{
+  double v = trajectory.speed;
+  double w = trajectory.yawRate;
+  yaw = w * time;
+
+  if (std::fabs(w) > 1e-9) {
+    pos = Eigen::Vector3d(v / w * std::sin(yaw), v / w * (1 - std::cos(yaw)), trajectory.height);
+  } else {
+    pos = Eigen::Vector3d(v * time, 0, trajectory.height);
+  }
+  vel = Eigen::Vector3d(v * std::cos(yaw), v * std::sin(yaw), 0);
+  acc = Eigen::Vector3d(-v * w * std::sin(yaw), v * w * std::cos(yaw), 0);
+}
+
+
+
+void SyntheticTrajectory::poseAt(const double& time,
+                                 Eigen::Matrix3f& rot,
+                                 Eigen::Vector3f& pos) const
+{
+  double yaw;
+  Eigen::Vector3d position, vel, acc;
+  trajectoryState(*this, time, yaw, position, vel, acc);
+
+  double phase = 2 * M_PI * swayFrequency * time;
+  double roll = swayAmplitude * std::sin(phase);
+  double pitch = swayAmplitude * std::cos(phase);
+
+  rot = (Eigen::AngleAxisd(yaw, Eigen::Vector3d::UnitZ())
+         * Eigen::AngleAxisd(pitch, Eigen::Vector3d::UnitY())
+         * Eigen::AngleAxisd(roll, Eigen::Vector3d::UnitX())).toRotationMatrix().cast<float>();
+  pos = position.cast<float>();
+}
+
+
+
+SyntheticLidar::SyntheticLidar(const MultiScanMapper& scanMapper,
+                               const size_t& nColumns,
+                               const float& scanPeriod)
+    : maxRange(100),
+      rangeNoise(0.02f),
+      _scanMapper(scanMapper),
+      _nColumns(nColumns),
+      _scanPeriod(scanPeriod),
+      _rng(1)
+{
+  // nothing to do
+}
+
+
+
+void SyntheticLidar::generateSweep(const double& sweepStart,
+                                   pcl::PointCloud<pcl::PointXYZI>& cloud)
+{
+  size_t nRings = _scanMapper.getNumberOfScanRings();
+  float lowerBound = _scanMapper.getLowerBound() * float(M_PI) / 180;
+  float upperBound = _scanMapper.getUpperBound() * float(M_PI) / 180;
+
+  std::vector<float> ringSin(nRings), ringCos(nRings);
+  for (size_t k = 0; k < nRings; k++) {
+    float elevation = lowerBound + (upperBound - lowerBound) * k / (nRings - 1);
+    ringSin[k] = std::sin(elevation);
+    ringCos[k] = std::cos(elevation);
+  }
+
+  Eigen::Matrix3f rot;
+  Eigen::Vector3f pos;
+  trajectory.poseAt(sweepStart + _scanPeriod / 2, rot, pos);
+  scene.cull(pos, maxRange + trajectory.speed * _scanPeriod);
+
+  cloud.clear();
+  cloud.reserve(_nColumns * nRings);
+
+  pcl::PointXYZI point;
+  for (size_t c = 0; c < _nColumns; c++) {
+    // the sensor spins clockwise, starting behind the sensor
+    trajectory.poseAt(sweepStart + double(_scanPeriod) * c / _nColumns, rot, pos);
+    float azimuth = float(M_PI - 2 * M_PI * c / _nColumns);
+    float azimuthSin = std::sin(azimuth);
+    float azimuthCos = std::cos(azimuth);
+
+    for (size_t k = 0; k < nRings; k++) {
+      Eigen::Vector3f direction(ringCos[k] * azimuthCos, ringCos[k] * azimuthSin, ringSin[k]);
+      float range, intensity;
+      if (!scene.castRay(pos, rot * direction, maxRange, range, intensity)) {
+        continue;
+      }
+
+      if (rangeNoise > 0) {
+        range += rangeNoise * gaussian(_rng);
+      }
+
+      point.x = range * direction.x();
+      point.y = range * direction.y();
+      point.z = range * direction.z();
+      point.intensity = intensity;
+      cloud.push_back(point);
+    }
+  }
+}
+
+
+
+void SyntheticLidar::generateImu(const double& time,
+                                 sensor_msgs::Imu& imu) const
+{
+  double yaw;
+  Eigen::Vector3d pos, vel, acc;
+  trajectoryState(trajectory, time, yaw, pos, vel, acc);
+
+  double rate = 2 * M_PI * trajectory.swayFrequency;
+  double phase = rate * time;
+  double roll = trajectory.swayAmplitude * std::sin(phase);
+  double pitch = trajectory.swayAmplitude * std::cos(phase);
+  double rollRate = trajectory.swayAmplitude * rate * std::cos(phase);
+  double pitchRate = -trajectory.swayAmplitude * rate * std::sin(phase);
+  double yawRate = trajectory.yawRate;
+
+  Eigen::Quaterniond orientation(Eigen::AngleAxisd(yaw, Eigen::Vector3d::UnitZ())
+                                 * Eigen::AngleAxisd(pitch, Eigen::Vector3d::UnitY())
+                                 * Eigen::AngleAxisd(roll, Eigen::Vector3d::UnitX()));
+  imu.orientation.x = orientation.x();
+  imu.orientation.y = orientation.y();
+  imu.orientation.z = orientation.z();
+  imu.orientation.w = orientation.w();
+
+  // body frame angular velocity of the z-y-x Euler angles
+  imu.angular_velocity.x = rollRate - yawRate * std::sin(pitch);
+  imu.angular_velocity.y = pitchRate * std::cos(roll) + yawRate * std::cos(pitch) * std::sin(roll);
+  imu.angular_velocity.z = -pitchRate * std::sin(roll) + yawRate * std::cos(pitch) * std::cos(roll);
+
+  // the accelerometer measures the specific force, i.e. includes the reaction to gravity
+  Eigen::Vector3d specificForce = orientation.toRotationMatrix().transpose() * (acc + Eigen::Vector3d(0, 0, 9.81));
+  imu.linear_acceleration.x = specificForce.x();
+  imu.linear_acceleration.y = specificForce.y();
+  imu.linear_acceleration.z = specificForce.z();
+}
+
+} // end namespace loam
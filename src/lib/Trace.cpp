@@ -0,0 +1,271 @@
+// Copyright 2013, Ji Zhang, Carnegie Mellon University
+// Further contributions copyright (c) 2016, Southwest Research Institute
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from this
+//    software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// This is an implementation of the algorithm described in the following paper:
+//   J. Zhang and S. Singh. LOAM: Lidar Odometry and Mapping in Real-time.
+//     Robotics: Science and Systems Conference (RSS). Berkeley, CA, July 2014.
+
+#include "loam_velodyne/Trace.h"
+
+#include <ros/ros.h>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/tss.hpp>
+
+#include <stdint.h>
+#include <unistd.h>
+#include <csignal>
+#include <cstdio>
+#include <vector>
+
+
+namespace loam {
+
+/** \brief A recorded span. */
+struct TraceEvent {
+  const char* category;   ///< span category
+  const char* name;       ///< span name
+  uint64_t frame;         ///< time stamp of the processed sweep (in nanoseconds)
+  uint64_t start;         ///< wall clock start time (in nanoseconds)
+  uint64_t end;           ///< wall clock end time (in nanoseconds)
+};
+
+/** \brief Span ring buffer of a single thread. */
+struct TraceBuffer {
+  boost::mutex mutex;               ///< guards the buffer against concurrent writing of the trace file
+  std::vector<TraceEvent> events;   ///< ring buffer of recorded spans
+  size_t next;                      ///< ring buffer index of the next span
+  size_t size;                      ///< number of recorded spans
+  int tid;                          ///< trace thread ID
+  std::string name;                 ///< thread name
+};
+
+/** \brief The thread buffers outlive their threads, such that the spans of finished threads are written, too. */
+static void keepBuffer(TraceBuffer*) {}
+
+static boost::mutex registryMutex;                 ///< guards the registry and the trace settings
+static std::vector<TraceBuffer*> registry;         ///< buffers of all threads that recorded spans
+static boost::thread_specific_ptr<TraceBuffer> localBuffer(&keepBuffer);
+static size_t traceBufferSize = 65536;             ///< number of spans kept per thread
+static std::string tracePath;                      ///< trace file
+static std::string processName;                    ///< process name shown in the trace
+static boost::thread flushThread;                  ///< thread writing the trace file on request
+static volatile sig_atomic_t flushRequested = 0;   ///< flag set by the SIGUSR1 handler
+
+boost::atomic<bool> Trace::_enabled(false);
+
+
+
+/** \brief Retrieve the buffer of the calling thread, creating it on first use. */
+static TraceBuffer& currentBuffer()
+{
+  TraceBuffer* buffer = localBuffer.get();
+  if (!buffer) {
+    buffer = new TraceBuffer();
+    buffer->next = 0;
+    buffer->size = 0;
+
+    boost::lock_guard<boost::mutex> lock(registryMutex);
+    buffer->events.resize(traceBufferSize);
+    buffer->tid = int(registry.size()) + 1;
+    registry.push_back(buffer);
+    localBuffer.reset(buffer);
+  }
+
+  return *buffer;
+}
+
+
+
+static void handleFlushSignal(int)
+{
+  flushRequested = 1;
+}
+
+
+
+/** \brief Write the trace file whenever requested by SIGUSR1 (signal handlers must not write files themselves). */
+static void runFlush()
+{
+  try {
+    while (true) {
+      boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+      if (flushRequested) {
+        flushRequested = 0;
+        Trace::write(tracePath);
+      }
+    }
+  } catch (const boost::thread_interrupted&) {
+    // shutdown
+  }
+}
+
+
+
+bool Trace::setup(ros::NodeHandle& privateNode)
+{
+  int iParam;
+  size_t bufferSize = 65536;
+
+  if (privateNode.getParam("traceBufferSize", iParam)) {
+    if (iParam < 1) {
+      ROS_ERROR("Invalid traceBufferSize parameter: %d (expected > 0)", iParam);
+      return false;
+    } else {
+      bufferSize = iParam;
+      ROS_INFO("Set traceBufferSize: %d", iParam);
+    }
+  }
+
+  std::string path;
+  if (privateNode.getParam("traceFile", path) && !path.empty()) {
+    processName = privateNode.getNamespace();
+    enable(path, bufferSize);
+    ROS_INFO("Set traceFile: %s", path.c_str());
+  }
+
+  return true;
+}
+
+
+
+void Trace::enable(const std::string& path,
+                   const size_t& bufferSize)
+{
+  boost::lock_guard<boost::mutex> lock(registryMutex);
+  if (enabled()) {
+    // several components in a single process share the trace of the first one
+    return;
+  }
+
+  tracePath = path;
+  traceBufferSize = bufferSize;
+  _enabled.store(true);
+
+  std::signal(SIGUSR1, &handleFlushSignal);
+  flushThread = boost::thread(&runFlush);
+}
+
+
+
+void Trace::setThreadName(const char* name)
+{
+  TraceBuffer& threadBuffer = currentBuffer();
+  boost::lock_guard<boost::mutex> lock(threadBuffer.mutex);
+  threadBuffer.name = name;
+}
+
+
+
+void Trace::record(const char* category,
+                   const char* name,
+                   const ros::Time& frame,
+                   const ros::WallTime& start,
+                   const ros::WallTime& end)
+{
+  TraceBuffer& threadBuffer = currentBuffer();
+  boost::lock_guard<boost::mutex> lock(threadBuffer.mutex);
+
+  TraceEvent& event = threadBuffer.events[threadBuffer.next];
+  event.category = category;
+  event.name = name;
+  event.frame = frame.toNSec();
+  event.start = start.toNSec();
+  event.end = end.toNSec();
+
+  threadBuffer.next = (threadBuffer.next + 1) % threadBuffer.events.size();
+  if (threadBuffer.size < threadBuffer.events.size()) {
+    threadBuffer.size++;
+  }
+}
+
+
+
+bool Trace::shutdown()
+{
+  if (!enabled()) {
+    return true;
+  }
+
+  _enabled.store(false);
+  flushThread.interrupt();
+  flushThread.join();
+
+  if (!write(tracePath)) {
+    ROS_ERROR("Failed to write trace file %s", tracePath.c_str());
+    return false;
+  }
+
+  ROS_INFO("Wrote trace file %s", tracePath.c_str());
+  return true;
+}
+
+
+
+bool Trace::write(const std::string& path)
+{
+  FILE* file = std::fopen(path.c_str(), "w");
+  if (!file) {
+    return false;
+  }
+
+  int pid = int(getpid());
+  std::fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  std::fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"%s\"}}",
+               pid, processName.c_str());
+
+  boost::lock_guard<boost::mutex> registryLock(registryMutex);
+  for (size_t i = 0; i < registry.size(); i++) {
+    TraceBuffer& threadBuffer = *registry[i];
+    boost::lock_guard<boost::mutex> lock(threadBuffer.mutex);
+
+    if (!threadBuffer.name.empty()) {
+      std::fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                   pid, threadBuffer.tid, threadBuffer.name.c_str());
+    }
+
+    // oldest span first, times in microseconds
+    size_t first = (threadBuffer.next + threadBuffer.events.size() - threadBuffer.size) % threadBuffer.events.size();
+    for (size_t j = 0; j < threadBuffer.size; j++) {
+      const TraceEvent& event = threadBuffer.events[(first + j) % threadBuffer.events.size()];
+      uint64_t duration = event.end - event.start;
+      std::fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,"
+                         "\"ts\":%llu.%03u,\"dur\":%llu.%03u,\"args\":{\"frame\":\"%u.%09u\"}}",
+                   event.name, event.category, pid, threadBuffer.tid,
+                   (unsigned long long) (event.start / 1000), unsigned(event.start % 1000),
+                   (unsigned long long) (duration / 1000), unsigned(duration % 1000),
+                   unsigned(event.frame / 1000000000), unsigned(event.frame % 1000000000));
+    }
+  }
+
+  std::fprintf(file, "\n]}\n");
+  return std::fclose(file) == 0;
+}
+
+} // end namespace loam
@@ -31,40 +31,64 @@
 //     Robotics: Science and Systems Conference (RSS). Berkeley, CA, July 2014.
 
 #include "loam_velodyne/TransformMaintenance.h"
+#include "loam_velodyne/Pose.h"
+#include "loam_velodyne/Trace.h"
 
 
 namespace loam {
 
-using std::sin;
-using std::cos;
-using std::asin;
-using std::atan2;
-
-
 TransformMaintenance::TransformMaintenance()
+    : _velocity(Eigen::Vector3f::Zero()),
+      _imuHistory(400),
+      _imuRotSum(Eigen::Matrix3f::Identity()),
+      _imuRotSumValid(false),
+      _maxImuPropagation(0.5)
 {
   // initialize odometry and odometry tf messages
   _laserOdometry2.header.frame_id = "/camera_init";
   _laserOdometry2.child_frame_id = "/camera";
 
+  _imuOdometry.header.frame_id = "/camera_init";
+  _imuOdometry.child_frame_id = "/camera";
+
   _laserOdometryTrans2.frame_id_ = "/camera_init";
   _laserOdometryTrans2.child_frame_id_ = "/camera";
-
-
-  for (int i = 0; i < 6; i++) {
-    _transformSum[i] = 0;
-    _transformIncre[i] = 0;
-    _transformMapped[i] = 0;
-    _transformBefMapped[i] = 0;
-    _transformAftMapped[i] = 0;
-  }
 }
 
 
 bool TransformMaintenance::setup(ros::NodeHandle &node, ros::NodeHandle &privateNode)
 {
-  // advertise integrated laser odometry topic
+  // fetch transform maintenance params
+  float fParam;
+
+  if (privateNode.getParam("maxImuPropagation", fParam)) {
+    if (fParam < 0) {
+      ROS_ERROR("Invalid maxImuPropagation parameter: %f (expected >= 0)", fParam);
+      return false;
+    } else {
+      _maxImuPropagation = fParam;
+      ROS_INFO("Set maxImuPropagation: %g", fParam);
+    }
+  }
+
+  int iParam;
+  if (privateNode.getParam("poseHistorySize", iParam)) {
+    if (iParam < 1) {
+      ROS_ERROR("Invalid poseHistorySize parameter: %d (expected > 0)", iParam);
+      return false;
+    } else {
+      _poseHistory.setCapacity(iParam);
+      ROS_INFO("Set poseHistorySize: %d", iParam);
+    }
+  }
+
+  if (!Trace::setup(privateNode)) {
+    return false;
+  }
+
+  // advertise integrated laser odometry topics
   _pubLaserOdometry2 = node.advertise<nav_msgs::Odometry> ("/integrated_to_init", 5);
+  _pubImuOdometry = node.advertise<nav_msgs::Odometry> ("/integrated_to_init_imu", 50);
 
   // subscribe to laser odometry and mapping odometry topics
   _subLaserOdometry = node.subscribe<nav_msgs::Odometry>
@@ -73,6 +97,14 @@ bool TransformMaintenance::setup(ros::NodeHandle &node, ros::NodeHandle &private
   _subOdomAftMapped = node.subscribe<nav_msgs::Odometry>
       ("/aft_mapped_to_init", 5, &TransformMaintenance::odomAftMappedHandler, this);
 
+  // subscribe to IMU topic (a maximum propagation time of zero disables the high rate output)
+  if (_maxImuPropagation > 0) {
+    _subImu = node.subscribe<sensor_msgs::Imu> ("/imu/data", 50, &TransformMaintenance::imuHandler, this);
+  }
+
+  // advertise pose history query service
+  _srvGetPoseAt = node.advertiseService("/get_pose_at", &TransformMaintenance::getPoseAtHandler, this);
+
   return true;
 }
 
@@ -80,135 +112,104 @@ bool TransformMaintenance::setup(ros::NodeHandle &node, ros::NodeHandle &private
 
 void TransformMaintenance::transformAssociateToMap()
 {
-  float x1 = cos(_transformSum[1]) * (_transformBefMapped[3] - _transformSum[3])
-             - sin(_transformSum[1]) * (_transformBefMapped[5] - _transformSum[5]);
-  float y1 = _transformBefMapped[4] - _transformSum[4];
-  float z1 = sin(_transformSum[1]) * (_transformBefMapped[3] - _transformSum[3])
-             + cos(_transformSum[1]) * (_transformBefMapped[5] - _transformSum[5]);
-
-  float x2 = x1;
-  float y2 = cos(_transformSum[0]) * y1 + sin(_transformSum[0]) * z1;
-  float z2 = -sin(_transformSum[0]) * y1 + cos(_transformSum[0]) * z1;
-
-  _transformIncre[3] = cos(_transformSum[2]) * x2 + sin(_transformSum[2]) * y2;
-  _transformIncre[4] = -sin(_transformSum[2]) * x2 + cos(_transformSum[2]) * y2;
-  _transformIncre[5] = z2;
-
-  float sbcx = sin(_transformSum[0]);
-  float cbcx = cos(_transformSum[0]);
-  float sbcy = sin(_transformSum[1]);
-  float cbcy = cos(_transformSum[1]);
-  float sbcz = sin(_transformSum[2]);
-  float cbcz = cos(_transformSum[2]);
-
-  float sblx = sin(_transformBefMapped[0]);
-  float cblx = cos(_transformBefMapped[0]);
-  float sbly = sin(_transformBefMapped[1]);
-  float cbly = cos(_transformBefMapped[1]);
-  float sblz = sin(_transformBefMapped[2]);
-  float cblz = cos(_transformBefMapped[2]);
-
-  float salx = sin(_transformAftMapped[0]);
-  float calx = cos(_transformAftMapped[0]);
-  float saly = sin(_transformAftMapped[1]);
-  float caly = cos(_transformAftMapped[1]);
-  float salz = sin(_transformAftMapped[2]);
-  float calz = cos(_transformAftMapped[2]);
-
-  float srx = -sbcx*(salx*sblx + calx*cblx*salz*sblz + calx*calz*cblx*cblz)
-              - cbcx*sbcy*(calx*calz*(cbly*sblz - cblz*sblx*sbly)
-                           - calx*salz*(cbly*cblz + sblx*sbly*sblz)
-                           + cblx*salx*sbly)
-              - cbcx*cbcy*(calx*salz*(cblz*sbly - cbly*sblx*sblz)
-                           - calx*calz*(sbly*sblz + cbly*cblz*sblx)
-                           + cblx*cbly*salx);
-  _transformMapped[0] = -asin(srx);
-
-  float srycrx = sbcx*(cblx*cblz*(caly*salz - calz*salx*saly)
-                       - cblx*sblz*(caly*calz + salx*saly*salz) + calx*saly*sblx)
-                 - cbcx*cbcy*((caly*calz + salx*saly*salz)*(cblz*sbly - cbly*sblx*sblz)
-                              + (caly*salz - calz*salx*saly)*(sbly*sblz + cbly*cblz*sblx)
-                              - calx*cblx*cbly*saly)
-                 + cbcx*sbcy*((caly*calz + salx*saly*salz)*(cbly*cblz + sblx*sbly*sblz)
-                              + (caly*salz - calz*salx*saly)*(cbly*sblz - cblz*sblx*sbly)
-                              + calx*cblx*saly*sbly);
-  float crycrx = sbcx*(cblx*sblz*(calz*saly - caly*salx*salz)
-                       - cblx*cblz*(saly*salz + caly*calz*salx) + calx*caly*sblx)
-                 + cbcx*cbcy*((saly*salz + caly*calz*salx)*(sbly*sblz + cbly*cblz*sblx)
-                              + (calz*saly - caly*salx*salz)*(cblz*sbly - cbly*sblx*sblz)
-                              + calx*caly*cblx*cbly)
-                 - cbcx*sbcy*((saly*salz + caly*calz*salx)*(cbly*sblz - cblz*sblx*sbly)
-                              + (calz*saly - caly*salx*salz)*(cbly*cblz + sblx*sbly*sblz)
-                              - calx*caly*cblx*sbly);
-  _transformMapped[1] = atan2(srycrx / cos(_transformMapped[0]),
-                             crycrx / cos(_transformMapped[0]));
-
-  float srzcrx = (cbcz*sbcy - cbcy*sbcx*sbcz)*(calx*salz*(cblz*sbly - cbly*sblx*sblz)
-                                               - calx*calz*(sbly*sblz + cbly*cblz*sblx)
-                                               + cblx*cbly*salx)
-                 - (cbcy*cbcz + sbcx*sbcy*sbcz)*(calx*calz*(cbly*sblz - cblz*sblx*sbly)
-                                                 - calx*salz*(cbly*cblz + sblx*sbly*sblz)
-                                                 + cblx*salx*sbly)
-                 + cbcx*sbcz*(salx*sblx + calx*cblx*salz*sblz + calx*calz*cblx*cblz);
-  float crzcrx = (cbcy*sbcz - cbcz*sbcx*sbcy)*(calx*calz*(cbly*sblz - cblz*sblx*sbly)
-                                               - calx*salz*(cbly*cblz + sblx*sbly*sblz)
-                                               + cblx*salx*sbly)
-                 - (sbcy*sbcz + cbcy*cbcz*sbcx)*(calx*salz*(cblz*sbly - cbly*sblx*sblz)
-                                                 - calx*calz*(sbly*sblz + cbly*cblz*sblx)
-                                                 + cblx*cbly*salx)
-                 + cbcx*cbcz*(salx*sblx + calx*cblx*salz*sblz + calx*calz*cblx*cblz);
-  _transformMapped[2] = atan2(srzcrx / cos(_transformMapped[0]),
-                             crzcrx / cos(_transformMapped[0]));
-
-  x1 = cos(_transformMapped[2]) * _transformIncre[3] - sin(_transformMapped[2]) * _transformIncre[4];
-  y1 = sin(_transformMapped[2]) * _transformIncre[3] + cos(_transformMapped[2]) * _transformIncre[4];
-  z1 = _transformIncre[5];
-
-  x2 = x1;
-  y2 = cos(_transformMapped[0]) * y1 - sin(_transformMapped[0]) * z1;
-  z2 = sin(_transformMapped[0]) * y1 + cos(_transformMapped[0]) * z1;
-
-  _transformMapped[3] = _transformAftMapped[3]
-                       - (cos(_transformMapped[1]) * x2 + sin(_transformMapped[1]) * z2);
-  _transformMapped[4] = _transformAftMapped[4] - y2;
-  _transformMapped[5] = _transformAftMapped[5]
-                       - (-sin(_transformMapped[1]) * x2 + cos(_transformMapped[1]) * z2);
+  Pose transformMapped = Pose(_transformAftMapped) * Pose(_transformBefMapped).inverse() * Pose(_transformSum);
+  _transformMapped = transformMapped.toTwist();
+}
+
+
+
+bool TransformMaintenance::imuOrientationAt(const ros::Time& stamp, Eigen::Matrix3f& rot)
+{
+  size_t imuIdx = 0;
+  while (imuIdx < _imuHistory.size() && _imuHistory[imuIdx].stamp < stamp) {
+    imuIdx++;
+  }
+
+  if (imuIdx == _imuHistory.size()) {
+    // newer than the newest IMU message (only acceptable if the IMU lags behind slightly)
+    if (_imuHistory.empty() || (stamp - _imuHistory.last().stamp).toSec() > 0.05) {
+      return false;
+    }
+    rot = _imuHistory.last().rot;
+  } else if (imuIdx == 0) {
+    // older than the oldest IMU message
+    if (_imuHistory[0].stamp != stamp) {
+      return false;
+    }
+    rot = _imuHistory[0].rot;
+  } else {
+    const IMUOrientation& prev = _imuHistory[imuIdx - 1];
+    const IMUOrientation& next = _imuHistory[imuIdx];
+    IMUOrientation result;
+    IMUOrientation::interpolate(prev, next, float((stamp - prev.stamp).toSec() / (next.stamp - prev.stamp).toSec()),
+                                result);
+    rot = result.rot;
+  }
+
+  return true;
+}
+
+
+
+void TransformMaintenance::publishOdometry(const Twist& transform,
+                                           const ros::Time& stamp,
+                                           nav_msgs::Odometry& msg,
+                                           ros::Publisher& publisher)
+{
+  geometry_msgs::Quaternion geoQuat = tf::createQuaternionMsgFromRollPitchYaw
+      (transform.rot_z.rad(), -transform.rot_x.rad(), -transform.rot_y.rad());
+
+  msg.header.stamp = stamp;
+  msg.pose.pose.orientation.x = -geoQuat.y;
+  msg.pose.pose.orientation.y = -geoQuat.z;
+  msg.pose.pose.orientation.z = geoQuat.x;
+  msg.pose.pose.orientation.w = geoQuat.w;
+  msg.pose.pose.position.x = transform.pos.x();
+  msg.pose.pose.position.y = transform.pos.y();
+  msg.pose.pose.position.z = transform.pos.z();
+  publisher.publish(msg);
 }
 
 
 
 void TransformMaintenance::laserOdometryHandler(const nav_msgs::Odometry::ConstPtr& laserOdometry)
 {
+  TraceSpan span("transformMaintenance", "laserOdometryHandler", laserOdometry->header.stamp);
   double roll, pitch, yaw;
   geometry_msgs::Quaternion geoQuat = laserOdometry->pose.pose.orientation;
   tf::Matrix3x3(tf::Quaternion(geoQuat.z, -geoQuat.x, -geoQuat.y, geoQuat.w)).getRPY(roll, pitch, yaw);
 
-  _transformSum[0] = -pitch;
-  _transformSum[1] = -yaw;
-  _transformSum[2] = roll;
-
-  _transformSum[3] = laserOdometry->pose.pose.position.x;
-  _transformSum[4] = laserOdometry->pose.pose.position.y;
-  _transformSum[5] = laserOdometry->pose.pose.position.z;
+  // estimate the odometry velocity for propagating the integrated odometry between laser odometry messages
+  Vector3 lastPos = _transformSum.pos;
+  double timeDiff = (laserOdometry->header.stamp - _timeSum).toSec();
+  _timeSum = laserOdometry->header.stamp;
+
+  _transformSum.rot_x = -pitch;
+  _transformSum.rot_y = -yaw;
+  _transformSum.rot_z = roll;
+
+  _transformSum.pos.x() = laserOdometry->pose.pose.position.x;
+  _transformSum.pos.y() = laserOdometry->pose.pose.position.y;
+  _transformSum.pos.z() = laserOdometry->pose.pose.position.z;
+
+  if (timeDiff > 0 && timeDiff < 1) {
+    // the velocity is expressed in the map frame, i.e. rotated by the mapping correction
+    Eigen::Matrix3f correction = Pose(_transformAftMapped).rot * Pose(_transformBefMapped).rot.transpose();
+    _velocity = correction * Eigen::Vector3f((_transformSum.pos - lastPos).head<3>()) / timeDiff;
+  } else {
+    _velocity.setZero();
+  }
 
   transformAssociateToMap();
+  _imuRotSumValid = imuOrientationAt(_timeSum, _imuRotSum);
+  _poseHistory.push(_timeSum, Pose(_transformMapped));
 
-  geoQuat = tf::createQuaternionMsgFromRollPitchYaw
-      (_transformMapped[2], -_transformMapped[0], -_transformMapped[1]);
-
-  _laserOdometry2.header.stamp = laserOdometry->header.stamp;
-  _laserOdometry2.pose.pose.orientation.x = -geoQuat.y;
-  _laserOdometry2.pose.pose.orientation.y = -geoQuat.z;
-  _laserOdometry2.pose.pose.orientation.z = geoQuat.x;
-  _laserOdometry2.pose.pose.orientation.w = geoQuat.w;
-  _laserOdometry2.pose.pose.position.x = _transformMapped[3];
-  _laserOdometry2.pose.pose.position.y = _transformMapped[4];
-  _laserOdometry2.pose.pose.position.z = _transformMapped[5];
-  _pubLaserOdometry2.publish(_laserOdometry2);
+  publishOdometry(_transformMapped, laserOdometry->header.stamp, _laserOdometry2, _pubLaserOdometry2);
 
+  const geometry_msgs::Quaternion& mappedQuat = _laserOdometry2.pose.pose.orientation;
   _laserOdometryTrans2.stamp_ = laserOdometry->header.stamp;
-  _laserOdometryTrans2.setRotation(tf::Quaternion(-geoQuat.y, -geoQuat.z, geoQuat.x, geoQuat.w));
-  _laserOdometryTrans2.setOrigin(tf::Vector3(_transformMapped[3], _transformMapped[4], _transformMapped[5]));
+  _laserOdometryTrans2.setRotation(tf::Quaternion(mappedQuat.x, mappedQuat.y, mappedQuat.z, mappedQuat.w));
+  _laserOdometryTrans2.setOrigin(tf::Vector3(_transformMapped.pos.x(), _transformMapped.pos.y(), _transformMapped.pos.z()));
   _tfBroadcaster2.sendTransform(_laserOdometryTrans2);
 }
 
@@ -216,25 +217,88 @@ void TransformMaintenance::laserOdometryHandler(const nav_msgs::Odometry::ConstP
 
 void TransformMaintenance::odomAftMappedHandler(const nav_msgs::Odometry::ConstPtr& odomAftMapped)
 {
+  TraceSpan span("transformMaintenance", "odomAftMappedHandler", odomAftMapped->header.stamp);
   double roll, pitch, yaw;
   geometry_msgs::Quaternion geoQuat = odomAftMapped->pose.pose.orientation;
   tf::Matrix3x3(tf::Quaternion(geoQuat.z, -geoQuat.x, -geoQuat.y, geoQuat.w)).getRPY(roll, pitch, yaw);
 
-  _transformAftMapped[0] = -pitch;
-  _transformAftMapped[1] = -yaw;
-  _transformAftMapped[2] = roll;
+  _transformAftMapped.rot_x = -pitch;
+  _transformAftMapped.rot_y = -yaw;
+  _transformAftMapped.rot_z = roll;
+
+  _transformAftMapped.pos.x() = odomAftMapped->pose.pose.position.x;
+  _transformAftMapped.pos.y() = odomAftMapped->pose.pose.position.y;
+  _transformAftMapped.pos.z() = odomAftMapped->pose.pose.position.z;
+
+  _transformBefMapped.rot_x = odomAftMapped->twist.twist.angular.x;
+  _transformBefMapped.rot_y = odomAftMapped->twist.twist.angular.y;
+  _transformBefMapped.rot_z = odomAftMapped->twist.twist.angular.z;
 
-  _transformAftMapped[3] = odomAftMapped->pose.pose.position.x;
-  _transformAftMapped[4] = odomAftMapped->pose.pose.position.y;
-  _transformAftMapped[5] = odomAftMapped->pose.pose.position.z;
+  _transformBefMapped.pos.x() = odomAftMapped->twist.twist.linear.x;
+  _transformBefMapped.pos.y() = odomAftMapped->twist.twist.linear.y;
+  _transformBefMapped.pos.z() = odomAftMapped->twist.twist.linear.z;
 
-  _transformBefMapped[0] = odomAftMapped->twist.twist.angular.x;
-  _transformBefMapped[1] = odomAftMapped->twist.twist.angular.y;
-  _transformBefMapped[2] = odomAftMapped->twist.twist.angular.z;
+  // apply the new mapping correction right away to the high rate output
+  transformAssociateToMap();
+}
+
+
+
+void TransformMaintenance::imuHandler(const sensor_msgs::Imu::ConstPtr& imuIn)
+{
+  // the IMU x-, y- and z-axis correspond to the camera z-, x- respectively y-axis
+  const geometry_msgs::Quaternion& q = imuIn->orientation;
+  IMUOrientation newState;
+  newState.stamp = imuIn->header.stamp;
+  newState.rot = Eigen::Quaternionf(q.w, q.y, q.z, q.x).normalized().toRotationMatrix();
+  _imuHistory.push(newState);
+
+  if (!_imuRotSumValid) {
+    // the IMU history did not cover the last laser odometry yet
+    _imuRotSumValid = imuOrientationAt(_timeSum, _imuRotSum);
+    if (!_imuRotSumValid) {
+      return;
+    }
+  }
 
-  _transformBefMapped[3] = odomAftMapped->twist.twist.linear.x;
-  _transformBefMapped[4] = odomAftMapped->twist.twist.linear.y;
-  _transformBefMapped[5] = odomAftMapped->twist.twist.linear.z;
+  double timeDiff = (newState.stamp - _timeSum).toSec();
+  if (timeDiff <= 0 || timeDiff > _maxImuPropagation || _pubImuOdometry.getNumSubscribers() == 0) {
+    return;
+  }
+
+  // propagate the integrated odometry with the IMU orientation change and the odometry velocity
+  Pose mapped(_transformMapped);
+  Pose propagated(mapped.rot * _imuRotSum.transpose() * newState.rot,
+                  mapped.pos + _velocity * float(timeDiff));
+
+  publishOdometry(propagated.toTwist(), newState.stamp, _imuOdometry, _pubImuOdometry);
+}
+
+
+
+bool TransformMaintenance::getPoseAtHandler(loam_velodyne::GetPoseAt::Request& req,
+                                            loam_velodyne::GetPoseAt::Response& res)
+{
+  _poseHistory.timeRange(res.oldest, res.newest);
+
+  Pose pose;
+  res.success = _poseHistory.lookup(req.stamp, pose);
+  if (!res.success) {
+    return true;
+  }
+
+  Eigen::Quaternionf quat(pose.rot);
+  res.pose.header.stamp = req.stamp;
+  res.pose.header.frame_id = "/camera_init";
+  res.pose.pose.orientation.x = quat.x();
+  res.pose.pose.orientation.y = quat.y();
+  res.pose.pose.orientation.z = quat.z();
+  res.pose.pose.orientation.w = quat.w();
+  res.pose.pose.position.x = pose.pos.x();
+  res.pose.pose.position.y = pose.pos.y();
+  res.pose.pose.position.z = pose.pos.z();
+
+  return true;
 }
 
 } // end namespace loam
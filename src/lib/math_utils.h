@@ -3,9 +3,19 @@
 
 
 #include "loam_velodyne/Angle.h"
+#include "loam_velodyne/PointXYZIRT.h"
+#include "loam_velodyne/Pose.h"
+#include "loam_velodyne/Twist.h"
 #include "loam_velodyne/Vector3.h"
 
+#include <pcl/point_cloud.h>
+#include <Eigen/Core>
+#include <Eigen/Eigenvalues>
+#include <Eigen/QR>
+
+#include <algorithm>
 #include <cmath>
+#include <vector>
 
 
 namespace loam {
@@ -274,6 +284,402 @@ inline void rotateYXZ(PointT& p,
   rotZ(p, angZ);
 }
 
+
+
+
+/** \brief Construct the rotation matrix of rotating by the specified angles around the z-, x- respectively y-axis.
+ *
+ * Multiplying a vector with the returned matrix is equivalent to calling rotateZXY() on it.
+ *
+ * @param angZ the rotation angle around the z-axis
+ * @param angX the rotation angle around the x-axis
+ * @param angY the rotation angle around the y-axis
+ * @return the rotation matrix
+ */
+inline Eigen::Matrix3f rotationZXY(const Angle& angZ,
+                                   const Angle& angX,
+                                   const Angle& angY)
+{
+  return rotationFromEuler(angX, angY, angZ);
+}
+
+
+
+/** \brief Construct the rotation matrix of rotating by the specified angles around the y-, x- respectively z-axis.
+ *
+ * Multiplying a vector with the returned matrix is equivalent to calling rotateYXZ() on it.
+ *
+ * @param angY the rotation angle around the y-axis
+ * @param angX the rotation angle around the x-axis
+ * @param angZ the rotation angle around the z-axis
+ * @return the rotation matrix
+ */
+inline Eigen::Matrix3f rotationYXZ(const Angle& angY,
+                                   const Angle& angX,
+                                   const Angle& angZ)
+{
+  // the inverse rotation of rotating by the negated angles in reverse order
+  return rotationZXY(-angZ, -angX, -angY).transpose();
+}
+
+
+
+/** \brief Number of points processed at once by the batch transformation kernels.
+ *
+ * The coordinates of a batch are gathered into (stack allocated) arrays, so that the transformation itself runs
+ * vectorized on contiguous data while the batch stays in the L1 cache.
+ */
+static const int TRANSFORM_BATCH_SIZE = 256;
+
+/** \brief Coordinate array of a batch of points. */
+typedef Eigen::Array<float, Eigen::Dynamic, 1, 0, TRANSFORM_BATCH_SIZE, 1> TransformBatchArray;
+
+
+
+/** \brief Transform the points of the given cloud in place by the rigid transformation p' = rot * p + trans.
+ *
+ * This is the batch version of rotating each point with rotateZXY() / rotateYXZ() and shifting it afterwards. Only
+ * the coordinates are modified.
+ *
+ * @param cloud the cloud to transform
+ * @param rot the rotation matrix (see rotationZXY() and rotationYXZ())
+ * @param trans the translation applied after the rotation
+ * @param begin the index of the first point to transform
+ */
+template <typename PointT>
+inline void transformCloud(pcl::PointCloud<PointT>& cloud,
+                           const Eigen::Matrix3f& rot,
+                           const Eigen::Vector3f& trans,
+                           size_t begin = 0)
+{
+  TransformBatchArray x, y, z;
+  size_t cloudSize = cloud.points.size();
+
+  for (size_t start = begin; start < cloudSize; start += TRANSFORM_BATCH_SIZE) {
+    int n = int(std::min(cloudSize - start, size_t(TRANSFORM_BATCH_SIZE)));
+    PointT* points = &cloud.points[start];
+
+    x.resize(n);
+    y.resize(n);
+    z.resize(n);
+    for (int i = 0; i < n; i++) {
+      x[i] = points[i].x;
+      y[i] = points[i].y;
+      z[i] = points[i].z;
+    }
+
+    TransformBatchArray tx = rot(0, 0) * x + rot(0, 1) * y + rot(0, 2) * z + trans.x();
+    TransformBatchArray ty = rot(1, 0) * x + rot(1, 1) * y + rot(1, 2) * z + trans.y();
+    TransformBatchArray tz = rot(2, 0) * x + rot(2, 1) * y + rot(2, 2) * z + trans.z();
+
+    for (int i = 0; i < n; i++) {
+      points[i].x = tx[i];
+      points[i].y = ty[i];
+      points[i].z = tz[i];
+    }
+  }
+}
+
+
+
+/** \brief Remove the motion distortion of the given sweep cloud in place and transform the result rigidly.
+ *
+ * Each point is first transformed to the start of the sweep by interpolating the sweep motion with s = time /
+ * scanPeriod, i.e. shifted by -s * motion.pos and rotated with rotateZXY() by -s times the motion angles, and then
+ * transformed by p' = rot * p + trans. The per point interpolation angles are evaluated vectorized for whole batches.
+ * The point times are left untouched.
+ *
+ * @param cloud the sweep cloud to de-skew
+ * @param motion the motion over the whole sweep
+ * @param scanPeriod the duration of a sweep (in seconds)
+ * @param rot the rotation matrix of the subsequent rigid transformation
+ * @param trans the translation of the subsequent rigid transformation
+ */
+inline void deskewCloud(pcl::PointCloud<PointXYZIRT>& cloud,
+                        const Twist& motion,
+                        float scanPeriod,
+                        const Eigen::Matrix3f& rot,
+                        const Eigen::Vector3f& trans)
+{
+  TransformBatchArray s, x, y, z;
+  size_t cloudSize = cloud.points.size();
+
+  for (size_t start = 0; start < cloudSize; start += TRANSFORM_BATCH_SIZE) {
+    int n = int(std::min(cloudSize - start, size_t(TRANSFORM_BATCH_SIZE)));
+    PointXYZIRT* points = &cloud.points[start];
+
+    s.resize(n);
+    x.resize(n);
+    y.resize(n);
+    z.resize(n);
+    for (int i = 0; i < n; i++) {
+      s[i] = points[i].time;
+      x[i] = points[i].x;
+      y[i] = points[i].y;
+      z[i] = points[i].z;
+    }
+    s /= scanPeriod;
+
+    // interpolated shift to the sweep start
+    x -= s * motion.pos.x();
+    y -= s * motion.pos.y();
+    z -= s * motion.pos.z();
+
+    // interpolated rotation to the sweep start (around z, x and y)
+    TransformBatchArray ang = -motion.rot_z.rad() * s;
+    TransformBatchArray c = ang.cos();
+    TransformBatchArray sn = ang.sin();
+    TransformBatchArray tmp = c * x - sn * y;
+    y = sn * x + c * y;
+    x = tmp;
+
+    ang = -motion.rot_x.rad() * s;
+    c = ang.cos();
+    sn = ang.sin();
+    tmp = c * y - sn * z;
+    z = sn * y + c * z;
+    y = tmp;
+
+    ang = -motion.rot_y.rad() * s;
+    c = ang.cos();
+    sn = ang.sin();
+    tmp = c * x + sn * z;
+    z = c * z - sn * x;
+    x = tmp;
+
+    // subsequent rigid transformation
+    TransformBatchArray tx = rot(0, 0) * x + rot(0, 1) * y + rot(0, 2) * z + trans.x();
+    TransformBatchArray ty = rot(1, 0) * x + rot(1, 1) * y + rot(1, 2) * z + trans.y();
+    TransformBatchArray tz = rot(2, 0) * x + rot(2, 1) * y + rot(2, 2) * z + trans.z();
+
+    for (int i = 0; i < n; i++) {
+      points[i].x = tx[i];
+      points[i].y = ty[i];
+      points[i].z = tz[i];
+    }
+  }
+}
+
+
+
+/** \brief Fit a line to the given map points and calculate the point to line residual of the given point.
+ *
+ * The line passes through the centroid of the first five indexed map points along their principal direction. It is
+ * only accepted if the neighborhood is sufficiently line like.
+ *
+ * @param map the map cloud
+ * @param indices the array of (at least) five neighboring map point indices
+ * @param point the point to calculate the residual for
+ * @param coeff the output residual: unit gradient of the point to line distance (x, y, z) and the distance (intensity)
+ * @return true if a line was fitted, false otherwise
+ */
+inline bool fitLineCoefficients(const pcl::PointCloud<PointXYZIRT>& map,
+                                const int* indices,
+                                const PointXYZIRT& point,
+                                PointXYZIRT& coeff)
+{
+  Vector3 vc(0, 0, 0);
+  for (int j = 0; j < 5; j++) {
+    vc += Vector3(map.points[indices[j]]);
+  }
+  vc /= 5.0;
+
+  Eigen::Matrix3f mat_a;
+  mat_a.setZero();
+
+  for (int j = 0; j < 5; j++) {
+    Vector3 a = Vector3(map.points[indices[j]]) - vc;
+
+    mat_a(0,0) += a.x() * a.x();
+    mat_a(0,1) += a.x() * a.y();
+    mat_a(0,2) += a.x() * a.z();
+    mat_a(1,1) += a.y() * a.y();
+    mat_a(1,2) += a.y() * a.z();
+    mat_a(2,2) += a.z() * a.z();
+  }
+  Eigen::Matrix3f matA1 = mat_a / 5.0;
+
+  Eigen::SelfAdjointEigenSolver<Eigen::Matrix3f> esolver(matA1);
+  Eigen::Matrix<float, 1, 3> matD1 = esolver.eigenvalues().real();
+  Eigen::Matrix3f matV1 = esolver.eigenvectors().real();
+
+  if (!(matD1(0, 0) > 3 * matD1(0, 1))) {
+    return false;
+  }
+
+  float x0 = point.x;
+  float y0 = point.y;
+  float z0 = point.z;
+  float x1 = vc.x() + 0.1 * matV1(0, 0);
+  float y1 = vc.y() + 0.1 * matV1(0, 1);
+  float z1 = vc.z() + 0.1 * matV1(0, 2);
+  float x2 = vc.x() - 0.1 * matV1(0, 0);
+  float y2 = vc.y() - 0.1 * matV1(0, 1);
+  float z2 = vc.z() - 0.1 * matV1(0, 2);
+
+  float a012 = std::sqrt(((x0 - x1)*(y0 - y2) - (x0 - x2)*(y0 - y1))
+                         * ((x0 - x1)*(y0 - y2) - (x0 - x2)*(y0 - y1))
+                         + ((x0 - x1)*(z0 - z2) - (x0 - x2)*(z0 - z1))
+                           * ((x0 - x1)*(z0 - z2) - (x0 - x2)*(z0 - z1))
+                         + ((y0 - y1)*(z0 - z2) - (y0 - y2)*(z0 - z1))
+                           * ((y0 - y1)*(z0 - z2) - (y0 - y2)*(z0 - z1)));
+
+  float l12 = std::sqrt((x1 - x2)*(x1 - x2) + (y1 - y2)*(y1 - y2) + (z1 - z2)*(z1 - z2));
+
+  coeff.x = ((y1 - y2)*((x0 - x1)*(y0 - y2) - (x0 - x2)*(y0 - y1))
+             + (z1 - z2)*((x0 - x1)*(z0 - z2) - (x0 - x2)*(z0 - z1))) / a012 / l12;
+
+  coeff.y = -((x1 - x2)*((x0 - x1)*(y0 - y2) - (x0 - x2)*(y0 - y1))
+              - (z1 - z2)*((y0 - y1)*(z0 - z2) - (y0 - y2)*(z0 - z1))) / a012 / l12;
+
+  coeff.z = -((x1 - x2)*((x0 - x1)*(z0 - z2) - (x0 - x2)*(z0 - z1))
+              + (y1 - y2)*((y0 - y1)*(z0 - z2) - (y0 - y2)*(z0 - z1))) / a012 / l12;
+
+  coeff.intensity = a012 / l12;
+
+  return true;
+}
+
+
+
+/** \brief Fit a plane to the given map points and calculate the point to plane residual of the given point.
+ *
+ * The plane is the least squares fit n * p + 1 = 0 to the first five indexed map points. It is only accepted if none
+ * of these points deviates from the plane by more than the given distance.
+ *
+ * @param map the map cloud
+ * @param indices the array of (at least) five neighboring map point indices
+ * @param maxPlaneDis the maximum distance of a map point to the fitted plane
+ * @param point the point to calculate the residual for
+ * @param coeff the output residual: unit plane normal (x, y, z) and the signed point to plane distance (intensity)
+ * @return true if a plane was fitted, false otherwise
+ */
+inline bool fitPlaneCoefficients(const pcl::PointCloud<PointXYZIRT>& map,
+                                 const int* indices,
+                                 const float& maxPlaneDis,
+                                 const PointXYZIRT& point,
+                                 PointXYZIRT& coeff)
+{
+  Eigen::Matrix<float, 5, 3> matA0;
+  Eigen::Matrix<float, 5, 1> matB0;
+  matB0.setConstant(-1);
+
+  for (int j = 0; j < 5; j++) {
+    matA0(j, 0) = map.points[indices[j]].x;
+    matA0(j, 1) = map.points[indices[j]].y;
+    matA0(j, 2) = map.points[indices[j]].z;
+  }
+  Eigen::Vector3f matX0 = matA0.colPivHouseholderQr().solve(matB0);
+
+  float pa = matX0(0, 0);
+  float pb = matX0(1, 0);
+  float pc = matX0(2, 0);
+  float pd = 1;
+
+  float ps = std::sqrt(pa * pa + pb * pb + pc * pc);
+  pa /= ps;
+  pb /= ps;
+  pc /= ps;
+  pd /= ps;
+
+  for (int j = 0; j < 5; j++) {
+    if (std::fabs(pa * map.points[indices[j]].x +
+                  pb * map.points[indices[j]].y +
+                  pc * map.points[indices[j]].z + pd) > maxPlaneDis) {
+      return false;
+    }
+  }
+
+  coeff.x = pa;
+  coeff.y = pb;
+  coeff.z = pc;
+  coeff.intensity = pa * point.x + pb * point.y + pc * point.z + pd;
+
+  return true;
+}
+
+
+
+/** \brief Accumulate the normal equations of the sweep to sweep (odometry) optimization.
+ *
+ * Instead of building the (dynamically sized) Jacobian J, its rows are directly accumulated into J^T * J and
+ * J^T * b, with b = -0.05 * residual.
+ *
+ * @param transform the current estimate of the sweep motion
+ * @param points the selected feature points (at their original sweep time)
+ * @param coeffs the weighted residual coefficients of the selected feature points: gradient (x, y, z), residual (intensity)
+ * @param matAtA the J^T * J accumulator
+ * @param matAtB the J^T * b accumulator
+ */
+inline void accumulateOdometryNormals(const Twist& transform,
+                                      const pcl::PointCloud<PointXYZIRT>& points,
+                                      const pcl::PointCloud<PointXYZIRT>& coeffs,
+                                      Eigen::Matrix<float, 6, 6>& matAtA,
+                                      Eigen::Matrix<float, 6, 1>& matAtB)
+{
+  Eigen::Matrix<float, 6, 1> matA;
+  size_t pointSelNum = points.points.size();
+
+  float s = 1;
+
+  float srx = std::sin(s * transform.rot_x.rad());
+  float crx = std::cos(s * transform.rot_x.rad());
+  float sry = std::sin(s * transform.rot_y.rad());
+  float cry = std::cos(s * transform.rot_y.rad());
+  float srz = std::sin(s * transform.rot_z.rad());
+  float crz = std::cos(s * transform.rot_z.rad());
+  float tx = s * transform.pos.x();
+  float ty = s * transform.pos.y();
+  float tz = s * transform.pos.z();
+
+  for (size_t i = 0; i < pointSelNum; i++) {
+    const PointXYZIRT& pointOri = points.points[i];
+    const PointXYZIRT& coeff = coeffs.points[i];
+
+    float arx = (-s*crx*sry*srz*pointOri.x + s*crx*crz*sry*pointOri.y + s*srx*sry*pointOri.z
+                 + s*tx*crx*sry*srz - s*ty*crx*crz*sry - s*tz*srx*sry) * coeff.x
+                + (s*srx*srz*pointOri.x - s*crz*srx*pointOri.y + s*crx*pointOri.z
+                   + s*ty*crz*srx - s*tz*crx - s*tx*srx*srz) * coeff.y
+                + (s*crx*cry*srz*pointOri.x - s*crx*cry*crz*pointOri.y - s*cry*srx*pointOri.z
+                   + s*tz*cry*srx + s*ty*crx*cry*crz - s*tx*crx*cry*srz) * coeff.z;
+
+    float ary = ((-s*crz*sry - s*cry*srx*srz)*pointOri.x
+                 + (s*cry*crz*srx - s*sry*srz)*pointOri.y - s*crx*cry*pointOri.z
+                 + tx*(s*crz*sry + s*cry*srx*srz) + ty*(s*sry*srz - s*cry*crz*srx)
+                 + s*tz*crx*cry) * coeff.x
+                + ((s*cry*crz - s*srx*sry*srz)*pointOri.x
+                   + (s*cry*srz + s*crz*srx*sry)*pointOri.y - s*crx*sry*pointOri.z
+                   + s*tz*crx*sry - ty*(s*cry*srz + s*crz*srx*sry)
+                   - tx*(s*cry*crz - s*srx*sry*srz)) * coeff.z;
+
+    float arz = ((-s*cry*srz - s*crz*srx*sry)*pointOri.x + (s*cry*crz - s*srx*sry*srz)*pointOri.y
+                 + tx*(s*cry*srz + s*crz*srx*sry) - ty*(s*cry*crz - s*srx*sry*srz)) * coeff.x
+                + (-s*crx*crz*pointOri.x - s*crx*srz*pointOri.y
+                   + s*ty*crx*srz + s*tx*crx*crz) * coeff.y
+                + ((s*cry*crz*srx - s*sry*srz)*pointOri.x + (s*crz*sry + s*cry*srx*srz)*pointOri.y
+                   + tx*(s*sry*srz - s*cry*crz*srx) - ty*(s*crz*sry + s*cry*srx*srz)) * coeff.z;
+
+    float atx = -s*(cry*crz - srx*sry*srz) * coeff.x + s*crx*srz * coeff.y
+                - s*(crz*sry + cry*srx*srz) * coeff.z;
+
+    float aty = -s*(cry*srz + crz*srx*sry) * coeff.x - s*crx*crz * coeff.y
+                - s*(sry*srz - cry*crz*srx) * coeff.z;
+
+    float atz = s*crx*sry * coeff.x - s*srx * coeff.y - s*crx*cry * coeff.z;
+
+    float d2 = coeff.intensity;
+
+    matA(0) = arx;
+    matA(1) = ary;
+    matA(2) = arz;
+    matA(3) = atx;
+    matA(4) = aty;
+    matA(5) = atz;
+    matAtA.noalias() += matA * matA.transpose();
+    matAtB += matA * (-0.05f * d2);
+  }
+}
+
 } // end namespace loam
 
 
@@ -1,5 +1,6 @@
 #include <ros/ros.h>
 #include "loam_velodyne/MultiScanRegistration.h"
+#include "loam_velodyne/Trace.h"
 
 
 /** Main node entry point. */
@@ -16,5 +17,6 @@ int main(int argc, char **argv)
     ros::spin();
   }
 
+  loam::Trace::shutdown();
   return 0;
 }
@@ -0,0 +1,259 @@
+// Copyright 2013, Ji Zhang, Carnegie Mellon University
+// Further contributions copyright (c) 2016, Southwest Research Institute
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from this
+//    software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// This is an implementation of the algorithm described in the following paper:
+//   J. Zhang and S. Singh. LOAM: Lidar Odometry and Mapping in Real-time.
+//     Robotics: Science and Systems Conference (RSS). Berkeley, CA, July 2014.
+
+#ifndef LOAM_EULER_CLOSED_FORMS_H
+#define LOAM_EULER_CLOSED_FORMS_H
+
+
+#include "loam_velodyne/Angle.h"
+#include "loam_velodyne/Twist.h"
+
+#include <cmath>
+
+
+/** \file
+ * Hand expanded Euler angle compositions of the original LOAM implementation, which were replaced by the Pose
+ * library. They are kept as reference for the equivalence tests and the pose benchmark.
+ */
+
+namespace loam {
+namespace closed_form {
+
+using std::asin;
+using std::atan2;
+
+
+/** \brief Rotate the vector by the specified angles around the z-, x- respectively y-axis. */
+inline void rotateZXY(Vector3& v, const Angle& angZ, const Angle& angX, const Angle& angY)
+{
+  float x = v.x();
+  v.x() = angZ.cos() * x - angZ.sin() * v.y();
+  v.y() = angZ.sin() * x + angZ.cos() * v.y();
+
+  float y = v.y();
+  v.y() = angX.cos() * y - angX.sin() * v.z();
+  v.z() = angX.sin() * y + angX.cos() * v.z();
+
+  x = v.x();
+  v.x() = angY.cos() * x + angY.sin() * v.z();
+  v.z() = angY.cos() * v.z() - angY.sin() * x;
+}
+
+/** \brief Rotate the vector by the specified angles around the y-, x- respectively z-axis. */
+inline void rotateYXZ(Vector3& v, const Angle& angY, const Angle& angX, const Angle& angZ)
+{
+  float x = v.x();
+  v.x() = angY.cos() * x + angY.sin() * v.z();
+  v.z() = angY.cos() * v.z() - angY.sin() * x;
+
+  float y = v.y();
+  v.y() = angX.cos() * y - angX.sin() * v.z();
+  v.z() = angX.sin() * y + angX.cos() * v.z();
+
+  x = v.x();
+  v.x() = angZ.cos() * x - angZ.sin() * v.y();
+  v.y() = angZ.sin() * x + angZ.cos() * v.y();
+}
+
+
+
+/** \brief Former LaserOdometry::accumulateRotation(). */
+inline void accumulateRotation(Angle cx, Angle cy, Angle cz,
+                               Angle lx, Angle ly, Angle lz,
+                               Angle &ox, Angle &oy, Angle &oz)
+{
+  float srx = lx.cos()*cx.cos()*ly.sin()*cz.sin()
+            - cx.cos()*cz.cos()*lx.sin()
+            - lx.cos()*ly.cos()*cx.sin();
+  ox = -asin(srx);
+
+  float srycrx = lx.sin()*(cy.cos()*cz.sin() - cz.cos()*cx.sin()*cy.sin())
+               + lx.cos()*ly.sin()*(cy.cos()*cz.cos() + cx.sin()*cy.sin()*cz.sin())
+               + lx.cos()*ly.cos()*cx.cos()*cy.sin();
+  float crycrx = lx.cos()*ly.cos()*cx.cos()*cy.cos()
+               - lx.cos()*ly.sin()*(cz.cos()*cy.sin() - cy.cos()*cx.sin()*cz.sin())
+               - lx.sin()*(cy.sin()*cz.sin() + cy.cos()*cz.cos()*cx.sin());
+  oy = atan2(srycrx / ox.cos(), crycrx / ox.cos());
+
+  float srzcrx = cx.sin()*(lz.cos()*ly.sin() - ly.cos()*lx.sin()*lz.sin())
+               + cx.cos()*cz.sin()*(ly.cos()*lz.cos() + lx.sin()*ly.sin()*lz.sin())
+               + lx.cos()*cx.cos()*cz.cos()*lz.sin();
+  float crzcrx = lx.cos()*lz.cos()*cx.cos()*cz.cos()
+               - cx.cos()*cz.sin()*(ly.cos()*lz.sin() - lz.cos()*lx.sin()*ly.sin())
+               - cx.sin()*(ly.sin()*lz.sin() + ly.cos()*lz.cos()*lx.sin());
+  oz = atan2(srzcrx / ox.cos(), crzcrx / ox.cos());
+}
+
+
+
+/** \brief Former LaserOdometry::pluginIMURotation(). */
+inline void pluginIMURotation(const Angle& bcx, const Angle& bcy, const Angle& bcz,
+                              const Angle& blx, const Angle& bly, const Angle& blz,
+                              const Angle& alx, const Angle& aly, const Angle& alz,
+                              Angle &acx, Angle &acy, Angle &acz)
+{
+  float sbcx = bcx.sin();
+  float cbcx = bcx.cos();
+  float sbcy = bcy.sin();
+  float cbcy = bcy.cos();
+  float sbcz = bcz.sin();
+  float cbcz = bcz.cos();
+
+  float sblx = blx.sin();
+  float cblx = blx.cos();
+  float sbly = bly.sin();
+  float cbly = bly.cos();
+  float sblz = blz.sin();
+  float cblz = blz.cos();
+
+  float salx = alx.sin();
+  float calx = alx.cos();
+  float saly = aly.sin();
+  float caly = aly.cos();
+  float salz = alz.sin();
+  float calz = alz.cos();
+
+  float srx = -sbcx*(salx*sblx + calx*caly*cblx*cbly + calx*cblx*saly*sbly)
+            - cbcx*cbcz*(calx*saly*(cbly*sblz - cblz*sblx*sbly)
+                         - calx*caly*(sbly*sblz + cbly*cblz*sblx) + cblx*cblz*salx)
+            - cbcx*sbcz*(calx*caly*(cblz*sbly - cbly*sblx*sblz)
+                         - calx*saly*(cbly*cblz + sblx*sbly*sblz) + cblx*salx*sblz);
+  acx = -asin(srx);
+
+  float srycrx = (cbcy*sbcz - cbcz*sbcx*sbcy)*(calx*saly*(cbly*sblz - cblz*sblx*sbly)
+                                       - calx*caly*(sbly*sblz + cbly*cblz*sblx) + cblx*cblz*salx)
+                 - (cbcy*cbcz + sbcx*sbcy*sbcz)*(calx*caly*(cblz*sbly - cbly*sblx*sblz)
+                                         - calx*saly*(cbly*cblz + sblx*sbly*sblz) + cblx*salx*sblz)
+                 + cbcx*sbcy*(salx*sblx + calx*caly*cblx*cbly + calx*cblx*saly*sbly);
+  float crycrx = (cbcz*sbcy - cbcy*sbcx*sbcz)*(calx*caly*(cblz*sbly - cbly*sblx*sblz)
+                                       - calx*saly*(cbly*cblz + sblx*sbly*sblz) + cblx*salx*sblz)
+                 - (sbcy*sbcz + cbcy*cbcz*sbcx)*(calx*saly*(cbly*sblz - cblz*sblx*sbly)
+                                         - calx*caly*(sbly*sblz + cbly*cblz*sblx) + cblx*cblz*salx)
+                 + cbcx*cbcy*(salx*sblx + calx*caly*cblx*cbly + calx*cblx*saly*sbly);
+  acy = atan2(srycrx / acx.cos(), crycrx / acx.cos());
+
+  float srzcrx = sbcx*(cblx*cbly*(calz*saly - caly*salx*salz) - cblx*sbly*(caly*calz + salx*saly*salz) + calx*salz*sblx)
+                 - cbcx*cbcz*((caly*calz + salx*saly*salz)*(cbly*sblz - cblz*sblx*sbly)
+                              + (calz*saly - caly*salx*salz)*(sbly*sblz + cbly*cblz*sblx)
+                              - calx*cblx*cblz*salz)
+                 + cbcx*sbcz*((caly*calz + salx*saly*salz)*(cbly*cblz + sblx*sbly*sblz)
+                              + (calz*saly - caly*salx*salz)*(cblz*sbly - cbly*sblx*sblz)
+                              + calx*cblx*salz*sblz);
+  float crzcrx = sbcx*(cblx*sbly*(caly*salz - calz*salx*saly) - cblx*cbly*(saly*salz + caly*calz*salx) + calx*calz*sblx)
+                 + cbcx*cbcz*((saly*salz + caly*calz*salx)*(sbly*sblz + cbly*cblz*sblx)
+                              + (caly*salz - calz*salx*saly)*(cbly*sblz - cblz*sblx*sbly)
+                              + calx*calz*cblx*cblz)
+                 - cbcx*sbcz*((saly*salz + caly*calz*salx)*(cblz*sbly - cbly*sblx*sblz)
+                              + (caly*salz - calz*salx*saly)*(cbly*cblz + sblx*sbly*sblz)
+                              - calx*calz*cblx*sblz);
+  acz = atan2(srzcrx / acx.cos(), crzcrx / acx.cos());
+}
+
+
+
+/** \brief Former LaserMapping::transformAssociateToMap() (TransformMaintenance used the same expansion). */
+inline Twist transformAssociateToMap(const Twist& transformSum,
+                                     const Twist& transformBefMapped,
+                                     const Twist& transformAftMapped)
+{
+  Twist transformTobeMapped;
+  Twist transformIncre;
+  transformIncre.pos = transformBefMapped.pos - transformSum.pos;
+  rotateYXZ(transformIncre.pos, -(transformSum.rot_y), -(transformSum.rot_x), -(transformSum.rot_z));
+
+  float sbcx = transformSum.rot_x.sin();
+  float cbcx = transformSum.rot_x.cos();
+  float sbcy = transformSum.rot_y.sin();
+  float cbcy = transformSum.rot_y.cos();
+  float sbcz = transformSum.rot_z.sin();
+  float cbcz = transformSum.rot_z.cos();
+
+  float sblx = transformBefMapped.rot_x.sin();
+  float cblx = transformBefMapped.rot_x.cos();
+  float sbly = transformBefMapped.rot_y.sin();
+  float cbly = transformBefMapped.rot_y.cos();
+  float sblz = transformBefMapped.rot_z.sin();
+  float cblz = transformBefMapped.rot_z.cos();
+
+  float salx = transformAftMapped.rot_x.sin();
+  float calx = transformAftMapped.rot_x.cos();
+  float saly = transformAftMapped.rot_y.sin();
+  float caly = transformAftMapped.rot_y.cos();
+  float salz = transformAftMapped.rot_z.sin();
+  float calz = transformAftMapped.rot_z.cos();
+
+  float srx = -sbcx*(salx*sblx + calx*cblx*salz*sblz + calx*calz*cblx*cblz)
+              - cbcx*sbcy*(calx*calz*(cbly*sblz - cblz*sblx*sbly)
+                           - calx*salz*(cbly*cblz + sblx*sbly*sblz) + cblx*salx*sbly)
+              - cbcx*cbcy*(calx*salz*(cblz*sbly - cbly*sblx*sblz)
+                           - calx*calz*(sbly*sblz + cbly*cblz*sblx) + cblx*cbly*salx);
+  transformTobeMapped.rot_x = -asin(srx);
+
+  float srycrx = sbcx*(cblx*cblz*(caly*salz - calz*salx*saly)
+                       - cblx*sblz*(caly*calz + salx*saly*salz) + calx*saly*sblx)
+                 - cbcx*cbcy*((caly*calz + salx*saly*salz)*(cblz*sbly - cbly*sblx*sblz)
+                              + (caly*salz - calz*salx*saly)*(sbly*sblz + cbly*cblz*sblx) - calx*cblx*cbly*saly)
+                 + cbcx*sbcy*((caly*calz + salx*saly*salz)*(cbly*cblz + sblx*sbly*sblz)
+                              + (caly*salz - calz*salx*saly)*(cbly*sblz - cblz*sblx*sbly) + calx*cblx*saly*sbly);
+  float crycrx = sbcx*(cblx*sblz*(calz*saly - caly*salx*salz)
+                       - cblx*cblz*(saly*salz + caly*calz*salx) + calx*caly*sblx)
+                 + cbcx*cbcy*((saly*salz + caly*calz*salx)*(sbly*sblz + cbly*cblz*sblx)
+                              + (calz*saly - caly*salx*salz)*(cblz*sbly - cbly*sblx*sblz) + calx*caly*cblx*cbly)
+                 - cbcx*sbcy*((saly*salz + caly*calz*salx)*(cbly*sblz - cblz*sblx*sbly)
+                              + (calz*saly - caly*salx*salz)*(cbly*cblz + sblx*sbly*sblz) - calx*caly*cblx*sbly);
+  transformTobeMapped.rot_y = atan2(srycrx / transformTobeMapped.rot_x.cos(),
+                                    crycrx / transformTobeMapped.rot_x.cos());
+
+  float srzcrx = (cbcz*sbcy - cbcy*sbcx*sbcz)*(calx*salz*(cblz*sbly - cbly*sblx*sblz)
+                                               - calx*calz*(sbly*sblz + cbly*cblz*sblx) + cblx*cbly*salx)
+                 - (cbcy*cbcz + sbcx*sbcy*sbcz)*(calx*calz*(cbly*sblz - cblz*sblx*sbly)
+                                                 - calx*salz*(cbly*cblz + sblx*sbly*sblz) + cblx*salx*sbly)
+                 + cbcx*sbcz*(salx*sblx + calx*cblx*salz*sblz + calx*calz*cblx*cblz);
+  float crzcrx = (cbcy*sbcz - cbcz*sbcx*sbcy)*(calx*calz*(cbly*sblz - cblz*sblx*sbly)
+                                               - calx*salz*(cbly*cblz + sblx*sbly*sblz) + cblx*salx*sbly)
+                 - (sbcy*sbcz + cbcy*cbcz*sbcx)*(calx*salz*(cblz*sbly - cbly*sblx*sblz)
+                                                 - calx*calz*(sbly*sblz + cbly*cblz*sblx) + cblx*cbly*salx)
+                 + cbcx*cbcz*(salx*sblx + calx*cblx*salz*sblz + calx*calz*cblx*cblz);
+  transformTobeMapped.rot_z = atan2(srzcrx / transformTobeMapped.rot_x.cos(),
+                                    crzcrx / transformTobeMapped.rot_x.cos());
+
+  Vector3 v = transformIncre.pos;
+  rotateZXY(v, transformTobeMapped.rot_z, transformTobeMapped.rot_x, transformTobeMapped.rot_y);
+  transformTobeMapped.pos = transformAftMapped.pos - v;
+
+  return transformTobeMapped;
+}
+
+} // end namespace closed_form
+} // end namespace loam
+
+#endif //LOAM_EULER_CLOSED_FORMS_H
@@ -0,0 +1,205 @@
+// Copyright 2013, Ji Zhang, Carnegie Mellon University
+// Further contributions copyright (c) 2016, Southwest Research Institute
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from this
+//    software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// This is an implementation of the algorithm described in the following paper:
+//   J. Zhang and S. Singh. LOAM: Lidar Odometry and Mapping in Real-time.
+//     Robotics: Science and Systems Conference (RSS). Berkeley, CA, July 2014.
+
+#include "loam_velodyne/nanoflann_pcl.h"
+#include "loam_velodyne/PointXYZIRT.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <limits>
+
+
+using namespace loam;
+
+namespace {
+
+/** \brief Create a cloud of uniformly distributed random points in a 20 m cube. */
+pcl::PointCloud<PointXYZIRT>::Ptr randomCloud(size_t size, unsigned int seed)
+{
+  std::srand(seed);
+  pcl::PointCloud<PointXYZIRT>::Ptr cloud(new pcl::PointCloud<PointXYZIRT>());
+  cloud->resize(size);
+  for (size_t i = 0; i < size; i++) {
+    cloud->points[i].x = 20.0f * std::rand() / RAND_MAX - 10;
+    cloud->points[i].y = 20.0f * std::rand() / RAND_MAX - 10;
+    cloud->points[i].z = 20.0f * std::rand() / RAND_MAX - 10;
+  }
+  return cloud;
+}
+
+/** \brief Compute the sorted squared distances of all cloud points to the given point. */
+std::vector<float> bruteForceSqDistances(const pcl::PointCloud<PointXYZIRT>& cloud, const PointXYZIRT& point)
+{
+  std::vector<float> sqDistances(cloud.points.size());
+  for (size_t i = 0; i < cloud.points.size(); i++) {
+    float dx = cloud.points[i].x - point.x;
+    float dy = cloud.points[i].y - point.y;
+    float dz = cloud.points[i].z - point.z;
+    sqDistances[i] = dx * dx + dy * dy + dz * dz;
+  }
+  std::sort(sqDistances.begin(), sqDistances.end());
+  return sqDistances;
+}
+
+} // end namespace
+
+
+
+TEST(KdTreeTest, batchSearchMatchesBruteForce)
+{
+  pcl::PointCloud<PointXYZIRT>::Ptr cloud = randomCloud(2000, 1);
+  pcl::PointCloud<PointXYZIRT>::Ptr queries = randomCloud(100, 2);
+  nanoflann::KdTreeFLANN<PointXYZIRT> tree;
+  tree.setInputCloud(cloud);
+
+  const int k = 5;
+  std::vector<int> indices(queries->size() * k);
+  std::vector<float> sqDistances(queries->size() * k);
+  EXPECT_EQ(queries->size() * k,
+            tree.nearestKSearch(&queries->points[0], queries->size(), k, &indices[0], &sqDistances[0]));
+
+  for (size_t i = 0; i < queries->size(); i++) {
+    std::vector<float> expected = bruteForceSqDistances(*cloud, queries->points[i]);
+    for (int j = 0; j < k; j++) {
+      EXPECT_NEAR(expected[j], sqDistances[i * k + j], 1e-4);
+      const PointXYZIRT& neighbor = cloud->points[indices[i * k + j]];
+      float dx = neighbor.x - queries->points[i].x;
+      float dy = neighbor.y - queries->points[i].y;
+      float dz = neighbor.z - queries->points[i].z;
+      EXPECT_NEAR(dx * dx + dy * dy + dz * dz, sqDistances[i * k + j], 1e-4);
+    }
+  }
+}
+
+
+
+TEST(KdTreeTest, spatialOrderDoesNotChangeResults)
+{
+  pcl::PointCloud<PointXYZIRT>::Ptr cloud = randomCloud(2000, 3);
+  pcl::PointCloud<PointXYZIRT>::Ptr queries = randomCloud(500, 4);
+  nanoflann::KdTreeFLANN<PointXYZIRT> tree;
+  tree.setInputCloud(cloud);
+
+  std::vector<int> order;
+  nanoflann::KdTreeFLANN<PointXYZIRT>::spatialOrder(&queries->points[0], queries->size(), order);
+  ASSERT_EQ(queries->size(), order.size());
+  std::vector<int> sortedOrder(order);
+  std::sort(sortedOrder.begin(), sortedOrder.end());
+  for (size_t i = 0; i < sortedOrder.size(); i++) {
+    ASSERT_EQ(int(i), sortedOrder[i]);
+  }
+
+  const int k = 3;
+  std::vector<int> indices(queries->size() * k), orderedIndices(queries->size() * k);
+  std::vector<float> sqDistances(queries->size() * k), orderedSqDistances(queries->size() * k);
+  tree.nearestKSearch(&queries->points[0], queries->size(), k, &indices[0], &sqDistances[0]);
+  tree.nearestKSearch(&queries->points[0], queries->size(), k, &orderedIndices[0], &orderedSqDistances[0], &order);
+  EXPECT_EQ(indices, orderedIndices);
+  EXPECT_EQ(sqDistances, orderedSqDistances);
+
+  // the single point search returns the same neighbors
+  std::vector<int> pointIndices;
+  std::vector<float> pointSqDistances;
+  tree.nearestKSearch(queries->points[7], k, pointIndices, pointSqDistances);
+  EXPECT_EQ(std::vector<int>(indices.begin() + 7 * k, indices.begin() + 8 * k), pointIndices);
+}
+
+
+
+TEST(KdTreeTest, parallelBuildMatchesSequentialBuild)
+{
+  // large enough for the parallel build to split the upper levels across threads
+  pcl::PointCloud<PointXYZIRT>::Ptr cloud = randomCloud(200000, 7);
+  pcl::PointCloud<PointXYZIRT>::Ptr queries = randomCloud(1000, 8);
+  nanoflann::KdTreeFLANN<PointXYZIRT> tree, parallelTree;
+  parallelTree.setBuildThreads(4);
+  tree.setInputCloud(cloud);
+  parallelTree.setInputCloud(cloud);
+
+  const int k = 5;
+  std::vector<int> indices(queries->size() * k), parallelIndices(queries->size() * k);
+  std::vector<float> sqDistances(queries->size() * k), parallelSqDistances(queries->size() * k);
+  tree.nearestKSearch(&queries->points[0], queries->size(), k, &indices[0], &sqDistances[0]);
+  parallelTree.nearestKSearch(&queries->points[0], queries->size(), k, &parallelIndices[0], &parallelSqDistances[0]);
+  EXPECT_EQ(indices, parallelIndices);
+  EXPECT_EQ(sqDistances, parallelSqDistances);
+}
+
+
+
+TEST(KdTreeTest, missingNeighborsAreMarked)
+{
+  pcl::PointCloud<PointXYZIRT>::Ptr cloud = randomCloud(3, 5);
+  nanoflann::KdTreeFLANN<PointXYZIRT> tree;
+  tree.setInputCloud(cloud);
+
+  int indices[5];
+  float sqDistances[5];
+  EXPECT_EQ(3, tree.nearestKSearch(&cloud->points[0], 1, 5, indices, sqDistances));
+  EXPECT_EQ(0, indices[0]);
+  EXPECT_EQ(0, sqDistances[0]);
+  EXPECT_EQ(-1, indices[3]);
+  EXPECT_EQ(-1, indices[4]);
+  EXPECT_EQ(std::numeric_limits<float>::max(), sqDistances[4]);
+}
+
+
+
+TEST(KdTreeTest, radiusSearchFindsAllPointsWithinRadius)
+{
+  pcl::PointCloud<PointXYZIRT>::Ptr cloud = randomCloud(2000, 6);
+  nanoflann::KdTreeFLANN<PointXYZIRT> tree;
+  tree.setInputCloud(cloud);
+
+  const PointXYZIRT& query = cloud->points[42];
+  std::vector<float> expected = bruteForceSqDistances(*cloud, query);
+  size_t nExpected = std::lower_bound(expected.begin(), expected.end(), 2.0f * 2.0f) - expected.begin();
+
+  std::vector<int> indices;
+  std::vector<float> sqDistances;
+  ASSERT_EQ(int(nExpected), tree.radiusSearch(query, 2.0, indices, sqDistances));
+  ASSERT_EQ(nExpected, sqDistances.size());
+  for (size_t i = 0; i < nExpected; i++) {
+    EXPECT_NEAR(expected[i], sqDistances[i], 1e-4);
+  }
+}
+
+
+
+
+int main(int argc, char **argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
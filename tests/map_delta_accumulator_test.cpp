@@ -0,0 +1,343 @@
+// Copyright 2013, Ji Zhang, Carnegie Mellon University
+// Further contributions copyright (c) 2016, Southwest Research Institute
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from this
+//    software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// This is an implementation of the algorithm described in the following paper:
+//   J. Zhang and S. Singh. LOAM: Lidar Odometry and Mapping in Real-time.
+//     Robotics: Science and Systems Conference (RSS). Berkeley, CA, July 2014.
+#include "loam_velodyne/MapDeltaAccumulator.h"
+#include "loam_velodyne/MapCloudPublisher.h"
+
+#include <gtest/gtest.h>
+
+#include <pcl_conversions/pcl_conversions.h>
+
+#include <algorithm>
+#include <cstdlib>
+
+
+using namespace loam;
+
+namespace {
+
+/** \brief Create a complete map cube message holding the given number of corner and surface points at height z. */
+loam_velodyne::MapCube makeCube(const int& i, const int& j, const int& k,
+                                const size_t& nCorners, const size_t& nSurfaces, const float& z = 0)
+{
+  pcl::PointCloud<pcl::PointXYZI> corners, surfaces;
+  for (size_t n = 0; n < nCorners; n++) {
+    pcl::PointXYZI point;
+    point.x = i + 0.1f * n;
+    point.y = j;
+    point.z = z;
+    point.intensity = 1;
+    corners.push_back(point);
+  }
+  for (size_t n = 0; n < nSurfaces; n++) {
+    pcl::PointXYZI point;
+    point.x = i;
+    point.y = j + 0.1f * n;
+    point.z = z;
+    point.intensity = 2;
+    surfaces.push_back(point);
+  }
+
+  loam_velodyne::MapCube cube;
+  cube.i = i;
+  cube.j = j;
+  cube.k = k;
+  cube.complete = true;
+  pcl::toROSMsg(corners, cube.cornerCloud);
+  pcl::toROSMsg(surfaces, cube.surfaceCloud);
+  return cube;
+}
+
+
+/** \brief Create a map delta message (a full update for baseVersion 0). */
+loam_velodyne::MapDelta makeDelta(const uint64_t& version, const uint64_t& baseVersion)
+{
+  loam_velodyne::MapDelta delta;
+  delta.version = version;
+  delta.baseVersion = baseVersion;
+  delta.cubeSize = 50;
+  delta.cornerLeafSize = 0.2;
+  delta.surfaceLeafSize = 0.4;
+  return delta;
+}
+
+
+/** \brief Create a point at the given position. */
+pcl::PointXYZI makePoint(const float& x, const float& y, const float& z, const float& intensity = 1)
+{
+  pcl::PointXYZI point;
+  point.x = x;
+  point.y = y;
+  point.z = z;
+  point.intensity = intensity;
+  return point;
+}
+
+
+/** \brief Add random points within a 10m cube to the given cloud. */
+void addRandomPoints(pcl::PointCloud<pcl::PointXYZI>& cloud, const size_t& nPoints)
+{
+  for (size_t i = 0; i < nPoints; i++) {
+    cloud.push_back(makePoint(10.0f * std::rand() / RAND_MAX, 10.0f * std::rand() / RAND_MAX,
+                              10.0f * std::rand() / RAND_MAX, float(std::rand() % 100)));
+  }
+}
+
+
+/** \brief Strict weak ordering of points by position and intensity. */
+bool pointLess(const pcl::PointXYZI& a, const pcl::PointXYZI& b)
+{
+  if (a.x != b.x) return a.x < b.x;
+  if (a.y != b.y) return a.y < b.y;
+  if (a.z != b.z) return a.z < b.z;
+  return a.intensity < b.intensity;
+}
+
+
+/** \brief Expect both clouds to contain the same points (in any order). */
+void expectSamePoints(pcl::PointCloud<pcl::PointXYZI> expected, pcl::PointCloud<pcl::PointXYZI> actual)
+{
+  ASSERT_EQ(expected.size(), actual.size());
+  std::sort(expected.points.begin(), expected.points.end(), pointLess);
+  std::sort(actual.points.begin(), actual.points.end(), pointLess);
+  for (size_t i = 0; i < expected.size(); i++) {
+    EXPECT_FALSE(pointLess(expected.points[i], actual.points[i]) || pointLess(actual.points[i], expected.points[i]));
+  }
+}
+
+} // end namespace
+
+
+
+TEST(MapDeltaAccumulator, appliesFullUpdateAndDeltas)
+{
+  MapDeltaAccumulator accumulator;
+  EXPECT_FALSE(accumulator.isSynchronized());
+
+  loam_velodyne::MapDelta full = makeDelta(1, 0);
+  full.cubes.push_back(makeCube(0, 0, 0, 3, 4));
+  full.cubes.push_back(makeCube(1, 0, 0, 2, 1));
+  ASSERT_TRUE(accumulator.apply(full));
+  EXPECT_TRUE(accumulator.isSynchronized());
+  EXPECT_EQ(1u, accumulator.version());
+  ASSERT_EQ(2u, accumulator.cubes().size());
+
+  // a delta replaces changed cubes and adds new ones
+  loam_velodyne::MapDelta delta = makeDelta(2, 1);
+  delta.cubes.push_back(makeCube(1, 0, 0, 5, 6, 1.0f));
+  delta.cubes.push_back(makeCube(0, 2, -1, 1, 0));
+  ASSERT_TRUE(accumulator.apply(delta));
+  EXPECT_EQ(2u, accumulator.version());
+  ASSERT_EQ(3u, accumulator.cubes().size());
+
+  const MapDeltaAccumulator::Cube& changed = accumulator.cubes().find(CubeKey(1, 0, 0))->second;
+  EXPECT_EQ(5u, changed.cornerCloud.size());
+  EXPECT_EQ(6u, changed.surfaceCloud.size());
+  EXPECT_EQ(1.0f, changed.cornerCloud.points[0].z);
+
+  const MapDeltaAccumulator::Cube& unchanged = accumulator.cubes().find(CubeKey(0, 0, 0))->second;
+  EXPECT_EQ(3u, unchanged.cornerCloud.size());
+  EXPECT_EQ(4u, unchanged.surfaceCloud.size());
+
+  pcl::PointCloud<pcl::PointXYZI> map;
+  accumulator.getMapCloud(map);
+  EXPECT_EQ(3u + 4u + 5u + 6u + 1u, map.size());
+}
+
+
+
+TEST(MapDeltaAccumulator, rejectsDeltasAfterVersionGap)
+{
+  MapDeltaAccumulator accumulator;
+
+  // deltas are rejected before the first full update
+  loam_velodyne::MapDelta delta = makeDelta(2, 1);
+  delta.cubes.push_back(makeCube(0, 0, 0, 1, 1));
+  EXPECT_FALSE(accumulator.apply(delta));
+  EXPECT_FALSE(accumulator.isSynchronized());
+  EXPECT_TRUE(accumulator.cubes().empty());
+
+  loam_velodyne::MapDelta full = makeDelta(1, 0);
+  full.cubes.push_back(makeCube(0, 0, 0, 3, 4));
+  ASSERT_TRUE(accumulator.apply(full));
+
+  // version 2 was missed
+  loam_velodyne::MapDelta gap = makeDelta(3, 2);
+  gap.cubes.push_back(makeCube(0, 0, 0, 7, 7));
+  EXPECT_FALSE(accumulator.apply(gap));
+  EXPECT_FALSE(accumulator.isSynchronized());
+  EXPECT_EQ(3u, accumulator.cubes().find(CubeKey(0, 0, 0))->second.cornerCloud.size());
+
+  // all subsequent deltas are rejected as well
+  loam_velodyne::MapDelta next = makeDelta(4, 3);
+  next.cubes.push_back(makeCube(0, 0, 0, 8, 8));
+  EXPECT_FALSE(accumulator.apply(next));
+  EXPECT_FALSE(accumulator.isSynchronized());
+}
+
+
+
+TEST(MapDeltaAccumulator, resynchronizesOnNextFullUpdate)
+{
+  MapDeltaAccumulator accumulator;
+
+  loam_velodyne::MapDelta full = makeDelta(1, 0);
+  full.cubes.push_back(makeCube(0, 0, 0, 3, 4));
+  full.cubes.push_back(makeCube(5, 0, 0, 1, 1));
+  ASSERT_TRUE(accumulator.apply(full));
+  EXPECT_FALSE(accumulator.apply(makeDelta(3, 2)));
+
+  // the full update replaces the whole map, dropping cubes possibly changed by the missed delta
+  loam_velodyne::MapDelta resync = makeDelta(4, 0);
+  resync.cubes.push_back(makeCube(0, 0, 0, 2, 2));
+  ASSERT_TRUE(accumulator.apply(resync));
+  EXPECT_TRUE(accumulator.isSynchronized());
+  EXPECT_EQ(4u, accumulator.version());
+  ASSERT_EQ(1u, accumulator.cubes().size());
+  EXPECT_EQ(2u, accumulator.cubes().find(CubeKey(0, 0, 0))->second.cornerCloud.size());
+
+  // deltas apply again
+  loam_velodyne::MapDelta delta = makeDelta(5, 4);
+  delta.cubes.push_back(makeCube(1, 1, 1, 1, 0));
+  EXPECT_TRUE(accumulator.apply(delta));
+  EXPECT_EQ(5u, accumulator.version());
+  EXPECT_EQ(2u, accumulator.cubes().size());
+
+  // while synchronized, a full update requested by another client keeps cubes outside of the mapping's memory
+  loam_velodyne::MapDelta requested = makeDelta(6, 0);
+  requested.cubes.push_back(makeCube(0, 0, 0, 2, 2));
+  EXPECT_TRUE(accumulator.apply(requested));
+  EXPECT_EQ(2u, accumulator.cubes().size());
+}
+
+
+
+TEST(MapDeltaAccumulator, replacesChangedVoxels)
+{
+  MapDeltaAccumulator accumulator;
+
+  pcl::PointCloud<pcl::PointXYZI> corners, surfaces;
+  corners.push_back(makePoint(0.05f, 0.05f, 0.05f));
+  corners.push_back(makePoint(0.25f, 0.05f, 0.05f));
+  surfaces.push_back(makePoint(0.1f, 0.1f, 0.1f));
+
+  loam_velodyne::MapDelta full = makeDelta(1, 0);
+  full.cubes.push_back(makeCube(0, 0, 0, 0, 0));
+  pcl::toROSMsg(corners, full.cubes[0].cornerCloud);
+  pcl::toROSMsg(surfaces, full.cubes[0].surfaceCloud);
+  ASSERT_TRUE(accumulator.apply(full));
+
+  // changed points replace the point of their voxel or are added for new voxels
+  pcl::PointCloud<pcl::PointXYZI> changedCorners, changedSurfaces;
+  changedCorners.push_back(makePoint(0.3f, 0.1f, 0.1f, 5));
+  changedCorners.push_back(makePoint(-0.1f, 0.1f, 0.1f, 6));
+  changedSurfaces.push_back(makePoint(0.3f, 0.3f, 0.3f, 7));
+
+  loam_velodyne::MapDelta delta = makeDelta(2, 1);
+  delta.cubes.push_back(makeCube(0, 0, 0, 0, 0));
+  delta.cubes[0].complete = false;
+  pcl::toROSMsg(changedCorners, delta.cubes[0].cornerCloud);
+  pcl::toROSMsg(changedSurfaces, delta.cubes[0].surfaceCloud);
+  ASSERT_TRUE(accumulator.apply(delta));
+
+  const MapDeltaAccumulator::Cube& cube = accumulator.cubes().find(CubeKey(0, 0, 0))->second;
+  pcl::PointCloud<pcl::PointXYZI> expectedCorners;
+  expectedCorners.push_back(corners.points[0]);
+  expectedCorners.push_back(changedCorners.points[0]);
+  expectedCorners.push_back(changedCorners.points[1]);
+  expectSamePoints(expectedCorners, cube.cornerCloud);
+
+  pcl::PointCloud<pcl::PointXYZI> expectedSurfaces;
+  expectedSurfaces.push_back(changedSurfaces.points[0]);
+  expectSamePoints(expectedSurfaces, cube.surfaceCloud);
+}
+
+
+
+TEST(MapDeltaAccumulator, reconstructsCubesFromChangedVoxels)
+{
+  std::srand(42);
+  VoxelGridFilter<pcl::PointXYZI> cornerFilter(0.2);
+  VoxelGridFilter<pcl::PointXYZI> surfaceFilter(0.4);
+  pcl::PointCloud<pcl::PointXYZI> corners, surfaces, previousCorners, previousSurfaces, changed, grown;
+  MapDeltaAccumulator accumulator;
+
+  for (uint64_t version = 1; version <= 5; version++) {
+    // add new points to the down sized cube clouds (like the mapping does) and down size them again
+    previousCorners = corners;
+    previousSurfaces = surfaces;
+    grown = corners;
+    addRandomPoints(grown, 500);
+    cornerFilter.filter(grown, corners);
+    grown = surfaces;
+    addRandomPoints(grown, 500);
+    surfaceFilter.filter(grown, surfaces);
+
+    loam_velodyne::MapDelta delta = makeDelta(version, version - 1);
+    delta.cubes.push_back(makeCube(0, 0, 0, 0, 0));
+    loam_velodyne::MapCube& cube = delta.cubes[0];
+    if (version == 1) {
+      pcl::toROSMsg(corners, cube.cornerCloud);
+      pcl::toROSMsg(surfaces, cube.surfaceCloud);
+    } else {
+      cube.complete = false;
+      ASSERT_TRUE(collectChangedVoxels(previousCorners, corners, 1 / delta.cornerLeafSize, changed));
+      EXPECT_LT(changed.size(), corners.size());
+      pcl::toROSMsg(changed, cube.cornerCloud);
+      ASSERT_TRUE(collectChangedVoxels(previousSurfaces, surfaces, 1 / delta.surfaceLeafSize, changed));
+      EXPECT_LT(changed.size(), surfaces.size());
+      pcl::toROSMsg(changed, cube.surfaceCloud);
+    }
+    ASSERT_TRUE(accumulator.apply(delta));
+
+    const MapDeltaAccumulator::Cube& accumulated = accumulator.cubes().find(CubeKey(0, 0, 0))->second;
+    expectSamePoints(corners, accumulated.cornerCloud);
+    expectSamePoints(surfaces, accumulated.surfaceCloud);
+  }
+
+  // clouds that can't be described per voxel have to be sent completely
+  changed.clear();
+  previousCorners = corners;
+  previousCorners.push_back(previousCorners.points[0]);
+  EXPECT_FALSE(collectChangedVoxels(previousCorners, corners, 1 / 0.2f, changed));
+  previousCorners = corners;
+  previousCorners.push_back(makePoint(-5, -5, -5));
+  EXPECT_FALSE(collectChangedVoxels(previousCorners, corners, 1 / 0.2f, changed));
+}
+
+
+
+
+int main(int argc, char **argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
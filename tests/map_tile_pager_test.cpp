@@ -0,0 +1,264 @@
+// Copyright 2013, Ji Zhang, Carnegie Mellon University
+// Further contributions copyright (c) 2016, Southwest Research Institute
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from this
+//    software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// This is an implementation of the algorithm described in the following paper:
+//   J. Zhang and S. Singh. LOAM: Lidar Odometry and Mapping in Real-time.
+//     Robotics: Science and Systems Conference (RSS). Berkeley, CA, July 2014.
+#include "loam_velodyne/MapTilePager.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+
+using namespace loam;
+
+namespace {
+
+/** \brief Pager on a tile store in a fresh temporary directory. */
+class MapTilePagerTest : public testing::Test {
+protected:
+  void SetUp()
+  {
+    char directory[] = "/tmp/loam_map_tile_pager_test_XXXXXX";
+    ASSERT_TRUE(mkdtemp(directory) != NULL);
+    _directory = directory;
+    ASSERT_TRUE(_store.open(_directory, 50));
+    ASSERT_TRUE(_pager.start(_store, false));
+  }
+
+  void TearDown()
+  {
+    _pager.stop();
+    std::vector<CubeKey> keys;
+    if (_store.listTiles(keys)) {
+      for (size_t i = 0; i < keys.size(); i++) {
+        _store.removeTile(keys[i]);
+      }
+    }
+    rmdir(_directory.c_str());
+  }
+
+  /** \brief Create a tile with the given number of corner and surface points, tagged by their intensity. */
+  static MapTile makeTile(const CubeKey& key, const size_t& nCorners, const size_t& nSurfaces, const float& tag)
+  {
+    MapTile tile;
+    tile.key = key;
+    tile.cornerCloud->resize(nCorners);
+    tile.surfaceCloud->resize(nSurfaces);
+    for (size_t i = 0; i < nCorners; i++) {
+      tile.cornerCloud->points[i].x = key.i * 50 + 0.1f * i;
+      tile.cornerCloud->points[i].intensity = tag;
+    }
+    for (size_t i = 0; i < nSurfaces; i++) {
+      tile.surfaceCloud->points[i].y = key.j * 50 + 0.1f * i;
+      tile.surfaceCloud->points[i].intensity = tag;
+    }
+    return tile;
+  }
+
+  /** \brief Expect the given tile to hold the given number of points, all tagged by the given intensity. */
+  static void expectTile(const MapTile& tile, const size_t& nCorners, const size_t& nSurfaces, const float& tag)
+  {
+    ASSERT_EQ(nCorners, tile.cornerCloud->size());
+    ASSERT_EQ(nSurfaces, tile.surfaceCloud->size());
+    for (size_t i = 0; i < nCorners; i++) {
+      EXPECT_EQ(tag, tile.cornerCloud->points[i].intensity);
+      EXPECT_FLOAT_EQ(tile.key.i * 50 + 0.1f * i, tile.cornerCloud->points[i].x);
+    }
+    for (size_t i = 0; i < nSurfaces; i++) {
+      EXPECT_EQ(tag, tile.surfaceCloud->points[i].intensity);
+      EXPECT_FLOAT_EQ(tile.key.j * 50 + 0.1f * i, tile.surfaceCloud->points[i].y);
+    }
+  }
+
+  std::string _directory;
+  MapTileStore _store;
+  MapTilePager _pager;
+};
+
+} // end namespace
+
+
+
+TEST_F(MapTilePagerTest, pagedOutCubeIsPagedIn)
+{
+  CubeKey key(1, 2, -1);
+  _pager.pageOut(makeTile(key, 10, 20, 1));
+  EXPECT_TRUE(_pager.isPagedOut(key));
+
+  MapTile tile;
+  ASSERT_TRUE(_pager.pageInNow(key, tile));
+  EXPECT_FALSE(_pager.isPagedOut(key));
+  EXPECT_TRUE(tile.key == key);
+  expectTile(tile, 10, 20, 1);
+
+  // cubes that are not paged out are paged in as empty cubes
+  ASSERT_TRUE(_pager.pageInNow(CubeKey(5, 5, 5), tile));
+  EXPECT_TRUE(tile.cornerCloud->empty());
+  EXPECT_TRUE(tile.surfaceCloud->empty());
+
+  std::vector<MapTile> tiles;
+  EXPECT_EQ(0u, _pager.collectPagedIn(tiles));
+  EXPECT_TRUE(tiles.empty());
+}
+
+
+
+TEST_F(MapTilePagerTest, requestsAreProcessedInOrder)
+{
+  CubeKey a(0, 0, 0), b(1, 0, 0), c(2, 0, 0);
+  _pager.pageOut(makeTile(a, 5, 5, 1));
+  _pager.pageOut(makeTile(b, 6, 6, 2));
+  _pager.pageOut(makeTile(c, 7, 7, 3));
+
+  // page ins issued right after the page outs see the written tiles, in request order
+  _pager.requestPageIn(c);
+  _pager.requestPageIn(a);
+  MapTile tile;
+  ASSERT_TRUE(_pager.pageInNow(b, tile));
+  expectTile(tile, 6, 6, 2);
+
+  std::vector<MapTile> tiles;
+  EXPECT_EQ(0u, _pager.collectPagedIn(tiles));
+  ASSERT_EQ(2u, tiles.size());
+  EXPECT_TRUE(tiles[0].key == c);
+  EXPECT_TRUE(tiles[1].key == a);
+  expectTile(tiles[0], 7, 7, 3);
+  expectTile(tiles[1], 5, 5, 1);
+  EXPECT_FALSE(_pager.isPagedOut(a));
+  EXPECT_FALSE(_pager.isPagedOut(c));
+
+  // a repeated page out of the same cube replaces the previous tile
+  _pager.pageOut(makeTile(a, 8, 3, 4));
+  ASSERT_TRUE(_pager.pageInNow(a, tile));
+  expectTile(tile, 8, 3, 4);
+}
+
+
+
+TEST_F(MapTilePagerTest, pointsAddedWhilePagedOutAreMerged)
+{
+  CubeKey key(0, 1, 0);
+  _pager.pageOut(makeTile(key, 4, 3, 1));
+
+  // points added to the (empty) in memory cube while it is paged out
+  MapTile added = makeTile(key, 2, 5, 2);
+  pcl::PointCloud<PointXYZIRT>::Ptr cornerCloud = added.cornerCloud;
+  pcl::PointCloud<PointXYZIRT>::Ptr surfaceCloud(new pcl::PointCloud<PointXYZIRT>());
+
+  MapTile tile;
+  ASSERT_TRUE(_pager.pageInNow(key, tile));
+  tile.mergeInto(cornerCloud, surfaceCloud);
+
+  ASSERT_EQ(6u, cornerCloud->size());
+  ASSERT_EQ(3u, surfaceCloud->size());
+  for (size_t i = 0; i < 4; i++) {
+    EXPECT_EQ(1, cornerCloud->points[i].intensity);
+  }
+  for (size_t i = 4; i < 6; i++) {
+    EXPECT_EQ(2, cornerCloud->points[i].intensity);
+  }
+  for (size_t i = 0; i < 3; i++) {
+    EXPECT_EQ(1, surfaceCloud->points[i].intensity);
+  }
+
+  // the paged in tile itself is left untouched
+  expectTile(tile, 4, 3, 1);
+}
+
+
+
+TEST_F(MapTilePagerTest, failedPageOutKeepsCubeInMemory)
+{
+  // make the tile directory unusable
+  ASSERT_EQ(0, rmdir(_directory.c_str()));
+  ASSERT_EQ(0, symlink("/dev/null", _directory.c_str()));
+
+  CubeKey key(3, 0, 0);
+  _pager.pageOut(makeTile(key, 5, 6, 1));
+  _pager.requestPageIn(key);
+
+  // the cube is handed back rather than lost
+  MapTile tile;
+  ASSERT_TRUE(_pager.pageInNow(key, tile));
+  EXPECT_FALSE(_pager.isPagedOut(key));
+  expectTile(tile, 5, 6, 1);
+
+  std::vector<MapTile> tiles;
+  EXPECT_EQ(1u, _pager.collectPagedIn(tiles));
+  EXPECT_TRUE(tiles.empty());
+
+  _pager.stop();
+  ASSERT_EQ(0, unlink(_directory.c_str()));
+  ASSERT_EQ(0, mkdir(_directory.c_str(), 0755));
+}
+
+
+
+TEST_F(MapTilePagerTest, failedPageInKeepsStoredTile)
+{
+  CubeKey key(0, 0, 4);
+  _pager.pageOut(makeTile(key, 5, 6, 1));
+  _pager.stop();
+  ASSERT_TRUE(_pager.start(_store, true));
+  ASSERT_TRUE(_pager.isPagedOut(key));
+
+  // the stored tile is temporarily unreadable
+  std::string path = _store.tilePath(key);
+  std::string movedPath = path + ".moved";
+  ASSERT_EQ(0, std::rename(path.c_str(), movedPath.c_str()));
+
+  MapTile tile;
+  EXPECT_FALSE(_pager.pageInNow(key, tile));
+  EXPECT_TRUE(_pager.isPagedOut(key));
+
+  std::vector<MapTile> tiles;
+  EXPECT_EQ(1u, _pager.collectPagedIn(tiles));
+  EXPECT_TRUE(tiles.empty());
+
+  // the next page in retries reading the tile
+  ASSERT_EQ(0, std::rename(movedPath.c_str(), path.c_str()));
+  ASSERT_TRUE(_pager.pageInNow(key, tile));
+  EXPECT_FALSE(_pager.isPagedOut(key));
+  expectTile(tile, 5, 6, 1);
+}
+
+
+
+
+int main(int argc, char **argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
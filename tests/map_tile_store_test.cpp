@@ -0,0 +1,194 @@
+// Copyright 2013, Ji Zhang, Carnegie Mellon University
+// Further contributions copyright (c) 2016, Southwest Research Institute
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from this
+//    software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// This is an implementation of the algorithm described in the following paper:
+//   J. Zhang and S. Singh. LOAM: Lidar Odometry and Mapping in Real-time.
+//     Robotics: Science and Systems Conference (RSS). Berkeley, CA, July 2014.
+
+#include "loam_velodyne/MapTileStore.h"
+
+#include <gtest/gtest.h>
+
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <unistd.h>
+
+
+using namespace loam;
+
+namespace {
+
+/** \brief Tile store in a fresh temporary directory. */
+class MapTileStoreTest : public testing::Test {
+protected:
+  void SetUp()
+  {
+    char directory[] = "/tmp/loam_map_tile_store_test_XXXXXX";
+    ASSERT_TRUE(mkdtemp(directory) != NULL);
+    _directory = directory;
+    ASSERT_TRUE(_store.open(_directory, 50));
+
+    _key = CubeKey(1, -2, 3);
+    _corners.resize(3);
+    _surfaces.resize(5);
+    for (size_t i = 0; i < _corners.size(); i++) {
+      _corners.points[i].x = i;
+      _corners.points[i].y = -float(i);
+      _corners.points[i].z = 0.5f * i;
+      _corners.points[i].intensity = 10 + i;
+    }
+    for (size_t i = 0; i < _surfaces.size(); i++) {
+      _surfaces.points[i].x = 100 + i;
+      _surfaces.points[i].y = 0.25f * i;
+      _surfaces.points[i].z = -3;
+      _surfaces.points[i].intensity = 20 + i;
+    }
+    ASSERT_TRUE(_store.writeTile(_key, _corners, _surfaces));
+  }
+
+  void TearDown()
+  {
+    std::remove(_store.tilePath(_key).c_str());
+    rmdir(_directory.c_str());
+  }
+
+  /** \brief Overwrite the given bytes of the tile file. */
+  void patchTile(const size_t& offset, const void* data, const size_t& size)
+  {
+    FILE* file = std::fopen(_store.tilePath(_key).c_str(), "r+b");
+    ASSERT_TRUE(file != NULL);
+    ASSERT_EQ(0, std::fseek(file, long(offset), SEEK_SET));
+    ASSERT_EQ(1u, std::fwrite(data, size, 1, file));
+    std::fclose(file);
+  }
+
+  /** \brief Check if reading the tile fails. */
+  bool readFails()
+  {
+    pcl::PointCloud<PointXYZIRT> corners, surfaces;
+    return !_store.readTile(_key, corners, surfaces);
+  }
+
+  std::string _directory;
+  MapTileStore _store;
+  CubeKey _key;
+  pcl::PointCloud<PointXYZIRT> _corners;
+  pcl::PointCloud<PointXYZIRT> _surfaces;
+};
+
+} // end namespace
+
+
+
+TEST_F(MapTileStoreTest, writtenTileIsReadBack)
+{
+  EXPECT_TRUE(_store.hasTile(_key));
+
+  pcl::PointCloud<PointXYZIRT> corners, surfaces;
+  ASSERT_TRUE(_store.readTile(_key, corners, surfaces));
+  ASSERT_EQ(_corners.size(), corners.size());
+  ASSERT_EQ(_surfaces.size(), surfaces.size());
+  for (size_t i = 0; i < corners.size(); i++) {
+    EXPECT_EQ(_corners.points[i].x, corners.points[i].x);
+    EXPECT_EQ(_corners.points[i].y, corners.points[i].y);
+    EXPECT_EQ(_corners.points[i].z, corners.points[i].z);
+    EXPECT_EQ(_corners.points[i].intensity, corners.points[i].intensity);
+  }
+  for (size_t i = 0; i < surfaces.size(); i++) {
+    EXPECT_EQ(_surfaces.points[i].x, surfaces.points[i].x);
+    EXPECT_EQ(_surfaces.points[i].y, surfaces.points[i].y);
+    EXPECT_EQ(_surfaces.points[i].z, surfaces.points[i].z);
+    EXPECT_EQ(_surfaces.points[i].intensity, surfaces.points[i].intensity);
+  }
+
+  // the tile of another cube is not mistaken for the requested one
+  MapTileStore otherSize;
+  ASSERT_TRUE(otherSize.open(_directory, 25));
+  EXPECT_FALSE(otherSize.readTile(_key, corners, surfaces));
+}
+
+
+
+TEST_F(MapTileStoreTest, badMagicIsRejected)
+{
+  patchTile(offsetof(MapTileHeader, magic), "XOAMTILE", 8);
+  EXPECT_TRUE(readFails());
+}
+
+
+
+TEST_F(MapTileStoreTest, badVersionIsRejected)
+{
+  uint32_t version = MapTileStore::VERSION + 1;
+  patchTile(offsetof(MapTileHeader, version), &version, sizeof(version));
+  EXPECT_TRUE(readFails());
+}
+
+
+
+TEST_F(MapTileStoreTest, badHeaderSizeIsRejected)
+{
+  uint32_t headerSize = 1 << 30;
+  patchTile(offsetof(MapTileHeader, headerSize), &headerSize, sizeof(headerSize));
+  EXPECT_TRUE(readFails());
+}
+
+
+
+TEST_F(MapTileStoreTest, truncatedTileIsRejected)
+{
+  ASSERT_EQ(0, truncate(_store.tilePath(_key).c_str(), sizeof(MapTileHeader) + 4 * sizeof(float)));
+  EXPECT_TRUE(readFails());
+}
+
+
+
+TEST_F(MapTileStoreTest, overflowingPointCountsAreRejected)
+{
+  // these counts wrap around to a small byte size when summed or multiplied by the point size
+  uint64_t cornerCount = uint64_t(1) << 62;
+  patchTile(offsetof(MapTileHeader, cornerCount), &cornerCount, sizeof(cornerCount));
+  EXPECT_TRUE(readFails());
+
+  cornerCount = 1;
+  uint64_t surfaceCount = ~uint64_t(0);
+  patchTile(offsetof(MapTileHeader, cornerCount), &cornerCount, sizeof(cornerCount));
+  patchTile(offsetof(MapTileHeader, surfaceCount), &surfaceCount, sizeof(surfaceCount));
+  EXPECT_TRUE(readFails());
+}
+
+
+
+
+int main(int argc, char **argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,148 @@
+// Copyright 2013, Ji Zhang, Carnegie Mellon University
+// Further contributions copyright (c) 2016, Southwest Research Institute
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from this
+//    software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// This is an implementation of the algorithm described in the following paper:
+//   J. Zhang and S. Singh. LOAM: Lidar Odometry and Mapping in Real-time.
+//     Robotics: Science and Systems Conference (RSS). Berkeley, CA, July 2014.
+
+#include "loam_velodyne/PoseHistory.h"
+
+#include <boost/thread/thread.hpp>
+#include <gtest/gtest.h>
+
+#include <Eigen/Geometry>
+
+
+using namespace loam;
+
+
+/** \brief Pose rotating around the z-axis with 0.1 rad/s and moving along the x-axis with 1 m/s. */
+static Pose poseAt(double time)
+{
+  return Pose(Eigen::AngleAxisf(0.1f * time, Eigen::Vector3f::UnitZ()).toRotationMatrix(),
+              Eigen::Vector3f(time, 0, 0));
+}
+
+
+TEST(PoseHistory, interpolatesBetweenPoses)
+{
+  PoseHistory history(10);
+  for (int i = 1; i <= 5; i++) {
+    history.push(ros::Time(i), poseAt(i));
+  }
+
+  Pose pose;
+  ASSERT_TRUE(history.lookup(ros::Time(2.25), pose));
+  EXPECT_LT((pose.rot - poseAt(2.25).rot).cwiseAbs().maxCoeff(), 1e-5f);
+  EXPECT_NEAR(2.25f, pose.pos.x(), 1e-5f);
+
+  ASSERT_TRUE(history.lookup(ros::Time(5), pose));
+  EXPECT_NEAR(5.0f, pose.pos.x(), 1e-5f);
+}
+
+TEST(PoseHistory, rejectsTimesOutsideHistory)
+{
+  PoseHistory history(10);
+  Pose pose;
+  EXPECT_FALSE(history.lookup(ros::Time(1), pose));
+
+  history.push(ros::Time(1), poseAt(1));
+  history.push(ros::Time(2), poseAt(2));
+  EXPECT_FALSE(history.lookup(ros::Time(0.5), pose));
+  EXPECT_FALSE(history.lookup(ros::Time(2.5), pose));
+  EXPECT_TRUE(history.lookup(ros::Time(1), pose));
+}
+
+TEST(PoseHistory, overwritesOldestPoses)
+{
+  PoseHistory history(3);
+  for (int i = 1; i <= 5; i++) {
+    history.push(ros::Time(i), poseAt(i));
+  }
+
+  ros::Time oldest, newest;
+  ASSERT_TRUE(history.timeRange(oldest, newest));
+  EXPECT_DOUBLE_EQ(3, oldest.toSec());
+  EXPECT_DOUBLE_EQ(5, newest.toSec());
+
+  Pose pose;
+  EXPECT_FALSE(history.lookup(ros::Time(2.5), pose));
+  ASSERT_TRUE(history.lookup(ros::Time(4.5), pose));
+  EXPECT_NEAR(4.5f, pose.pos.x(), 1e-5f);
+}
+
+TEST(PoseHistory, discardsNewerPosesOnTimeJump)
+{
+  PoseHistory history(10);
+  for (int i = 1; i <= 5; i++) {
+    history.push(ros::Time(i), poseAt(i));
+  }
+  history.push(ros::Time(3.5), poseAt(10));
+
+  ros::Time oldest, newest;
+  ASSERT_TRUE(history.timeRange(oldest, newest));
+  EXPECT_DOUBLE_EQ(1, oldest.toSec());
+  EXPECT_DOUBLE_EQ(3.5, newest.toSec());
+}
+
+
+/** \brief Look up random times while the history is written, every result has to be consistent with poseAt(). */
+static void checkConcurrentLookups(const PoseHistory* history, int* inconsistent)
+{
+  Pose pose;
+  for (int i = 0; i < 200000; i++) {
+    double time = 1 + (i % 1000) * 0.01;
+    if (history->lookup(ros::Time(time), pose) && std::abs(pose.pos.x() - time) > 1e-3) {
+      (*inconsistent)++;
+    }
+  }
+}
+
+TEST(PoseHistory, concurrentLookups)
+{
+  PoseHistory history(16);
+  int inconsistent[2] = {0, 0};
+
+  boost::thread reader1(checkConcurrentLookups, &history, &inconsistent[0]);
+  boost::thread reader2(checkConcurrentLookups, &history, &inconsistent[1]);
+  for (int i = 0; i < 200000; i++) {
+    history.push(ros::Time(1 + (i % 1000) * 0.01), poseAt(1 + (i % 1000) * 0.01));
+  }
+  reader1.join();
+  reader2.join();
+
+  EXPECT_EQ(0, inconsistent[0]);
+  EXPECT_EQ(0, inconsistent[1]);
+}
+
+
+int main(int argc, char **argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
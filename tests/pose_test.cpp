@@ -0,0 +1,179 @@
+// Copyright 2013, Ji Zhang, Carnegie Mellon University
+// Further contributions copyright (c) 2016, Southwest Research Institute
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from this
+//    software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// This is an implementation of the algorithm described in the following paper:
+//   J. Zhang and S. Singh. LOAM: Lidar Odometry and Mapping in Real-time.
+//     Robotics: Science and Systems Conference (RSS). Berkeley, CA, July 2014.
+
+#include "loam_velodyne/Pose.h"
+#include "euler_closed_forms.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstdlib>
+
+
+using namespace loam;
+
+
+static const int NUM_SAMPLES = 1000;
+
+
+/** \brief Draw a random angle in [-limit, limit]. */
+static float randomAngle(float limit = M_PI)
+{
+  return limit * (2.0f * std::rand() / RAND_MAX - 1.0f);
+}
+
+/** \brief Draw a random twist (pitch limited to +/- 80 degrees to stay clear of the gimbal lock). */
+static Twist randomTwist()
+{
+  Twist twist;
+  twist.rot_x = randomAngle(1.4f);
+  twist.rot_y = randomAngle();
+  twist.rot_z = randomAngle();
+  twist.pos = Vector3(randomAngle(100), randomAngle(100), randomAngle(10));
+  return twist;
+}
+
+/** \brief Expect both rotations to be equal (compared via their matrices to be independent of angle wrapping). */
+static void expectRotationNear(const Angle& ax, const Angle& ay, const Angle& az,
+                               const Angle& bx, const Angle& by, const Angle& bz)
+{
+  Eigen::Matrix3f a = rotationFromEuler(ax, ay, az);
+  Eigen::Matrix3f b = rotationFromEuler(bx, by, bz);
+  EXPECT_LT((a - b).cwiseAbs().maxCoeff(), 1e-4f);
+}
+
+
+TEST(Pose, rotationFromEulerMatchesSequentialRotation)
+{
+  std::srand(1);
+  for (int i = 0; i < NUM_SAMPLES; i++) {
+    Twist twist = randomTwist();
+    Vector3 v = twist.pos;
+    closed_form::rotateZXY(v, twist.rot_z, twist.rot_x, twist.rot_y);
+
+    Eigen::Vector3f w = rotationFromEuler(twist.rot_x, twist.rot_y, twist.rot_z) * twist.pos.head<3>();
+    EXPECT_LT((w - v.head<3>()).cwiseAbs().maxCoeff(), 1e-3f);
+  }
+}
+
+TEST(Pose, eulerFromRotationRoundTrip)
+{
+  std::srand(2);
+  for (int i = 0; i < NUM_SAMPLES; i++) {
+    Twist twist = randomTwist();
+    Angle rx, ry, rz;
+    eulerFromRotation(rotationFromEuler(twist.rot_x, twist.rot_y, twist.rot_z), rx, ry, rz);
+
+    EXPECT_NEAR(twist.rot_x.rad(), rx.rad(), 1e-3f);
+    EXPECT_NEAR(twist.rot_y.rad(), ry.rad(), 1e-3f);
+    EXPECT_NEAR(twist.rot_z.rad(), rz.rad(), 1e-3f);
+    EXPECT_NEAR(std::cos(rx.rad()), rx.cos(), 1e-5f);
+    EXPECT_NEAR(std::sin(ry.rad()), ry.sin(), 1e-5f);
+    EXPECT_NEAR(std::sin(rz.rad()), rz.sin(), 1e-5f);
+  }
+}
+
+TEST(Pose, inverseComposesToIdentity)
+{
+  std::srand(3);
+  for (int i = 0; i < NUM_SAMPLES; i++) {
+    Pose pose(randomTwist());
+    Pose identity = pose * pose.inverse();
+    EXPECT_LT((identity.rot - Eigen::Matrix3f::Identity()).cwiseAbs().maxCoeff(), 1e-5f);
+    EXPECT_LT(identity.pos.cwiseAbs().maxCoeff(), 1e-4f);
+  }
+}
+
+TEST(Pose, accumulateRotationEquivalence)
+{
+  std::srand(4);
+  for (int i = 0; i < NUM_SAMPLES; i++) {
+    Twist c = randomTwist();
+    Twist l = randomTwist();
+
+    Angle ox, oy, oz;
+    closed_form::accumulateRotation(c.rot_x, c.rot_y, c.rot_z, l.rot_x, l.rot_y, l.rot_z, ox, oy, oz);
+
+    Angle rx, ry, rz;
+    eulerFromRotation(rotationFromEuler(c.rot_x, c.rot_y, c.rot_z) * rotationFromEuler(l.rot_x, l.rot_y, l.rot_z),
+                      rx, ry, rz);
+
+    expectRotationNear(ox, oy, oz, rx, ry, rz);
+  }
+}
+
+TEST(Pose, pluginIMURotationEquivalence)
+{
+  std::srand(5);
+  for (int i = 0; i < NUM_SAMPLES; i++) {
+    Twist bc = randomTwist();
+    Twist bl = randomTwist();
+    Twist al = randomTwist();
+
+    Angle ox, oy, oz;
+    closed_form::pluginIMURotation(bc.rot_x, bc.rot_y, bc.rot_z,
+                                   bl.rot_x, bl.rot_y, bl.rot_z,
+                                   al.rot_x, al.rot_y, al.rot_z,
+                                   ox, oy, oz);
+
+    Angle rx, ry, rz;
+    eulerFromRotation(rotationFromEuler(bc.rot_x, bc.rot_y, bc.rot_z)
+                      * rotationFromEuler(bl.rot_x, bl.rot_y, bl.rot_z).transpose()
+                      * rotationFromEuler(al.rot_x, al.rot_y, al.rot_z),
+                      rx, ry, rz);
+
+    expectRotationNear(ox, oy, oz, rx, ry, rz);
+  }
+}
+
+TEST(Pose, transformAssociateToMapEquivalence)
+{
+  std::srand(6);
+  for (int i = 0; i < NUM_SAMPLES; i++) {
+    Twist sum = randomTwist();
+    Twist befMapped = randomTwist();
+    Twist aftMapped = randomTwist();
+
+    Twist expected = closed_form::transformAssociateToMap(sum, befMapped, aftMapped);
+    Twist actual = (Pose(aftMapped) * Pose(befMapped).inverse() * Pose(sum)).toTwist();
+
+    expectRotationNear(expected.rot_x, expected.rot_y, expected.rot_z, actual.rot_x, actual.rot_y, actual.rot_z);
+    EXPECT_LT((expected.pos - actual.pos).cwiseAbs().maxCoeff(), 1e-2f);
+  }
+}
+
+
+int main(int argc, char **argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
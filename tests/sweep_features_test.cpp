@@ -0,0 +1,140 @@
+// Copyright 2013, Ji Zhang, Carnegie Mellon University
+// Further contributions copyright (c) 2016, Southwest Research Institute
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from this
+//    software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// This is an implementation of the algorithm described in the following paper:
+//   J. Zhang and S. Singh. LOAM: Lidar Odometry and Mapping in Real-time.
+//     Robotics: Science and Systems Conference (RSS). Berkeley, CA, July 2014.
+
+#include "loam_velodyne/SweepFeatures.h"
+
+#include <gtest/gtest.h>
+
+
+using namespace loam;
+
+
+/** \brief Fill the given cloud with the given number of points, tagged with the given ring. */
+static void fillCloud(pcl::PointCloud<PointXYZIRT>& cloud, size_t size, uint16_t ring)
+{
+  cloud.clear();
+  for (size_t i = 0; i < size; i++) {
+    PointXYZIRT point;
+    point.x = i;
+    point.y = ring;
+    point.z = 0;
+    point.intensity = 1;
+    point.ring = ring;
+    point.time = 0.001f * i;
+    cloud.push_back(point);
+  }
+}
+
+/** \brief Expect the given cloud to match fillCloud(). */
+static void expectCloud(const pcl::PointCloud<PointXYZIRT>& cloud, size_t size, uint16_t ring)
+{
+  ASSERT_EQ(size, cloud.size());
+  for (size_t i = 0; i < size; i++) {
+    EXPECT_EQ(ring, cloud.points[i].ring);
+    EXPECT_FLOAT_EQ(float(i), cloud.points[i].x);
+    EXPECT_FLOAT_EQ(0.001f * i, cloud.points[i].time);
+  }
+}
+
+static void fillFeatures(SweepFeatures& features)
+{
+  features.sweepStart = ros::Time(12.5);
+  features.scanPeriod = 0.1f;
+  fillCloud(features.cornerPointsSharp, 3, 1);
+  fillCloud(features.cornerPointsLessSharp, 5, 2);
+  fillCloud(features.surfacePointsFlat, 0, 3);
+  fillCloud(features.surfacePointsLessFlat, 7, 4);
+  fillCloud(features.laserCloud, 11, 5);
+  features.imuPitchStart = 0.1f;
+  features.imuYawEnd = -0.2f;
+  features.imuShiftFromStart = Vector3(1, 2, 3);
+  features.imuVeloFromStart = Vector3(-1, 0, 1);
+}
+
+
+TEST(SweepFeatures, roundTrip)
+{
+  SweepFeatures features;
+  fillFeatures(features);
+
+  loam_velodyne::FeatureFrame msg;
+  features.toMsg(msg);
+
+  SweepFeatures received;
+  ASSERT_TRUE(received.fromMsg(msg));
+  EXPECT_EQ(features.sweepStart, received.sweepStart);
+  EXPECT_FLOAT_EQ(0.1f, received.scanPeriod);
+  expectCloud(received.cornerPointsSharp, 3, 1);
+  expectCloud(received.cornerPointsLessSharp, 5, 2);
+  expectCloud(received.surfacePointsFlat, 0, 3);
+  expectCloud(received.surfacePointsLessFlat, 7, 4);
+  expectCloud(received.laserCloud, 11, 5);
+  EXPECT_FLOAT_EQ(0.1f, received.imuPitchStart.rad());
+  EXPECT_FLOAT_EQ(-0.2f, received.imuYawEnd.rad());
+  EXPECT_FLOAT_EQ(2, received.imuShiftFromStart.y());
+  EXPECT_FLOAT_EQ(-1, received.imuVeloFromStart.x());
+}
+
+TEST(SweepFeatures, withoutFullResolutionCloud)
+{
+  SweepFeatures features;
+  fillFeatures(features);
+
+  loam_velodyne::FeatureFrame msg;
+  features.toMsg(msg, false);
+  EXPECT_EQ(0u, msg.laserCloud);
+
+  SweepFeatures received;
+  ASSERT_TRUE(received.fromMsg(msg));
+  expectCloud(received.surfacePointsLessFlat, 7, 4);
+  EXPECT_TRUE(received.laserCloud.empty());
+}
+
+TEST(SweepFeatures, rejectsInconsistentCounts)
+{
+  SweepFeatures features;
+  fillFeatures(features);
+
+  loam_velodyne::FeatureFrame msg;
+  features.toMsg(msg);
+  msg.cornerPointsSharp++;
+
+  SweepFeatures received;
+  EXPECT_FALSE(received.fromMsg(msg));
+}
+
+
+int main(int argc, char **argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
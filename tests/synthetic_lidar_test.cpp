@@ -0,0 +1,161 @@
+// Copyright 2013, Ji Zhang, Carnegie Mellon University
+// Further contributions copyright (c) 2016, Southwest Research Institute
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from this
+//    software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// This is an implementation of the algorithm described in the following paper:
+//   J. Zhang and S. Singh. LOAM: Lidar Odometry and Mapping in Real-time.
+//     Robotics: Science and Systems Conference (RSS). Berkeley, CA, July 2014.
+
+#include "loam_velodyne/SyntheticLidar.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+
+
+using namespace loam;
+
+TEST(SyntheticLidarTest, groundRangeMatchesRingElevation)
+{
+  SyntheticScene scene;
+  SyntheticScene::Plane ground;
+  ground.normal = Eigen::Vector3f::UnitZ();
+  ground.offset = 0;
+  ground.intensity = 10;
+  scene.planes.push_back(ground);
+
+  float elevation = -15 * float(M_PI) / 180;
+  Eigen::Vector3f direction(std::cos(elevation), 0, std::sin(elevation));
+  float range, intensity;
+  ASSERT_TRUE(scene.castRay(Eigen::Vector3f(0, 0, 2), direction, 100, range, intensity));
+  EXPECT_NEAR(2 / std::sin(-elevation), range, 1e-4);
+  EXPECT_EQ(10, intensity);
+
+  // rays pointing upwards never hit the ground
+  EXPECT_FALSE(scene.castRay(Eigen::Vector3f(0, 0, 2), Eigen::Vector3f(1, 0, 0.1f).normalized(), 100, range, intensity));
+}
+
+
+
+TEST(SyntheticLidarTest, closestPrimitiveIsHit)
+{
+  SyntheticScene scene;
+  SyntheticScene::Pole pole;
+  pole.center = Eigen::Vector2f(10, 0);
+  pole.radius = 0.5f;
+  pole.bottom = 0;
+  pole.top = 5;
+  pole.intensity = 1;
+  scene.poles.push_back(pole);
+
+  SyntheticScene::Box box;
+  box.min = Eigen::Vector3f(20, -5, 0);
+  box.max = Eigen::Vector3f(30, 5, 10);
+  box.intensity = 2;
+  scene.boxes.push_back(box);
+
+  float range, intensity;
+  Eigen::Vector3f origin(0, 0, 1);
+
+  // culled primitives are ignored
+  scene.cull(origin, 1);
+  EXPECT_FALSE(scene.castRay(origin, Eigen::Vector3f::UnitX(), 100, range, intensity));
+
+  scene.cull(origin, 100);
+  ASSERT_TRUE(scene.castRay(origin, Eigen::Vector3f::UnitX(), 100, range, intensity));
+  EXPECT_NEAR(9.5f, range, 1e-4);
+  EXPECT_EQ(1, intensity);
+
+  // above the pole the ray continues to the box
+  ASSERT_TRUE(scene.castRay(Eigen::Vector3f(0, 0, 6), Eigen::Vector3f::UnitX(), 100, range, intensity));
+  EXPECT_NEAR(20, range, 1e-4);
+  EXPECT_EQ(2, intensity);
+
+  // but not beyond the maximum range
+  EXPECT_FALSE(scene.castRay(Eigen::Vector3f(0, 0, 6), Eigen::Vector3f::UnitX(), 15, range, intensity));
+}
+
+
+
+TEST(SyntheticLidarTest, sweepPointsLieOnScanRings)
+{
+  MultiScanMapper scanMapper = MultiScanMapper::Velodyne_HDL_32();
+  SyntheticLidar lidar(scanMapper, 360);
+  lidar.scene = SyntheticScene::city(100);
+  lidar.rangeNoise = 0;
+
+  pcl::PointCloud<pcl::PointXYZI> sweep;
+  lidar.generateSweep(0, sweep);
+  ASSERT_GT(sweep.size(), 0u);
+  EXPECT_LE(sweep.size(), 360u * 32);
+
+  float step = (scanMapper.getUpperBound() - scanMapper.getLowerBound()) / 31;
+  for (size_t i = 0; i < sweep.size(); i++) {
+    const pcl::PointXYZI& p = sweep[i];
+    float elevation = std::atan2(p.z, std::sqrt(p.x * p.x + p.y * p.y)) * 180 / float(M_PI);
+    float ring = (elevation - scanMapper.getLowerBound()) / step;
+    EXPECT_NEAR(std::floor(ring + 0.5f), ring, 1e-2) << "point " << i;
+  }
+}
+
+
+
+TEST(SyntheticLidarTest, sceneIsReproducible)
+{
+  SyntheticScene a = SyntheticScene::city(100, 7);
+  SyntheticScene b = SyntheticScene::city(100, 7);
+  ASSERT_EQ(a.boxes.size(), b.boxes.size());
+  for (size_t i = 0; i < a.boxes.size(); i++) {
+    EXPECT_EQ(a.boxes[i].min, b.boxes[i].min);
+    EXPECT_EQ(a.boxes[i].max, b.boxes[i].max);
+  }
+}
+
+
+
+TEST(SyntheticLidarTest, imuMeasuresGravityWhenStationary)
+{
+  SyntheticLidar lidar;
+  lidar.trajectory.speed = 0;
+  lidar.trajectory.swayAmplitude = 0;
+
+  sensor_msgs::Imu imu;
+  lidar.generateImu(3.2, imu);
+  EXPECT_NEAR(0, imu.linear_acceleration.x, 1e-6);
+  EXPECT_NEAR(0, imu.linear_acceleration.y, 1e-6);
+  EXPECT_NEAR(9.81, imu.linear_acceleration.z, 1e-6);
+  EXPECT_NEAR(0, imu.angular_velocity.z, 1e-6);
+  EXPECT_NEAR(1, imu.orientation.w, 1e-6);
+}
+
+
+
+int main(int argc, char **argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,185 @@
+// Copyright 2013, Ji Zhang, Carnegie Mellon University
+// Further contributions copyright (c) 2016, Southwest Research Institute
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from this
+//    software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// This is an implementation of the algorithm described in the following paper:
+//   J. Zhang and S. Singh. LOAM: Lidar Odometry and Mapping in Real-time.
+//     Robotics: Science and Systems Conference (RSS). Berkeley, CA, July 2014.
+#include "../src/lib/math_utils.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+
+using namespace loam;
+
+
+static const int NUM_SAMPLES = 100;
+
+/** \brief Maximum deviation of the batch kernels from the per point rotations, relative to the point distance. */
+static const float TOLERANCE = 1.6e-5f;
+
+
+/** \brief Draw a random number in [-limit, limit]. */
+static float randomValue(float limit)
+{
+  return limit * (2.0f * std::rand() / RAND_MAX - 1.0f);
+}
+
+/** \brief Draw a random twist. */
+static Twist randomTwist(float angleLimit, float posLimit)
+{
+  Twist twist;
+  twist.rot_x = randomValue(angleLimit);
+  twist.rot_y = randomValue(angleLimit);
+  twist.rot_z = randomValue(angleLimit);
+  twist.pos = Vector3(randomValue(posLimit), randomValue(posLimit), randomValue(posLimit));
+  return twist;
+}
+
+/** \brief Create a random sweep cloud (not a multiple of the batch size) with point times in [0, scanPeriod]. */
+static pcl::PointCloud<PointXYZIRT> randomCloud(float scanPeriod)
+{
+  pcl::PointCloud<PointXYZIRT> cloud;
+  cloud.resize(3 * TRANSFORM_BATCH_SIZE + std::rand() % TRANSFORM_BATCH_SIZE);
+  for (size_t i = 0; i < cloud.size(); i++) {
+    PointXYZIRT& p = cloud.points[i];
+    p.x = randomValue(80);
+    p.y = randomValue(10);
+    p.z = randomValue(80);
+    p.intensity = float(i);
+    p.time = scanPeriod * std::rand() / RAND_MAX;
+    p.ring = uint16_t(i % 16);
+  }
+  return cloud;
+}
+
+/** \brief Expect both clouds to have the same points within the tolerance and the same non coordinate fields. */
+static void expectCloudsNear(const pcl::PointCloud<PointXYZIRT>& expected, const pcl::PointCloud<PointXYZIRT>& actual)
+{
+  ASSERT_EQ(expected.size(), actual.size());
+  for (size_t i = 0; i < expected.size(); i++) {
+    const PointXYZIRT& a = expected.points[i];
+    const PointXYZIRT& b = actual.points[i];
+    float tolerance = TOLERANCE * std::max(1.0f, calcPointDistance(a));
+    EXPECT_NEAR(a.x, b.x, tolerance);
+    EXPECT_NEAR(a.y, b.y, tolerance);
+    EXPECT_NEAR(a.z, b.z, tolerance);
+    EXPECT_EQ(a.intensity, b.intensity);
+    EXPECT_EQ(a.time, b.time);
+    EXPECT_EQ(a.ring, b.ring);
+  }
+}
+
+
+
+TEST(Transform, transformCloudMatchesRotateZXY)
+{
+  std::srand(1);
+  for (int n = 0; n < NUM_SAMPLES; n++) {
+    Twist pose = randomTwist(M_PI, 100);
+    pcl::PointCloud<PointXYZIRT> cloud = randomCloud(0.1f);
+    pcl::PointCloud<PointXYZIRT> expected = cloud;
+    for (size_t i = 0; i < expected.size(); i++) {
+      PointXYZIRT& p = expected.points[i];
+      rotateZXY(p, pose.rot_z, pose.rot_x, pose.rot_y);
+      p.x += pose.pos.x();
+      p.y += pose.pos.y();
+      p.z += pose.pos.z();
+    }
+
+    transformCloud(cloud, rotationZXY(pose.rot_z, pose.rot_x, pose.rot_y), pose.pos.head<3>());
+    expectCloudsNear(expected, cloud);
+  }
+}
+
+
+
+TEST(Transform, transformCloudMatchesRotateYXZ)
+{
+  std::srand(2);
+  for (int n = 0; n < NUM_SAMPLES; n++) {
+    Twist pose = randomTwist(M_PI, 100);
+    pcl::PointCloud<PointXYZIRT> cloud = randomCloud(0.1f);
+    pcl::PointCloud<PointXYZIRT> expected = cloud;
+
+    // points before the begin index stay untouched
+    size_t begin = std::rand() % cloud.size();
+    for (size_t i = begin; i < expected.size(); i++) {
+      PointXYZIRT& p = expected.points[i];
+      rotateYXZ(p, pose.rot_y, pose.rot_x, pose.rot_z);
+      p.x += pose.pos.x();
+      p.y += pose.pos.y();
+      p.z += pose.pos.z();
+    }
+
+    transformCloud(cloud, rotationYXZ(pose.rot_y, pose.rot_x, pose.rot_z), pose.pos.head<3>(), begin);
+    expectCloudsNear(expected, cloud);
+  }
+}
+
+
+
+TEST(Transform, deskewCloudMatchesPerPointInterpolation)
+{
+  const float scanPeriod = 0.1f;
+  std::srand(3);
+  for (int n = 0; n < NUM_SAMPLES; n++) {
+    Twist motion = randomTwist(0.3f, 3);
+    Twist pose = randomTwist(M_PI, 100);
+    pcl::PointCloud<PointXYZIRT> cloud = randomCloud(scanPeriod);
+    pcl::PointCloud<PointXYZIRT> expected = cloud;
+    for (size_t i = 0; i < expected.size(); i++) {
+      PointXYZIRT& p = expected.points[i];
+      float s = p.time / scanPeriod;
+      p.x -= s * motion.pos.x();
+      p.y -= s * motion.pos.y();
+      p.z -= s * motion.pos.z();
+      rotateZXY(p, Angle(-s * motion.rot_z.rad()), Angle(-s * motion.rot_x.rad()), Angle(-s * motion.rot_y.rad()));
+
+      rotateYXZ(p, pose.rot_y, pose.rot_x, pose.rot_z);
+      p.x += pose.pos.x();
+      p.y += pose.pos.y();
+      p.z += pose.pos.z();
+    }
+
+    deskewCloud(cloud, motion, scanPeriod, rotationYXZ(pose.rot_y, pose.rot_x, pose.rot_z), pose.pos.head<3>());
+    expectCloudsNear(expected, cloud);
+  }
+}
+
+
+
+
+int main(int argc, char **argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
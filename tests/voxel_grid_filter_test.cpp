@@ -0,0 +1,225 @@
+// Copyright 2013, Ji Zhang, Carnegie Mellon University
+// Further contributions copyright (c) 2016, Southwest Research Institute
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from this
+//    software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// This is an implementation of the algorithm described in the following paper:
+//   J. Zhang and S. Singh. LOAM: Lidar Odometry and Mapping in Real-time.
+//     Robotics: Science and Systems Conference (RSS). Berkeley, CA, July 2014.
+
+#include "loam_velodyne/VoxelGridFilter.h"
+
+#include <gtest/gtest.h>
+#include <pcl/filters/voxel_grid.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+
+
+using namespace loam;
+
+namespace {
+
+/** \brief Create a cloud of uniformly distributed random points in a 20 m cube, with random intensities. */
+template <typename PointT>
+pcl::PointCloud<PointT> randomCloud(size_t size, unsigned int seed)
+{
+  std::srand(seed);
+  pcl::PointCloud<PointT> cloud;
+  cloud.resize(size);
+  for (size_t i = 0; i < size; i++) {
+    cloud.points[i].x = 20.0f * std::rand() / RAND_MAX - 10;
+    cloud.points[i].y = 20.0f * std::rand() / RAND_MAX - 10;
+    cloud.points[i].z = 20.0f * std::rand() / RAND_MAX - 10;
+    cloud.points[i].intensity = 100.0f * std::rand() / RAND_MAX;
+  }
+  return cloud;
+}
+
+/** \brief Lexicographic point comparison. */
+bool lessXYZ(const PointXYZIRT& a, const PointXYZIRT& b)
+{
+  if (a.x != b.x) return a.x < b.x;
+  if (a.y != b.y) return a.y < b.y;
+  return a.z < b.z;
+}
+
+} // end namespace
+
+
+
+TEST(VoxelGridFilterTest, matchesPclVoxelGrid)
+{
+  const float leafSizes[] = {0.2f, 0.5f, 1.3f};
+  pcl::PointCloud<pcl::PointXYZI>::Ptr cloud(new pcl::PointCloud<pcl::PointXYZI>(randomCloud<pcl::PointXYZI>(50000, 2)));
+
+  VoxelGridFilter<pcl::PointXYZI> filter;
+  pcl::VoxelGrid<pcl::PointXYZI> pclFilter;
+  pclFilter.setInputCloud(cloud);
+
+  for (size_t n = 0; n < sizeof(leafSizes) / sizeof(leafSizes[0]); n++) {
+    pcl::PointCloud<pcl::PointXYZI> filtered, pclFiltered;
+    filter.setLeafSize(leafSizes[n]);
+    filter.filter(*cloud, filtered);
+    pclFilter.setLeafSize(leafSizes[n], leafSizes[n], leafSizes[n]);
+    pclFilter.filter(pclFiltered);
+
+    // same centroids in the same (voxel index) order
+    ASSERT_EQ(pclFiltered.size(), filtered.size());
+    EXPECT_EQ(filtered.size(), size_t(filtered.width));
+    EXPECT_EQ(1u, filtered.height);
+    for (size_t i = 0; i < filtered.size(); i++) {
+      EXPECT_NEAR(pclFiltered.points[i].x, filtered.points[i].x, 1e-4);
+      EXPECT_NEAR(pclFiltered.points[i].y, filtered.points[i].y, 1e-4);
+      EXPECT_NEAR(pclFiltered.points[i].z, filtered.points[i].z, 1e-4);
+      EXPECT_NEAR(pclFiltered.points[i].intensity, filtered.points[i].intensity, 1e-3);
+    }
+  }
+}
+
+
+
+TEST(VoxelGridFilterTest, skipsNonFinitePoints)
+{
+  pcl::PointCloud<PointXYZIRT> cloud = randomCloud<PointXYZIRT>(5000, 3);
+  pcl::PointCloud<PointXYZIRT> withNaN = cloud;
+  const float nan = std::numeric_limits<float>::quiet_NaN();
+  const float inf = std::numeric_limits<float>::infinity();
+  for (size_t i = 0; i < 3; i++) {
+    PointXYZIRT p = cloud.points[i];
+    (i == 0 ? p.x : i == 1 ? p.y : p.z) = i == 2 ? inf : nan;
+    withNaN.points.insert(withNaN.points.begin() + 100 * i, p);
+  }
+  withNaN.width = withNaN.points.size();
+
+  VoxelGridFilter<PointXYZIRT> filter(1.0f);
+  pcl::PointCloud<PointXYZIRT> filtered, filteredNaN;
+  filter.filter(cloud, filtered);
+  filter.filter(withNaN, filteredNaN);
+
+  ASSERT_EQ(filtered.size(), filteredNaN.size());
+  EXPECT_TRUE(filteredNaN.is_dense);
+  for (size_t i = 0; i < filtered.size(); i++) {
+    EXPECT_EQ(filtered.points[i].x, filteredNaN.points[i].x);
+    EXPECT_EQ(filtered.points[i].y, filteredNaN.points[i].y);
+    EXPECT_EQ(filtered.points[i].z, filteredNaN.points[i].z);
+  }
+}
+
+
+
+TEST(VoxelGridFilterTest, emptyInputYieldsEmptyOutput)
+{
+  VoxelGridFilter<PointXYZIRT> filter;
+  pcl::PointCloud<PointXYZIRT> cloud, filtered = randomCloud<PointXYZIRT>(10, 4);
+  filter.filter(cloud, filtered);
+  EXPECT_TRUE(filtered.empty());
+  EXPECT_EQ(0u, filtered.width);
+
+  // a cloud of non-finite points only is empty as well
+  PointXYZIRT p;
+  p.x = p.y = p.z = std::numeric_limits<float>::quiet_NaN();
+  cloud.push_back(p);
+  filter.filter(cloud, filtered);
+  EXPECT_TRUE(filtered.empty());
+  EXPECT_EQ(0u, filtered.width);
+}
+
+
+
+TEST(VoxelGridFilterTest, tooManyVoxelsYieldUnfilteredOutput)
+{
+  // 2e12 voxels along each axis exceed the 2^62 voxel limit
+  pcl::PointCloud<PointXYZIRT> cloud = randomCloud<PointXYZIRT>(100, 5);
+  cloud.points[0].x = cloud.points[0].y = cloud.points[0].z = -1e6f;
+  cloud.points[1].x = cloud.points[1].y = cloud.points[1].z = 1e6f;
+
+  VoxelGridFilter<PointXYZIRT> filter(1e-6f);
+  pcl::PointCloud<PointXYZIRT> filtered;
+  filter.filter(cloud, filtered);
+
+  ASSERT_EQ(cloud.size(), filtered.size());
+  EXPECT_EQ(cloud.size(), size_t(filtered.width));
+  for (size_t i = 0; i < cloud.size(); i++) {
+    EXPECT_EQ(cloud.points[i].x, filtered.points[i].x);
+    EXPECT_EQ(cloud.points[i].y, filtered.points[i].y);
+    EXPECT_EQ(cloud.points[i].z, filtered.points[i].z);
+  }
+}
+
+
+
+TEST(VoxelGridFilterTest, mortonCodeInterleavesBits)
+{
+  EXPECT_EQ(0u, mortonCode(0, 0, 0));
+  EXPECT_EQ(1u, mortonCode(1, 0, 0));
+  EXPECT_EQ(2u, mortonCode(0, 1, 0));
+  EXPECT_EQ(4u, mortonCode(0, 0, 1));
+  EXPECT_EQ(7u, mortonCode(1, 1, 1));
+  EXPECT_EQ(8u, mortonCode(2, 0, 0));
+  EXPECT_EQ((uint64_t(1) << 63) - 1, mortonCode(0x1FFFFF, 0x1FFFFF, 0x1FFFFF));
+}
+
+
+
+TEST(VoxelGridFilterTest, mortonOrderOnlyPermutesCentroids)
+{
+  pcl::PointCloud<PointXYZIRT> cloud = randomCloud<PointXYZIRT>(20000, 1);
+  pcl::PointCloud<PointXYZIRT> indexOrdered, mortonOrdered;
+
+  VoxelGridFilter<PointXYZIRT> filter(1.0f);
+  filter.filter(cloud, indexOrdered);
+  filter.setMortonOrder(true);
+  filter.filter(cloud, mortonOrdered);
+  ASSERT_EQ(indexOrdered.size(), mortonOrdered.size());
+
+  // consecutive centroids are in non-decreasing Morton order of their voxels
+  for (size_t i = 1; i < mortonOrdered.size(); i++) {
+    const PointXYZIRT& a = mortonOrdered.points[i - 1];
+    const PointXYZIRT& b = mortonOrdered.points[i];
+    EXPECT_LT(mortonCode(uint64_t(std::floor(a.x) + 10), uint64_t(std::floor(a.y) + 10), uint64_t(std::floor(a.z) + 10)),
+              mortonCode(uint64_t(std::floor(b.x) + 10), uint64_t(std::floor(b.y) + 10), uint64_t(std::floor(b.z) + 10)));
+  }
+
+  std::sort(indexOrdered.points.begin(), indexOrdered.points.end(), lessXYZ);
+  std::sort(mortonOrdered.points.begin(), mortonOrdered.points.end(), lessXYZ);
+  for (size_t i = 0; i < indexOrdered.size(); i++) {
+    EXPECT_EQ(indexOrdered.points[i].x, mortonOrdered.points[i].x);
+    EXPECT_EQ(indexOrdered.points[i].y, mortonOrdered.points[i].y);
+    EXPECT_EQ(indexOrdered.points[i].z, mortonOrdered.points[i].z);
+  }
+}
+
+
+
+
+int main(int argc, char **argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}